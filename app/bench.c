@@ -0,0 +1,391 @@
+#include <windows.h>
+#include <winioctl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "vhidmini_ioctl.h"
+#include "vhidclient.h"
+#include "testvhid.h"
+
+//
+// Synthetic load generator. Each thread owns a client and a generator that
+// draws events from a weighted mix of keys, moves and buttons; keys are
+// pressed on one event and released on the next, optionally wrapped in a
+// shift, so the device is never left with stuck keys. Events are sent one
+// per request or accumulated into batches.
+//
+// With a target rate the threads are paced open loop: each event has a
+// scheduled send time and its latency is measured from that time, so a
+// stalled request also charges the events queued up behind it. Without a
+// rate the threads send back to back.
+//
+// With --instances N, thread i drives instance (first + i % N), where
+// first is the instance selected on the command line. Instances share no
+// state in the driver, so throughput should scale with the instance count
+// until the threads saturate the CPUs; per-instance rates are reported.
+//
+// The generator only sees a VHID_CLIENT, so --loopback runs the same load
+// against the in-process loopback transport, without the driver, and
+// --pipe runs it through a 'testvhid broker'. The time each thread takes
+// to open its client is reported as the connect latency.
+//
+// Results are printed as a single JSON object.
+//
+
+#define BENCH_BUCKETS       10000   // 1 us latency buckets, plus one overflow
+
+typedef struct _BENCH_OPTIONS {
+    ULONG   KeyWeight;
+    ULONG   MoveWeight;
+    ULONG   ButtonWeight;
+    ULONG   ModifierPercent;        // share of key presses wrapped in a shift
+    double  Rate;                   // events/s for all threads, 0 for open loop max
+    ULONG   DurationMs;
+    ULONG   Threads;
+    ULONG   Batch;                  // events per request
+    ULONG   FirstInstance;
+    ULONG   Instances;
+    BOOL    Loopback;
+    BOOL    Pipe;
+} BENCH_OPTIONS, *PBENCH_OPTIONS;
+
+typedef struct _BENCH_THREAD {
+    PBENCH_OPTIONS  Options;
+    ULONG           Index;
+    ULONG           Instance;
+    ULONG           Seed;
+    // generator state
+    UCHAR           HeldKey;
+    BOOL            HeldShift;
+    UCHAR           Buttons;
+    // results
+    ULONGLONG       Events;
+    ULONGLONG       Requests;
+    ULONGLONG       Errors;
+    ULONGLONG       Busy;           // ERROR_BUSY, counted in Errors too
+    DWORD           LastError;
+    LONGLONG        Connect;        // ticks
+    ULONG           Latency[BENCH_BUCKETS + 1];
+} BENCH_THREAD, *PBENCH_THREAD;
+
+static LARGE_INTEGER benchFrequency;
+
+static ULONG benchRandom(PBENCH_THREAD t) {
+    t->Seed ^= t->Seed << 13;
+    t->Seed ^= t->Seed >> 17;
+    t->Seed ^= t->Seed << 5;
+    return t->Seed;
+}
+
+//
+// Appends the next event of the mix to the batch. Returns FALSE once the
+// batch is full; the event is then not consumed and the generator state is
+// unchanged.
+//
+static BOOL benchNextEvent(PBENCH_THREAD t, PVHID_BATCH batch) {
+    PBENCH_OPTIONS o = t->Options;
+    ULONG pick;
+
+    if (t->HeldKey != 0) {
+        if (batch->Header.Count + (t->HeldShift ? 2 : 1) > VHID_BATCH_MAX_EVENTS)
+            return FALSE;
+        VhidBatchKey(batch, t->HeldKey, FALSE);
+        if (t->HeldShift)
+            VhidBatchKey(batch, 0xE1, FALSE);
+        t->HeldKey = 0;
+        t->HeldShift = FALSE;
+        return TRUE;
+    }
+
+    pick = benchRandom(t) % (o->KeyWeight + o->MoveWeight + o->ButtonWeight);
+    if (pick < o->KeyWeight) {
+        BOOL shift = benchRandom(t) % 100 < o->ModifierPercent;
+        if (batch->Header.Count + (shift ? 2 : 1) > VHID_BATCH_MAX_EVENTS)
+            return FALSE;
+        t->HeldKey = (UCHAR)(0x04 + benchRandom(t) % 26);
+        t->HeldShift = shift;
+        if (shift)
+            VhidBatchKey(batch, 0xE1, TRUE);
+        VhidBatchKey(batch, t->HeldKey, TRUE);
+        return TRUE;
+    }
+    if (pick < o->KeyWeight + o->MoveWeight)
+        return VhidBatchMove(batch, (CHAR)(benchRandom(t) % 21 - 10), (CHAR)(benchRandom(t) % 21 - 10));
+
+    if (!VhidBatchButtons(batch, t->Buttons ^ 0x01))
+        return FALSE;
+    t->Buttons ^= 0x01;
+    return TRUE;
+}
+
+//
+// Sends the batch, as a single event IOCTL when it holds one event so
+// --batch 1 measures the per-event path.
+//
+static BOOL benchSend(PVHID_CLIENT client, PVHID_BATCH batch) {
+    PVHID_BATCH_EVENT e = &batch->Events[0];
+
+    if (batch->Header.Count != 1)
+        return VhidBatchSubmit(client, batch);
+
+    switch (e->Type) {
+    case VHID_BATCH_KEY:
+        return VhidSendKey(client, e->Data[0], e->Data[1]);
+    case VHID_BATCH_MOVE:
+        return VhidSendMove(client, (CHAR)e->Data[0], (CHAR)e->Data[1]);
+    default:
+        return VhidSendButtons(client, e->Data[0]);
+    }
+}
+
+static void benchRecord(PBENCH_THREAD t, LONGLONG ticks) {
+    LONGLONG us = ticks * 1000000 / benchFrequency.QuadPart;
+
+    t->Latency[us < 0 ? 0 : us > BENCH_BUCKETS ? BENCH_BUCKETS : us]++;
+}
+
+static DWORD WINAPI benchThread(LPVOID parameter) {
+    PBENCH_THREAD t = (PBENCH_THREAD)parameter;
+    PBENCH_OPTIONS o = t->Options;
+    VHID_CLIENT client;
+    VHID_LOOPBACK loopback;
+    VHID_BATCH batch;
+    LARGE_INTEGER start, now;
+    LONGLONG end, due, interval = 0;
+    BOOL opened = TRUE;
+    ULONG i;
+
+    QueryPerformanceCounter(&start);
+    if (o->Loopback)
+        VhidOpenLoopback(&client, &loopback);
+    else if (o->Pipe)
+        opened = VhidOpenPipe(&client, t->Instance);
+    else
+        opened = VhidOpenInstance(&client, t->Instance);
+    if (!opened) {
+        t->LastError = GetLastError();
+        t->Errors++;
+        return 1;
+    }
+    QueryPerformanceCounter(&now);
+    t->Connect = now.QuadPart - start.QuadPart;
+
+    QueryPerformanceCounter(&start);
+    end = start.QuadPart + (LONGLONG)o->DurationMs * benchFrequency.QuadPart / 1000;
+    if (o->Rate > 0)
+        interval = (LONGLONG)(benchFrequency.QuadPart * o->Batch * o->Threads / o->Rate);
+    due = start.QuadPart;
+
+    for (;;) {
+        if (interval != 0) {
+            for (;;) {
+                QueryPerformanceCounter(&now);
+                if (now.QuadPart >= due)
+                    break;
+                if ((due - now.QuadPart) * 1000 / benchFrequency.QuadPart > 2)
+                    Sleep(1);
+            }
+        }
+        else {
+            QueryPerformanceCounter(&now);
+            due = now.QuadPart;
+        }
+        if (due >= end)
+            break;
+
+        VhidBatchReset(&batch);
+        for (i = 0; i < o->Batch && benchNextEvent(t, &batch); i++)
+            ;
+
+        if (benchSend(&client, &batch)) {
+            t->Events += batch.Header.Count;
+        }
+        else {
+            t->LastError = GetLastError();
+            if (t->LastError == ERROR_BUSY)
+                t->Busy++;
+            t->Errors++;
+        }
+        t->Requests++;
+
+        QueryPerformanceCounter(&now);
+        benchRecord(t, now.QuadPart - due);
+        due += interval;
+    }
+
+    //
+    // Leave nothing pressed behind.
+    //
+    VhidBatchReset(&batch);
+    if (t->HeldKey != 0)
+        benchNextEvent(t, &batch);
+    if (t->Buttons != 0)
+        VhidBatchButtons(&batch, 0);
+    if (batch.Header.Count != 0)
+        benchSend(&client, &batch);
+
+    VhidClose(&client);
+    return 0;
+}
+
+static double benchPercentile(const ULONG* histogram, ULONGLONG total, double p) {
+    ULONGLONG rank = (ULONGLONG)(total * p), seen = 0;
+    ULONG i;
+
+    for (i = 0; i <= BENCH_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen > rank)
+            return i;
+    }
+    return BENCH_BUCKETS;
+}
+
+static BOOL benchParseMix(const char* mix, PBENCH_OPTIONS o) {
+    char name[16];
+    unsigned weight;
+    int used;
+
+    o->KeyWeight = o->MoveWeight = o->ButtonWeight = 0;
+    while (sscanf_s(mix, "%15[a-z]=%u%n", name, (unsigned)sizeof(name), &weight, &used) == 2) {
+        if (strcmp(name, "keys") == 0)
+            o->KeyWeight = weight;
+        else if (strcmp(name, "moves") == 0)
+            o->MoveWeight = weight;
+        else if (strcmp(name, "buttons") == 0)
+            o->ButtonWeight = weight;
+        else
+            return FALSE;
+        mix += used;
+        if (*mix != ',')
+            break;
+        mix++;
+    }
+    return *mix == '\0' && o->KeyWeight + o->MoveWeight + o->ButtonWeight != 0;
+}
+
+//
+// testvhid bench [--mix keys=N,moves=N,buttons=N] [--modifiers PCT] [--rate N] [--duration S]
+//                [--threads N] [--batch N] [--instances N] [--loopback | --pipe]
+//
+int benchRun(ULONG instance, int argc, char* argv[]) {
+    BENCH_OPTIONS options = { 60, 30, 10, 10, 0, 5000, 1, 1, instance, 1, FALSE, FALSE };
+    ULONGLONG* instanceEvents;
+    PBENCH_THREAD threads;
+    HANDLE* handles;
+    static ULONG histogram[BENCH_BUCKETS + 1];
+    ULONGLONG events = 0, requests = 0, errors = 0, busy = 0;
+    DWORD lastError = 0;
+    LARGE_INTEGER start, end;
+    double elapsed, mean = 0, connectMean = 0, connectMax = 0, connect;
+    ULONG i, j;
+    int a;
+
+    for (a = 2; a < argc; a++) {
+        if (strcmp(argv[a], "--loopback") == 0)
+            options.Loopback = TRUE;
+        else if (strcmp(argv[a], "--pipe") == 0)
+            options.Pipe = TRUE;
+        else if (a + 1 >= argc)
+            break;
+        else if (strcmp(argv[a], "--mix") == 0) {
+            if (!benchParseMix(argv[++a], &options)) {
+                printf("Bad mix: %s\n", argv[a]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[a], "--modifiers") == 0)
+            options.ModifierPercent = strtoul(argv[++a], NULL, 10);
+        else if (strcmp(argv[a], "--rate") == 0)
+            options.Rate = atof(argv[++a]);
+        else if (strcmp(argv[a], "--duration") == 0)
+            options.DurationMs = (ULONG)(atof(argv[++a]) * 1000);
+        else if (strcmp(argv[a], "--threads") == 0)
+            options.Threads = strtoul(argv[++a], NULL, 10);
+        else if (strcmp(argv[a], "--batch") == 0)
+            options.Batch = strtoul(argv[++a], NULL, 10);
+        else if (strcmp(argv[a], "--instances") == 0)
+            options.Instances = strtoul(argv[++a], NULL, 10);
+    }
+    if (options.Threads == 0 || options.Threads > MAXIMUM_WAIT_OBJECTS ||
+        options.Batch == 0 || options.Batch > VHID_BATCH_MAX_EVENTS ||
+        options.Instances == 0 || options.Instances > options.Threads) {
+        printf("usage: testvhid [--instance N] bench [--mix keys=N,moves=N,buttons=N] [--modifiers PCT] [--rate N]\n"
+               "                      [--duration S] [--threads 1-%d] [--batch 1-%d] [--instances 1-threads]\n"
+               "                      [--loopback | --pipe]\n",
+            MAXIMUM_WAIT_OBJECTS, VHID_BATCH_MAX_EVENTS);
+        return 1;
+    }
+    if (!options.Loopback && !options.Pipe && options.FirstInstance + options.Instances > VhidCountInstances()) {
+        printf("Only %lu instance(s) installed\n", VhidCountInstances());
+        return 1;
+    }
+
+    QueryPerformanceFrequency(&benchFrequency);
+    threads = (PBENCH_THREAD)calloc(options.Threads, sizeof(BENCH_THREAD));
+    handles = (HANDLE*)calloc(options.Threads, sizeof(HANDLE));
+    instanceEvents = (ULONGLONG*)calloc(options.Instances, sizeof(ULONGLONG));
+
+    QueryPerformanceCounter(&start);
+    for (i = 0; i < options.Threads; i++) {
+        threads[i].Options = &options;
+        threads[i].Index = i;
+        threads[i].Instance = options.FirstInstance + i % options.Instances;
+        threads[i].Seed = 0x9E3779B9 * (i + 1);
+        handles[i] = CreateThread(NULL, 0, benchThread, &threads[i], 0, NULL);
+    }
+    WaitForMultipleObjects(options.Threads, handles, TRUE, INFINITE);
+    QueryPerformanceCounter(&end);
+    elapsed = (double)(end.QuadPart - start.QuadPart) / benchFrequency.QuadPart;
+
+    for (i = 0; i < options.Threads; i++) {
+        CloseHandle(handles[i]);
+        events += threads[i].Events;
+        instanceEvents[i % options.Instances] += threads[i].Events;
+        requests += threads[i].Requests;
+        errors += threads[i].Errors;
+        busy += threads[i].Busy;
+        if (threads[i].LastError != 0)
+            lastError = threads[i].LastError;
+        connect = threads[i].Connect * 1000000.0 / benchFrequency.QuadPart;
+        connectMean += connect / options.Threads;
+        if (connect > connectMax)
+            connectMax = connect;
+        for (j = 0; j <= BENCH_BUCKETS; j++) {
+            histogram[j] += threads[i].Latency[j];
+            mean += (double)j * threads[i].Latency[j];
+        }
+    }
+    if (requests != 0)
+        mean /= requests;
+
+    printf("{\n");
+    printf("  \"transport\": \"%s\",\n", options.Loopback ? "loopback" : options.Pipe ? "pipe" : "device");
+    printf("  \"connect_us\": { \"mean\": %.1f, \"max\": %.1f },\n", connectMean, connectMax);
+    printf("  \"mix\": { \"keys\": %lu, \"moves\": %lu, \"buttons\": %lu, \"modifiers_pct\": %lu },\n",
+        options.KeyWeight, options.MoveWeight, options.ButtonWeight, options.ModifierPercent);
+    printf("  \"threads\": %lu,\n  \"batch\": %lu,\n  \"target_rate\": %.1f,\n",
+        options.Threads, options.Batch, options.Rate);
+    printf("  \"instances\": { \"first\": %lu, \"count\": %lu, \"events_per_sec\": [",
+        options.FirstInstance, options.Instances);
+    for (i = 0; i < options.Instances; i++)
+        printf("%s%.1f", i ? ", " : " ", instanceEvents[i] / elapsed);
+    printf(" ] },\n");
+    printf("  \"duration_s\": %.3f,\n", elapsed);
+    printf("  \"events\": %llu,\n  \"requests\": %llu,\n", events, requests);
+    printf("  \"events_per_sec\": %.1f,\n", events / elapsed);
+    printf("  \"latency_us\": { \"mean\": %.1f, \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f },\n",
+        mean,
+        benchPercentile(histogram, requests, 0.50),
+        benchPercentile(histogram, requests, 0.90),
+        benchPercentile(histogram, requests, 0.99),
+        benchPercentile(histogram, requests, 0.999),
+        benchPercentile(histogram, requests, requests ? (requests - 1.0) / requests : 0));
+    printf("  \"latency_overflow\": %lu,\n", histogram[BENCH_BUCKETS]);
+    printf("  \"errors\": { \"total\": %llu, \"busy\": %llu, \"last\": %lu }\n", errors, busy, lastError);
+    printf("}\n");
+
+    free(instanceEvents);
+    free(handles);
+    free(threads);
+    return errors != 0 ? 2 : 0;
+}
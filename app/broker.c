@@ -0,0 +1,359 @@
+#include <windows.h>
+#include <winioctl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "vhidmini_ioctl.h"
+#include "vhidclient.h"
+#include "keymerge.h"
+#include "testvhid.h"
+
+//
+// Injection broker. Keeps one device handle open and serves clients over
+// a local named pipe (see VhidOpenPipe), so short-lived tools don't pay
+// for a device enumeration each time they start.
+//
+// Every client has a thread that reads its requests. Key, move, button and
+// batch requests are turned into batch events and handed to the dispatcher
+// thread, which packs the pending submissions of all clients into one
+// IOCTL_VHIDMINI_SEND_BATCH; each of them returns the sequence number of
+// that batch, whose receipt covers them all. It takes one submission per client per round,
+// starting after the client it served last, so a busy client can't starve
+// the others; a client has at most one submission pending, since it waits
+// for the reply before sending its next request, so its own events stay in
+// order. Other requests are forwarded to the device as they are.
+//
+// The driver sees a single client, so the broker merges what its clients
+// hold itself, with the same rules as the driver: a key stays down while
+// any client holds it, and a client that disconnects releases what it held.
+//
+
+#define BROKER_MAX_CLIENTS      64
+
+typedef struct _BROKER_CLIENT {
+    struct _BROKER*         Broker;
+    HANDLE                  Pipe;
+    HANDLE                  Done;           // signalled when the submission completed
+    BOOL                    InUse;
+    // protected by Broker->Lock
+    BOOL                    Pending;
+    BOOL                    Retract;        // release what the client holds
+    ULONG                   Count;
+    VHID_BATCH_EVENT        Events[VHID_BATCH_MAX_EVENTS];
+    DWORD                   Error;
+    ULONG                   Sequence;       // of the batch that carried the submission
+    KEY_OWNER               Keys;
+} BROKER_CLIENT, *PBROKER_CLIENT;
+
+typedef struct _BROKER {
+    VHID_CLIENT             Device;
+    CRITICAL_SECTION        Lock;
+    CONDITION_VARIABLE      Work;
+    ULONG                   PendingCount;
+    ULONG                   Next;           // first client of the next round
+    KEY_MERGE               Merge;
+    BROKER_CLIENT           Clients[BROKER_MAX_CLIENTS];
+    // dispatcher thread only
+    VHID_BATCH              Batch;
+    PBROKER_CLIENT          Members[BROKER_MAX_CLIENTS];
+    ULONG                   MemberCount;
+} BROKER, *PBROKER;
+
+//
+// Sends the batch and completes the submissions it carries.
+//
+static void brokerFlush(PBROKER broker) {
+    DWORD error = 0;
+    DWORD returned;
+    ULONG sequence = 0;
+    ULONG i;
+
+    if (broker->Batch.Header.Count != 0 &&
+        !VhidIoControl(&broker->Device, (DWORD)IOCTL_VHIDMINI_SEND_BATCH, &broker->Batch,
+            (DWORD)(sizeof(VHID_BATCH_HEADER) + broker->Batch.Header.Count * sizeof(VHID_BATCH_EVENT)),
+            &sequence, sizeof(sequence), &returned))
+        error = GetLastError();
+
+    for (i = 0; i < broker->MemberCount; i++) {
+        broker->Members[i]->Error = error;
+        broker->Members[i]->Sequence = sequence;
+        SetEvent(broker->Members[i]->Done);
+    }
+    broker->MemberCount = 0;
+    VhidBatchReset(&broker->Batch);
+}
+
+static void brokerEmit(PBROKER broker, UCHAR type, UCHAR a, UCHAR b) {
+    PVHID_BATCH batch = &broker->Batch;
+
+    for (;;) {
+        if ((type == VHID_BATCH_KEY && VhidBatchKey(batch, a, b)) ||
+            (type == VHID_BATCH_MOVE && VhidBatchMove(batch, (CHAR)a, (CHAR)b)) ||
+            (type == VHID_BATCH_BUTTON && VhidBatchButtons(batch, a)))
+            return;
+        brokerFlush(broker);
+    }
+}
+
+//
+// Adds a client's submission to the batch, keeping only the transitions
+// that change the merged state.
+//
+static void brokerApply(PBROKER broker, PBROKER_CLIENT c) {
+    UCHAR released[KEY_MERGE_USAGES];
+    BOOLEAN buttonsChanged;
+    ULONG i, count;
+
+    if (c->Retract) {
+        count = KeyMergeRetract(&broker->Merge, &c->Keys, released, &buttonsChanged);
+        for (i = 0; i < count; i++)
+            brokerEmit(broker, VHID_BATCH_KEY, released[i], FALSE);
+        if (buttonsChanged)
+            brokerEmit(broker, VHID_BATCH_BUTTON, broker->Merge.Buttons, 0);
+        return;
+    }
+
+    for (i = 0; i < c->Count; i++) {
+        PVHID_BATCH_EVENT e = &c->Events[i];
+
+        switch (e->Type) {
+        case VHID_BATCH_KEY:
+            if (KeyMergeApplyKey(&broker->Merge, &c->Keys, e->Data[0], e->Data[1] != 0))
+                brokerEmit(broker, VHID_BATCH_KEY, e->Data[0], e->Data[1] != 0);
+            break;
+        case VHID_BATCH_MOVE:
+            brokerEmit(broker, VHID_BATCH_MOVE, e->Data[0], e->Data[1]);
+            break;
+        case VHID_BATCH_BUTTON:
+            if (KeyMergeApplyButtons(&broker->Merge, &c->Keys, e->Data[0] & 0x07))
+                brokerEmit(broker, VHID_BATCH_BUTTON, broker->Merge.Buttons, 0);
+            break;
+        }
+    }
+}
+
+static DWORD WINAPI brokerDispatchThread(LPVOID parameter) {
+    PBROKER broker = (PBROKER)parameter;
+    PBROKER_CLIENT c;
+    ULONG n, i, need;
+
+    for (;;) {
+        EnterCriticalSection(&broker->Lock);
+        while (broker->PendingCount == 0)
+            SleepConditionVariableCS(&broker->Work, &broker->Lock, INFINITE);
+
+        for (n = 0; n < BROKER_MAX_CLIENTS; n++) {
+            i = (broker->Next + n) % BROKER_MAX_CLIENTS;
+            c = &broker->Clients[i];
+            if (!c->Pending)
+                continue;
+
+            //
+            // Submissions are not split across requests, except for a
+            // retraction of more keys than a batch holds.
+            //
+            need = c->Retract ? VHID_BATCH_MAX_EVENTS : c->Count;
+            if (broker->Batch.Header.Count != 0 && broker->Batch.Header.Count + need > VHID_BATCH_MAX_EVENTS)
+                break;
+
+            c->Pending = FALSE;
+            broker->PendingCount--;
+            brokerApply(broker, c);
+            broker->Members[broker->MemberCount++] = c;
+            broker->Next = (i + 1) % BROKER_MAX_CLIENTS;
+        }
+        LeaveCriticalSection(&broker->Lock);
+
+        brokerFlush(broker);
+    }
+}
+
+static DWORD brokerSubmit(PBROKER broker, PBROKER_CLIENT c) {
+    EnterCriticalSection(&broker->Lock);
+    c->Pending = TRUE;
+    broker->PendingCount++;
+    WakeConditionVariable(&broker->Work);
+    LeaveCriticalSection(&broker->Lock);
+
+    WaitForSingleObject(c->Done, INFINITE);
+    return c->Error;
+}
+
+//
+// Turns an event request into batch events, with the checks the driver
+// would apply, so a bad request fails alone rather than the whole batch.
+//
+static DWORD brokerParse(PBROKER_CLIENT c, DWORD ioControlCode, PUCHAR input, DWORD length) {
+    PVHID_BATCH_HEADER header = (PVHID_BATCH_HEADER)input;
+    ULONG i;
+
+    switch (ioControlCode) {
+    case IOCTL_VHIDMINI_KEY_EVENT:
+        if (length < sizeof(VHID_KEY_EVENT))
+            return ERROR_INVALID_PARAMETER;
+        c->Events[0].Type = VHID_BATCH_KEY;
+        c->Events[0].Data[0] = ((PVHID_KEY_EVENT)input)->KeyCode;
+        c->Events[0].Data[1] = ((PVHID_KEY_EVENT)input)->Pressed != 0;
+        c->Count = 1;
+        return 0;
+    case IOCTL_VHIDMINI_MOVE_EVENT:
+        if (length < sizeof(VHID_MOUSE_MOVE))
+            return ERROR_INVALID_PARAMETER;
+        c->Events[0].Type = VHID_BATCH_MOVE;
+        c->Events[0].Data[0] = (UCHAR)((PVHID_MOUSE_EVENT)input)->DeltaX;
+        c->Events[0].Data[1] = (UCHAR)((PVHID_MOUSE_EVENT)input)->DeltaY;
+        c->Count = 1;
+        return 0;
+    case IOCTL_VHIDMINI_BUTTON_EVENT:
+        if (length < sizeof(VHID_MOUSE_BUTTON))
+            return ERROR_INVALID_PARAMETER;
+        c->Events[0].Type = VHID_BATCH_BUTTON;
+        c->Events[0].Data[0] = ((PVHID_MOUSE_BUTTON)input)->ButtonMask;
+        c->Count = 1;
+        return 0;
+    default:
+        if (length < sizeof(VHID_BATCH_HEADER) || header->Reserved != 0 || header->Count > VHID_BATCH_MAX_EVENTS ||
+            length < sizeof(VHID_BATCH_HEADER) + header->Count * sizeof(VHID_BATCH_EVENT))
+            return ERROR_INVALID_PARAMETER;
+        memcpy(c->Events, header + 1, header->Count * sizeof(VHID_BATCH_EVENT));
+        for (i = 0; i < header->Count; i++) {
+            if (c->Events[i].Type < VHID_BATCH_KEY || c->Events[i].Type > VHID_BATCH_BUTTON)
+                return ERROR_INVALID_PARAMETER;
+        }
+        c->Count = header->Count;
+        return 0;
+    }
+}
+
+static DWORD WINAPI brokerClientThread(LPVOID parameter) {
+    PBROKER_CLIENT c = (PBROKER_CLIENT)parameter;
+    PBROKER broker = c->Broker;
+    PVHID_PIPE_REQUEST request = (PVHID_PIPE_REQUEST)malloc(VHID_PIPE_MAX_MESSAGE);
+    PVHID_PIPE_REPLY reply = (PVHID_PIPE_REPLY)malloc(VHID_PIPE_MAX_MESSAGE);
+    DWORD read, written, error, returned, outputLength;
+
+    while (ReadFile(c->Pipe, request, VHID_PIPE_MAX_MESSAGE, &read, NULL) && read >= sizeof(VHID_PIPE_REQUEST)) {
+        returned = 0;
+        switch (request->IoControlCode) {
+        case IOCTL_VHIDMINI_KEY_EVENT:
+        case IOCTL_VHIDMINI_MOVE_EVENT:
+        case IOCTL_VHIDMINI_BUTTON_EVENT:
+        case IOCTL_VHIDMINI_SEND_BATCH:
+            error = brokerParse(c, request->IoControlCode, (PUCHAR)(request + 1), read - sizeof(VHID_PIPE_REQUEST));
+            if (error == 0)
+                error = brokerSubmit(broker, c);
+            if (error == 0 && request->OutputLength >= sizeof(ULONG)) {
+                *(PULONG)(reply + 1) = c->Sequence;
+                returned = sizeof(ULONG);
+            }
+            break;
+        case IOCTL_VHIDMINI_WAIT_EVENT:
+            //
+            // Events are queued per handle; through the broker's handle
+            // every client would see, and consume, everybody's.
+            //
+        case IOCTL_VHIDMINI_SEND_STREAM:
+        case IOCTL_VHIDMINI_TYPE_TEXT_DIRECT:
+            //
+            // The payload of these is the output buffer, which the pipe
+            // doesn't carry to the broker.
+            //
+            error = ERROR_NOT_SUPPORTED;
+            break;
+        default:
+            outputLength = min(request->OutputLength, VHID_PIPE_MAX_MESSAGE - (DWORD)sizeof(VHID_PIPE_REPLY));
+            error = VhidIoControl(&broker->Device, request->IoControlCode, request + 1, read - sizeof(VHID_PIPE_REQUEST),
+                reply + 1, outputLength, &returned) ? 0 : GetLastError();
+            break;
+        }
+
+        reply->Error = error;
+        reply->Returned = returned;
+        if (!WriteFile(c->Pipe, reply, sizeof(VHID_PIPE_REPLY) + returned, &written, NULL))
+            break;
+    }
+
+    c->Retract = TRUE;
+    brokerSubmit(broker, c);
+
+    DisconnectNamedPipe(c->Pipe);
+    CloseHandle(c->Pipe);
+    free(request);
+    free(reply);
+
+    EnterCriticalSection(&broker->Lock);
+    c->InUse = FALSE;
+    LeaveCriticalSection(&broker->Lock);
+    return 0;
+}
+
+//
+// testvhid [--instance N] broker
+//
+int brokerRun(ULONG instance) {
+    static BROKER broker;
+    WCHAR name[64];
+    HANDLE pipe, thread;
+    PBROKER_CLIENT c;
+    ULONG i;
+
+    if (!VhidOpenInstance(&broker.Device, instance)) {
+        printf("Failed to open the device: %d\n", GetLastError());
+        return 1;
+    }
+
+    InitializeCriticalSection(&broker.Lock);
+    InitializeConditionVariable(&broker.Work);
+    KeyMergeInit(&broker.Merge);
+    VhidBatchReset(&broker.Batch);
+    for (i = 0; i < BROKER_MAX_CLIENTS; i++) {
+        broker.Clients[i].Broker = &broker;
+        broker.Clients[i].Done = CreateEvent(NULL, FALSE, FALSE, NULL);
+    }
+
+    thread = CreateThread(NULL, 0, brokerDispatchThread, &broker, 0, NULL);
+    CloseHandle(thread);
+
+    swprintf_s(name, ARRAYSIZE(name), VHID_PIPE_NAME_FORMAT, instance);
+    printf("Brokering instance %lu on %ls\n", instance, name);
+
+    for (;;) {
+        pipe = CreateNamedPipe(name, PIPE_ACCESS_DUPLEX,
+            PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES, VHID_PIPE_MAX_MESSAGE, VHID_PIPE_MAX_MESSAGE, 0, NULL);
+        if (pipe == INVALID_HANDLE_VALUE) {
+            printf("CreateNamedPipe failed: %d\n", GetLastError());
+            break;
+        }
+        if (!ConnectNamedPipe(pipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) {
+            CloseHandle(pipe);
+            continue;
+        }
+
+        c = NULL;
+        EnterCriticalSection(&broker.Lock);
+        for (i = 0; i < BROKER_MAX_CLIENTS && c == NULL; i++) {
+            if (!broker.Clients[i].InUse)
+                c = &broker.Clients[i];
+        }
+        if (c != NULL) {
+            c->InUse = TRUE;
+            c->Retract = FALSE;
+            c->Pipe = pipe;
+            KeyOwnerInit(&c->Keys);
+        }
+        LeaveCriticalSection(&broker.Lock);
+
+        if (c == NULL) {
+            printf("Too many clients, refusing one\n");
+            CloseHandle(pipe);
+            continue;
+        }
+
+        thread = CreateThread(NULL, 0, brokerClientThread, c, 0, NULL);
+        CloseHandle(thread);
+    }
+
+    VhidClose(&broker.Device);
+    return 1;
+}
@@ -0,0 +1,313 @@
+#include <windows.h>
+#include <winioctl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "vhidmini_ioctl.h"
+#include "vhidclient.h"
+#include "testvhid.h"
+
+//
+// Replays a captured event sequence against the driver and measures it.
+//
+// Corpus files are text, one event per line, '#' starts a comment:
+//
+//     <time us> key <usage hex> <0|1>
+//     <time us> move <dx> <dy>
+//     <time us> button <mask>
+//
+// Events are submitted at their original time divided by the speed factor,
+// or back to back with a speed of 0. The run reports throughput and the
+// distribution of the per-event IOCTL latency, and can write the reports
+// the driver handed to hidclass (from the trace ring) for diffing. With
+// --window N, events are submitted asynchronously with up to N in flight.
+//
+
+#define REPLAY_TOLERANCE    0.10    // allowed regression against a baseline
+
+typedef struct _REPLAY_EVENT {
+    ULONGLONG Time;         // us
+    DWORD     IoControlCode;
+    union {
+        VHID_KEY_EVENT     Key;
+        VHID_MOUSE_MOVE    Move;
+        VHID_MOUSE_BUTTON  Button;
+    } u;
+    DWORD     Size;
+} REPLAY_EVENT, *PREPLAY_EVENT;
+
+typedef struct _REPLAY_RESULT {
+    double    EventsPerSec;
+    double    P50;          // us
+    double    P99;
+    double    Max;
+} REPLAY_RESULT, *PREPLAY_RESULT;
+
+static ULONG replayLoad(const char* path, PREPLAY_EVENT* events) {
+    FILE* f;
+    char line[256], name[16];
+    ULONG count = 0, capacity = 256;
+    unsigned long long time;
+    int a, b;
+    PREPLAY_EVENT e = (PREPLAY_EVENT)malloc(capacity * sizeof(REPLAY_EVENT));
+
+    if (fopen_s(&f, path, "r") != 0) {
+        printf("Cannot open %s\n", path);
+        free(e);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        int n;
+        if (line[0] == '#')
+            continue;
+        n = sscanf_s(line, "%llu %15s %x %d", &time, name, (unsigned)sizeof(name), &a, &b);
+        if (n < 3)
+            continue;
+        if (count == capacity) {
+            capacity *= 2;
+            e = (PREPLAY_EVENT)realloc(e, capacity * sizeof(REPLAY_EVENT));
+        }
+        e[count].Time = time;
+        if (strcmp(name, "key") == 0 && n == 4) {
+            e[count].IoControlCode = (DWORD)IOCTL_VHIDMINI_KEY_EVENT;
+            e[count].u.Key.KeyCode = (UCHAR)a;
+            e[count].u.Key.Pressed = (UCHAR)(b != 0);
+            e[count].Size = sizeof(VHID_KEY_EVENT);
+        }
+        else if (strcmp(name, "move") == 0 && sscanf_s(line, "%*llu %*s %d %d", &a, &b) == 2) {
+            e[count].IoControlCode = (DWORD)IOCTL_VHIDMINI_MOVE_EVENT;
+            e[count].u.Move.DeltaX = (CHAR)a;
+            e[count].u.Move.DeltaY = (CHAR)b;
+            e[count].Size = sizeof(VHID_MOUSE_MOVE);
+        }
+        else if (strcmp(name, "button") == 0) {
+            e[count].IoControlCode = (DWORD)IOCTL_VHIDMINI_BUTTON_EVENT;
+            e[count].u.Button.ButtonMask = (UCHAR)a;
+            e[count].Size = sizeof(VHID_MOUSE_BUTTON);
+        }
+        else {
+            printf("Skipping: %s", line);
+            continue;
+        }
+        count++;
+    }
+
+    fclose(f);
+    *events = e;
+    return count;
+}
+
+static double replayTicksPerUs;
+static volatile LONG replayAsyncFailed;
+
+//
+// Asynchronous completion: the slot holds the submission time in ticks and
+// is turned into the latency in us.
+//
+static VOID replayCompletion(PVOID context, DWORD error, DWORD returned) {
+    double* latency = (double*)context;
+    LARGE_INTEGER now;
+
+    UNREFERENCED_PARAMETER(returned);
+
+    if (error != 0)
+        InterlockedIncrement(&replayAsyncFailed);
+
+    QueryPerformanceCounter(&now);
+    *latency = (now.QuadPart - *latency) / replayTicksPerUs;
+}
+
+static int compareDouble(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+//
+// Writes the reports completed to hidclass since FirstSequence, one per
+// line in hex, in the order hidclass received them.
+//
+static void replayDumpReports(PVHID_CLIENT client, ULONG firstSequence, const char* path) {
+    static VHID_TRACE_RECORD records[1024];
+    DWORD returned;
+    ULONG i, j, count, lost = 0;
+    FILE* f;
+
+    if (!VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_GET_TRACE, &firstSequence, sizeof(firstSequence),
+        records, sizeof(records), &returned)) {
+        printf("Failed to get trace: %d\n", GetLastError());
+        return;
+    }
+    if (fopen_s(&f, path, "w") != 0) {
+        printf("Cannot create %s\n", path);
+        return;
+    }
+
+    count = returned / sizeof(VHID_TRACE_RECORD);
+    if (count != 0)
+        lost = records[0].Sequence - firstSequence;
+    for (i = 0; i < count; i++) {
+        if (records[i].Type != VHID_TRACE_REPORT_COMPLETED)
+            continue;
+        for (j = 0; j < records[i].Length; j++)
+            fprintf(f, "%02x", records[i].Data[j]);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+
+    if (lost != 0)
+        printf("Warning: %lu trace record(s) overwritten, report dump is incomplete\n", lost);
+}
+
+static ULONG replayTraceNext(PVHID_CLIENT client) {
+    static VHID_TRACE_RECORD records[1024];
+    ULONG first = 0;
+    DWORD returned = 0;
+
+    if (!VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_GET_TRACE, &first, sizeof(first),
+        records, sizeof(records), &returned) || returned == 0)
+        return 1;
+    return records[returned / sizeof(VHID_TRACE_RECORD) - 1].Sequence + 1;
+}
+
+static int replayBaseline(const char* path, PREPLAY_RESULT result, BOOL save) {
+    FILE* f;
+    REPLAY_RESULT baseline;
+
+    if (save) {
+        if (fopen_s(&f, path, "w") != 0) {
+            printf("Cannot create %s\n", path);
+            return 1;
+        }
+        fprintf(f, "events_per_sec %.1f\np99_us %.1f\n", result->EventsPerSec, result->P99);
+        fclose(f);
+        return 0;
+    }
+
+    if (fopen_s(&f, path, "r") != 0) {
+        printf("Cannot open %s\n", path);
+        return 1;
+    }
+    if (fscanf_s(f, "events_per_sec %lf p99_us %lf", &baseline.EventsPerSec, &baseline.P99) != 2) {
+        printf("Malformed baseline %s\n", path);
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+
+    printf("baseline: %.1f events/s, p99 %.1f us\n", baseline.EventsPerSec, baseline.P99);
+    if (result->EventsPerSec < baseline.EventsPerSec * (1 - REPLAY_TOLERANCE)) {
+        printf("REGRESSION: throughput\n");
+        return 2;
+    }
+    if (result->P99 > baseline.P99 * (1 + REPLAY_TOLERANCE)) {
+        printf("REGRESSION: p99 latency\n");
+        return 2;
+    }
+    return 0;
+}
+
+//
+// testvhid replay <corpus> [--speed N] [--window N] [--reports FILE] [--save FILE] [--baseline FILE]
+//
+int replayRun(PVHID_CLIENT client, int argc, char* argv[]) {
+    PREPLAY_EVENT events;
+    REPLAY_RESULT result;
+    VHID_CLIENT asyncClient;
+    ULONG window = 0;
+    double speed = 1.0, * latency;
+    const char* reports = NULL, * save = NULL, * baseline = NULL;
+    LARGE_INTEGER frequency, start, before, after, now;
+    ULONG count, i, failed = 0, firstSequence;
+    DWORD returned;
+    int ret = 0;
+
+    if (argc < 3) {
+        printf("usage: testvhid replay <corpus> [--speed N] [--window N] [--reports FILE] [--save FILE] [--baseline FILE]\n");
+        return 1;
+    }
+    for (i = 3; i + 1 < (ULONG)argc; i += 2) {
+        if (strcmp(argv[i], "--speed") == 0)
+            speed = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--window") == 0)
+            window = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "--reports") == 0)
+            reports = argv[i + 1];
+        else if (strcmp(argv[i], "--save") == 0)
+            save = argv[i + 1];
+        else if (strcmp(argv[i], "--baseline") == 0)
+            baseline = argv[i + 1];
+    }
+
+    count = replayLoad(argv[2], &events);
+    if (count == 0)
+        return 1;
+    latency = (double*)malloc(count * sizeof(double));
+
+    if (window != 0) {
+        if (!VhidOpenAsync(&asyncClient, client->Instance, window)) {
+            free(latency);
+            free(events);
+            return 1;
+        }
+    }
+
+    firstSequence = replayTraceNext(client);
+    QueryPerformanceFrequency(&frequency);
+    replayTicksPerUs = frequency.QuadPart / 1000000.0;
+    QueryPerformanceCounter(&start);
+
+    for (i = 0; i < count; i++) {
+        if (speed > 0) {
+            LONGLONG due = start.QuadPart + (LONGLONG)(events[i].Time / speed * frequency.QuadPart / 1000000);
+            for (;;) {
+                QueryPerformanceCounter(&now);
+                if (now.QuadPart >= due)
+                    break;
+                if ((due - now.QuadPart) * 1000 / frequency.QuadPart > 2)
+                    Sleep(1);
+            }
+        }
+
+        QueryPerformanceCounter(&before);
+        if (window != 0) {
+            latency[i] = (double)before.QuadPart;
+            if (!VhidSubmit(&asyncClient, events[i].IoControlCode, &events[i].u, events[i].Size, replayCompletion, &latency[i])) {
+                latency[i] = 0;
+                failed++;
+            }
+            continue;
+        }
+        if (!VhidIoControl(client, events[i].IoControlCode, &events[i].u, events[i].Size, NULL, 0, &returned))
+            failed++;
+        QueryPerformanceCounter(&after);
+        latency[i] = (double)(after.QuadPart - before.QuadPart) * 1000000 / frequency.QuadPart;
+    }
+
+    if (window != 0) {
+        VhidDrain(&asyncClient);
+        QueryPerformanceCounter(&after);
+        VhidClose(&asyncClient);
+        failed += replayAsyncFailed;
+    }
+
+    result.EventsPerSec = count * (double)frequency.QuadPart / (after.QuadPart - start.QuadPart);
+    qsort(latency, count, sizeof(double), compareDouble);
+    result.P50 = latency[count / 2];
+    result.P99 = latency[(count * 99) / 100];
+    result.Max = latency[count - 1];
+
+    printf("%lu events (%lu failed), %.1f events/s\n", count, failed, result.EventsPerSec);
+    printf("latency us: p50 %.1f, p99 %.1f, max %.1f\n", result.P50, result.P99, result.Max);
+
+    if (reports)
+        replayDumpReports(client, firstSequence, reports);
+    if (save)
+        ret = replayBaseline(save, &result, TRUE);
+    if (baseline && ret == 0)
+        ret = replayBaseline(baseline, &result, FALSE);
+
+    free(latency);
+    free(events);
+    return ret;
+}
@@ -2,110 +2,1257 @@
 #include <winioctl.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <setupapi.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
 #include "vhidmini_ioctl.h"
+#include "vhidclient.h"
+#include "macrovm.h"
+#include "stream.h"
+#include "receipt.h"
+#include "trace.h"
+#include "logring.h"
+#include "slab.h"
+#include "snapshot.h"
+#include "descriptor.h"
+#include "layout.h"
+#include "hidreport.h"
+#include "testvhid.h"
 
-HANDLE OpenVhidMini()
-{
-    HDEVINFO deviceInfo;
-    SP_DEVICE_INTERFACE_DATA interfaceData;
-    PSP_DEVICE_INTERFACE_DETAIL_DATA detailData;
-    DWORD requiredSize = 0;
-    HANDLE deviceHandle = INVALID_HANDLE_VALUE;
-
-    deviceInfo = SetupDiGetClassDevs(
-        &GUID_DEVINTERFACE_VHIDMINI,
-        NULL,
-        NULL,
-        DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
-
-    if (deviceInfo == INVALID_HANDLE_VALUE) {
-		printf("Failed to get device info set\n");
-        return INVALID_HANDLE_VALUE;
-    }
-
-    interfaceData.cbSize = sizeof(interfaceData);
-
-    if (!SetupDiEnumDeviceInterfaces(
-        deviceInfo,
-        NULL,
-        &GUID_DEVINTERFACE_VHIDMINI,
-        0,
-        &interfaceData))
-    {
-        printf("Failed to enumerate device\n");
-        SetupDiDestroyDeviceInfoList(deviceInfo);
-        return INVALID_HANDLE_VALUE;
-    }
-
-    SetupDiGetDeviceInterfaceDetail(
-        deviceInfo,
-        &interfaceData,
-        NULL,
-        0,
-        &requiredSize,
-        NULL);
-
-    detailData = (PSP_DEVICE_INTERFACE_DETAIL_DATA)malloc(requiredSize);
-    detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
-
-    if (SetupDiGetDeviceInterfaceDetail(
-        deviceInfo,
-        &interfaceData,
-        detailData,
-        requiredSize,
-        NULL,
-        NULL))
-    {
-        deviceHandle = CreateFile(
-            detailData->DevicePath,
-            GENERIC_READ | GENERIC_WRITE,
-            FILE_SHARE_READ | FILE_SHARE_WRITE,
-            NULL,
-            OPEN_EXISTING,
-            0,
-            NULL);
-        if (deviceHandle == INVALID_HANDLE_VALUE)
-            printf("Failed to open file: %d\n", GetLastError());
+int typeText(PVHID_CLIENT client, ULONG layout, const char* text) {
+    size_t length = strlen(text);
+    PVHID_TYPE_TEXT request = (PVHID_TYPE_TEXT)malloc(sizeof(VHID_TYPE_TEXT) + length);
+    VHID_TYPE_TEXT_RESULT result;
+    DWORD returned;
+
+    request->Layout = layout;
+    request->Reserved = 0;
+
+    while (length != 0) {
+        memcpy(request + 1, text, length);
+        if (!VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_TYPE_TEXT, request, (DWORD)(sizeof(VHID_TYPE_TEXT) + length),
+            &result, sizeof(result), &returned)) {
+            if (GetLastError() == ERROR_BUSY) {
+                Sleep(10);
+                continue;
+            }
+            printf("Failed to type: %d\n", GetLastError());
+            free(request);
+            return 1;
+        }
+        if (result.Unmapped != 0)
+            printf("%lu character(s) not on this layout\n", result.Unmapped);
+        text += result.Consumed;
+        length -= result.Consumed;
     }
-    else {
-        printf("Failed to get device detail\n");
+
+    free(request);
+    return 0;
+}
+
+int printStats(PVHID_CLIENT client) {
+    VHID_STATS stats;
+    DWORD returned;
+
+    if (!VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_GET_STATS, NULL, 0, &stats, sizeof(stats), &returned)) {
+        printf("Failed to get stats: %d\n", GetLastError());
+        return 1;
+    }
+
+    printf("StateLock: %llu acquisitions, mean hold %.2f us, max hold %.1f us\n",
+        stats.StateLockCount,
+        stats.StateLockCount ? stats.StateLockHoldTotal / 10.0 / stats.StateLockCount : 0.0,
+        stats.StateLockHoldMax / 10.0);
+    printf("Reports: %lu pending, %lu merged, %lu dropped, %lu suppressed\n",
+        stats.ReportsPending, stats.ReportsMerged, stats.ReportsDropped, stats.ReportsSuppressed);
+    printf("Nodes: %lu in use, peak %lu, %lu failed allocation(s)\n",
+        stats.NodesInUse, stats.NodesPeak, stats.NodeFailures);
+    return 0;
+}
+
+//
+// Prints the driver trace as a timeline. The report queue is replayed from
+// the QUEUED/EVICTED/COMPLETED records to measure how long each report
+// waited for hidclass; waits above outlierUs and evicted reports are
+// flagged, as are gaps where the ring wrapped before it was read.
+//
+int printTrace(PVHID_CLIENT client, ULONG outlierUs) {
+    static const char* names[] = { "?", "key", "queued", "merged", "evicted", "completed", "read-parked", "config", "chord" };
+    static VHID_TRACE_RECORD records[1024];
+    struct { UCHAR Id; ULONGLONG Time; } pending[VHID_MAX_QUEUE_DEPTH];
+    ULONG pendingCount = 0, evicted = 0, outliers = 0, lost = 0;
+    ULONG first = 0, count, i, j, k;
+    DWORD returned;
+
+    if (!VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_GET_TRACE, &first, sizeof(first), records, sizeof(records), &returned)) {
+        printf("Failed to get trace: %d\n", GetLastError());
+        return 1;
+    }
+    count = returned / sizeof(VHID_TRACE_RECORD);
+
+    for (i = 0; i < count; i++) {
+        PVHID_TRACE_RECORD r = &records[i];
+
+        if (i != 0 && r->Sequence != records[i - 1].Sequence + 1) {
+            printf("          --- %lu record(s) lost ---\n", r->Sequence - records[i - 1].Sequence - 1);
+            lost += r->Sequence - records[i - 1].Sequence - 1;
+        }
+
+        printf("%12.1f us #%-8lu %-12s", (r->Timestamp - records[0].Timestamp) / 10.0, r->Sequence,
+            r->Type < ARRAYSIZE(names) ? names[r->Type] : names[0]);
+        for (j = 0; j < r->Length; j++)
+            printf(" %02x", r->Data[j]);
+
+        switch (r->Type) {
+        case VHID_TRACE_REPORT_QUEUED:
+            if (pendingCount < ARRAYSIZE(pending)) {
+                pending[pendingCount].Id = r->Data[0];
+                pending[pendingCount++].Time = r->Timestamp;
+            }
+            break;
+        case VHID_TRACE_REPORT_EVICTED:
+            printf("   <<< lost transition");
+            evicted++;
+            if (pendingCount != 0)
+                memmove(&pending[0], &pending[1], --pendingCount * sizeof(pending[0]));
+            break;
+        case VHID_TRACE_CHORD:
+            printf("   (sequence %lu)", *(PULONG)r->Data);
+            break;
+        case VHID_TRACE_REPORT_COMPLETED:
+            for (k = 0; k < pendingCount && pending[k].Id != r->Data[0]; k++)
+                ;
+            if (k < pendingCount) {
+                ULONGLONG wait = (r->Timestamp - pending[k].Time) / 10;
+                printf("   (waited %llu us)", wait);
+                if (wait > outlierUs) {
+                    printf(" <<< outlier");
+                    outliers++;
+                }
+                memmove(&pending[k], &pending[k + 1], (--pendingCount - k) * sizeof(pending[0]));
+            }
+            break;
+        }
+        printf("\n");
+    }
+
+    printf("%lu record(s), %lu lost, %lu evicted report(s), %lu wait(s) over %lu us\n",
+        count, lost, evicted, outliers, outlierUs);
+    return 0;
+}
+
+//
+// Times TraceWrite with the given number of threads sharing one ring, as
+// the driver's paths do, each writing a mouse report record for a second.
+// The ring is read back at the end to check that every slot holds a
+// complete record.
+//
+typedef struct _TRACE_BENCH {
+    PTRACE_RING Ring;
+    ULONGLONG   Writes;
+    double      Seconds;
+} TRACE_BENCH, *PTRACE_BENCH;
+
+static DWORD WINAPI traceBenchThread(LPVOID parameter) {
+    PTRACE_BENCH b = (PTRACE_BENCH)parameter;
+    HID_MOUSE_REPORT report = { MOUSE_REPORT_ID, 1, 10, -10 };
+    LARGE_INTEGER frequency, start, end;
+    ULONG i;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    do {
+        for (i = 0; i < TRACE_RING_SIZE; i++)
+            TraceWrite(b->Ring, VHID_TRACE_REPORT_QUEUED, &report, sizeof(report), b->Writes + i);
+        b->Writes += TRACE_RING_SIZE;
+        QueryPerformanceCounter(&end);
+    } while (end.QuadPart - start.QuadPart < frequency.QuadPart);
+
+    b->Seconds = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+    return 0;
+}
+
+int benchTrace(ULONG threads) {
+    static TRACE_RING ring;
+    static VHID_TRACE_RECORD records[TRACE_RING_SIZE];
+    TRACE_BENCH bench[MAXIMUM_WAIT_OBJECTS];
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    ULONGLONG writes = 0;
+    double perWrite = 0;
+    ULONG i, count;
+
+    if (threads == 0 || threads > MAXIMUM_WAIT_OBJECTS) {
+        printf("Thread count must be 1 to %d\n", MAXIMUM_WAIT_OBJECTS);
+        return 1;
+    }
+
+    TraceRingInit(&ring);
+    for (i = 0; i < threads; i++) {
+        bench[i].Ring = &ring;
+        bench[i].Writes = 0;
+        handles[i] = CreateThread(NULL, 0, traceBenchThread, &bench[i], 0, NULL);
+        if (handles[i] == NULL) {
+            printf("CreateThread failed: %d\n", GetLastError());
+            threads = i;
+            break;
+        }
+    }
+    WaitForMultipleObjects(threads, handles, TRUE, INFINITE);
+
+    for (i = 0; i < threads; i++) {
+        CloseHandle(handles[i]);
+        writes += bench[i].Writes;
+        perWrite += bench[i].Seconds * 1e9 / bench[i].Writes;
+    }
+    if (writes == 0)
+        return 1;
+
+    count = TraceRingRead(&ring, 0, records, TRACE_RING_SIZE);
+    printf("%lu thread(s), %llu record(s): %.1f ns per record, %.1f M records/s\n", threads, writes,
+        perWrite / threads, writes / bench[0].Seconds / 1e6);
+    printf("%lu of %d slot(s) read back complete\n", count, TRACE_RING_SIZE);
+    return count == TRACE_RING_SIZE ? 0 : 1;
+}
+
+//
+// Compares what a debug message costs on the calling path: deferred by
+// VhidLog, which stores it in a LOG_RING, and formatted on the spot, as
+// KdPrint did. The latter is a lower bound, as DbgPrint also hands the text
+// to the debugger transport.
+//
+static void benchLogDeferred(PLOG_RING ring, PCSTR format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    LogRingWrite(ring, 0, format, args);
+    va_end(args);
+}
+
+static void benchLogFormatted(char* buffer, size_t size, PCSTR format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(buffer, size, format, args);
+    va_end(args);
+}
+
+int benchLog(VOID) {
+    static LOG_RING ring;
+    static char buffer[256];
+    LARGE_INTEGER frequency, start, end;
+    ULONGLONG messages;
+    double deferred, formatted;
+    ULONG i;
+
+    QueryPerformanceFrequency(&frequency);
+
+    messages = 0;
+    QueryPerformanceCounter(&start);
+    do {
+        for (i = 0; i < LOG_RING_SIZE; i++)
+            benchLogDeferred(&ring, "Macro %u done, %u instruction(s)\n", i, (ULONG)messages);
+        messages += LOG_RING_SIZE;
+        QueryPerformanceCounter(&end);
+    } while (end.QuadPart - start.QuadPart < frequency.QuadPart);
+    deferred = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart * 1e9 / messages;
+
+    messages = 0;
+    QueryPerformanceCounter(&start);
+    do {
+        for (i = 0; i < LOG_RING_SIZE; i++)
+            benchLogFormatted(buffer, sizeof(buffer), "Macro %u done, %u instruction(s)\n", i, (ULONG)messages);
+        messages += LOG_RING_SIZE;
+        QueryPerformanceCounter(&end);
+    } while (end.QuadPart - start.QuadPart < frequency.QuadPart);
+    formatted = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart * 1e9 / messages;
+
+    printf("deferred: %.1f ns per message\n", deferred);
+    printf("formatted: %.1f ns per message, before any debugger output\n", formatted);
+    return 0;
+}
+
+//
+// Times the batch builder: encoding events into a VHID_BATCH, then the
+// same with every full batch submitted to the loopback transport, which
+// copies it like a request would. Events cycle through key, move and
+// button. No device is needed.
+//
+int benchBatch(VOID) {
+    static const char* names[] = { "encode", "encode + loopback submit" };
+    static VHID_BATCH batch;
+    VHID_LOOPBACK loopback;
+    VHID_CLIENT client;
+    LARGE_INTEGER frequency, start, end;
+    ULONGLONG events;
+    double seconds;
+    ULONG pass, i;
+
+    VhidOpenLoopback(&client, &loopback);
+    QueryPerformanceFrequency(&frequency);
+
+    for (pass = 0; pass < ARRAYSIZE(names); pass++) {
+        events = 0;
+        QueryPerformanceCounter(&start);
+        do {
+            VhidBatchReset(&batch);
+            for (i = 0; i < VHID_BATCH_MAX_EVENTS; i++) {
+                switch (i % 3) {
+                case 0:
+                    VhidBatchKey(&batch, (UCHAR)(0x04 + i % 26), i & 1);
+                    break;
+                case 1:
+                    VhidBatchMove(&batch, (CHAR)(i & 0x3F), -(CHAR)(i & 0x3F));
+                    break;
+                default:
+                    VhidBatchButtons(&batch, (UCHAR)(i & 7));
+                    break;
+                }
+            }
+            if (pass == 1)
+                VhidBatchSubmit(&client, &batch);
+            events += VHID_BATCH_MAX_EVENTS;
+            QueryPerformanceCounter(&end);
+        } while (end.QuadPart - start.QuadPart < frequency.QuadPart);
+
+        seconds = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+        printf("%s: %.2f ns per event, %.1f M events/s\n", names[pass], seconds * 1e9 / events, events / seconds / 1e6);
+    }
+
+    VhidClose(&client);
+    return loopback.Events == 0;
+}
+
+//
+// Compares the slab behind the macro nodes with malloc, the user mode
+// stand-in for the pool, under churn: each thread keeps a window of
+// node-sized objects live and keeps replacing a random one. The slab holds
+// twice what the threads can keep live, as the device's node slab does
+// for its expected load.
+//
+#define SLAB_BENCH_OBJECT   256     // NODE_SIZE
+#define SLAB_BENCH_WINDOW   8
+
+typedef struct _SLAB_BENCH {
+    PSLAB       Slab;               // NULL for malloc
+    ULONG       Seed;
+    ULONGLONG   Pairs;
+    ULONGLONG   Failures;
+    double      Seconds;
+} SLAB_BENCH, *PSLAB_BENCH;
+
+static DWORD WINAPI slabBenchThread(LPVOID parameter) {
+    PSLAB_BENCH b = (PSLAB_BENCH)parameter;
+    PUCHAR live[SLAB_BENCH_WINDOW] = { NULL };
+    LARGE_INTEGER frequency, start, end;
+    ULONG slot, i;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    do {
+        for (i = 0; i < 1024; i++) {
+            b->Seed = b->Seed * 1103515245 + 12345;
+            slot = (b->Seed >> 16) % SLAB_BENCH_WINDOW;
+            if (live[slot] != NULL) {
+                if (b->Slab != NULL)
+                    SlabFree(b->Slab, live[slot]);
+                else
+                    free(live[slot]);
+            }
+            live[slot] = b->Slab != NULL ? (PUCHAR)SlabAlloc(b->Slab) : (PUCHAR)malloc(SLAB_BENCH_OBJECT);
+            if (live[slot] != NULL)
+                live[slot][SLAB_BENCH_OBJECT - 1] = (UCHAR)i;
+            else
+                b->Failures++;
+        }
+        b->Pairs += 1024;
+        QueryPerformanceCounter(&end);
+    } while (end.QuadPart - start.QuadPart < frequency.QuadPart);
+    b->Seconds = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+    for (slot = 0; slot < SLAB_BENCH_WINDOW; slot++) {
+        if (live[slot] == NULL)
+            continue;
+        if (b->Slab != NULL)
+            SlabFree(b->Slab, live[slot]);
+        else
+            free(live[slot]);
+    }
+    return 0;
+}
+
+int benchSlab(ULONG threads) {
+    static const char* names[] = { "slab", "malloc" };
+    SLAB_BENCH bench[MAXIMUM_WAIT_OBJECTS];
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    SIZE_T length = (SIZE_T)threads * SLAB_BENCH_WINDOW * 2 * SLAB_STRIDE(SLAB_BENCH_OBJECT);
+    PVOID memory;
+    SLAB slab;
+    ULONGLONG pairs, failures;
+    double perPair;
+    ULONG pass, started, i;
+
+    if (threads == 0 || threads > MAXIMUM_WAIT_OBJECTS) {
+        printf("Thread count must be 1 to %d\n", MAXIMUM_WAIT_OBJECTS);
+        return 1;
+    }
+
+    memory = malloc(length);
+    if (memory == NULL)
+        return 1;
+    SlabInit(&slab, memory, length, SLAB_BENCH_OBJECT);
+
+    for (pass = 0; pass < ARRAYSIZE(names); pass++) {
+        for (started = 0; started < threads; started++) {
+            bench[started].Slab = pass == 0 ? &slab : NULL;
+            bench[started].Seed = started + 1;
+            bench[started].Pairs = 0;
+            bench[started].Failures = 0;
+            handles[started] = CreateThread(NULL, 0, slabBenchThread, &bench[started], 0, NULL);
+            if (handles[started] == NULL)
+                break;
+        }
+        if (started == 0)
+            break;
+        WaitForMultipleObjects(started, handles, TRUE, INFINITE);
+
+        pairs = failures = 0;
+        perPair = 0;
+        for (i = 0; i < started; i++) {
+            CloseHandle(handles[i]);
+            pairs += bench[i].Pairs;
+            failures += bench[i].Failures;
+            perPair += bench[i].Seconds * 1e9 / bench[i].Pairs;
+        }
+        printf("%-6s %lu thread(s): %.1f ns per free/alloc pair, %.1f M pairs/s, %llu failure(s)\n",
+            names[pass], started, perPair / started, pairs / bench[0].Seconds / 1e6, failures);
+    }
+    printf("slab peak %ld of %lu object(s)\n", slab.Peak, slab.Count);
+
+    free(memory);
+    return 0;
+}
+
+//
+// Prints the receipts of the requests from sequence number first on, with
+// the time from submission to the read of the last report for those that
+// have completed.
+//
+int printReceipts(PVHID_CLIENT client, ULONG first) {
+    static const char* names[] = { "pending", "delivered", "merged", "dropped", "none" };
+    static VHID_RECEIPT receipts[RECEIPT_RING_SIZE];
+    ULONG counts[ARRAYSIZE(names)] = { 0 };
+    ULONGLONG latency, total = 0, worst = 0;
+    ULONG count, i;
+    DWORD returned;
+
+    if (!VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_GET_RECEIPTS, &first, sizeof(first), receipts, sizeof(receipts), &returned)) {
+        printf("Failed to get receipts: %d\n", GetLastError());
+        return 1;
+    }
+    count = returned / sizeof(VHID_RECEIPT);
+
+    for (i = 0; i < count; i++) {
+        PVHID_RECEIPT r = &receipts[i];
+
+        printf("#%-8lu %-10s", r->Sequence, r->Status < ARRAYSIZE(names) ? names[r->Status] : "?");
+        if (r->Status < ARRAYSIZE(names))
+            counts[r->Status]++;
+        if (r->Status == VHID_RECEIPT_DELIVERED) {
+            latency = r->Completed - r->Submitted;
+            printf(" %10.1f us", latency / 10.0);
+            total += latency;
+            if (latency > worst)
+                worst = latency;
+        }
+        printf("\n");
+    }
+
+    printf("%lu receipt(s): %lu delivered, %lu merged, %lu dropped, %lu without report, %lu pending\n",
+        count, counts[VHID_RECEIPT_DELIVERED], counts[VHID_RECEIPT_MERGED], counts[VHID_RECEIPT_DROPPED],
+        counts[VHID_RECEIPT_NONE], counts[VHID_RECEIPT_PENDING]);
+    if (counts[VHID_RECEIPT_DELIVERED] != 0)
+        printf("Latency: mean %.1f us, max %.1f us\n", total / 10.0 / counts[VHID_RECEIPT_DELIVERED], worst / 10.0);
+    return 0;
+}
+
+int benchReceipts(VOID) {
+    static RECEIPT_RING ring;
+    static VHID_RECEIPT receipts[RECEIPT_RING_SIZE];
+    ULONGLONG requests = 0;
+    ULONG sequence, i;
+    LARGE_INTEGER frequency, start, end;
+    double seconds;
+
+    //
+    // The bookkeeping of a request queuing two reports that are both read,
+    // as the driver does it under StateLock, plus one full read of the ring
+    // per ring's worth of requests.
+    //
+    ReceiptRingInit(&ring);
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    do {
+        for (i = 0; i < RECEIPT_RING_SIZE; i++) {
+            sequence = ReceiptOpen(&ring, requests);
+            ReceiptQueued(&ring, sequence);
+            ReceiptQueued(&ring, sequence);
+            ReceiptClose(&ring, sequence, requests);
+            ReceiptResolve(&ring, sequence, RECEIPT_DELIVERED, requests + 1);
+            ReceiptResolve(&ring, sequence, RECEIPT_DELIVERED, requests + 2);
+            requests++;
+        }
+        ReceiptRingRead(&ring, 0, receipts, RECEIPT_RING_SIZE);
+        QueryPerformanceCounter(&end);
+    } while (end.QuadPart - start.QuadPart < frequency.QuadPart);
+
+    seconds = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+    printf("%llu request(s) in %.2f s: %.1f ns per request\n", requests, seconds, seconds * 1e9 / requests);
+    return 0;
+}
+
+//
+// Prints the report descriptor each profile advertises, and the reports
+// LayoutParse finds in it.
+//
+int printProfiles(VOID) {
+    static const char* names[] = { "keyboard+mouse", "keyboard", "mouse", "nkro", "gamepad" };
+    static DESCRIPTOR_LAYOUT layout;
+    UCHAR descriptor[DESCRIPTOR_MAX_SIZE];
+    UCHAR collections;
+    ULONG profile, length, i, f;
+
+    for (profile = 0; profile < VHID_PROFILE_COUNT; profile++) {
+        if (!DescriptorBuild(profile, descriptor, sizeof(descriptor), &length, &collections)) {
+            printf("Profile %lu: failed to build\n", profile);
+            return 1;
+        }
+        printf("Profile %lu (%s): %lu bytes, collections 0x%02x", profile, names[profile], length, collections);
+        for (i = 0; i < length; i++)
+            printf("%s%02x", i % 16 == 0 ? "\n    " : " ", descriptor[i]);
+        printf("\n");
+
+        if (!LayoutParse(descriptor, length, &layout, &i)) {
+            printf("  rejected at offset %lu\n", i);
+            return 1;
+        }
+        for (i = 0; i < layout.ReportCount; i++) {
+            const LAYOUT_REPORT* report = &layout.Reports[i];
+
+            printf("  report %u %s, %u bits\n", report->ReportId,
+                report->Type == LAYOUT_INPUT ? "input" : report->Type == LAYOUT_OUTPUT ? "output" : "feature",
+                report->BitLength);
+            for (f = report->FirstField; f < (ULONG)report->FirstField + report->FieldCount; f++) {
+                const LAYOUT_FIELD* field = &layout.Fields[f];
+
+                printf("    bit %3u: %3u x %2u bits, usage %04x:%04x-%04x, logical %ld..%ld%s\n",
+                    field->BitOffset, field->Count, field->BitSize, field->UsagePage, field->UsageMin,
+                    field->UsageMax, field->LogicalMin, field->LogicalMax,
+                    (field->Flags & FIELD_VARIABLE) ? "" : ", array");
+            }
+        }
+    }
+    return 0;
+}
+
+int benchLayout(VOID) {
+    static DESCRIPTOR_LAYOUT layout;
+    static const USHORT axes[] = { 0x30, 0x31, 0x32, 0x35 };
+    const LAYOUT_REPORT* report;
+    const LAYOUT_FIELD* buttons;
+    const LAYOUT_FIELD* fields[4];
+    UCHAR descriptor[DESCRIPTOR_MAX_SIZE];
+    HID_GAMEPAD_REPORT gamepad;
+    UCHAR collections;
+    ULONG length, index, i, round;
+    ULONGLONG reports;
+    volatile ULONG sink = 0;
+    LARGE_INTEGER frequency, start, end;
+    double seconds[4];
+
+    //
+    // Packs and unpacks the gamepad report, sixteen one bit fields and four
+    // byte axes, through the layout the driver validates its descriptor
+    // with, and through the HID_GAMEPAD_REPORT the driver actually fills.
+    //
+    DescriptorBuild(VHID_PROFILE_GAMEPAD, descriptor, sizeof(descriptor), &length, &collections);
+    if (!LayoutParse(descriptor, length, &layout, &index) ||
+        (report = LayoutFindReport(&layout, GAMEPAD_REPORT_ID, LAYOUT_INPUT)) == NULL ||
+        (buttons = LayoutFindField(&layout, report, 0x09, 1, &index)) == NULL) {
+        printf("Gamepad report not found\n");
+        return 1;
+    }
+    for (i = 0; i < 4; i++) {
+        fields[i] = LayoutFindField(&layout, report, 0x01, axes[i], &index);
+        if (fields[i] == NULL) {
+            printf("Gamepad axis 0x%02x not found\n", axes[i]);
+            return 1;
+        }
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    for (round = 0; round < 4; round++) {
+        RtlZeroMemory(&gamepad, sizeof(gamepad));
+        gamepad.ReportId = GAMEPAD_REPORT_ID;
+        reports = 0;
+        QueryPerformanceCounter(&start);
+        do {
+            for (index = 0; index < 4096; index++, reports++) {
+                LONG value = (LONG)(reports & 0xFF) - 128;
+
+                switch (round) {
+                case 0:
+                    for (i = 0; i < 16; i++)
+                        FieldPack((PUCHAR)&gamepad, buttons, i, (LONG)(reports >> i) & 1);
+                    for (i = 0; i < 4; i++)
+                        FieldPack((PUCHAR)&gamepad, fields[i], 0, value);
+                    break;
+                case 1:
+                    gamepad.Buttons = (USHORT)reports;
+                    gamepad.X = gamepad.Y = gamepad.Z = gamepad.Rz = (CHAR)max(value, -127);
+                    break;
+                case 2:
+                    for (i = 0; i < 16; i++)
+                        sink += FieldUnpack((const UCHAR*)&gamepad, buttons, i);
+                    for (i = 0; i < 4; i++)
+                        sink += FieldUnpack((const UCHAR*)&gamepad, fields[i], 0);
+                    break;
+                default:
+                    for (i = 0; i < 16; i++)
+                        sink += (gamepad.Buttons >> i) & 1;
+                    sink += gamepad.X + gamepad.Y + gamepad.Z + gamepad.Rz;
+                    break;
+                }
+                sink += gamepad.Buttons;
+            }
+            QueryPerformanceCounter(&end);
+        } while (end.QuadPart - start.QuadPart < frequency.QuadPart);
+        seconds[round] = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart * 1e9 / reports;
+    }
+
+    printf("Pack:   layout %.1f ns, struct %.1f ns per report\n", seconds[0], seconds[1]);
+    printf("Unpack: layout %.1f ns, struct %.1f ns per report\n", seconds[2], seconds[3]);
+    return 0;
+}
+
+static ULONG fuzzSeed;
+
+ULONG fuzzRandom(VOID) {
+    fuzzSeed ^= fuzzSeed << 13;
+    fuzzSeed ^= fuzzSeed >> 17;
+    fuzzSeed ^= fuzzSeed << 5;
+    return fuzzSeed;
+}
+
+//
+// Checks what a caller of LayoutParse relies on: fields inside their
+// report, reports inside the size limit, and values in the logical range
+// packing and unpacking back unchanged without touching other bits.
+//
+BOOL fuzzCheck(const DESCRIPTOR_LAYOUT* layout) {
+    static UCHAR buffer[LAYOUT_MAX_REPORT_BYTES];
+    static UCHAR before[LAYOUT_MAX_REPORT_BYTES];
+    ULONG fields = 0;
+    ULONG r, f, i, bit;
+
+    for (r = 0; r < layout->ReportCount; r++) {
+        const LAYOUT_REPORT* report = &layout->Reports[r];
+
+        if (report->BitLength > LAYOUT_MAX_REPORT_BYTES * 8 ||
+            (ULONG)report->FirstField + report->FieldCount > layout->FieldCount)
+            return FALSE;
+        fields += report->FieldCount;
+
+        for (f = report->FirstField; f < (ULONG)report->FirstField + report->FieldCount; f++) {
+            const LAYOUT_FIELD* field = &layout->Fields[f];
+            LONGLONG low = (field->Flags & FIELD_SIGNED) ? -(1LL << (field->BitSize - 1)) : 0;
+            LONGLONG high = (field->Flags & FIELD_SIGNED) ? (1LL << (field->BitSize - 1)) - 1 : (1LL << field->BitSize) - 1;
+            LONG values[2];
+
+            if (field->BitSize == 0 || field->BitSize > 32 || field->Count == 0 ||
+                field->BitOffset + (ULONG)field->Count * field->BitSize > report->BitLength ||
+                field->LogicalMin > field->LogicalMax)
+                return FALSE;
+
+            values[0] = field->LogicalMin;
+            values[1] = field->LogicalMax;
+            for (i = 0; i < 2; i++) {
+                ULONG index = fuzzRandom() % field->Count;
+                ULONG first = field->BitOffset + index * field->BitSize;
+
+                if (values[i] < low || values[i] > high)
+                    continue;
+                for (bit = 0; bit < sizeof(buffer); bit++)
+                    buffer[bit] = (UCHAR)fuzzRandom();
+                memcpy(before, buffer, sizeof(buffer));
+                FieldPack(buffer, field, index, values[i]);
+                if (FieldUnpack(buffer, field, index) != values[i])
+                    return FALSE;
+                for (bit = 0; bit < sizeof(buffer) * 8; bit++) {
+                    if ((bit < first || bit >= first + field->BitSize) &&
+                        ((buffer[bit / 8] ^ before[bit / 8]) & (1 << (bit % 8))) != 0)
+                        return FALSE;
+                }
+            }
+        }
     }
+    return fields == layout->FieldCount;
+}
+
+int fuzzLayout(ULONG iterations) {
+    static DESCRIPTOR_LAYOUT layout;
+    UCHAR descriptor[DESCRIPTOR_MAX_SIZE];
+    UCHAR collections;
+    ULONG length, offset, n, i, mutations;
+    ULONG accepted = 0;
 
-    free(detailData);
-    SetupDiDestroyDeviceInfoList(deviceInfo);
+    //
+    // Mutates the profile descriptors in process: bytes replaced, bits
+    // flipped, bytes inserted and removed. Whatever LayoutParse accepts
+    // has to pass fuzzCheck.
+    //
+    fuzzSeed = GetTickCount() | 1;
+    printf("Seed %lu\n", fuzzSeed);
+    for (n = 0; n < iterations; n++) {
+        DescriptorBuild(n % VHID_PROFILE_COUNT, descriptor, sizeof(descriptor), &length, &collections);
+        mutations = n < VHID_PROFILE_COUNT ? 0 : 1 + fuzzRandom() % 4;
+        for (i = 0; i < mutations && length != 0; i++) {
+            offset = fuzzRandom() % length;
+            switch (fuzzRandom() % 4) {
+            case 0:
+                descriptor[offset] = (UCHAR)fuzzRandom();
+                break;
+            case 1:
+                descriptor[offset] ^= (UCHAR)(1 << (fuzzRandom() % 8));
+                break;
+            case 2:
+                if (length < sizeof(descriptor)) {
+                    memmove(descriptor + offset + 1, descriptor + offset, length - offset);
+                    descriptor[offset] = (UCHAR)fuzzRandom();
+                    length++;
+                }
+                break;
+            default:
+                memmove(descriptor + offset, descriptor + offset + 1, length - offset - 1);
+                length--;
+                break;
+            }
+        }
 
-    return deviceHandle;
+        if (!LayoutParse(descriptor, length, &layout, &offset)) {
+            if (n < VHID_PROFILE_COUNT || offset > length)
+                break;
+            continue;
+        }
+        accepted++;
+        if (!fuzzCheck(&layout))
+            break;
+    }
+
+    if (n != iterations) {
+        printf("Iteration %lu failed on", n);
+        for (i = 0; i < length; i++)
+            printf("%s%02x", i % 16 == 0 ? "\n    " : " ", descriptor[i]);
+        printf("\n");
+        return 1;
+    }
+    printf("%lu descriptor(s), %lu accepted\n", iterations, accepted);
+    return 0;
 }
 
-VOID sendKey(HANDLE hDevice, PVHID_KEY_EVENT key) {
-    if (!DeviceIoControl(hDevice, (DWORD)IOCTL_VHIDMINI_KEY_EVENT, key, sizeof(VHID_KEY_EVENT), NULL, 0, NULL, NULL))
+int sendGamepad(PVHID_CLIENT client, int argc, char* argv[]) {
+    VHID_GAMEPAD_STATE state = { 0 };
+
+    //
+    // testvhid gamepad <buttons> [x y z rz]
+    //
+    state.Buttons = (USHORT)strtoul(argv[2], NULL, 0);
+    if (argc >= 7) {
+        state.X = (CHAR)strtol(argv[3], NULL, 10);
+        state.Y = (CHAR)strtol(argv[4], NULL, 10);
+        state.Z = (CHAR)strtol(argv[5], NULL, 10);
+        state.Rz = (CHAR)strtol(argv[6], NULL, 10);
+    }
+
+    if (!VhidSendGamepad(client, &state)) {
         printf("Failed to send: %d\n", GetLastError());
+        return 1;
+    }
+    return 0;
 }
 
-int main(char* argc, char* argv[]) {
-	UNREFERENCED_PARAMETER(argc);
-	UNREFERENCED_PARAMETER(argv);
+VOID printKeys(const char* label, const ULONG* keys) {
+    ULONG i;
 
-    VHID_KEY_EVENT keyEvent = {
-        .KeyCode = 0x04,
-        .Pressed = 1
-    };
+    printf("%s:", label);
+    for (i = 0; i < VHID_SNAPSHOT_KEY_WORDS * 32; i++) {
+        if (keys[i / 32] & (1u << (i % 32)))
+            printf(" %02lx", i);
+    }
+    printf("\n");
+}
 
-    HANDLE hDevice = OpenVhidMini();
-    if (hDevice == INVALID_HANDLE_VALUE) {
-        printf("Impossible douvrir le device: %d\n", GetLastError());
+VOID printSnapshot(const VHID_SNAPSHOT* snapshot) {
+    printKeys("Keys", snapshot->Keys);
+    printKeys("Own keys", snapshot->OwnKeys);
+    printf("Buttons: 0x%x (own 0x%x)\n", snapshot->Buttons, snapshot->OwnButtons);
+    printf("Gamepad: buttons 0x%04x, x %d, y %d, z %d, rz %d\n", snapshot->Gamepad.Buttons,
+        snapshot->Gamepad.X, snapshot->Gamepad.Y, snapshot->Gamepad.Z, snapshot->Gamepad.Rz);
+    printf("Collections: 0x%02x\n", snapshot->Collections);
+}
+
+VOID printDiff(const SNAPSHOT_DIFF* diff) {
+    ULONG reports = 0;
+    UCHAR collection;
+
+    for (collection = VHID_COLLECTION_KEYBOARD; collection <= VHID_COLLECTION_GAMEPAD; collection <<= 1)
+        reports += (diff->Collections & collection) != 0;
+
+    printKeys("Release", diff->Released);
+    printKeys("Press", diff->Pressed);
+    printf("Buttons: release 0x%x, press 0x%x%s\n", diff->ButtonsReleased, diff->ButtonsPressed,
+        diff->GamepadChanged ? ", gamepad changes" : "");
+    printf("%lu transition(s) in %lu report(s)\n", diff->Transitions, reports);
+}
+
+BOOL loadSnapshot(const char* path, PVHID_SNAPSHOT snapshot) {
+    FILE* f;
+    size_t read;
+
+    if (fopen_s(&f, path, "rb") != 0) {
+        printf("Cannot open %s\n", path);
+        return FALSE;
+    }
+    read = fread(snapshot, 1, sizeof(*snapshot), f);
+    fclose(f);
+    if (read != sizeof(*snapshot)) {
+        printf("%s is not a snapshot\n", path);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//
+// testvhid snapshot [file]
+//
+int takeSnapshot(PVHID_CLIENT client, const char* path) {
+    VHID_SNAPSHOT snapshot;
+    FILE* f;
+
+    if (!VhidGetSnapshot(client, &snapshot)) {
+        printf("Failed to read the snapshot: %d\n", GetLastError());
+        return 1;
+    }
+    printSnapshot(&snapshot);
+
+    if (path != NULL) {
+        if (fopen_s(&f, path, "wb") != 0) {
+            printf("Cannot create %s\n", path);
+            return 1;
+        }
+        fwrite(&snapshot, sizeof(snapshot), 1, f);
+        fclose(f);
+    }
+    return 0;
+}
+
+//
+// testvhid restore <file> [collections]
+//
+int restoreSnapshot(PVHID_CLIENT client, const char* path, const char* collections) {
+    VHID_SNAPSHOT snapshot;
+    VHID_SNAPSHOT current;
+    SNAPSHOT_DIFF diff;
+    ULONG sequence;
+
+    if (!loadSnapshot(path, &snapshot))
+        return 1;
+    if (collections != NULL)
+        snapshot.Collections = (UCHAR)strtoul(collections, NULL, 0);
+
+    //
+    // What the driver will do, unless someone else injects in between.
+    //
+    if (VhidGetSnapshot(client, &current)) {
+        SnapshotDiff(&current, &snapshot, snapshot.Collections, &diff);
+        printDiff(&diff);
+    }
+
+    if (!VhidRestoreSnapshot(client, &snapshot, &sequence)) {
+        printf("Failed to restore: %d\n", GetLastError());
+        return 1;
+    }
+    printf("Sequence %lu\n", sequence);
+    return 0;
+}
+
+//
+// testvhid snapshot --diff <from> <to>, in process.
+//
+int diffSnapshots(const char* from, const char* to) {
+    VHID_SNAPSHOT a, b;
+    SNAPSHOT_DIFF diff;
+
+    if (!loadSnapshot(from, &a) || !loadSnapshot(to, &b))
+        return 1;
+    SnapshotDiff(&a, &b, b.Collections, &diff);
+    printDiff(&diff);
+    return 0;
+}
+
+ULONG parseMacro(const char* text, UCHAR* code) {
+    ULONG length = 0;
+    ULONG offset;
+    char digits[3] = { 0 };
+
+    //
+    // Hex bytes, optionally separated by spaces.
+    //
+    while (*text != 0) {
+        if (*text == ' ') {
+            text++;
+            continue;
+        }
+        if (length == VHID_MACRO_MAX_CODE || text[1] == 0 || !isxdigit((UCHAR)text[0]) || !isxdigit((UCHAR)text[1])) {
+            printf("Invalid program\n");
+            return 0;
+        }
+        digits[0] = text[0];
+        digits[1] = text[1];
+        code[length++] = (UCHAR)strtoul(digits, NULL, 16);
+        text += 2;
+    }
+
+    if (!MacroVerify(code, length, &offset)) {
+        printf("Program rejected at offset %lu\n", offset);
+        return 0;
+    }
+    return length;
+}
+
+ULONG benchQuery(PVOID context, ULONG query, UCHAR arg) {
+    return query == MACRO_QUERY_DRAINED;
+}
+
+VOID benchEmit(PVOID context, const VHID_BATCH_EVENT* event) {
+    (*(PULONG)context)++;
+}
+
+int benchMacro(const char* text) {
+    UCHAR code[VHID_MACRO_MAX_CODE];
+    ULONG length = parseMacro(text, code);
+    MACRO_VM vm;
+    MACRO_HOST host;
+    ULONG events = 0;
+    ULONGLONG steps = 0;
+    ULONGLONG now;
+    LARGE_INTEGER frequency, start, end;
+    double seconds;
+
+    if (length == 0)
+        return 1;
+
+    //
+    // Runs the program in process against a device that is always drained,
+    // with waits taking no time, so only the interpreter is measured.
+    //
+    host.Emit = benchEmit;
+    host.Query = benchQuery;
+    host.Context = &events;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    do {
+        MacroVmInit(&vm, code, (USHORT)length);
+        now = 0;
+        while (!MacroVmRun(&vm, &host, now))
+            now = MacroVmNextDeadline(&vm, now);
+        steps += vm.Steps;
+        QueryPerformanceCounter(&end);
+    } while (end.QuadPart - start.QuadPart < frequency.QuadPart);
+
+    seconds = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+    printf("%llu instruction(s), %lu event(s) in %.2f s: %.1f M instructions/s\n",
+        steps, events, seconds, steps / seconds / 1e6);
+    return 0;
+}
+
+int runMacro(PVHID_CLIENT client, const char* text) {
+    UCHAR code[VHID_MACRO_MAX_CODE];
+    ULONG length = parseMacro(text, code);
+    ULONG id;
+    DWORD returned;
+
+    if (length == 0)
+        return 1;
+
+    if (!VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_RUN_MACRO, code, length, &id, sizeof(id), &returned)) {
+        printf("Failed to start macro: %d\n", GetLastError());
+        return 1;
+    }
+
+    //
+    // Closing the handle stops the macro.
+    //
+    printf("Macro %lu running, press Enter to stop\n", id);
+    getchar();
+    return 0;
+}
+
+const UCHAR* mapFile(const char* path, SIZE_T* length) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    HANDLE mapping;
+    LARGE_INTEGER size;
+    const UCHAR* view = NULL;
+
+    if (file == INVALID_HANDLE_VALUE) {
+        printf("Cannot open %s: %d\n", path, GetLastError());
+        return NULL;
+    }
+    if (GetFileSizeEx(file, &size) && size.QuadPart != 0) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL) {
+            view = (const UCHAR*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+
+    if (view == NULL)
+        printf("Cannot map %s: %d\n", path, GetLastError());
+    *length = (SIZE_T)size.QuadPart;
+    return view;
+}
+
+int sendStream(PVHID_CLIENT client, const char* path, BOOL parseOnly) {
+    SIZE_T length;
+    const UCHAR* data = mapFile(path, &length);
+    VHID_BATCH_EVENT events[VHID_MAX_QUEUE_DEPTH];
+    STREAM_PARSER parser;
+    ULONGLONG count = 0;
+    SIZE_T offset = 0;
+    SIZE_T used;
+    LARGE_INTEGER frequency, start, end;
+    double seconds;
+    BOOL ok = TRUE;
+
+    if (data == NULL)
+        return 1;
+
+    //
+    // The file is mapped and sent as is, the driver reads the pages in
+    // place. --bench only runs the parser, in process, the way the driver
+    // does.
+    //
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    if (parseOnly) {
+        StreamParserInit(&parser);
+        while (offset < length && !parser.Invalid) {
+            count += StreamParserFeed(&parser, data + offset, length - offset, &used, events, ARRAYSIZE(events));
+            offset += used;
+        }
+        ok = !parser.Invalid;
+    }
+    else {
+        ok = VhidSendStream(client, data, length);
+    }
+    QueryPerformanceCounter(&end);
+    UnmapViewOfFile(data);
+
+    if (!ok) {
+        if (parseOnly)
+            printf("Invalid record at offset %Iu\n", parser.Consumed);
+        else
+            printf("Failed to send: %d\n", GetLastError());
         return 1;
     }
 
-    sendKey(hDevice, &keyEvent);
-    keyEvent.Pressed=0;
-    Sleep(50);
-    sendKey(hDevice, &keyEvent);
+    seconds = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+    if (parseOnly)
+        printf("%llu event(s), ", count);
+    printf("%Iu byte(s) in %.3f s: %.1f MB/s\n", length, seconds, length / seconds / 1e6);
+    return 0;
+}
+
+int sendChord(PVHID_CLIENT client, int argc, char* argv[]) {
+    VHID_CHORD chord = { 0 };
+    ULONG sequence;
+    DWORD returned;
+    int i;
+
+    //
+    // testvhid chord [--hold ms] [--buttons mask] <hex key code>...
+    //
+    for (i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--hold") == 0 && i + 1 < argc)
+            chord.HoldMs = (USHORT)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--buttons") == 0 && i + 1 < argc)
+            chord.Buttons = (UCHAR)strtoul(argv[++i], NULL, 0);
+        else if (chord.KeyCount < VHID_CHORD_MAX_KEYS)
+            chord.Keys[chord.KeyCount++] = (UCHAR)strtoul(argv[i], NULL, 16);
+    }
+
+    while (!VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_SEND_CHORD, &chord, sizeof(chord),
+        &sequence, sizeof(sequence), &returned)) {
+        if (GetLastError() != ERROR_BUSY) {
+            printf("Failed to send chord: %d\n", GetLastError());
+            return 1;
+        }
+        Sleep(10);
+    }
 
-    Sleep(50);
-	CloseHandle(hDevice);
-	return 0;
+    //
+    // The releases are sent by the driver once the hold time is over, as
+    // long as the handle stays open.
+    //
+    printf("Chord %lu\n", sequence);
+    Sleep(chord.HoldMs + 50);
+    return 0;
 }
 
+int main(int argc, char* argv[]) {
+    VHID_CLIENT client;
+    ULONG instance = 0;
+    BOOL pipe = FALSE;
+    BOOL opened;
+    int ret = 0;
+
+    //
+    // testvhid [--instance N] [--pipe] <command>
+    //
+    if (argc >= 3 && strcmp(argv[1], "--instance") == 0) {
+        instance = strtoul(argv[2], NULL, 10);
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc >= 2 && strcmp(argv[1], "--pipe") == 0) {
+        pipe = TRUE;
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    }
+
+    if (argc == 2 && strcmp(argv[1], "instances") == 0) {
+        printf("%lu instance(s)\n", VhidCountInstances());
+        return 0;
+    }
+
+    //
+    // The load generator opens its own client per thread.
+    //
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0)
+        return benchRun(instance, argc, argv);
+
+    if (argc == 2 && strcmp(argv[1], "broker") == 0)
+        return brokerRun(instance);
 
+    //
+    // testvhid macro [--bench] <hex program>
+    //
+    if (argc == 4 && strcmp(argv[1], "macro") == 0 && strcmp(argv[2], "--bench") == 0)
+        return benchMacro(argv[3]);
+
+    //
+    // testvhid stream [--bench] <file of packed records>
+    //
+    if (argc == 4 && strcmp(argv[1], "stream") == 0 && strcmp(argv[2], "--bench") == 0)
+        return sendStream(NULL, argv[3], TRUE);
+
+    if (argc == 3 && strcmp(argv[1], "receipts") == 0 && strcmp(argv[2], "--bench") == 0)
+        return benchReceipts();
+
+    if (argc == 3 && strcmp(argv[1], "log") == 0 && strcmp(argv[2], "--bench") == 0)
+        return benchLog();
+
+    if (argc == 3 && strcmp(argv[1], "batch") == 0 && strcmp(argv[2], "--bench") == 0)
+        return benchBatch();
+
+    //
+    // testvhid slab --bench [threads]
+    //
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "slab") == 0 && strcmp(argv[2], "--bench") == 0)
+        return benchSlab(argc == 4 ? strtoul(argv[3], NULL, 10) : 4);
+
+    //
+    // testvhid trace --bench [threads]
+    //
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "trace") == 0 && strcmp(argv[2], "--bench") == 0)
+        return benchTrace(argc == 4 ? strtoul(argv[3], NULL, 10) : 1);
+
+    //
+    // testvhid profiles [--bench | --fuzz iterations]
+    //
+    if (argc == 2 && strcmp(argv[1], "profiles") == 0)
+        return printProfiles();
+
+    if (argc == 3 && strcmp(argv[1], "profiles") == 0 && strcmp(argv[2], "--bench") == 0)
+        return benchLayout();
+
+    if (argc == 4 && strcmp(argv[1], "profiles") == 0 && strcmp(argv[2], "--fuzz") == 0)
+        return fuzzLayout(strtoul(argv[3], NULL, 10));
+
+    if (argc == 5 && strcmp(argv[1], "snapshot") == 0 && strcmp(argv[2], "--diff") == 0)
+        return diffSnapshots(argv[3], argv[4]);
+
+    opened = pipe ? VhidOpenPipe(&client, instance) : VhidOpenInstance(&client, instance);
+    if (!opened) {
+        printf("Impossible douvrir le device: %d\n", GetLastError());
+        return 1;
+    }
+
+    //
+    // testvhid type <us|fr|de> <utf-8 text>
+    //
+    if (argc == 4 && strcmp(argv[1], "type") == 0) {
+        ULONG layout = strcmp(argv[2], "fr") == 0 ? VHID_LAYOUT_FR :
+                       strcmp(argv[2], "de") == 0 ? VHID_LAYOUT_DE : VHID_LAYOUT_US;
+        ret = typeText(&client, layout, argv[3]);
+    }
+    else if (argc == 2 && strcmp(argv[1], "stats") == 0) {
+        ret = printStats(&client);
+    }
+    //
+    // testvhid trace [--bench [threads] | outlier threshold in us]
+    //
+    else if ((argc == 2 || argc == 3) && strcmp(argv[1], "trace") == 0) {
+        ret = printTrace(&client, argc == 3 ? strtoul(argv[2], NULL, 10) : 10000);
+    }
+    //
+    // testvhid receipts [--bench | first sequence number]
+    //
+    else if ((argc == 2 || argc == 3) && strcmp(argv[1], "receipts") == 0) {
+        ret = printReceipts(&client, argc == 3 ? strtoul(argv[2], NULL, 10) : 0);
+    }
+    else if (argc >= 3 && strcmp(argv[1], "gamepad") == 0) {
+        ret = sendGamepad(&client, argc, argv);
+    }
+    else if ((argc == 2 || argc == 3) && strcmp(argv[1], "snapshot") == 0) {
+        ret = takeSnapshot(&client, argc == 3 ? argv[2] : NULL);
+    }
+    else if ((argc == 3 || argc == 4) && strcmp(argv[1], "restore") == 0) {
+        ret = restoreSnapshot(&client, argv[2], argc == 4 ? argv[3] : NULL);
+    }
+    else if (argc >= 3 && strcmp(argv[1], "chord") == 0) {
+        ret = sendChord(&client, argc, argv);
+    }
+    else if (argc == 3 && strcmp(argv[1], "stream") == 0) {
+        ret = sendStream(&client, argv[2], FALSE);
+    }
+    else if (argc == 3 && strcmp(argv[1], "macro") == 0) {
+        ret = runMacro(&client, argv[2]);
+    }
+    else if (argc >= 2 && strcmp(argv[1], "replay") == 0) {
+        ret = replayRun(&client, argc, argv);
+    }
+    else {
+        if (!VhidSendKey(&client, 0x04, TRUE))
+            printf("Failed to send: %d\n", GetLastError());
+        Sleep(50);
+        if (!VhidSendKey(&client, 0x04, FALSE))
+            printf("Failed to send: %d\n", GetLastError());
+        Sleep(50);
+    }
+
+    VhidClose(&client);
+    return ret;
+}
@@ -0,0 +1,8 @@
+#ifndef __TESTVHID_H_
+#define __TESTVHID_H_
+
+int replayRun(PVHID_CLIENT client, int argc, char* argv[]);
+int benchRun(ULONG instance, int argc, char* argv[]);
+int brokerRun(ULONG instance);
+
+#endif // __TESTVHID_H_
@@ -0,0 +1,575 @@
+#include <windows.h>
+#include <winioctl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <setupapi.h>
+#include "vhidmini_ioctl.h"
+#include "vhidclient.h"
+
+static BOOL deviceIoControl(PVOID context, DWORD ioControlCode, PVOID input, DWORD inputLength,
+    PVOID output, DWORD outputLength, DWORD* returned) {
+    return DeviceIoControl((HANDLE)context, ioControlCode, input, inputLength, output, outputLength, returned, NULL);
+}
+
+static VOID deviceClose(PVOID context) {
+    CloseHandle((HANDLE)context);
+}
+
+//
+// Every vhidmini devnode registers its own interface; instance selects one
+// of them in enumeration order.
+//
+static HANDLE openDevice(ULONG instance, DWORD flags)
+{
+    HDEVINFO deviceInfo;
+    SP_DEVICE_INTERFACE_DATA interfaceData;
+    PSP_DEVICE_INTERFACE_DETAIL_DATA detailData;
+    DWORD requiredSize = 0;
+    HANDLE deviceHandle = INVALID_HANDLE_VALUE;
+
+    deviceInfo = SetupDiGetClassDevs(
+        &GUID_DEVINTERFACE_VHIDMINI,
+        NULL,
+        NULL,
+        DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+
+    if (deviceInfo == INVALID_HANDLE_VALUE) {
+        printf("Failed to get device info set\n");
+        return INVALID_HANDLE_VALUE;
+    }
+
+    interfaceData.cbSize = sizeof(interfaceData);
+
+    if (!SetupDiEnumDeviceInterfaces(
+        deviceInfo,
+        NULL,
+        &GUID_DEVINTERFACE_VHIDMINI,
+        instance,
+        &interfaceData))
+    {
+        printf("Failed to enumerate device %lu\n", instance);
+        SetupDiDestroyDeviceInfoList(deviceInfo);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    SetupDiGetDeviceInterfaceDetail(
+        deviceInfo,
+        &interfaceData,
+        NULL,
+        0,
+        &requiredSize,
+        NULL);
+
+    detailData = (PSP_DEVICE_INTERFACE_DETAIL_DATA)malloc(requiredSize);
+    detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+    if (SetupDiGetDeviceInterfaceDetail(
+        deviceInfo,
+        &interfaceData,
+        detailData,
+        requiredSize,
+        NULL,
+        NULL))
+    {
+        deviceHandle = CreateFile(
+            detailData->DevicePath,
+            GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE,
+            NULL,
+            OPEN_EXISTING,
+            flags,
+            NULL);
+        if (deviceHandle == INVALID_HANDLE_VALUE)
+            printf("Failed to open file: %d\n", GetLastError());
+    }
+    else {
+        printf("Failed to get device detail\n");
+    }
+
+    free(detailData);
+    SetupDiDestroyDeviceInfoList(deviceInfo);
+
+    return deviceHandle;
+}
+
+ULONG VhidCountInstances(VOID) {
+    HDEVINFO deviceInfo;
+    SP_DEVICE_INTERFACE_DATA interfaceData;
+    ULONG count = 0;
+
+    deviceInfo = SetupDiGetClassDevs(&GUID_DEVINTERFACE_VHIDMINI, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (deviceInfo == INVALID_HANDLE_VALUE)
+        return 0;
+
+    interfaceData.cbSize = sizeof(interfaceData);
+    while (SetupDiEnumDeviceInterfaces(deviceInfo, NULL, &GUID_DEVINTERFACE_VHIDMINI, count, &interfaceData))
+        count++;
+
+    SetupDiDestroyDeviceInfoList(deviceInfo);
+    return count;
+}
+
+BOOL VhidOpen(PVHID_CLIENT client) {
+    return VhidOpenInstance(client, 0);
+}
+
+BOOL VhidOpenInstance(PVHID_CLIENT client, ULONG instance) {
+    HANDLE handle = openDevice(instance, 0);
+
+    if (handle == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    client->IoControl = deviceIoControl;
+    client->Submit = NULL;
+    client->Drain = NULL;
+    client->Close = deviceClose;
+    client->Context = handle;
+    client->Handle = handle;
+    client->Instance = instance;
+    return TRUE;
+}
+
+static BOOL loopbackIoControl(PVOID context, DWORD ioControlCode, PVOID input, DWORD inputLength,
+    PVOID output, DWORD outputLength, DWORD* returned) {
+    PVHID_LOOPBACK loopback = (PVHID_LOOPBACK)context;
+
+    UNREFERENCED_PARAMETER(output);
+    UNREFERENCED_PARAMETER(outputLength);
+
+    loopback->Requests++;
+    loopback->LastIoControlCode = ioControlCode;
+    loopback->LastLength = min(inputLength, (DWORD)sizeof(loopback->Last));
+    if (input != NULL)
+        memcpy(loopback->Last, input, loopback->LastLength);
+
+    switch (ioControlCode) {
+    case IOCTL_VHIDMINI_KEY_EVENT:
+    case IOCTL_VHIDMINI_MOVE_EVENT:
+    case IOCTL_VHIDMINI_BUTTON_EVENT:
+        loopback->Events++;
+        break;
+    case IOCTL_VHIDMINI_SEND_BATCH:
+        loopback->Events += ((PVHID_BATCH_HEADER)input)->Count;
+        break;
+    }
+
+    *returned = 0;
+    return TRUE;
+}
+
+VOID VhidOpenLoopback(PVHID_CLIENT client, PVHID_LOOPBACK loopback) {
+    memset(loopback, 0, sizeof(*loopback));
+    client->IoControl = loopbackIoControl;
+    client->Submit = NULL;
+    client->Drain = NULL;
+    client->Close = NULL;
+    client->Context = loopback;
+    client->Handle = INVALID_HANDLE_VALUE;
+    client->Instance = 0;
+}
+
+VOID VhidClose(PVHID_CLIENT client) {
+    if (client->Close)
+        client->Close(client->Context);
+    client->IoControl = NULL;
+    client->Submit = NULL;
+    client->Drain = NULL;
+    client->Close = NULL;
+    client->Context = NULL;
+    client->Handle = INVALID_HANDLE_VALUE;
+}
+
+BOOL VhidIoControl(PVHID_CLIENT client, DWORD ioControlCode, PVOID input, DWORD inputLength,
+    PVOID output, DWORD outputLength, DWORD* returned) {
+    DWORD ignored;
+
+    return client->IoControl(client->Context, ioControlCode, input, inputLength, output, outputLength,
+        returned ? returned : &ignored);
+}
+
+//
+// Asynchronous device transport. Each in-flight request owns a slot holding
+// its OVERLAPPED and a copy of its input, so callers may reuse their buffers
+// as soon as VhidSubmit returns. The Window semaphore counts free slots.
+//
+typedef struct _VHID_ASYNC_SLOT {
+    OVERLAPPED Overlapped;
+    struct _VHID_ASYNC* Async;
+    VHID_COMPLETION* Completion;
+    PVOID Context;
+    UCHAR Input[VHID_ASYNC_MAX_INPUT];
+} VHID_ASYNC_SLOT, *PVHID_ASYNC_SLOT;
+
+typedef struct _VHID_ASYNC {
+    HANDLE Handle;
+    PTP_IO Io;
+    HANDLE Window;
+    ULONG Size;
+    CRITICAL_SECTION Lock;
+    ULONG FreeCount;
+    PVHID_ASYNC_SLOT* Free;
+    PVHID_ASYNC_SLOT Slots;
+} VHID_ASYNC, *PVHID_ASYNC;
+
+static VOID asyncRelease(PVHID_ASYNC async, PVHID_ASYNC_SLOT slot) {
+    EnterCriticalSection(&async->Lock);
+    async->Free[async->FreeCount++] = slot;
+    LeaveCriticalSection(&async->Lock);
+    ReleaseSemaphore(async->Window, 1, NULL);
+}
+
+static VOID CALLBACK asyncCompletion(PTP_CALLBACK_INSTANCE instance, PVOID context, PVOID overlapped,
+    ULONG ioResult, ULONG_PTR returned, PTP_IO io) {
+    PVHID_ASYNC_SLOT slot = CONTAINING_RECORD(overlapped, VHID_ASYNC_SLOT, Overlapped);
+    VHID_COMPLETION* completion = slot->Completion;
+    PVOID completionContext = slot->Context;
+
+    UNREFERENCED_PARAMETER(instance);
+    UNREFERENCED_PARAMETER(context);
+    UNREFERENCED_PARAMETER(io);
+
+    asyncRelease(slot->Async, slot);
+    if (completion)
+        completion(completionContext, ioResult, (DWORD)returned);
+}
+
+static BOOL asyncSubmit(PVOID transportContext, DWORD ioControlCode, PVOID input, DWORD inputLength,
+    VHID_COMPLETION* completion, PVOID context) {
+    PVHID_ASYNC async = (PVHID_ASYNC)transportContext;
+    PVHID_ASYNC_SLOT slot;
+    DWORD error;
+
+    if (inputLength > VHID_ASYNC_MAX_INPUT) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    WaitForSingleObject(async->Window, INFINITE);
+    EnterCriticalSection(&async->Lock);
+    slot = async->Free[--async->FreeCount];
+    LeaveCriticalSection(&async->Lock);
+
+    memset(&slot->Overlapped, 0, sizeof(slot->Overlapped));
+    slot->Completion = completion;
+    slot->Context = context;
+    if (inputLength != 0)
+        memcpy(slot->Input, input, inputLength);
+
+    StartThreadpoolIo(async->Io);
+    if (!DeviceIoControl(async->Handle, ioControlCode, slot->Input, inputLength, NULL, 0, NULL, &slot->Overlapped) &&
+        (error = GetLastError()) != ERROR_IO_PENDING) {
+        CancelThreadpoolIo(async->Io);
+        asyncRelease(async, slot);
+        SetLastError(error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static VOID asyncDrain(PVOID transportContext) {
+    PVHID_ASYNC async = (PVHID_ASYNC)transportContext;
+    ULONG i;
+
+    for (i = 0; i < async->Size; i++)
+        WaitForSingleObject(async->Window, INFINITE);
+    ReleaseSemaphore(async->Window, async->Size, NULL);
+}
+
+//
+// Synchronous requests on the overlapped handle. Setting the low bit of
+// hEvent keeps their completion off the thread pool.
+//
+static BOOL asyncIoControl(PVOID context, DWORD ioControlCode, PVOID input, DWORD inputLength,
+    PVOID output, DWORD outputLength, DWORD* returned) {
+    PVHID_ASYNC async = (PVHID_ASYNC)context;
+    OVERLAPPED overlapped;
+    HANDLE event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    BOOL ret;
+
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.hEvent = (HANDLE)((ULONG_PTR)event | 1);
+
+    ret = DeviceIoControl(async->Handle, ioControlCode, input, inputLength, output, outputLength, returned, &overlapped);
+    if (!ret && GetLastError() == ERROR_IO_PENDING)
+        ret = GetOverlappedResult(async->Handle, &overlapped, returned, TRUE);
+
+    CloseHandle(event);
+    return ret;
+}
+
+static VOID asyncClose(PVOID context) {
+    PVHID_ASYNC async = (PVHID_ASYNC)context;
+
+    asyncDrain(async);
+    WaitForThreadpoolIoCallbacks(async->Io, FALSE);
+    CloseThreadpoolIo(async->Io);
+    CloseHandle(async->Handle);
+    CloseHandle(async->Window);
+    DeleteCriticalSection(&async->Lock);
+    free(async->Free);
+    free(async->Slots);
+    free(async);
+}
+
+BOOL VhidOpenAsync(PVHID_CLIENT client, ULONG instance, ULONG window) {
+    PVHID_ASYNC async;
+    ULONG i;
+
+    if (window == 0)
+        window = 1;
+
+    async = (PVHID_ASYNC)calloc(1, sizeof(VHID_ASYNC));
+    async->Handle = openDevice(instance, FILE_FLAG_OVERLAPPED);
+    if (async->Handle == INVALID_HANDLE_VALUE) {
+        free(async);
+        return FALSE;
+    }
+
+    async->Io = CreateThreadpoolIo(async->Handle, asyncCompletion, async, NULL);
+    if (async->Io == NULL) {
+        printf("CreateThreadpoolIo failed: %d\n", GetLastError());
+        CloseHandle(async->Handle);
+        free(async);
+        return FALSE;
+    }
+
+    async->Size = window;
+    async->Window = CreateSemaphore(NULL, window, window, NULL);
+    InitializeCriticalSection(&async->Lock);
+    async->Slots = (PVHID_ASYNC_SLOT)calloc(window, sizeof(VHID_ASYNC_SLOT));
+    async->Free = (PVHID_ASYNC_SLOT*)malloc(window * sizeof(PVHID_ASYNC_SLOT));
+    for (i = 0; i < window; i++) {
+        async->Slots[i].Async = async;
+        async->Free[i] = &async->Slots[i];
+    }
+    async->FreeCount = window;
+
+    client->IoControl = asyncIoControl;
+    client->Submit = asyncSubmit;
+    client->Drain = asyncDrain;
+    client->Close = asyncClose;
+    client->Context = async;
+    client->Handle = async->Handle;
+    client->Instance = instance;
+    return TRUE;
+}
+
+//
+// Broker transport. Requests and replies share one message buffer; the
+// pipe is in message mode, so TransactNamedPipe returns exactly one reply.
+//
+typedef struct _VHID_PIPE {
+    HANDLE Handle;
+    UCHAR Buffer[VHID_PIPE_MAX_MESSAGE];
+} VHID_PIPE, *PVHID_PIPE;
+
+static BOOL pipeIoControl(PVOID context, DWORD ioControlCode, PVOID input, DWORD inputLength,
+    PVOID output, DWORD outputLength, DWORD* returned) {
+    PVHID_PIPE pipe = (PVHID_PIPE)context;
+    PVHID_PIPE_REQUEST request = (PVHID_PIPE_REQUEST)pipe->Buffer;
+    PVHID_PIPE_REPLY reply = (PVHID_PIPE_REPLY)pipe->Buffer;
+    DWORD read;
+
+    *returned = 0;
+    if (inputLength > VHID_PIPE_MAX_MESSAGE - sizeof(VHID_PIPE_REQUEST) ||
+        outputLength > VHID_PIPE_MAX_MESSAGE - sizeof(VHID_PIPE_REPLY)) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    request->IoControlCode = ioControlCode;
+    request->OutputLength = outputLength;
+    if (inputLength != 0)
+        memcpy(request + 1, input, inputLength);
+
+    if (!TransactNamedPipe(pipe->Handle, pipe->Buffer, sizeof(VHID_PIPE_REQUEST) + inputLength,
+        pipe->Buffer, sizeof(pipe->Buffer), &read, NULL))
+        return FALSE;
+    if (read < sizeof(VHID_PIPE_REPLY) || reply->Returned > read - sizeof(VHID_PIPE_REPLY) ||
+        reply->Returned > outputLength) {
+        SetLastError(ERROR_INVALID_DATA);
+        return FALSE;
+    }
+
+    *returned = reply->Returned;
+    if (reply->Returned != 0)
+        memcpy(output, reply + 1, reply->Returned);
+    if (reply->Error != 0) {
+        SetLastError(reply->Error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static VOID pipeClose(PVOID context) {
+    PVHID_PIPE pipe = (PVHID_PIPE)context;
+
+    CloseHandle(pipe->Handle);
+    free(pipe);
+}
+
+BOOL VhidOpenPipe(PVHID_CLIENT client, ULONG instance) {
+    PVHID_PIPE pipe;
+    WCHAR name[64];
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    HANDLE handle;
+
+    swprintf_s(name, ARRAYSIZE(name), VHID_PIPE_NAME_FORMAT, instance);
+    for (;;) {
+        handle = CreateFile(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (handle != INVALID_HANDLE_VALUE)
+            break;
+        if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipe(name, 1000)) {
+            printf("Failed to connect to the broker: %d\n", GetLastError());
+            return FALSE;
+        }
+    }
+
+    if (!SetNamedPipeHandleState(handle, &mode, NULL, NULL)) {
+        printf("SetNamedPipeHandleState failed: %d\n", GetLastError());
+        CloseHandle(handle);
+        return FALSE;
+    }
+
+    pipe = (PVHID_PIPE)malloc(sizeof(VHID_PIPE));
+    pipe->Handle = handle;
+
+    client->IoControl = pipeIoControl;
+    client->Submit = NULL;
+    client->Drain = NULL;
+    client->Close = pipeClose;
+    client->Context = pipe;
+    client->Handle = INVALID_HANDLE_VALUE;
+    client->Instance = instance;
+    return TRUE;
+}
+
+BOOL VhidSubmit(PVHID_CLIENT client, DWORD ioControlCode, PVOID input, DWORD inputLength,
+    VHID_COMPLETION* completion, PVOID context) {
+    DWORD returned = 0;
+    BOOL ret;
+
+    if (client->Submit)
+        return client->Submit(client->Context, ioControlCode, input, inputLength, completion, context);
+
+    ret = VhidIoControl(client, ioControlCode, input, inputLength, NULL, 0, &returned);
+    if (ret && completion)
+        completion(context, 0, returned);
+    return ret;
+}
+
+//
+// Waits until every request submitted so far has completed.
+//
+VOID VhidDrain(PVHID_CLIENT client) {
+    if (client->Drain)
+        client->Drain(client->Context);
+}
+
+BOOL VhidSendKey(PVHID_CLIENT client, UCHAR keyCode, BOOL pressed) {
+    VHID_KEY_EVENT key = { keyCode, (UCHAR)(pressed != 0) };
+
+    return VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_KEY_EVENT, &key, sizeof(key), NULL, 0, NULL);
+}
+
+BOOL VhidSendMove(PVHID_CLIENT client, CHAR deltaX, CHAR deltaY) {
+    VHID_MOUSE_MOVE move = { deltaX, deltaY };
+
+    return VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_MOVE_EVENT, &move, sizeof(move), NULL, 0, NULL);
+}
+
+BOOL VhidSendButtons(PVHID_CLIENT client, UCHAR buttonMask) {
+    VHID_MOUSE_BUTTON button = { buttonMask };
+
+    return VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_BUTTON_EVENT, &button, sizeof(button), NULL, 0, NULL);
+}
+
+BOOL VhidSendGamepad(PVHID_CLIENT client, const VHID_GAMEPAD_STATE* state) {
+    return VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_GAMEPAD_EVENT, (PVOID)state, sizeof(*state), NULL, 0, NULL);
+}
+
+BOOL VhidGetSnapshot(PVHID_CLIENT client, PVHID_SNAPSHOT snapshot) {
+    DWORD returned;
+
+    return VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_GET_SNAPSHOT, NULL, 0, snapshot, sizeof(*snapshot), &returned) &&
+        returned == sizeof(*snapshot);
+}
+
+BOOL VhidRestoreSnapshot(PVHID_CLIENT client, const VHID_SNAPSHOT* snapshot, ULONG* sequence) {
+    DWORD returned;
+
+    return VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_RESTORE_SNAPSHOT, (PVOID)snapshot, sizeof(*snapshot),
+        sequence, sequence != NULL ? sizeof(*sequence) : 0, &returned);
+}
+
+VOID VhidBatchReset(PVHID_BATCH batch) {
+    batch->Header.Count = 0;
+    batch->Header.Reserved = 0;
+}
+
+static BOOL batchAdd(PVHID_BATCH batch, UCHAR type, UCHAR a, UCHAR b) {
+    PVHID_BATCH_EVENT event;
+
+    if (batch->Header.Count == VHID_BATCH_MAX_EVENTS)
+        return FALSE;
+
+    event = &batch->Events[batch->Header.Count++];
+    event->Type = type;
+    event->Data[0] = a;
+    event->Data[1] = b;
+    event->Data[2] = 0;
+    return TRUE;
+}
+
+//
+// The batch builders return FALSE when the batch is full; submit it and
+// add the event again.
+//
+BOOL VhidBatchKey(PVHID_BATCH batch, UCHAR keyCode, BOOL pressed) {
+    return batchAdd(batch, VHID_BATCH_KEY, keyCode, (UCHAR)(pressed != 0));
+}
+
+BOOL VhidBatchMove(PVHID_BATCH batch, CHAR deltaX, CHAR deltaY) {
+    return batchAdd(batch, VHID_BATCH_MOVE, (UCHAR)deltaX, (UCHAR)deltaY);
+}
+
+BOOL VhidBatchButtons(PVHID_BATCH batch, UCHAR buttonMask) {
+    return batchAdd(batch, VHID_BATCH_BUTTON, buttonMask, 0);
+}
+
+BOOL VhidBatchSubmit(PVHID_CLIENT client, PVHID_BATCH batch) {
+    BOOL ret = TRUE;
+
+    if (batch->Header.Count != 0) {
+        ret = VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_SEND_BATCH, batch,
+            (DWORD)(sizeof(VHID_BATCH_HEADER) + batch->Header.Count * sizeof(VHID_BATCH_EVENT)), NULL, 0, NULL);
+        VhidBatchReset(batch);
+    }
+    return ret;
+}
+
+BOOL VhidSendStream(PVHID_CLIENT client, const VOID* data, SIZE_T length) {
+    const UCHAR* next = (const UCHAR*)data;
+    DWORD returned;
+
+    //
+    // One request applies at most a slice, so only the unconsumed tail up
+    // to a slice is passed: the driver locks every page it is given.
+    //
+    while (length != 0) {
+        if (!VhidIoControl(client, (DWORD)IOCTL_VHIDMINI_SEND_STREAM, NULL, 0, (PVOID)next,
+            (DWORD)min(length, VHID_STREAM_MAX_SLICE), &returned)) {
+            if (GetLastError() != ERROR_BUSY)
+                return FALSE;
+            //
+            // The report queue is full, let hidclass read some.
+            //
+            Sleep(1);
+            continue;
+        }
+        next += returned;
+        length -= returned;
+    }
+    return TRUE;
+}
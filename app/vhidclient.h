@@ -0,0 +1,136 @@
+#ifndef __VHIDCLIENT_H_
+#define __VHIDCLIENT_H_
+
+//
+// Client library for the vhidmini control interface. Tools talk to the
+// driver through a VHID_CLIENT, which forwards every request to a
+// transport: the device itself, or an in-process loopback that records
+// requests so tools can be exercised without the driver.
+//
+// Each installed vhidmini device is an independent instance with its own
+// keyboard, mouse and report queue. Instances are numbered in interface
+// enumeration order; VhidOpen opens instance 0.
+//
+// Events can be sent one by one, or accumulated in a VHID_BATCH and sent
+// with a single request. A batch is a fixed-size structure laid out as the
+// IOCTL_VHIDMINI_SEND_BATCH input, so building one never allocates.
+//
+// VhidSubmit sends a request without waiting for it. A client opened with
+// VhidOpenAsync keeps up to a fixed window of requests in flight on an
+// overlapped handle, and their completion callbacks run on the thread pool
+// bound to it; VhidSubmit blocks only while the window is full. Other
+// transports complete the request before VhidSubmit returns.
+//
+// VhidOpenPipe connects to a 'testvhid broker' instead of the device. The
+// broker keeps the device open, so connecting costs a pipe open rather
+// than a device enumeration, and it folds the events of all its clients
+// into batched requests. Each request is one message on the pipe.
+//
+
+typedef BOOL VHID_TRANSPORT_IO_CONTROL(PVOID context, DWORD ioControlCode, PVOID input, DWORD inputLength,
+    PVOID output, DWORD outputLength, DWORD* returned);
+
+typedef VOID VHID_TRANSPORT_CLOSE(PVOID context);
+
+//
+// Called once per submitted request with the Win32 error (0 on success).
+//
+typedef VOID VHID_COMPLETION(PVOID context, DWORD error, DWORD returned);
+
+typedef BOOL VHID_TRANSPORT_SUBMIT(PVOID transportContext, DWORD ioControlCode, PVOID input, DWORD inputLength,
+    VHID_COMPLETION* completion, PVOID context);
+
+typedef VOID VHID_TRANSPORT_DRAIN(PVOID transportContext);
+
+typedef struct _VHID_CLIENT {
+    VHID_TRANSPORT_IO_CONTROL*  IoControl;
+    VHID_TRANSPORT_SUBMIT*      Submit;     // optional, asynchronous transports
+    VHID_TRANSPORT_DRAIN*       Drain;
+    VHID_TRANSPORT_CLOSE*       Close;
+    PVOID                       Context;
+    HANDLE                      Handle;     // device transport only
+    ULONG                       Instance;
+} VHID_CLIENT, *PVHID_CLIENT;
+
+//
+// Loopback transport state. Requests succeed and are counted; the input of
+// the last one is kept.
+//
+typedef struct _VHID_LOOPBACK {
+    ULONG                   Requests;
+    ULONG                   Events;         // key, move, button and batched events
+    DWORD                   LastIoControlCode;
+    DWORD                   LastLength;
+    UCHAR                   Last[sizeof(VHID_BATCH_HEADER) + VHID_BATCH_MAX_EVENTS * sizeof(VHID_BATCH_EVENT)];
+} VHID_LOOPBACK, *PVHID_LOOPBACK;
+
+typedef struct _VHID_BATCH {
+    VHID_BATCH_HEADER       Header;
+    VHID_BATCH_EVENT        Events[VHID_BATCH_MAX_EVENTS];
+} VHID_BATCH, *PVHID_BATCH;
+
+#define VHID_ASYNC_MAX_INPUT    sizeof(VHID_BATCH)
+
+//
+// Broker pipe protocol, one message per request and per reply.
+//
+#define VHID_PIPE_NAME_FORMAT   L"\\\\.\\pipe\\vhidmini-%lu"
+#define VHID_PIPE_MAX_MESSAGE   (64 * 1024)
+
+typedef struct _VHID_PIPE_REQUEST {
+    DWORD                   IoControlCode;
+    DWORD                   OutputLength;
+    // input follows
+} VHID_PIPE_REQUEST, *PVHID_PIPE_REQUEST;
+
+typedef struct _VHID_PIPE_REPLY {
+    DWORD                   Error;          // Win32 error, 0 on success
+    DWORD                   Returned;
+    // output follows
+} VHID_PIPE_REPLY, *PVHID_PIPE_REPLY;
+
+ULONG VhidCountInstances(VOID);
+BOOL VhidOpen(PVHID_CLIENT client);
+BOOL VhidOpenInstance(PVHID_CLIENT client, ULONG instance);
+BOOL VhidOpenAsync(PVHID_CLIENT client, ULONG instance, ULONG window);
+BOOL VhidOpenPipe(PVHID_CLIENT client, ULONG instance);
+VOID VhidOpenLoopback(PVHID_CLIENT client, PVHID_LOOPBACK loopback);
+VOID VhidClose(PVHID_CLIENT client);
+
+BOOL VhidIoControl(PVHID_CLIENT client, DWORD ioControlCode, PVOID input, DWORD inputLength,
+    PVOID output, DWORD outputLength, DWORD* returned);
+
+//
+// VhidSubmit returns FALSE, without calling the completion, if the request
+// could not be sent at all.
+//
+BOOL VhidSubmit(PVHID_CLIENT client, DWORD ioControlCode, PVOID input, DWORD inputLength,
+    VHID_COMPLETION* completion, PVOID context);
+VOID VhidDrain(PVHID_CLIENT client);
+
+BOOL VhidSendKey(PVHID_CLIENT client, UCHAR keyCode, BOOL pressed);
+BOOL VhidSendMove(PVHID_CLIENT client, CHAR deltaX, CHAR deltaY);
+BOOL VhidSendButtons(PVHID_CLIENT client, UCHAR buttonMask);
+BOOL VhidSendGamepad(PVHID_CLIENT client, const VHID_GAMEPAD_STATE* state);
+
+//
+// sequence may be NULL. Through the broker, the snapshot's OwnKeys are
+// those of the broker's handle, which holds the keys of all its clients.
+//
+BOOL VhidGetSnapshot(PVHID_CLIENT client, PVHID_SNAPSHOT snapshot);
+BOOL VhidRestoreSnapshot(PVHID_CLIENT client, const VHID_SNAPSHOT* snapshot, ULONG* sequence);
+
+VOID VhidBatchReset(PVHID_BATCH batch);
+BOOL VhidBatchKey(PVHID_BATCH batch, UCHAR keyCode, BOOL pressed);
+BOOL VhidBatchMove(PVHID_BATCH batch, CHAR deltaX, CHAR deltaY);
+BOOL VhidBatchButtons(PVHID_BATCH batch, UCHAR buttonMask);
+BOOL VhidBatchSubmit(PVHID_CLIENT client, PVHID_BATCH batch);
+
+//
+// VhidSendStream hands a payload of packed records (see
+// IOCTL_VHIDMINI_SEND_STREAM) to the driver in place, a slice at a time,
+// until all of it has been applied. Not available through the broker.
+//
+BOOL VhidSendStream(PVHID_CLIENT client, const VOID* data, SIZE_T length);
+
+#endif // __VHIDCLIENT_H_
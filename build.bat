@@ -5,5 +5,10 @@ msbuild vhidmini.sln /p:Configuration=Debug /p:Platform=x64
 
 certutil -addstore Root driver\x64\Debug\vhidmini.cer
 
-"%WDKToolRoot%\x64\devcon" install driver\x64\Debug\vhidmini\vhidmini.inf root\vhidmini
-@if %errorlevel% neq 0 exit /b %errorlevel%
+@rem build.bat [instance count], each instance is an independent device
+@set instances=%1
+@if "%instances%"=="" set instances=1
+
+@for /l %%i in (1,1,%instances%) do @(
+    "%WDKToolRoot%\x64\devcon" install driver\x64\Debug\vhidmini\vhidmini.inf root\vhidmini || exit /b 1
+)
@@ -0,0 +1,74 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "chord.h"
+
+BOOLEAN
+ChordCompile(
+    _In_  const VHID_CHORD* Chord,
+    _Out_writes_bytes_to_(VHID_MACRO_MAX_CODE, *Length) PUCHAR Code,
+    _Out_ PUSHORT           Length,
+    _Out_ PULONG            Reports
+    )
+/*++
+
+Routine Description:
+
+    Validates a chord and compiles it. A chord presses at least one key or
+    button; keys are non-zero and appear once.
+
+Return Value:
+
+    FALSE if the chord is invalid. Otherwise Reports receives the most
+    reports the chord can queue.
+
+--*/
+{
+    ULONG                   length = 0;
+    ULONG                   i, j;
+
+    *Length = 0;
+    *Reports = 0;
+
+    if (Chord->KeyCount > VHID_CHORD_MAX_KEYS || (Chord->Buttons & ~0x07) != 0 ||
+        (Chord->KeyCount == 0 && Chord->Buttons == 0))
+        return FALSE;
+
+    for (i = 0; i < Chord->KeyCount; i++) {
+        if (Chord->Keys[i] == 0)
+            return FALSE;
+        for (j = 0; j < i; j++) {
+            if (Chord->Keys[j] == Chord->Keys[i])
+                return FALSE;
+        }
+    }
+
+    for (i = 0; i < Chord->KeyCount; i++) {
+        Code[length++] = VHID_OP_KEY;
+        Code[length++] = Chord->Keys[i];
+        Code[length++] = 1;
+    }
+    if (Chord->Buttons != 0) {
+        Code[length++] = VHID_OP_BUTTON;
+        Code[length++] = Chord->Buttons;
+    }
+
+    if (Chord->HoldMs != 0) {
+        Code[length++] = VHID_OP_WAIT;
+        Code[length++] = (UCHAR)Chord->HoldMs;
+        Code[length++] = (UCHAR)(Chord->HoldMs >> 8);
+    }
+
+    if (Chord->Buttons != 0) {
+        Code[length++] = VHID_OP_BUTTON;
+        Code[length++] = 0;
+    }
+    for (i = Chord->KeyCount; i-- > 0; ) {
+        Code[length++] = VHID_OP_KEY;
+        Code[length++] = Chord->Keys[i];
+        Code[length++] = 0;
+    }
+
+    *Length = (USHORT)length;
+    *Reports = 2 * (Chord->KeyCount + (Chord->Buttons != 0));
+    return TRUE;
+}
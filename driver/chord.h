@@ -0,0 +1,17 @@
+#ifndef __CHORD_H_
+#define __CHORD_H_
+
+//
+// Turns a VHID_CHORD into a macro program: the presses, a wait for the
+// hold time (left out when it is zero, so that the whole chord runs in a
+// single slice), and the releases.
+//
+BOOLEAN
+ChordCompile(
+    _In_  const VHID_CHORD* Chord,
+    _Out_writes_bytes_to_(VHID_MACRO_MAX_CODE, *Length) PUCHAR Code,
+    _Out_ PUSHORT           Length,
+    _Out_ PULONG            Reports
+    );
+
+#endif // __CHORD_H_
@@ -0,0 +1,129 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "reportq.h"
+#include "pacer.h"
+#include "typematic.h"
+#include "config.h"
+
+VOID
+ConfigInitDefault(
+    _Out_ PVHID_CONFIG_REPORT Config
+    )
+{
+    RtlZeroMemory(Config, sizeof(VHID_CONFIG_REPORT));
+    Config->ReportId            = VHID_CONFIG_REPORT_ID;
+    Config->Version             = VHID_CONFIG_VERSION;
+    Config->EnabledCollections  = VHID_COLLECTION_ALL;
+    Config->KeyboardCoalesce    = VHID_COALESCE_QUEUE;
+    Config->MouseCoalesce       = VHID_COALESCE_LATEST;
+    Config->QueueDepth          = 32;
+}
+
+NTSTATUS
+ConfigValidate(
+    _In_  const VHID_CONFIG_REPORT* Config
+    )
+{
+    ULONG                   i;
+
+    if (Config->EnabledCollections & ~VHID_COLLECTION_ALL)
+        return STATUS_INVALID_PARAMETER;
+
+    if (Config->KeyboardCoalesce > VHID_COALESCE_QUEUE ||
+        Config->MouseCoalesce > VHID_COALESCE_QUEUE)
+        return STATUS_INVALID_PARAMETER;
+
+    if (Config->QueueDepth == 0 || Config->QueueDepth > VHID_MAX_QUEUE_DEPTH)
+        return STATUS_INVALID_PARAMETER;
+
+    if (Config->PacingInterval != 0 &&
+        (Config->PacingInterval < PACER_MIN_INTERVAL_US || Config->PacingInterval > PACER_MAX_INTERVAL_US))
+        return STATUS_INVALID_PARAMETER;
+
+    if (Config->TypematicDelay != 0 &&
+        (Config->TypematicDelay < TYPEMATIC_MIN_DELAY_MS || Config->TypematicDelay > TYPEMATIC_MAX_DELAY_MS ||
+         Config->TypematicRate == 0 || Config->TypematicRate > TYPEMATIC_MAX_RATE))
+        return STATUS_INVALID_PARAMETER;
+
+    for (i = 0; i < sizeof(Config->Reserved); i++) {
+        if (Config->Reserved[i] != 0)
+            return STATUS_INVALID_PARAMETER;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+ConfigDecode(
+    _In_reads_bytes_(Length) const VOID* Buffer,
+    _In_  size_t            Length,
+    _Out_ PVHID_CONFIG_REPORT Config
+    )
+/*++
+
+Routine Description:
+
+    Decodes a configuration feature report written by a client. Fields that
+    did not exist in the client's version keep their default value.
+
+Return Value:
+
+    STATUS_SUCCESS, STATUS_INVALID_BUFFER_SIZE if Length is not the size of
+    the report, STATUS_REVISION_MISMATCH for an unknown version or
+    STATUS_INVALID_PARAMETER if a field is out of range.
+
+--*/
+{
+    const VHID_CONFIG_REPORT* report = (const VHID_CONFIG_REPORT*)Buffer;
+
+    ConfigInitDefault(Config);
+
+    if (Length != sizeof(VHID_CONFIG_REPORT))
+        return STATUS_INVALID_BUFFER_SIZE;
+
+    if (report->ReportId != VHID_CONFIG_REPORT_ID)
+        return STATUS_INVALID_PARAMETER;
+
+    if (report->Version == 0 || report->Version > VHID_CONFIG_VERSION)
+        return STATUS_REVISION_MISMATCH;
+
+    // version 1
+    Config->EnabledCollections  = report->EnabledCollections;
+    Config->KeyboardCoalesce    = report->KeyboardCoalesce;
+    Config->MouseCoalesce       = report->MouseCoalesce;
+    Config->QueueDepth          = report->QueueDepth;
+
+    if (report->Version >= 2)
+        Config->PacingInterval  = report->PacingInterval;
+
+    if (report->Version >= 3) {
+        Config->TypematicDelay  = report->TypematicDelay;
+        Config->TypematicRate   = report->TypematicRate;
+    }
+
+    if (report->Version >= 4)
+        Config->IdleRate        = report->IdleRate;
+
+    if (report->Version < 5)
+        Config->EnabledCollections |= VHID_COLLECTION_GAMEPAD;
+
+    //
+    // Bytes that are still reserved in the current version must be zero.
+    // For older versions they overlap newer fields and are ignored.
+    //
+    if (report->Version == VHID_CONFIG_VERSION)
+        RtlCopyMemory(Config->Reserved, report->Reserved, sizeof(Config->Reserved));
+
+    return ConfigValidate(Config);
+}
+
+VOID
+ConfigEncode(
+    _In_  const VHID_CONFIG_REPORT* Config,
+    _Out_ PVHID_CONFIG_REPORT Report
+    )
+{
+    *Report = *Config;
+    Report->ReportId = VHID_CONFIG_REPORT_ID;
+    Report->Version  = VHID_CONFIG_VERSION;
+}
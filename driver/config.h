@@ -0,0 +1,26 @@
+#ifndef __CONFIG_H_
+#define __CONFIG_H_
+
+//
+// Encoding, decoding and validation of VHID_CONFIG_REPORT.
+//
+
+VOID
+ConfigInitDefault(
+    _Out_ PVHID_CONFIG_REPORT Config
+    );
+
+NTSTATUS
+ConfigDecode(
+    _In_reads_bytes_(Length) const VOID* Buffer,
+    _In_  size_t            Length,
+    _Out_ PVHID_CONFIG_REPORT Config
+    );
+
+VOID
+ConfigEncode(
+    _In_  const VHID_CONFIG_REPORT* Config,
+    _Out_ PVHID_CONFIG_REPORT Report
+    );
+
+#endif // __CONFIG_H_
@@ -0,0 +1,244 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "descriptor.h"
+
+//
+// Boot keyboard, HID_KEYBOARD_REPORT, and its LED output report.
+//
+static const UCHAR G_KeyboardCollection[] = {
+    0x05, 0x01,       // USAGE_PAGE (Generic Desktop)
+    0x09, 0x06,       // USAGE (Keyboard)
+    0xA1, 0x01,       // COLLECTION (Application)
+    0x85, 0x01,       // REPORT_ID (1)
+
+    0x05, 0x07,       // USAGE_PAGE (Keyboard/Keypad)
+    0x19, 0xE0,       // Usage Minimum (224, Left Control)
+    0x29, 0xE7,       // Usage Maximum (231, Right GUI)
+    0x15, 0x00,       // Logical Minimum (0)
+    0x25, 0x01,       // Logical Maximum (1)
+    0x75, 0x01,
+    0x95, 0x08,       // Report count
+    0x81, 0x02,       // Modifiers
+
+    0x95, 0x01,       // Report count
+    0x75, 0x08,
+    0x81, 0x01,       // Reserved
+
+    0x95, 0x06,       // Report count
+    0x75, 0x08,
+    0x15, 0x00,
+    0x25, 0x65,
+    0x05, 0x07,
+    0x19, 0x00,
+    0x29, 0x65,
+    0x81, 0x00,       // Keys
+
+    0x95, 0x05,       // Report count
+    0x75, 0x01,
+    0x15, 0x00,
+    0x25, 0x01,
+    0x05, 0x08,       // USAGE_PAGE (LEDs)
+    0x19, 0x01,       // Usage Minimum (1, Num Lock)
+    0x29, 0x05,       // Usage Maximum (5, Kana)
+    0x91, 0x02,       // LEDs (Output)
+
+    0x95, 0x01,       // Report count
+    0x75, 0x03,
+    0x91, 0x01,       // Padding (Output)
+    0xC0
+};
+
+//
+// Keyboard of VHID_PROFILE_NKRO, HID_NKRO_REPORT: the same modifiers and
+// LEDs as the boot keyboard, and a bitmap of usages 0 to 0x67 instead of
+// six key slots.
+//
+static const UCHAR G_NkroKeyboardCollection[] = {
+    0x05, 0x01,       // USAGE_PAGE (Generic Desktop)
+    0x09, 0x06,       // USAGE (Keyboard)
+    0xA1, 0x01,       // COLLECTION (Application)
+    0x85, 0x01,       // REPORT_ID (1)
+
+    0x05, 0x07,       // USAGE_PAGE (Keyboard/Keypad)
+    0x19, 0xE0,       // Usage Minimum (224, Left Control)
+    0x29, 0xE7,       // Usage Maximum (231, Right GUI)
+    0x15, 0x00,       // Logical Minimum (0)
+    0x25, 0x01,       // Logical Maximum (1)
+    0x75, 0x01,
+    0x95, 0x08,       // Report count
+    0x81, 0x02,       // Modifiers
+
+    0x19, 0x00,       // Usage Minimum (0)
+    0x29, 0x67,       // Usage Maximum (103, Keypad =)
+    0x95, 0x68,       // Report count
+    0x81, 0x02,       // Keys, one bit each
+
+    0x95, 0x05,       // Report count
+    0x75, 0x01,
+    0x05, 0x08,       // USAGE_PAGE (LEDs)
+    0x19, 0x01,       // Usage Minimum (1, Num Lock)
+    0x29, 0x05,       // Usage Maximum (5, Kana)
+    0x91, 0x02,       // LEDs (Output)
+
+    0x95, 0x01,       // Report count
+    0x75, 0x03,
+    0x91, 0x01,       // Padding (Output)
+    0xC0
+};
+
+//
+// HID_MOUSE_REPORT.
+//
+static const UCHAR G_MouseCollection[] = {
+    0x05, 0x01,       // USAGE_PAGE (Generic Desktop)
+    0x09, 0x02,       // USAGE (Mouse)
+    0xA1, 0x01,       // COLLECTION (Application)
+    0x85, 0x02,       // Report ID (2)
+
+    0x09, 0x01,       // Usage (Pointer)
+    0xA1, 0x00,       // Collection (Physical)
+    0x05, 0x09,       // Usage Page (Buttons)
+    0x19, 0x01,       // Usage Minimum = Button 1
+    0x29, 0x03,       // Usage Maximum = Button 3
+    0x15, 0x00,       // Logical Min = 0
+    0x25, 0x01,       // Logical Max = 1
+    0x95, 0x03,       // Report size
+    0x75, 0x01,
+    0x81, 0x02,       // Input (Data, Variable, Absolute)
+
+    0x95, 0x01,
+    0x75, 0x05,
+    0x81, 0x01,       // Input (Constant) -> padding pour aligner  1 octet
+
+    0x05, 0x01,       // Usage Page (Generic Desktop)
+    0x09, 0x30,       // Usage X
+    0x09, 0x31,       // Usage Y
+    0x15, 0x81,
+    0x25, 0x7F,
+    0x75, 0x08,
+    0x95, 0x02,
+    0x81, 0x06,       // Input (Data, Variable, Relative)
+    0xC0,             // END_COLLECTION (Physical)
+    0xC0              // END_COLLECTION (Application)
+};
+
+//
+// HID_GAMEPAD_REPORT.
+//
+static const UCHAR G_GamepadCollection[] = {
+    0x05, 0x01,       // USAGE_PAGE (Generic Desktop)
+    0x09, 0x05,       // USAGE (Game Pad)
+    0xA1, 0x01,       // COLLECTION (Application)
+    0x85, 0x04,       // REPORT_ID (4)
+
+    0x05, 0x09,       // Usage Page (Buttons)
+    0x19, 0x01,       // Usage Minimum = Button 1
+    0x29, 0x10,       // Usage Maximum = Button 16
+    0x15, 0x00,       // Logical Min = 0
+    0x25, 0x01,       // Logical Max = 1
+    0x75, 0x01,
+    0x95, 0x10,
+    0x81, 0x02,       // Input (Data, Variable, Absolute)
+
+    0x05, 0x01,       // Usage Page (Generic Desktop)
+    0x09, 0x30,       // Usage X
+    0x09, 0x31,       // Usage Y
+    0x09, 0x32,       // Usage Z
+    0x09, 0x35,       // Usage Rz
+    0x15, 0x81,
+    0x25, 0x7F,
+    0x75, 0x08,
+    0x95, 0x04,
+    0x81, 0x02,       // Input (Data, Variable, Absolute)
+    0xC0
+};
+
+//
+// VHID_CONFIG_REPORT, present in every profile.
+//
+static const UCHAR G_ConfigCollection[] = {
+    0x06, 0x00, 0xFF, // USAGE_PAGE (Vendor Defined 0xFF00)
+    0x09, 0x01,       // USAGE (Vendor Usage 1)
+    0xA1, 0x01,       // COLLECTION (Application)
+    0x85, 0x03,       // REPORT_ID (3)
+
+    0x09, 0x02,       // USAGE (Vendor Usage 2)
+    0x15, 0x00,       // Logical Minimum (0)
+    0x26, 0xFF, 0x00, // Logical Maximum (255)
+    0x75, 0x08,
+    0x95, 0x0F,       // Report count (sizeof(VHID_CONFIG_REPORT) - 1)
+    0xB1, 0x02,       // Feature (Data, Variable, Absolute)
+    0xC0
+};
+
+typedef struct _DESCRIPTOR_FRAGMENT {
+    const UCHAR*            Data;
+    ULONG                   Length;
+    UCHAR                   Collection;     // VHID_COLLECTION_xxx, 0 for configuration
+} DESCRIPTOR_FRAGMENT;
+
+#define FRAGMENT(Array, Collection) { Array, sizeof(Array), Collection }
+
+static const DESCRIPTOR_FRAGMENT G_Keyboard = FRAGMENT(G_KeyboardCollection, VHID_COLLECTION_KEYBOARD);
+static const DESCRIPTOR_FRAGMENT G_NkroKeyboard = FRAGMENT(G_NkroKeyboardCollection, VHID_COLLECTION_KEYBOARD);
+static const DESCRIPTOR_FRAGMENT G_Mouse = FRAGMENT(G_MouseCollection, VHID_COLLECTION_MOUSE);
+static const DESCRIPTOR_FRAGMENT G_Gamepad = FRAGMENT(G_GamepadCollection, VHID_COLLECTION_GAMEPAD);
+static const DESCRIPTOR_FRAGMENT G_Config = FRAGMENT(G_ConfigCollection, 0);
+
+//
+// Collections of each profile, in report id order, up to three.
+//
+static const DESCRIPTOR_FRAGMENT* const G_Profiles[VHID_PROFILE_COUNT][3] = {
+    { &G_Keyboard, &G_Mouse, &G_Config },           // VHID_PROFILE_KEYBOARD_MOUSE
+    { &G_Keyboard, &G_Config },                     // VHID_PROFILE_KEYBOARD
+    { &G_Mouse, &G_Config },                        // VHID_PROFILE_MOUSE
+    { &G_NkroKeyboard, &G_Mouse, &G_Config },       // VHID_PROFILE_NKRO
+    { &G_Config, &G_Gamepad },                      // VHID_PROFILE_GAMEPAD
+};
+
+BOOLEAN
+DescriptorBuild(
+    _In_  ULONG             Profile,
+    _Out_writes_bytes_to_(BufferLength, *Length) PUCHAR Buffer,
+    _In_  ULONG             BufferLength,
+    _Out_ PULONG            Length,
+    _Out_ PUCHAR            Collections
+    )
+/*++
+
+Routine Description:
+
+    Assembles the report descriptor of a profile. Collections receives the
+    VHID_COLLECTION_xxx mask of the collections it declares.
+
+Return Value:
+
+    FALSE if the profile is unknown or the buffer too small.
+
+--*/
+{
+    const DESCRIPTOR_FRAGMENT* fragment;
+    ULONG                   i;
+
+    *Length = 0;
+    *Collections = 0;
+
+    if (Profile >= VHID_PROFILE_COUNT)
+        return FALSE;
+
+    for (i = 0; i < ARRAYSIZE(G_Profiles[Profile]); i++) {
+        fragment = G_Profiles[Profile][i];
+        if (fragment == NULL)
+            break;
+        if (BufferLength - *Length < fragment->Length) {
+            *Length = 0;
+            *Collections = 0;
+            return FALSE;
+        }
+        RtlCopyMemory(Buffer + *Length, fragment->Data, fragment->Length);
+        *Length += fragment->Length;
+        *Collections |= fragment->Collection;
+    }
+
+    return TRUE;
+}
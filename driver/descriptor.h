@@ -0,0 +1,20 @@
+#ifndef __DESCRIPTOR_H_
+#define __DESCRIPTOR_H_
+
+//
+// Report descriptors are assembled per device from one fragment per
+// top-level collection, for the collections of its VHID_PROFILE_xxx, so
+// hidclass and the input stack only set up what the device really has.
+//
+#define DESCRIPTOR_MAX_SIZE     256
+
+BOOLEAN
+DescriptorBuild(
+    _In_  ULONG             Profile,
+    _Out_writes_bytes_to_(BufferLength, *Length) PUCHAR Buffer,
+    _In_  ULONG             BufferLength,
+    _Out_ PULONG            Length,
+    _Out_ PUCHAR            Collections
+    );
+
+#endif // __DESCRIPTOR_H_
@@ -0,0 +1,75 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "evtqueue.h"
+
+VOID
+EventQueueInit(
+    _Out_ PEVENT_QUEUE      Queue
+    )
+{
+    RtlZeroMemory(Queue, sizeof(EVENT_QUEUE));
+}
+
+VOID
+EventQueuePush(
+    _Inout_ PEVENT_QUEUE    Queue,
+    _In_  ULONG             Type,
+    _In_  ULONG             Data,
+    _In_  ULONGLONG         Timestamp
+    )
+/*++
+
+Routine Description:
+
+    Appends an event. On overflow the oldest entry is discarded and its loss
+    (plus whatever it was already carrying) is charged to the new oldest entry.
+
+--*/
+{
+    PVHID_NOTIFY_EVENT      entry;
+    ULONG                   dropped;
+
+    if (Queue->Count == EVENT_QUEUE_DEPTH) {
+        dropped = Queue->Entries[Queue->Head].Dropped + 1;
+        Queue->Head = (Queue->Head + 1) % EVENT_QUEUE_DEPTH;
+        Queue->Count--;
+        Queue->Entries[Queue->Head].Dropped += dropped;
+    }
+
+    entry = &Queue->Entries[(Queue->Head + Queue->Count) % EVENT_QUEUE_DEPTH];
+    entry->Type      = Type;
+    entry->Sequence  = ++Queue->Sequence;
+    entry->Dropped   = 0;
+    entry->Data      = Data;
+    entry->Timestamp = Timestamp;
+    Queue->Count++;
+}
+
+ULONG
+EventQueuePop(
+    _Inout_ PEVENT_QUEUE    Queue,
+    _Out_writes_(MaxEvents) PVHID_NOTIFY_EVENT Events,
+    _In_  ULONG             MaxEvents
+    )
+/*++
+
+Routine Description:
+
+    Moves up to MaxEvents of the oldest events to Events.
+
+Return Value:
+
+    Number of events copied.
+
+--*/
+{
+    ULONG                   count = 0;
+
+    while (count < MaxEvents && Queue->Count != 0) {
+        Events[count++] = Queue->Entries[Queue->Head];
+        Queue->Head = (Queue->Head + 1) % EVENT_QUEUE_DEPTH;
+        Queue->Count--;
+    }
+
+    return count;
+}
@@ -0,0 +1,38 @@
+#ifndef __EVTQUEUE_H_
+#define __EVTQUEUE_H_
+
+//
+// Bounded per-handle queue of VHID_NOTIFY_EVENT records. When the queue is
+// full the oldest record is discarded and accounted for in the Dropped field
+// of the record that follows it, so a client always sees the latest state.
+//
+#define EVENT_QUEUE_DEPTH   32
+
+typedef struct _EVENT_QUEUE {
+    ULONG                   Head;
+    ULONG                   Count;
+    ULONG                   Sequence;
+    VHID_NOTIFY_EVENT       Entries[EVENT_QUEUE_DEPTH];
+} EVENT_QUEUE, *PEVENT_QUEUE;
+
+VOID
+EventQueueInit(
+    _Out_ PEVENT_QUEUE      Queue
+    );
+
+VOID
+EventQueuePush(
+    _Inout_ PEVENT_QUEUE    Queue,
+    _In_  ULONG             Type,
+    _In_  ULONG             Data,
+    _In_  ULONGLONG         Timestamp
+    );
+
+ULONG
+EventQueuePop(
+    _Inout_ PEVENT_QUEUE    Queue,
+    _Out_writes_(MaxEvents) PVHID_NOTIFY_EVENT Events,
+    _In_  ULONG             MaxEvents
+    );
+
+#endif // __EVTQUEUE_H_
@@ -0,0 +1,116 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "layout.h"
+#include "gamepad.h"
+
+#define USAGE_PAGE_GENERIC      0x01
+#define USAGE_PAGE_BUTTON       0x09
+
+static const USHORT G_AxisUsages[GAMEPAD_AXES] = {
+    0x30, 0x31, 0x32, 0x35,     // X, Y, Z, Rz
+};
+
+BOOLEAN
+GamepadLayoutInit(
+    _Out_ PGAMEPAD_LAYOUT   Gamepad,
+    _In_  const DESCRIPTOR_LAYOUT* Layout,
+    _In_  UCHAR             ReportId
+    )
+/*++
+
+Routine Description:
+
+    Finds the field holding each button and axis in the input report
+    ReportId of a parsed descriptor.
+
+Return Value:
+
+    FALSE if the report or one of the usages is missing. Gamepad is then
+    left empty, and packs and unpacks nothing.
+
+--*/
+{
+    const LAYOUT_FIELD*     field;
+    ULONG                   i;
+
+    RtlZeroMemory(Gamepad, sizeof(GAMEPAD_LAYOUT));
+
+    Gamepad->Report = LayoutFindReport(Layout, ReportId, LAYOUT_INPUT);
+    if (Gamepad->Report == NULL)
+        return FALSE;
+
+    for (i = 0; i < GAMEPAD_BUTTONS + GAMEPAD_AXES; i++) {
+        if (i < GAMEPAD_BUTTONS)
+            field = LayoutFindField(Layout, Gamepad->Report, USAGE_PAGE_BUTTON, (USHORT)(i + 1), &Gamepad->Index[i]);
+        else
+            field = LayoutFindField(Layout, Gamepad->Report, USAGE_PAGE_GENERIC, G_AxisUsages[i - GAMEPAD_BUTTONS],
+                &Gamepad->Index[i]);
+
+        if (field == NULL || (field->Flags & FIELD_VARIABLE) == 0) {
+            RtlZeroMemory(Gamepad, sizeof(GAMEPAD_LAYOUT));
+            return FALSE;
+        }
+        Gamepad->Fields[i] = field;
+    }
+
+    return TRUE;
+}
+
+VOID
+GamepadPack(
+    _In_  const GAMEPAD_LAYOUT* Gamepad,
+    _In_  const VHID_GAMEPAD_STATE* State,
+    _Inout_ PUCHAR          Report
+    )
+/*++
+
+Routine Description:
+
+    Writes a gamepad state into a report buffer the size of the report.
+    Axes are clamped to their logical range.
+
+--*/
+{
+    CHAR                    axes[GAMEPAD_AXES];
+    ULONG                   i;
+
+    if (Gamepad->Report == NULL)
+        return;
+
+    axes[0] = State->X;
+    axes[1] = State->Y;
+    axes[2] = State->Z;
+    axes[3] = State->Rz;
+
+    for (i = 0; i < GAMEPAD_BUTTONS; i++)
+        FieldPack(Report, Gamepad->Fields[i], Gamepad->Index[i], (State->Buttons >> i) & 1);
+    for (i = 0; i < GAMEPAD_AXES; i++)
+        FieldPack(Report, Gamepad->Fields[GAMEPAD_BUTTONS + i], Gamepad->Index[GAMEPAD_BUTTONS + i], axes[i]);
+}
+
+VOID
+GamepadUnpack(
+    _In_  const GAMEPAD_LAYOUT* Gamepad,
+    _In_  const UCHAR*      Report,
+    _Out_ PVHID_GAMEPAD_STATE State
+    )
+{
+    CHAR                    axes[GAMEPAD_AXES];
+    ULONG                   i;
+
+    RtlZeroMemory(State, sizeof(VHID_GAMEPAD_STATE));
+    if (Gamepad->Report == NULL)
+        return;
+
+    for (i = 0; i < GAMEPAD_BUTTONS; i++) {
+        if (FieldUnpack(Report, Gamepad->Fields[i], Gamepad->Index[i]) != 0)
+            State->Buttons |= (USHORT)(1 << i);
+    }
+    for (i = 0; i < GAMEPAD_AXES; i++)
+        axes[i] = (CHAR)FieldUnpack(Report, Gamepad->Fields[GAMEPAD_BUTTONS + i], Gamepad->Index[GAMEPAD_BUTTONS + i]);
+
+    State->X = axes[0];
+    State->Y = axes[1];
+    State->Z = axes[2];
+    State->Rz = axes[3];
+}
@@ -0,0 +1,40 @@
+#ifndef __GAMEPAD_H_
+#define __GAMEPAD_H_
+
+//
+// The gamepad input report, written and read through the fields LayoutParse
+// found for its usages rather than through HID_GAMEPAD_REPORT, so that the
+// report built is the one the descriptor declares: buttons 1 to 16 and the
+// X, Y, Z and Rz axes, wherever the descriptor puts them.
+//
+#define GAMEPAD_BUTTONS         16
+#define GAMEPAD_AXES            4
+
+typedef struct _GAMEPAD_LAYOUT {
+    const LAYOUT_REPORT*    Report;
+    const LAYOUT_FIELD*     Fields[GAMEPAD_BUTTONS + GAMEPAD_AXES];     // buttons, then axes
+    ULONG                   Index[GAMEPAD_BUTTONS + GAMEPAD_AXES];
+} GAMEPAD_LAYOUT, *PGAMEPAD_LAYOUT;
+
+BOOLEAN
+GamepadLayoutInit(
+    _Out_ PGAMEPAD_LAYOUT   Gamepad,
+    _In_  const DESCRIPTOR_LAYOUT* Layout,
+    _In_  UCHAR             ReportId
+    );
+
+VOID
+GamepadPack(
+    _In_  const GAMEPAD_LAYOUT* Gamepad,
+    _In_  const VHID_GAMEPAD_STATE* State,
+    _Inout_ PUCHAR          Report
+    );
+
+VOID
+GamepadUnpack(
+    _In_  const GAMEPAD_LAYOUT* Gamepad,
+    _In_  const UCHAR*      Report,
+    _Out_ PVHID_GAMEPAD_STATE State
+    );
+
+#endif // __GAMEPAD_H_
@@ -0,0 +1,142 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "hidreport.h"
+
+UCHAR
+ReportCollection(
+    _In_  UCHAR             ReportId
+    )
+{
+    switch (ReportId) {
+    case KEYBOARD_REPORT_ID:
+        return VHID_COLLECTION_KEYBOARD;
+    case MOUSE_REPORT_ID:
+        return VHID_COLLECTION_MOUSE;
+    case GAMEPAD_REPORT_ID:
+        return VHID_COLLECTION_GAMEPAD;
+    default:
+        return 0;
+    }
+}
+
+VOID
+KeyboardReportApplyKey(
+    _Inout_ PHID_KEYBOARD_REPORT Report,
+    _In_  UCHAR             KeyCode,
+    _In_  BOOLEAN           Pressed
+    )
+/*++
+
+Routine Description:
+
+    Applies a key transition to a boot keyboard report. Usages 0xE0-0xE7
+    map to the modifier bits, other keys to the first free slot of Keys.
+    Pressing a key already down, or a seventh key, leaves the report
+    unchanged.
+
+--*/
+{
+    UCHAR                   from = Pressed ? 0 : KeyCode;
+    UCHAR                   to = Pressed ? KeyCode : 0;
+    int                     i;
+
+    if (KeyCode >= 0xE0 && KeyCode <= 0xE7) {
+        UCHAR mask = 1 << (KeyCode - 0xE0);
+        if (Pressed)
+            Report->Modifiers |= mask;
+        else
+            Report->Modifiers &= ~mask;
+        return;
+    }
+
+    if (KeyCode == 0)
+        return;
+
+    if (Pressed) {
+        for (i = 0; i < 6; i++) {
+            if (Report->Keys[i] == KeyCode)
+                return;
+        }
+    }
+
+    for (i = 0; i < 6; i++) {
+        if (Report->Keys[i] == from) {
+            Report->Keys[i] = to;
+            return;
+        }
+    }
+}
+
+VOID
+NkroReportApplyKey(
+    _Inout_ PHID_NKRO_REPORT Report,
+    _In_  UCHAR             KeyCode,
+    _In_  BOOLEAN           Pressed
+    )
+/*++
+
+Routine Description:
+
+    Applies a key transition to an NKRO keyboard report. Usages past the
+    bitmap, other than the modifiers, leave the report unchanged.
+
+--*/
+{
+    UCHAR                   mask;
+    PUCHAR                  bits;
+
+    if (KeyCode >= 0xE0 && KeyCode <= 0xE7) {
+        mask = 1 << (KeyCode - 0xE0);
+        bits = &Report->Modifiers;
+    }
+    else if (KeyCode != 0 && KeyCode < NKRO_KEY_COUNT) {
+        mask = 1 << (KeyCode % 8);
+        bits = &Report->Keys[KeyCode / 8];
+    }
+    else {
+        return;
+    }
+
+    if (Pressed)
+        *bits |= mask;
+    else
+        *bits &= ~mask;
+}
+
+BOOLEAN
+MouseReportMerge(
+    _Inout_updates_bytes_(Length) PVOID Pending,
+    _In_reads_bytes_(Length) const VOID* Report,
+    _In_  UCHAR             Length
+    )
+/*++
+
+Routine Description:
+
+    Folds a mouse report into one that has not been read yet. Motion is
+    relative, so the deltas are added up instead of replaced. Button
+    transitions are never folded away.
+
+Return Value:
+
+    FALSE if the buttons changed or the summed motion would not fit in a
+    report, in which case the new report has to be queued on its own.
+
+--*/
+{
+    PHID_MOUSE_REPORT       pending = (PHID_MOUSE_REPORT)Pending;
+    const HID_MOUSE_REPORT* report = (const HID_MOUSE_REPORT*)Report;
+    LONG                    x, y;
+
+    if (Length != sizeof(HID_MOUSE_REPORT) || pending->Buttons != report->Buttons)
+        return FALSE;
+
+    x = (LONG)pending->X + report->X;
+    y = (LONG)pending->Y + report->Y;
+    if (x < -127 || x > 127 || y < -127 || y > 127)
+        return FALSE;
+
+    pending->X = (CHAR)x;
+    pending->Y = (CHAR)y;
+    return TRUE;
+}
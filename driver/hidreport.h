@@ -0,0 +1,88 @@
+#ifndef __HIDREPORT_H_
+#define __HIDREPORT_H_
+
+//
+// Layout of the reports declared in the report descriptors assembled by
+// descriptor.c, and the per-collection rules applied to them while they
+// wait for a hidclass read.
+//
+
+#include <pshpack1.h>
+
+typedef struct _HID_KEYBOARD_REPORT {
+    UCHAR ReportId;      // Report ID = 1
+    UCHAR Modifiers;     // Ctrl, Shift, Alt, GUI
+    UCHAR Reserved;      // Toujours 0
+    UCHAR Keys[6];       // Codes des touches
+} HID_KEYBOARD_REPORT, * PHID_KEYBOARD_REPORT;
+
+typedef struct _HID_MOUSE_REPORT {
+    UCHAR ReportId;      // Report ID = 2
+    UCHAR Buttons;       // bits 0-2 = bouton1-3, bits 3-7 padding
+    CHAR X;              // mouvement X relatif
+    CHAR Y;              // mouvement Y relatif
+} HID_MOUSE_REPORT, * PHID_MOUSE_REPORT;
+
+//
+// Keyboard report of VHID_PROFILE_NKRO, in place of HID_KEYBOARD_REPORT:
+// one bit per usage up to NKRO_KEY_COUNT, so any number of keys can be
+// down at once.
+//
+#define NKRO_KEY_COUNT      0x68
+
+typedef struct _HID_NKRO_REPORT {
+    UCHAR ReportId;      // Report ID = 1
+    UCHAR Modifiers;
+    UCHAR Keys[NKRO_KEY_COUNT / 8];
+} HID_NKRO_REPORT, * PHID_NKRO_REPORT;
+
+typedef struct _HID_GAMEPAD_REPORT {
+    UCHAR ReportId;      // Report ID = 4
+    USHORT Buttons;      // bits 0-15 = buttons 1-16
+    CHAR X;              // absolute axes
+    CHAR Y;
+    CHAR Z;
+    CHAR Rz;
+} HID_GAMEPAD_REPORT, * PHID_GAMEPAD_REPORT;
+
+typedef struct _HID_KEYBOARD_OUTPUT_REPORT {
+    UCHAR ReportId;      // Report ID = 1
+    UCHAR Leds;          // bits 0-4 = Num, Caps, Scroll, Compose, Kana
+} HID_KEYBOARD_OUTPUT_REPORT, * PHID_KEYBOARD_OUTPUT_REPORT;
+
+#include <poppack.h>
+
+//
+// Misc definitions
+//
+#define KEYBOARD_REPORT_ID   0x01
+#define MOUSE_REPORT_ID   0x02
+#define GAMEPAD_REPORT_ID   0x04
+
+UCHAR
+ReportCollection(
+    _In_  UCHAR             ReportId
+    );
+
+VOID
+KeyboardReportApplyKey(
+    _Inout_ PHID_KEYBOARD_REPORT Report,
+    _In_  UCHAR             KeyCode,
+    _In_  BOOLEAN           Pressed
+    );
+
+VOID
+NkroReportApplyKey(
+    _Inout_ PHID_NKRO_REPORT Report,
+    _In_  UCHAR             KeyCode,
+    _In_  BOOLEAN           Pressed
+    );
+
+BOOLEAN
+MouseReportMerge(
+    _Inout_updates_bytes_(Length) PVOID Pending,
+    _In_reads_bytes_(Length) const VOID* Report,
+    _In_  UCHAR             Length
+    );
+
+#endif // __HIDREPORT_H_
@@ -0,0 +1,139 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "reportq.h"
+#include "idle.h"
+
+VOID
+IdleFilterInit(
+    _Out_ PIDLE_FILTER      Filter
+    )
+{
+    RtlZeroMemory(Filter, sizeof(IDLE_FILTER));
+}
+
+VOID
+IdleFilterSetRate(
+    _Inout_ PIDLE_FILTER    Filter,
+    _In_  UCHAR             ReportId,
+    _In_  ULONG             Rate,
+    _In_  ULONGLONG         Now
+    )
+/*++
+
+Routine Description:
+
+    Sets the idle rate of a report id, in IDLE_RATE_UNIT_MS units; 0
+    disables idle repeats, as it does on USB. The period restarts now.
+
+--*/
+{
+    if (ReportId >= IDLE_MAX_REPORT_ID)
+        return;
+
+    Filter->Period[ReportId] = (ULONGLONG)Rate * IDLE_RATE_UNIT_MS * 10000;
+    Filter->NextRepeat[ReportId] = Now + Filter->Period[ReportId];
+}
+
+BOOLEAN
+IdleFilterAccept(
+    _Inout_ PIDLE_FILTER    Filter,
+    _In_reads_bytes_(Length) const VOID* Report,
+    _In_  UCHAR             Length,
+    _In_  BOOLEAN           Force,
+    _In_  ULONGLONG         Now
+    )
+/*++
+
+Routine Description:
+
+    Decides whether a report is worth sending, comparing it with the last
+    one accepted for its report id. Accepting a report restarts the idle
+    period of its id.
+
+Return Value:
+
+    FALSE if the report is identical to the last one and not forced.
+
+--*/
+{
+    UCHAR                   reportId = *(const UCHAR*)Report;
+    PREPORT_ENTRY           last;
+
+    if (reportId >= IDLE_MAX_REPORT_ID || Length > REPORT_MAX_SIZE)
+        return TRUE;
+
+    last = &Filter->Last[reportId];
+    if (!Force && last->Length == Length && RtlEqualMemory(last->Data, Report, Length)) {
+        Filter->Suppressed++;
+        return FALSE;
+    }
+
+    last->Length = Length;
+    RtlCopyMemory(last->Data, Report, Length);
+    Filter->NextRepeat[reportId] = Now + Filter->Period[reportId];
+    return TRUE;
+}
+
+BOOLEAN
+IdleFilterTick(
+    _Inout_ PIDLE_FILTER    Filter,
+    _In_  ULONGLONG         Now,
+    _In_  ULONG             PendingMask,
+    _Out_ PREPORT_ENTRY     Report
+    )
+/*++
+
+Routine Description:
+
+    Finds a report whose idle period has elapsed. A report id with a report
+    still pending (in PendingMask, as REPORT_ID_MASK bits) isn't idle, its
+    period just restarts.
+
+Return Value:
+
+    TRUE if Report receives a copy of a report to send again. Call again
+    until it returns FALSE.
+
+--*/
+{
+    ULONG                   id;
+
+    for (id = 0; id < IDLE_MAX_REPORT_ID; id++) {
+        if (Filter->Period[id] == 0 || Filter->Last[id].Length == 0 || Now < Filter->NextRepeat[id])
+            continue;
+
+        Filter->NextRepeat[id] = Now + Filter->Period[id];
+        if (PendingMask & REPORT_ID_MASK(id))
+            continue;
+
+        *Report = Filter->Last[id];
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+ULONGLONG
+IdleFilterNextDeadline(
+    _In_  PIDLE_FILTER      Filter
+    )
+/*++
+
+Return Value:
+
+    Time of the next idle repeat, or 0 if there is none.
+
+--*/
+{
+    ULONGLONG               deadline = 0;
+    ULONG                   id;
+
+    for (id = 0; id < IDLE_MAX_REPORT_ID; id++) {
+        if (Filter->Period[id] == 0 || Filter->Last[id].Length == 0)
+            continue;
+        if (deadline == 0 || Filter->NextRepeat[id] < deadline)
+            deadline = Filter->NextRepeat[id];
+    }
+
+    return deadline;
+}
@@ -0,0 +1,58 @@
+#ifndef __IDLE_H_
+#define __IDLE_H_
+
+//
+// Suppression of redundant input reports and USB-style idle repeats. The
+// last report accepted for each report id is kept; a new one that is
+// identical carries no information and is dropped, unless the caller
+// forces it (relative motion is an event, not a state). When an idle
+// period is set for a report id, its last report is sent again each time
+// the period elapses without a new one, as a USB keyboard does after
+// SET_IDLE. Times are in 100ns units from any monotonic clock.
+//
+#define IDLE_MAX_REPORT_ID      8
+#define IDLE_RATE_UNIT_MS       4           // USB idle rates count 4ms units
+
+typedef struct _IDLE_FILTER {
+    ULONGLONG               Period[IDLE_MAX_REPORT_ID];         // 0 = no idle repeat
+    ULONGLONG               NextRepeat[IDLE_MAX_REPORT_ID];
+    REPORT_ENTRY            Last[IDLE_MAX_REPORT_ID];           // Length 0 = none yet
+    ULONG                   Suppressed;
+} IDLE_FILTER, *PIDLE_FILTER;
+
+VOID
+IdleFilterInit(
+    _Out_ PIDLE_FILTER      Filter
+    );
+
+VOID
+IdleFilterSetRate(
+    _Inout_ PIDLE_FILTER    Filter,
+    _In_  UCHAR             ReportId,
+    _In_  ULONG             Rate,
+    _In_  ULONGLONG         Now
+    );
+
+BOOLEAN
+IdleFilterAccept(
+    _Inout_ PIDLE_FILTER    Filter,
+    _In_reads_bytes_(Length) const VOID* Report,
+    _In_  UCHAR             Length,
+    _In_  BOOLEAN           Force,
+    _In_  ULONGLONG         Now
+    );
+
+BOOLEAN
+IdleFilterTick(
+    _Inout_ PIDLE_FILTER    Filter,
+    _In_  ULONGLONG         Now,
+    _In_  ULONG             PendingMask,
+    _Out_ PREPORT_ENTRY     Report
+    );
+
+ULONGLONG
+IdleFilterNextDeadline(
+    _In_  PIDLE_FILTER      Filter
+    );
+
+#endif // __IDLE_H_
@@ -5,75 +5,9 @@
 EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL EvtIoInternalDeviceControl;
 
 //
-// This is the default report descriptor for the virtual Hid device returned
-// by the mini driver in response to IOCTL_HID_GET_REPORT_DESCRIPTOR.
-//
-HID_REPORT_DESCRIPTOR G_DefaultReportDescriptor[] = {
-    // ===== KEYBOARD =====
-    0x05, 0x01,       // USAGE_PAGE (Generic Desktop)
-    0x09, 0x06,       // USAGE (Keyboard)
-    0xA1, 0x01,       // COLLECTION (Application)
-    0x85, 0x01,       // REPORT_ID (1)
-
-    0x05, 0x07,       // USAGE_PAGE (Keyboard/Keypad)
-    0x19, 0xE0,       // Usage Minimum (224, Left Control)
-    0x29, 0xE7,       // Usage Maximum (231, Right GUI)
-    0x15, 0x00,       // Logical Minimum (0)
-    0x25, 0x01,       // Logical Maximum (1)
-    0x75, 0x01,
-    0x95, 0x08,       // Report count
-    0x81, 0x02,       // Modifiers
-
-    0x95, 0x01,       // Report count
-    0x75, 0x08,
-    0x81, 0x01,       // Reserved
-
-    0x95, 0x06,       // Report count
-    0x75, 0x08,
-    0x15, 0x00,
-    0x25, 0x65,
-    0x05, 0x07,
-    0x19, 0x00,
-    0x29, 0x65,
-    0x81, 0x00,       // Keys
-    0xC0,
-
-    // ===== MOUSE =====
-    0x05, 0x01,       // USAGE_PAGE (Generic Desktop)
-    0x09, 0x02,       // USAGE (Mouse)
-    0xA1, 0x01,       // COLLECTION (Application)
-    0x85, 0x02,       // Report ID (2)
-
-    0x09, 0x01,       // Usage (Pointer)
-    0xA1, 0x00,       // Collection (Physical)
-    0x05, 0x09,       // Usage Page (Buttons)
-    0x19, 0x01,       // Usage Minimum = Button 1
-    0x29, 0x03,       // Usage Maximum = Button 3
-    0x15, 0x00,       // Logical Min = 0
-    0x25, 0x01,       // Logical Max = 1
-    0x95, 0x03,       // Report size
-    0x75, 0x01,
-    0x81, 0x02,       // Input (Data, Variable, Absolute)
-
-    0x95, 0x01,
-    0x75, 0x05,
-    0x81, 0x01,       // Input (Constant) -> padding pour aligner  1 octet
-
-    0x05, 0x01,       // Usage Page (Generic Desktop)
-    0x09, 0x30,       // Usage X
-    0x09, 0x31,       // Usage Y
-    0x15, 0x81,
-    0x25, 0x7F,
-    0x75, 0x08,
-    0x95, 0x02,
-    0x81, 0x06,       // Input (Data, Variable, Relative)
-    0xC0
-};
-
-//
-// This is the default HID descriptor returned by the mini driver
-// in response to IOCTL_HID_GET_DEVICE_DESCRIPTOR. The size
-// of report descriptor is currently the size of G_DefaultReportDescriptor.
+// This is the HID descriptor returned by the mini driver in response to
+// IOCTL_HID_GET_DEVICE_DESCRIPTOR. Each device copies it and fills in the
+// length of the report descriptor it assembled for its profile.
 //
 
 HID_DESCRIPTOR              G_DefaultHidDescriptor = {
@@ -84,7 +18,7 @@ HID_DESCRIPTOR              G_DefaultHidDescriptor = {
     0x01,   // number of HID class descriptors
     {                                       //DescriptorList[0]
         0x22,                               //report descriptor type 0x22
-        sizeof(G_DefaultReportDescriptor)   //total length of report descriptor
+        0                                   //total length of report descriptor
     }
 };
 
@@ -125,7 +59,7 @@ Return Value:
 
     status = WdfIoQueueCreate(Device, &queueConfig, &queueAttributes, &queue);
     if (!NT_SUCCESS(status)) {
-        KdPrint(("WdfIoQueueCreate failed 0x%x\n", status));
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "WdfIoQueueCreate failed 0x%x\n", status);
         return status;
     }
 
@@ -148,34 +82,45 @@ ReadReport(
 {
     NTSTATUS                status;
 	PDEVICE_CONTEXT		    deviceContext = QueueContext->DeviceContext;
+    REPORT_ENTRY            report;
+    ULONGLONG               now = VhidQueryTime();
 
-    KdPrint(("ReadReport\n"));
+    VhidLog(LOG_HID, LOG_LEVEL_VERBOSE, "ReadReport\n");
+
+    StateLockAcquire(deviceContext);
+    if (ReportQueuePop(&deviceContext->Reports, PacerReadyMask(&deviceContext->Pacer, now), &report)) {
+        PacerRelease(&deviceContext->Pacer, report.Data[0], now);
+        ReceiptResolve(&deviceContext->Receipts, report.Sequence, RECEIPT_DELIVERED, now);
+        TraceWrite(&deviceContext->Trace, VHID_TRACE_REPORT_COMPLETED, report.Data, report.Length, now);
+        status = RequestCopyFromBuffer(Request, report.Data, report.Length);
+        if (deviceContext->Reports.Count == 0)
+            deviceContext->DrainedPending = TRUE;
+        StateLockRelease(deviceContext);
 
-    WdfWaitLockAcquire(deviceContext->StateLock, NULL);
-    if(deviceContext->KeyboardChanged) {
-		status = RequestCopyFromBuffer(Request, &deviceContext->KeyboardState, sizeof(HID_KEYBOARD_REPORT));
-        deviceContext->KeyboardChanged = FALSE;
-        *CompleteRequest = TRUE;
-        return status;
-    }
-    if (deviceContext->MouseChanged) {
-        status = RequestCopyFromBuffer(Request, &deviceContext->MouseState, sizeof(HID_MOUSE_REPORT));
-        deviceContext->MouseChanged = FALSE;
         *CompleteRequest = TRUE;
         return status;
     }
-    WdfWaitLockRelease(deviceContext->StateLock);
 
     //
-    // forward the request to manual queue
+    // forward the request to manual queue. This is done under StateLock so
+    // that a report sent concurrently either finds the request there or is
+    // queued before we looked.
     //
     status = WdfRequestForwardToIoQueue(Request, deviceContext->ManualQueue);
+    if (NT_SUCCESS(status)) {
+        TraceWrite(&deviceContext->Trace, VHID_TRACE_READ_PARKED, NULL, 0, now);
+        if (deviceContext->Reports.Count != 0)
+            ReportDispatch(deviceContext);
+    }
+    StateLockRelease(deviceContext);
     if (!NT_SUCCESS(status)) {
-        KdPrint(("WdfRequestForwardToIoQueue failed with 0x%x\n", status));
+        VhidLog(LOG_HID, LOG_LEVEL_ERROR, "WdfRequestForwardToIoQueue failed with 0x%x\n", status);
         *CompleteRequest = TRUE;
     }
     else {
         *CompleteRequest = FALSE;
+        if (InterlockedExchange(&deviceContext->ReaderStarted, TRUE) == FALSE)
+            NotifyEvent(deviceContext, VHID_EVENT_READER_STARTED, 0);
     }
 
     return status;
@@ -197,12 +142,23 @@ GetInputReport(
     {
     case KEYBOARD_REPORT_ID:
     {
+        if (QueueContext->DeviceContext->Config.Profile == VHID_PROFILE_NKRO) {
+            if (packet.reportBufferLen != sizeof(HID_NKRO_REPORT))
+                return STATUS_INVALID_BUFFER_SIZE;
+
+            StateLockAcquire(QueueContext->DeviceContext);
+            RtlCopyMemory(packet.reportBuffer, &QueueContext->DeviceContext->NkroState, sizeof(HID_NKRO_REPORT));
+            StateLockRelease(QueueContext->DeviceContext);
+            WdfRequestSetInformation(Request, sizeof(HID_NKRO_REPORT));
+            break;
+        }
+
         if (packet.reportBufferLen != sizeof(HID_KEYBOARD_REPORT))
             return STATUS_INVALID_BUFFER_SIZE;
         
-        WdfWaitLockAcquire(QueueContext->DeviceContext->StateLock, NULL);
+        StateLockAcquire(QueueContext->DeviceContext);
         RtlCopyMemory(packet.reportBuffer, &QueueContext->DeviceContext->KeyboardState, sizeof(HID_KEYBOARD_REPORT));
-        WdfWaitLockRelease(QueueContext->DeviceContext->StateLock);
+        StateLockRelease(QueueContext->DeviceContext);
         WdfRequestSetInformation(Request, sizeof(HID_KEYBOARD_REPORT));
         break;
     }
@@ -211,12 +167,23 @@ GetInputReport(
         if (packet.reportBufferLen != sizeof(HID_MOUSE_REPORT))
             return STATUS_INVALID_BUFFER_SIZE;
 
-        WdfWaitLockAcquire(QueueContext->DeviceContext->StateLock, NULL);
+        StateLockAcquire(QueueContext->DeviceContext);
         RtlCopyMemory(packet.reportBuffer, &QueueContext->DeviceContext->MouseState, sizeof(HID_MOUSE_REPORT));
-        WdfWaitLockRelease(QueueContext->DeviceContext->StateLock);
+        StateLockRelease(QueueContext->DeviceContext);
         WdfRequestSetInformation(Request, sizeof(HID_MOUSE_REPORT));
         break;
     }
+    case GAMEPAD_REPORT_ID:
+    {
+        if (packet.reportBufferLen != sizeof(HID_GAMEPAD_REPORT))
+            return STATUS_INVALID_BUFFER_SIZE;
+
+        StateLockAcquire(QueueContext->DeviceContext);
+        RtlCopyMemory(packet.reportBuffer, &QueueContext->DeviceContext->GamepadState, sizeof(HID_GAMEPAD_REPORT));
+        StateLockRelease(QueueContext->DeviceContext);
+        WdfRequestSetInformation(Request, sizeof(HID_GAMEPAD_REPORT));
+        break;
+    }
     default:
         return STATUS_INVALID_PARAMETER;
     }
@@ -230,7 +197,9 @@ SetOutputReport(
     _In_  WDFREQUEST     Request
 )
 {
-    UNREFERENCED_PARAMETER(QueueContext);
+    PDEVICE_CONTEXT deviceContext = QueueContext->DeviceContext;
+    PHID_KEYBOARD_OUTPUT_REPORT output;
+    BOOLEAN changed;
 
     HID_XFER_PACKET packet;
     NTSTATUS status = RequestGetHidXferPacket_ToWriteToDevice(Request, &packet);
@@ -239,9 +208,18 @@ SetOutputReport(
     switch (packet.reportId)
     {
     case KEYBOARD_REPORT_ID:
-        if (packet.reportBufferLen != sizeof(HID_KEYBOARD_REPORT))
+        if (packet.reportBufferLen != sizeof(HID_KEYBOARD_OUTPUT_REPORT))
             return STATUS_DEVICE_DATA_ERROR;
-        WdfRequestSetInformation(Request, sizeof(HID_KEYBOARD_REPORT));
+        output = (PHID_KEYBOARD_OUTPUT_REPORT)packet.reportBuffer;
+
+        StateLockAcquire(deviceContext);
+        changed = deviceContext->KeyboardOutput.Leds != output->Leds;
+        deviceContext->KeyboardOutput = *output;
+        StateLockRelease(deviceContext);
+
+        if (changed)
+            NotifyEvent(deviceContext, VHID_EVENT_OUTPUT_CHANGED, (KEYBOARD_REPORT_ID << 8) | output->Leds);
+        WdfRequestSetInformation(Request, sizeof(HID_KEYBOARD_OUTPUT_REPORT));
         break;
 
     case MOUSE_REPORT_ID:
@@ -255,6 +233,88 @@ SetOutputReport(
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+GetFeature(
+    _In_  PQUEUE_CONTEXT QueueContext,
+    _In_  WDFREQUEST     Request
+)
+/*++
+
+Routine Description:
+
+    Handles IOCTL_HID_GET_FEATURE for the configuration report.
+
+--*/
+{
+    NTSTATUS status;
+    HID_XFER_PACKET packet;
+    PDEVICE_CONTEXT deviceContext = QueueContext->DeviceContext;
+
+    status = RequestGetHidXferPacket_ToReadFromDevice(Request, &packet);
+    if (!NT_SUCCESS(status)) return status;
+
+    if (packet.reportId != VHID_CONFIG_REPORT_ID)
+        return STATUS_INVALID_PARAMETER;
+    if (packet.reportBufferLen < sizeof(VHID_CONFIG_REPORT))
+        return STATUS_INVALID_BUFFER_SIZE;
+
+    StateLockAcquire(deviceContext);
+    ConfigEncode(&deviceContext->Config, (PVHID_CONFIG_REPORT)packet.reportBuffer);
+    StateLockRelease(deviceContext);
+
+    WdfRequestSetInformation(Request, sizeof(VHID_CONFIG_REPORT));
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SetFeature(
+    _In_  PQUEUE_CONTEXT QueueContext,
+    _In_  WDFREQUEST     Request
+)
+/*++
+
+Routine Description:
+
+    Handles IOCTL_HID_SET_FEATURE for the configuration report. The new
+    configuration is validated as a whole, then swapped in under StateLock,
+    so the pipeline never sees a partially applied configuration.
+
+--*/
+{
+    NTSTATUS status;
+    HID_XFER_PACKET packet;
+    VHID_CONFIG_REPORT config;
+    PDEVICE_CONTEXT deviceContext = QueueContext->DeviceContext;
+
+    status = RequestGetHidXferPacket_ToWriteToDevice(Request, &packet);
+    if (!NT_SUCCESS(status)) return status;
+
+    if (packet.reportId != VHID_CONFIG_REPORT_ID)
+        return STATUS_INVALID_PARAMETER;
+
+    status = ConfigDecode(packet.reportBuffer, packet.reportBufferLen, &config);
+    if (!NT_SUCCESS(status)) {
+        VhidLog(LOG_CONFIG, LOG_LEVEL_WARNING, "SetFeature: invalid configuration 0x%x\n", status);
+        return status;
+    }
+
+    StateLockAcquire(deviceContext);
+    config.Profile = deviceContext->Config.Profile;
+    TraceWrite(&deviceContext->Trace, VHID_TRACE_CONFIG, &config, sizeof(config), VhidQueryTime());
+    deviceContext->Config = config;
+    ReportSetQueueDepth(deviceContext, config.QueueDepth);
+    PacerSetInterval(&deviceContext->Pacer, config.PacingInterval);
+    TypematicSetRate(&deviceContext->Typematic, config.TypematicDelay, config.TypematicRate);
+    IdleFilterSetRate(&deviceContext->Idle, KEYBOARD_REPORT_ID, config.IdleRate, VhidQueryTime());
+    ReportDispatch(deviceContext);
+    StateLockRelease(deviceContext);
+
+    NotifyEvent(deviceContext, VHID_EVENT_FEATURE_CHANGED, VHID_CONFIG_REPORT_ID);
+
+    WdfRequestSetInformation(Request, sizeof(VHID_CONFIG_REPORT));
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS
 GetStringId(
     _In_  WDFREQUEST        Request,
@@ -358,7 +418,7 @@ Return Value:
         if (stringIndex != VHIDMINI_DEVICE_STRING_INDEX)
         {
             status = STATUS_INVALID_PARAMETER;
-            KdPrint(("GetString: unkown string index %d\n", stringIndex));
+            VhidLog(LOG_HID, LOG_LEVEL_WARNING, "GetString: unkown string index %d\n", stringIndex);
             return status;
         }
 
@@ -418,7 +478,7 @@ Return Value:
         break;
     default:
         status = STATUS_INVALID_PARAMETER;
-        KdPrint(("GetString: unkown string id %d\n", stringId));
+        VhidLog(LOG_HID, LOG_LEVEL_WARNING, "GetString: unkown string id %d\n", stringId);
         return status;
     }
 
@@ -486,18 +546,19 @@ Return Value:
         //
         // Retrieves the device's HID descriptor.
         //
-        _Analysis_assume_(G_DefaultHidDescriptor.bLength != 0);
+        _Analysis_assume_(deviceContext->HidDescriptor.bLength != 0);
         status = RequestCopyFromBuffer(Request,
-            &G_DefaultHidDescriptor,
-            G_DefaultHidDescriptor.bLength);
+            &deviceContext->HidDescriptor,
+            deviceContext->HidDescriptor.bLength);
         break;
     case IOCTL_HID_GET_REPORT_DESCRIPTOR:   // METHOD_NEITHER
         //
         //Obtains the report descriptor for the HID device.
         //
+        _Analysis_assume_(deviceContext->HidDescriptor.DescriptorList[0].wReportLength != 0);
         status = RequestCopyFromBuffer(Request,
-            &G_DefaultReportDescriptor,
-            sizeof(G_DefaultReportDescriptor));
+            deviceContext->ReportDescriptor,
+            deviceContext->HidDescriptor.DescriptorList[0].wReportLength);
         break;
 
     case IOCTL_HID_READ_REPORT:             // METHOD_NEITHER
@@ -525,7 +586,12 @@ Return Value:
         break;
 
     case IOCTL_HID_GET_FEATURE:             // METHOD_OUT_DIRECT
+        status = GetFeature(queueContext, Request);
+        break;
     case IOCTL_HID_SET_FEATURE:             // METHOD_IN_DIRECT
+        status = SetFeature(queueContext, Request);
+        break;
+
     case IOCTL_HID_SEND_IDLE_NOTIFICATION_REQUEST:  // METHOD_NEITHER
         //
         // This has the USBSS Idle notification callback. If the lower driver
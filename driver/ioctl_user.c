@@ -22,7 +22,7 @@ UserQueueCreate(
 
     status = WdfIoQueueCreate(Device, &queueConfig, &queueAttributes, &queue);
     if (!NT_SUCCESS(status)) {
-        KdPrint(("WdfIoQueueCreate failed 0x%x\n", status));
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "WdfIoQueueCreate failed 0x%x\n", status);
         return status;
     }
     queueContext = GetQueueContext(queue);
@@ -31,13 +31,13 @@ UserQueueCreate(
 
     status = WdfDeviceConfigureRequestDispatching(Device, queue, WdfRequestTypeDeviceControl);
     if (!NT_SUCCESS(status)) {
-        KdPrint(("WdfDeviceConfigureRequestDispatching failed 0x%x\n", status));
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "WdfDeviceConfigureRequestDispatching failed 0x%x\n", status);
         return status;
     }
 
     status = WdfDeviceCreateDeviceInterface(Device, &GUID_DEVINTERFACE_VHIDMINI, NULL);
     if (!NT_SUCCESS(status)) {
-        KdPrint(("WdfDeviceCreateDeviceInterface failed 0x%x\n", status));
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "WdfDeviceCreateDeviceInterface failed 0x%x\n", status);
         return status;
     }
 
@@ -45,27 +45,54 @@ UserQueueCreate(
     return status;
 }
 
-NTSTATUS SendReport(PDEVICE_CONTEXT Ctx, VOID* Report, size_t Size)
+PKEY_OWNER
+RequestKeyOwner(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Returns the key state of the client issuing Request. Requests without
+    a file object share the device's own.
+
+--*/
 {
-    WDFREQUEST request;
-    NTSTATUS status;
+    WDFFILEOBJECT           fileObject = WdfRequestGetFileObject(Request);
 
-    status = WdfIoQueueRetrieveNextRequest(Ctx->ManualQueue, &request);
-    if (!NT_SUCCESS(status))
-        return status;
+    if (fileObject == NULL)
+        return &DeviceContext->DeviceKeys;
 
-    status = RequestCopyFromBuffer(request, Report, Size);
-    WdfRequestComplete(request, status);
-    return status;
+    return &GetFileContext(fileObject)->Keys;
 }
 
-VOID updateKey(PHID_KEYBOARD_REPORT report, UCHAR old, UCHAR new) {
-    for (int i = 0; i < 6; i++) {
-        if (report->Keys[i] == old) {
-            report->Keys[i] = new;
-            return;
-        }
-    }
+BOOLEAN
+RequestCompleteWithSequence(
+    _In_  WDFREQUEST        Request,
+    _In_  size_t            OutputBufferLength,
+    _In_  ULONG             Sequence
+    )
+/*++
+Routine Description:
+
+    Completes a successful injection request with its sequence number, if
+    the caller passed an output buffer for it.
+
+Return Value:
+
+    TRUE if the request was completed.
+
+--*/
+{
+    PULONG                  output;
+
+    if (OutputBufferLength < sizeof(ULONG) ||
+        !NT_SUCCESS(WdfRequestRetrieveOutputBuffer(Request, sizeof(ULONG), (PVOID*)&output, NULL)))
+        return FALSE;
+
+    *output = Sequence;
+    WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, sizeof(ULONG));
+    return TRUE;
 }
 
 VOID
@@ -78,9 +105,10 @@ EvtIoDeviceControl(
 )
 {
     PDEVICE_CONTEXT          deviceContext = GetQueueContext(Queue)->DeviceContext;
-    UNREFERENCED_PARAMETER(OutputBufferLength);
+    PKEY_OWNER               owner = RequestKeyOwner(deviceContext, Request);
+    BOOLEAN                  completeRequest = TRUE;
 
-    KdPrint(("IOCtl received 0x%x\n", IoControlCode));
+    VhidLog(LOG_USER, LOG_LEVEL_VERBOSE, "IOCtl received 0x%x\n", IoControlCode);
 
 	NTSTATUS status;
     switch (IoControlCode)
@@ -92,32 +120,278 @@ EvtIoDeviceControl(
             break;
         }
         PVHID_KEY_EVENT keyEvent;
+        ULONG sequence;
         status = WdfRequestRetrieveInputBuffer(Request, sizeof(VHID_KEY_EVENT), (PVOID*)&keyEvent, NULL);
         if (NT_SUCCESS(status)) {
-			UCHAR KeyCode = keyEvent->KeyCode;
-            WdfWaitLockAcquire(deviceContext->StateLock, NULL);
-            if (KeyCode >= 0xE0 && KeyCode <= 0xE7) {
-                UCHAR mask = 1 << (KeyCode - 0xE0);
-                if (keyEvent->Pressed)
-                    deviceContext->KeyboardState.Modifiers |= mask;
-                else
-                    deviceContext->KeyboardState.Modifiers &= ~mask;
-            }
-            else {
-                if (keyEvent->Pressed)
-                    updateKey(&deviceContext->KeyboardState, 0, KeyCode);
-                else
-                    updateKey(&deviceContext->KeyboardState, KeyCode, 0);
-            }
-			if(SendReport(deviceContext, &deviceContext->KeyboardState, sizeof(HID_KEYBOARD_REPORT)) == STATUS_NO_MORE_ENTRIES)
-				deviceContext->KeyboardChanged = TRUE;
-            WdfWaitLockRelease(deviceContext->StateLock);
+            StateLockAcquire(deviceContext);
+            sequence = InjectOpen(deviceContext);
+            InjectKeyEvent(deviceContext, owner, keyEvent->KeyCode, keyEvent->Pressed != 0);
+            InjectClose(deviceContext, sequence);
+            StateLockRelease(deviceContext);
+            completeRequest = !RequestCompleteWithSequence(Request, OutputBufferLength, sequence);
         }
         break;
 	}
+    case IOCTL_VHIDMINI_MOVE_EVENT:
+    {
+        PVHID_MOUSE_EVENT moveEvent;
+        ULONG sequence;
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(VHID_MOUSE_MOVE), (PVOID*)&moveEvent, NULL);
+        if (NT_SUCCESS(status)) {
+            StateLockAcquire(deviceContext);
+            sequence = InjectOpen(deviceContext);
+            InjectMouseMove(deviceContext, moveEvent->DeltaX, moveEvent->DeltaY);
+            InjectClose(deviceContext, sequence);
+            StateLockRelease(deviceContext);
+            completeRequest = !RequestCompleteWithSequence(Request, OutputBufferLength, sequence);
+        }
+        break;
+    }
+    case IOCTL_VHIDMINI_BUTTON_EVENT:
+    {
+        PVHID_MOUSE_BUTTON buttonEvent;
+        ULONG sequence;
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(VHID_MOUSE_BUTTON), (PVOID*)&buttonEvent, NULL);
+        if (NT_SUCCESS(status)) {
+            StateLockAcquire(deviceContext);
+            sequence = InjectOpen(deviceContext);
+            InjectMouseButtons(deviceContext, owner, buttonEvent->ButtonMask);
+            InjectClose(deviceContext, sequence);
+            StateLockRelease(deviceContext);
+            completeRequest = !RequestCompleteWithSequence(Request, OutputBufferLength, sequence);
+        }
+        break;
+    }
+    case IOCTL_VHIDMINI_GAMEPAD_EVENT:
+    {
+        PVHID_GAMEPAD_STATE gamepadState;
+        ULONG sequence;
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(VHID_GAMEPAD_STATE), (PVOID*)&gamepadState, NULL);
+        if (NT_SUCCESS(status)) {
+            StateLockAcquire(deviceContext);
+            sequence = InjectOpen(deviceContext);
+            InjectGamepad(deviceContext, gamepadState);
+            InjectClose(deviceContext, sequence);
+            StateLockRelease(deviceContext);
+            completeRequest = !RequestCompleteWithSequence(Request, OutputBufferLength, sequence);
+        }
+        break;
+    }
+    case IOCTL_VHIDMINI_GET_SNAPSHOT:
+    {
+        PVHID_SNAPSHOT snapshot;
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VHID_SNAPSHOT), (PVOID*)&snapshot, NULL);
+        if (!NT_SUCCESS(status))
+            break;
+        StateLockAcquire(deviceContext);
+        InjectSnapshot(deviceContext, owner, snapshot);
+        StateLockRelease(deviceContext);
+        WdfRequestCompleteWithInformation(Request, status, sizeof(VHID_SNAPSHOT));
+        completeRequest = FALSE;
+        break;
+    }
+    case IOCTL_VHIDMINI_RESTORE_SNAPSHOT:
+    {
+        PVHID_SNAPSHOT snapshot;
+        ULONG sequence;
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(VHID_SNAPSHOT), (PVOID*)&snapshot, NULL);
+        if (!NT_SUCCESS(status))
+            break;
+        if (snapshot->Reserved != 0 || (snapshot->Collections & ~VHID_COLLECTION_ALL) != 0 ||
+            (snapshot->Buttons & ~0x07) != 0) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        sequence = InjectRestore(deviceContext, owner, snapshot);
+        completeRequest = !RequestCompleteWithSequence(Request, OutputBufferLength, sequence);
+        break;
+    }
+    case IOCTL_VHIDMINI_SEND_BATCH:
+    {
+        PVHID_BATCH_HEADER batch;
+        ULONG sequence;
+        size_t length;
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(VHID_BATCH_HEADER), (PVOID*)&batch, &length);
+        if (!NT_SUCCESS(status))
+            break;
+        if (batch->Reserved != 0 || batch->Count > VHID_BATCH_MAX_EVENTS ||
+            length < sizeof(VHID_BATCH_HEADER) + batch->Count * sizeof(VHID_BATCH_EVENT)) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        status = InjectBatch(deviceContext, owner, (const VHID_BATCH_EVENT*)(batch + 1), batch->Count, &sequence);
+        if (NT_SUCCESS(status))
+            completeRequest = !RequestCompleteWithSequence(Request, OutputBufferLength, sequence);
+        break;
+    }
+    case IOCTL_VHIDMINI_RUN_MACRO:
+    {
+        PUCHAR code;
+        ULONG id;
+        size_t length;
+        status = WdfRequestRetrieveInputBuffer(Request, 1, (PVOID*)&code, &length);
+        if (!NT_SUCCESS(status))
+            break;
+        status = MacroStart(deviceContext, WdfRequestGetFileObject(Request), code, length, &id);
+        if (NT_SUCCESS(status))
+            completeRequest = !RequestCompleteWithSequence(Request, OutputBufferLength, id);
+        break;
+    }
+    case IOCTL_VHIDMINI_SEND_CHORD:
+    {
+        PVHID_CHORD chord;
+        ULONG sequence;
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(VHID_CHORD), (PVOID*)&chord, NULL);
+        if (!NT_SUCCESS(status))
+            break;
+        status = ChordStart(deviceContext, WdfRequestGetFileObject(Request), chord, &sequence);
+        if (NT_SUCCESS(status))
+            completeRequest = !RequestCompleteWithSequence(Request, OutputBufferLength, sequence);
+        break;
+    }
+    case IOCTL_VHIDMINI_CANCEL_MACRO:
+    {
+        PULONG macroId;
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(ULONG), (PVOID*)&macroId, NULL);
+        if (!NT_SUCCESS(status))
+            break;
+        StateLockAcquire(deviceContext);
+        if (MacroCancel(deviceContext, WdfRequestGetFileObject(Request), *macroId) == 0)
+            status = STATUS_NOT_FOUND;
+        StateLockRelease(deviceContext);
+        break;
+    }
+    case IOCTL_VHIDMINI_SEND_STREAM:
+    {
+        PUCHAR data;
+        size_t length;
+        size_t consumed = 0;
+        //
+        // METHOD_IN_DIRECT: the payload is the output buffer, mapped from
+        // the caller's locked pages.
+        //
+        status = WdfRequestRetrieveOutputBuffer(Request, 1, (PVOID*)&data, &length);
+        if (!NT_SUCCESS(status))
+            break;
+        status = InjectStream(deviceContext, owner, data, length, &consumed);
+        WdfRequestCompleteWithInformation(Request, status, consumed);
+        completeRequest = FALSE;
+        break;
+    }
+    case IOCTL_VHIDMINI_TYPE_TEXT_DIRECT:
+    {
+        PVHID_TYPE_TEXT typeText;
+        VHID_TYPE_TEXT_RESULT result = { 0 };
+        PUCHAR text;
+        size_t length;
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(VHID_TYPE_TEXT), (PVOID*)&typeText, NULL);
+        if (!NT_SUCCESS(status))
+            break;
+        if (typeText->Reserved != 0) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        status = WdfRequestRetrieveOutputBuffer(Request, 1, (PVOID*)&text, &length);
+        if (!NT_SUCCESS(status))
+            break;
+        status = TypeText(deviceContext, owner, typeText->Layout, text, length, &result);
+        WdfRequestCompleteWithInformation(Request, status, result.Consumed);
+        completeRequest = FALSE;
+        break;
+    }
+    case IOCTL_VHIDMINI_TYPE_TEXT:
+    {
+        PVHID_TYPE_TEXT typeText;
+        PVHID_TYPE_TEXT_RESULT typeResult;
+        VHID_TYPE_TEXT_RESULT result;
+        size_t resultLength;
+        size_t length;
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(VHID_TYPE_TEXT), (PVOID*)&typeText, &length);
+        if (!NT_SUCCESS(status))
+            break;
+        if (typeText->Reserved != 0) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        //
+        // METHOD_BUFFERED: input and output share the system buffer, copy
+        // the result out only once the text has been consumed. Callers
+        // built before Sequence was added get the result without it.
+        //
+        status = TypeText(deviceContext, owner, typeText->Layout, (const UCHAR*)(typeText + 1), length - sizeof(VHID_TYPE_TEXT), &result);
+        resultLength = OutputBufferLength >= sizeof(VHID_TYPE_TEXT_RESULT) ?
+            sizeof(VHID_TYPE_TEXT_RESULT) : FIELD_OFFSET(VHID_TYPE_TEXT_RESULT, Sequence);
+        if (NT_SUCCESS(status) && OutputBufferLength >= resultLength &&
+            NT_SUCCESS(WdfRequestRetrieveOutputBuffer(Request, resultLength, (PVOID*)&typeResult, NULL))) {
+            RtlCopyMemory(typeResult, &result, resultLength);
+            WdfRequestCompleteWithInformation(Request, status, resultLength);
+            completeRequest = FALSE;
+        }
+        break;
+    }
+    case IOCTL_VHIDMINI_GET_STATS:
+    {
+        VHID_STATS stats;
+        StateLockAcquire(deviceContext);
+        stats.StateLockCount = deviceContext->StateLockCount;
+        stats.StateLockHoldTotal = deviceContext->StateLockHoldTotal;
+        stats.StateLockHoldMax = deviceContext->StateLockHoldMax;
+        stats.ReportsMerged = deviceContext->Reports.Merged;
+        stats.ReportsDropped = deviceContext->Reports.Dropped;
+        stats.ReportsPending = deviceContext->Reports.Count;
+        stats.ReportsSuppressed = deviceContext->Idle.Suppressed;
+        StateLockRelease(deviceContext);
+        stats.NodesInUse = deviceContext->Nodes.InUse;
+        stats.NodesPeak = deviceContext->Nodes.Peak;
+        stats.NodeFailures = deviceContext->Nodes.Failures;
+        status = RequestCopyFromBuffer(Request, &stats, sizeof(stats));
+        break;
+    }
+    case IOCTL_VHIDMINI_GET_TRACE:
+    {
+        PVHID_TRACE_RECORD records;
+        PULONG firstSequence;
+        ULONG first = 0;
+        ULONG count;
+        size_t length;
+        if (InputBufferLength >= sizeof(ULONG) &&
+            NT_SUCCESS(WdfRequestRetrieveInputBuffer(Request, sizeof(ULONG), (PVOID*)&firstSequence, NULL)))
+            first = *firstSequence;
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VHID_TRACE_RECORD), (PVOID*)&records, &length);
+        if (!NT_SUCCESS(status))
+            break;
+        count = TraceRingRead(&deviceContext->Trace, first, records, (ULONG)(length / sizeof(VHID_TRACE_RECORD)));
+        WdfRequestCompleteWithInformation(Request, status, count * sizeof(VHID_TRACE_RECORD));
+        completeRequest = FALSE;
+        break;
+    }
+    case IOCTL_VHIDMINI_GET_RECEIPTS:
+    {
+        PVHID_RECEIPT receipts;
+        PULONG firstSequence;
+        ULONG first = 0;
+        ULONG count;
+        size_t length;
+        if (InputBufferLength >= sizeof(ULONG) &&
+            NT_SUCCESS(WdfRequestRetrieveInputBuffer(Request, sizeof(ULONG), (PVOID*)&firstSequence, NULL)))
+            first = *firstSequence;
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VHID_RECEIPT), (PVOID*)&receipts, &length);
+        if (!NT_SUCCESS(status))
+            break;
+        StateLockAcquire(deviceContext);
+        count = ReceiptRingRead(&deviceContext->Receipts, first, receipts, (ULONG)(length / sizeof(VHID_RECEIPT)));
+        StateLockRelease(deviceContext);
+        WdfRequestCompleteWithInformation(Request, status, count * sizeof(VHID_RECEIPT));
+        completeRequest = FALSE;
+        break;
+    }
+    case IOCTL_VHIDMINI_WAIT_EVENT:
+        status = NotifyWaitEvent(deviceContext, Request, OutputBufferLength, &completeRequest);
+        break;
     default:
         status = STATUS_INVALID_DEVICE_REQUEST;
         break;
     }
-    WdfRequestComplete(Request, status);
+    if (completeRequest)
+        WdfRequestComplete(Request, status);
 }
\ No newline at end of file
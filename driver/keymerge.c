@@ -0,0 +1,190 @@
+#include "vhidport.h"
+#include "keymerge.h"
+
+VOID
+KeyMergeInit(
+    _Out_ PKEY_MERGE        Merge
+    )
+{
+    RtlZeroMemory(Merge, sizeof(KEY_MERGE));
+}
+
+VOID
+KeyOwnerInit(
+    _Out_ PKEY_OWNER        Owner
+    )
+{
+    RtlZeroMemory(Owner, sizeof(KEY_OWNER));
+}
+
+BOOLEAN
+KeyMergeApplyKey(
+    _Inout_ PKEY_MERGE      Merge,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  UCHAR             KeyCode,
+    _In_  BOOLEAN           Pressed
+    )
+/*++
+
+Routine Description:
+
+    Records a key transition for one client.
+
+Return Value:
+
+    TRUE if the merged state of the key changed, that is if this was the
+    first client to press it or the last one to release it.
+
+--*/
+{
+    ULONG                   bit = 1u << (KeyCode & 31);
+    PULONG                  word = &Owner->Keys[KeyCode >> 5];
+
+    if (Pressed) {
+        if (*word & bit)
+            return FALSE;
+        *word |= bit;
+        return Merge->KeyRefs[KeyCode]++ == 0;
+    }
+
+    if (!(*word & bit))
+        return FALSE;
+    *word &= ~bit;
+    return --Merge->KeyRefs[KeyCode] == 0;
+}
+
+BOOLEAN
+KeyMergeApplyButtons(
+    _Inout_ PKEY_MERGE      Merge,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  UCHAR             ButtonMask
+    )
+/*++
+
+Routine Description:
+
+    Replaces the buttons one client holds with ButtonMask.
+
+Return Value:
+
+    TRUE if the merged button state changed.
+
+--*/
+{
+    UCHAR                   changed = (Owner->Buttons ^ ButtonMask) & ((1 << KEY_MERGE_BUTTONS) - 1);
+    UCHAR                   before = Merge->Buttons;
+    ULONG                   i;
+
+    for (i = 0; i < KEY_MERGE_BUTTONS; i++) {
+        if (!(changed & (1 << i)))
+            continue;
+        if (ButtonMask & (1 << i)) {
+            if (Merge->ButtonRefs[i]++ == 0)
+                Merge->Buttons |= 1 << i;
+        }
+        else {
+            if (--Merge->ButtonRefs[i] == 0)
+                Merge->Buttons &= ~(1 << i);
+        }
+    }
+    Owner->Buttons ^= changed;
+
+    return Merge->Buttons != before;
+}
+
+ULONG
+KeyMergeRetract(
+    _Inout_ PKEY_MERGE      Merge,
+    _Inout_ PKEY_OWNER      Owner,
+    _Out_writes_to_(KEY_MERGE_USAGES, return) PUCHAR Released,
+    _Out_ PBOOLEAN          ButtonsChanged
+    )
+/*++
+
+Routine Description:
+
+    Withdraws everything a client holds, when it goes away. Only the set
+    bits of the client's bitmap are visited.
+
+Return Value:
+
+    The number of keys no other client holds, which are now released and
+    listed in Released.
+
+--*/
+{
+    ULONG                   count = 0;
+    ULONG                   i;
+    ULONG                   word;
+    ULONG                   bit;
+
+    for (i = 0; i < ARRAYSIZE(Owner->Keys); i++) {
+        word = Owner->Keys[i];
+        while (word != 0) {
+            BitScanForward(&bit, word);
+            word &= word - 1;
+            if (--Merge->KeyRefs[i * 32 + bit] == 0)
+                Released[count++] = (UCHAR)(i * 32 + bit);
+        }
+        Owner->Keys[i] = 0;
+    }
+
+    *ButtonsChanged = KeyMergeApplyButtons(Merge, Owner, 0);
+    return count;
+}
+
+VOID
+KeyMergeHeld(
+    _In_  const KEY_MERGE*  Merge,
+    _Out_writes_(KEY_MERGE_USAGES / 32) PULONG Keys
+    )
+/*++
+
+Routine Description:
+
+    Fills a bitmap of the keys held by any client.
+
+--*/
+{
+    ULONG                   i;
+
+    RtlZeroMemory(Keys, KEY_MERGE_USAGES / 8);
+    for (i = 0; i < KEY_MERGE_USAGES; i++) {
+        if (Merge->KeyRefs[i] != 0)
+            Keys[i >> 5] |= 1u << (i & 31);
+    }
+}
+
+VOID
+KeyMergeWithdraw(
+    _Inout_ PKEY_MERGE      Merge,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_reads_(KEY_MERGE_USAGES / 32) const ULONG* Keys,
+    _In_  UCHAR             Buttons
+    )
+/*++
+
+Routine Description:
+
+    Takes the keys of the bitmap Keys and the buttons of Buttons away from
+    a client, as if it had released them. Withdrawing them from every
+    client releases them on the device.
+
+--*/
+{
+    ULONG                   i;
+    ULONG                   word;
+    ULONG                   bit;
+
+    for (i = 0; i < ARRAYSIZE(Owner->Keys); i++) {
+        word = Owner->Keys[i] & Keys[i];
+        Owner->Keys[i] &= ~word;
+        while (word != 0) {
+            BitScanForward(&bit, word);
+            word &= word - 1;
+            Merge->KeyRefs[i * 32 + bit]--;
+        }
+    }
+
+    KeyMergeApplyButtons(Merge, Owner, Owner->Buttons & ~Buttons);
+}
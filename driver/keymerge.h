@@ -0,0 +1,72 @@
+#ifndef __KEYMERGE_H_
+#define __KEYMERGE_H_
+
+//
+// Merges the keys and buttons held by several clients into the state the
+// device reports. Each client records what it holds in a KEY_OWNER bitmap;
+// the device keeps a reference count per usage, so a key is reported down
+// while any client holds it. Pressing a key a client already holds, or
+// releasing one it doesn't, changes nothing.
+//
+#define KEY_MERGE_USAGES        256
+#define KEY_MERGE_BUTTONS       3
+
+typedef struct _KEY_OWNER {
+    ULONG                   Keys[KEY_MERGE_USAGES / 32];
+    UCHAR                   Buttons;
+} KEY_OWNER, *PKEY_OWNER;
+
+typedef struct _KEY_MERGE {
+    USHORT                  KeyRefs[KEY_MERGE_USAGES];
+    USHORT                  ButtonRefs[KEY_MERGE_BUTTONS];
+    UCHAR                   Buttons;        // merged, bit set while any ref
+} KEY_MERGE, *PKEY_MERGE;
+
+VOID
+KeyMergeInit(
+    _Out_ PKEY_MERGE        Merge
+    );
+
+VOID
+KeyOwnerInit(
+    _Out_ PKEY_OWNER        Owner
+    );
+
+BOOLEAN
+KeyMergeApplyKey(
+    _Inout_ PKEY_MERGE      Merge,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  UCHAR             KeyCode,
+    _In_  BOOLEAN           Pressed
+    );
+
+BOOLEAN
+KeyMergeApplyButtons(
+    _Inout_ PKEY_MERGE      Merge,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  UCHAR             ButtonMask
+    );
+
+ULONG
+KeyMergeRetract(
+    _Inout_ PKEY_MERGE      Merge,
+    _Inout_ PKEY_OWNER      Owner,
+    _Out_writes_to_(KEY_MERGE_USAGES, return) PUCHAR Released,
+    _Out_ PBOOLEAN          ButtonsChanged
+    );
+
+VOID
+KeyMergeHeld(
+    _In_  const KEY_MERGE*  Merge,
+    _Out_writes_(KEY_MERGE_USAGES / 32) PULONG Keys
+    );
+
+VOID
+KeyMergeWithdraw(
+    _Inout_ PKEY_MERGE      Merge,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_reads_(KEY_MERGE_USAGES / 32) const ULONG* Keys,
+    _In_  UCHAR             Buttons
+    );
+
+#endif // __KEYMERGE_H_
@@ -0,0 +1,574 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "layout.h"
+
+//
+// Item types and tags, HID 1.11 section 6.2.2.
+//
+#define ITEM_MAIN               0
+#define ITEM_GLOBAL             1
+#define ITEM_LOCAL              2
+#define ITEM_LONG_PREFIX        0xFE
+
+#define MAIN_COLLECTION         0x0A
+#define MAIN_END_COLLECTION     0x0C
+
+#define GLOBAL_USAGE_PAGE       0x00
+#define GLOBAL_LOGICAL_MIN      0x01
+#define GLOBAL_LOGICAL_MAX      0x02
+#define GLOBAL_REPORT_SIZE      0x07
+#define GLOBAL_REPORT_ID        0x08
+#define GLOBAL_REPORT_COUNT     0x09
+#define GLOBAL_PUSH             0x0A
+#define GLOBAL_POP              0x0B
+
+#define LOCAL_USAGE             0x00
+#define LOCAL_USAGE_MIN         0x01
+#define LOCAL_USAGE_MAX         0x02
+
+#define MAIN_CONSTANT           0x01
+
+typedef struct _LAYOUT_GLOBALS {
+    ULONG                   UsagePage;
+    LONG                    LogicalMin;
+    LONG                    LogicalMax;
+    ULONG                   ReportSize;
+    ULONG                   ReportId;
+    ULONG                   ReportCount;
+} LAYOUT_GLOBALS;
+
+typedef struct _LAYOUT_LOCALS {
+    ULONG                   UsageCount;
+    ULONG                   Usages[LAYOUT_MAX_USAGES];     // page in the high word
+    ULONG                   UsageMin;
+    ULONG                   UsageMax;
+    BOOLEAN                 HasMin;
+    BOOLEAN                 HasMax;
+} LAYOUT_LOCALS;
+
+static
+ULONG
+ItemUsage(
+    _In_  ULONG             Usage,
+    _In_  ULONG             UsagePage
+    )
+{
+    //
+    // A four byte usage carries its own page in the high word.
+    //
+    return (Usage > 0xFFFF) ? Usage : (UsagePage << 16) | Usage;
+}
+
+static
+UCHAR
+FieldShape(
+    _In_  const LAYOUT_FIELD* Field
+    )
+{
+    if (Field->BitSize == 1)
+        return FIELD_SHAPE_BIT;
+    if ((Field->BitOffset % 8) == 0 &&
+        (Field->BitSize == 8 || Field->BitSize == 16 || Field->BitSize == 32))
+        return FIELD_SHAPE_BYTES;
+    return FIELD_SHAPE_GENERIC;
+}
+
+static
+PLAYOUT_REPORT
+LayoutReport(
+    _Inout_ PDESCRIPTOR_LAYOUT Layout,
+    _In_  UCHAR             ReportId,
+    _In_  UCHAR             Type
+    )
+{
+    PLAYOUT_REPORT          report;
+
+    report = (PLAYOUT_REPORT)LayoutFindReport(Layout, ReportId, Type);
+    if (report != NULL || Layout->ReportCount == LAYOUT_MAX_REPORTS)
+        return report;
+
+    report = &Layout->Reports[Layout->ReportCount++];
+    report->ReportId = ReportId;
+    report->Type = Type;
+    report->BitLength = ReportId != 0 ? 8 : 0;
+    report->FirstField = (UCHAR)Layout->FieldCount;
+    report->FieldCount = 0;
+    return report;
+}
+
+static
+PLAYOUT_FIELD
+LayoutAddField(
+    _Inout_ PDESCRIPTOR_LAYOUT Layout,
+    _Inout_ PLAYOUT_REPORT  Report,
+    _In_  ULONG             BitOffset,
+    _In_  const LAYOUT_GLOBALS* Globals,
+    _In_  ULONG             Count,
+    _In_  UCHAR             Flags,
+    _In_  ULONG             UsageMin,
+    _In_  ULONG             UsageMax
+    )
+{
+    PLAYOUT_FIELD           field;
+    ULONG                   position = Report->FirstField + Report->FieldCount;
+    ULONG                   i;
+
+    if (Layout->FieldCount == LAYOUT_MAX_FIELDS)
+        return NULL;
+
+    //
+    // Items of different reports may interleave, a keyboard's LED output
+    // between its inputs for one; fields are kept grouped by report.
+    //
+    RtlMoveMemory(&Layout->Fields[position + 1], &Layout->Fields[position],
+                  (Layout->FieldCount - position) * sizeof(LAYOUT_FIELD));
+    for (i = 0; i < Layout->ReportCount; i++) {
+        if (&Layout->Reports[i] != Report && Layout->Reports[i].FirstField >= position)
+            Layout->Reports[i].FirstField++;
+    }
+    Layout->FieldCount++;
+    Report->FieldCount++;
+
+    field = &Layout->Fields[position];
+
+    field->BitOffset = (USHORT)BitOffset;
+    field->BitSize = (UCHAR)Globals->ReportSize;
+    field->Count = (UCHAR)Count;
+    field->Flags = Flags;
+    if (Globals->LogicalMin < 0)
+        field->Flags |= FIELD_SIGNED;
+    field->UsagePage = (USHORT)(UsageMin >> 16);
+    field->UsageMin = (USHORT)UsageMin;
+    field->UsageMax = (USHORT)UsageMax;
+    field->LogicalMin = Globals->LogicalMin;
+    field->LogicalMax = Globals->LogicalMax;
+    field->Shape = FieldShape(field);
+    return field;
+}
+
+static
+BOOLEAN
+LayoutMainItem(
+    _Inout_ PDESCRIPTOR_LAYOUT Layout,
+    _In_  UCHAR             Type,
+    _In_  ULONG             Data,
+    _In_  const LAYOUT_GLOBALS* Globals,
+    _In_  const LAYOUT_LOCALS* Locals
+    )
+/*++
+
+Routine Description:
+
+    Lays out the fields of an Input, Output or Feature item at the end of
+    its report. A variable item listing its usages one by one becomes a
+    field per element, since the usages need not be consecutive; any other
+    item is a single field covering its usage range.
+
+--*/
+{
+    PLAYOUT_REPORT          report;
+    ULONG                   bits = Globals->ReportSize * Globals->ReportCount;
+    ULONG                   offset;
+    ULONG                   usageMin, usageMax;
+    ULONG                   i;
+    UCHAR                   flags = (UCHAR)(Data & (FIELD_VARIABLE | FIELD_RELATIVE));
+
+    if (Globals->ReportSize == 0 || Globals->ReportSize > 32 || Globals->ReportCount > 0xFF)
+        return FALSE;
+    if (Globals->LogicalMin > Globals->LogicalMax)
+        return FALSE;
+
+    report = LayoutReport(Layout, (UCHAR)Globals->ReportId, Type);
+    if (report == NULL)
+        return FALSE;
+
+    offset = report->BitLength;
+    if (offset + bits > LAYOUT_MAX_REPORT_BYTES * 8)
+        return FALSE;
+    report->BitLength = (USHORT)(offset + bits);
+
+    if ((Data & MAIN_CONSTANT) != 0 || bits == 0)
+        return TRUE;
+
+    if ((flags & FIELD_VARIABLE) != 0 && Locals->UsageCount != 0 && !Locals->HasMin) {
+        //
+        // Elements past the end of the list repeat its last usage, and
+        // share its field.
+        //
+        ULONG last = min(Locals->UsageCount, Globals->ReportCount) - 1;
+
+        for (i = 0; i <= last; i++) {
+            ULONG usage = Locals->Usages[i];
+            ULONG count = (i == last) ? Globals->ReportCount - last : 1;
+            if (LayoutAddField(Layout, report, offset + i * Globals->ReportSize,
+                               Globals, count, flags, usage, usage) == NULL)
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    if (Locals->HasMin || Locals->HasMax) {
+        if (!Locals->HasMin || !Locals->HasMax)
+            return FALSE;
+        usageMin = Locals->UsageMin;
+        usageMax = Locals->UsageMax;
+        if ((usageMin >> 16) != (usageMax >> 16) || usageMin > usageMax)
+            return FALSE;
+    }
+    else if (Locals->UsageCount != 0) {
+        usageMin = Locals->Usages[0];
+        usageMax = Locals->Usages[Locals->UsageCount - 1];
+        if ((usageMin >> 16) != (usageMax >> 16) || usageMin > usageMax)
+            usageMax = usageMin;
+    }
+    else {
+        usageMin = usageMax = Globals->UsagePage << 16;
+    }
+
+    return LayoutAddField(Layout, report, offset, Globals, Globals->ReportCount,
+                          flags, usageMin, usageMax) != NULL;
+}
+
+BOOLEAN
+LayoutParse(
+    _In_reads_bytes_(Length) const UCHAR* Descriptor,
+    _In_  ULONG             Length,
+    _Out_ PDESCRIPTOR_LAYOUT Layout,
+    _Out_ PULONG            ErrorOffset
+    )
+/*++
+
+Routine Description:
+
+    Walks a report descriptor item by item and lays out every report it
+    declares. Anything the HID class driver would refuse to parse is
+    rejected here too: truncated or long items, main items outside of a
+    collection, unbalanced collections or Push/Pop, usage ranges missing a
+    bound, fields wider than 32 bits, reports over LAYOUT_MAX_REPORT_BYTES
+    and report id 0.
+
+Arguments:
+
+    Descriptor - the report descriptor, which may come from anywhere.
+
+    ErrorOffset - receives the offset of the item that was rejected, or
+        Length if the descriptor ended early.
+
+Return Value:
+
+    TRUE if the descriptor is well formed and Layout describes it.
+
+--*/
+{
+    LAYOUT_GLOBALS          globals;
+    LAYOUT_GLOBALS          stack[LAYOUT_MAX_PUSH];
+    LAYOUT_LOCALS           locals;
+    ULONG                   pushed = 0;
+    ULONG                   depth = 0;
+    ULONG                   offset = 0;
+    BOOLEAN                 mainSeen = FALSE;
+    BOOLEAN                 usesIds = FALSE;
+
+    RtlZeroMemory(Layout, sizeof(*Layout));
+    RtlZeroMemory(&globals, sizeof(globals));
+    RtlZeroMemory(&locals, sizeof(locals));
+
+    while (offset < Length) {
+        UCHAR       prefix = Descriptor[offset];
+        ULONG       size = (prefix & 0x03) == 3 ? 4 : (prefix & 0x03);
+        ULONG       type = (prefix >> 2) & 0x03;
+        ULONG       tag = prefix >> 4;
+        ULONG       data = 0;
+        LONG        value;
+        ULONG       i;
+
+        *ErrorOffset = offset;
+
+        if (prefix == ITEM_LONG_PREFIX || Length - offset - 1 < size)
+            return FALSE;
+
+        for (i = 0; i < size; i++)
+            data |= (ULONG)Descriptor[offset + 1 + i] << (8 * i);
+
+        //
+        // Logical bounds are signed in the size they were given in.
+        //
+        if (size == 1)
+            value = (CHAR)data;
+        else if (size == 2)
+            value = (SHORT)data;
+        else
+            value = (LONG)data;
+
+        switch (type) {
+        case ITEM_MAIN:
+            switch (tag) {
+            case LAYOUT_INPUT:
+            case LAYOUT_OUTPUT:
+            case LAYOUT_FEATURE:
+                if (depth == 0 || (usesIds && globals.ReportId == 0))
+                    return FALSE;
+                if (!LayoutMainItem(Layout, (UCHAR)tag, data, &globals, &locals))
+                    return FALSE;
+                mainSeen = TRUE;
+                break;
+            case MAIN_COLLECTION:
+                if (depth == LAYOUT_MAX_DEPTH)
+                    return FALSE;
+                depth++;
+                break;
+            case MAIN_END_COLLECTION:
+                if (depth == 0)
+                    return FALSE;
+                depth--;
+                break;
+            default:
+                return FALSE;
+            }
+            RtlZeroMemory(&locals, sizeof(locals));
+            break;
+
+        case ITEM_GLOBAL:
+            switch (tag) {
+            case GLOBAL_USAGE_PAGE:
+                if (data > 0xFFFF)
+                    return FALSE;
+                globals.UsagePage = data;
+                break;
+            case GLOBAL_LOGICAL_MIN:
+                globals.LogicalMin = value;
+                break;
+            case GLOBAL_LOGICAL_MAX:
+                globals.LogicalMax = value;
+                break;
+            case GLOBAL_REPORT_SIZE:
+                globals.ReportSize = data;
+                break;
+            case GLOBAL_REPORT_ID:
+                //
+                // Ids have to come before the first report, or every
+                // report declared so far would be missing one.
+                //
+                if (data == 0 || data > 0xFF || (mainSeen && !usesIds))
+                    return FALSE;
+                usesIds = TRUE;
+                globals.ReportId = data;
+                break;
+            case GLOBAL_REPORT_COUNT:
+                globals.ReportCount = data;
+                break;
+            case GLOBAL_PUSH:
+                if (pushed == LAYOUT_MAX_PUSH)
+                    return FALSE;
+                stack[pushed++] = globals;
+                break;
+            case GLOBAL_POP:
+                if (pushed == 0)
+                    return FALSE;
+                globals = stack[--pushed];
+                break;
+            default:
+                break;
+            }
+            break;
+
+        case ITEM_LOCAL:
+            switch (tag) {
+            case LOCAL_USAGE:
+                if (locals.UsageCount == LAYOUT_MAX_USAGES)
+                    return FALSE;
+                locals.Usages[locals.UsageCount++] = ItemUsage(data, globals.UsagePage);
+                break;
+            case LOCAL_USAGE_MIN:
+                locals.UsageMin = ItemUsage(data, globals.UsagePage);
+                locals.HasMin = TRUE;
+                break;
+            case LOCAL_USAGE_MAX:
+                locals.UsageMax = ItemUsage(data, globals.UsagePage);
+                locals.HasMax = TRUE;
+                break;
+            default:
+                break;
+            }
+            break;
+
+        default:
+            return FALSE;
+        }
+
+        offset += 1 + size;
+    }
+
+    *ErrorOffset = Length;
+    return depth == 0 && pushed == 0 && Layout->ReportCount != 0;
+}
+
+const LAYOUT_REPORT*
+LayoutFindReport(
+    _In_  const DESCRIPTOR_LAYOUT* Layout,
+    _In_  UCHAR             ReportId,
+    _In_  UCHAR             Type
+    )
+{
+    ULONG                   i;
+
+    for (i = 0; i < Layout->ReportCount; i++) {
+        if (Layout->Reports[i].ReportId == ReportId && Layout->Reports[i].Type == Type)
+            return &Layout->Reports[i];
+    }
+    return NULL;
+}
+
+const LAYOUT_FIELD*
+LayoutFindField(
+    _In_  const DESCRIPTOR_LAYOUT* Layout,
+    _In_  const LAYOUT_REPORT* Report,
+    _In_  USHORT            UsagePage,
+    _In_  USHORT            Usage,
+    _Out_ PULONG            Index
+    )
+/*++
+
+Routine Description:
+
+    Finds where a usage of a report lives. For a variable field Index is
+    the element holding the usage, or the first of those sharing it; an
+    array field holds usages as values, so Index is 0 and the caller picks
+    a free element.
+
+--*/
+{
+    ULONG                   i;
+
+    for (i = Report->FirstField; i < (ULONG)Report->FirstField + Report->FieldCount; i++) {
+        const LAYOUT_FIELD* field = &Layout->Fields[i];
+
+        if (field->UsagePage != UsagePage || Usage < field->UsageMin || Usage > field->UsageMax)
+            continue;
+
+        *Index = 0;
+        if ((field->Flags & FIELD_VARIABLE) != 0) {
+            *Index = Usage - field->UsageMin;
+            if (*Index >= field->Count)
+                continue;
+        }
+        return field;
+    }
+    return NULL;
+}
+
+VOID
+FieldPack(
+    _Inout_ PUCHAR          Report,
+    _In_  const LAYOUT_FIELD* Field,
+    _In_  ULONG             Index,
+    _In_  LONG              Value
+    )
+/*++
+
+Routine Description:
+
+    Writes element Index of a field, clamped to its logical range. The
+    report buffer must hold the field's report; elements past Count are
+    ignored.
+
+--*/
+{
+    ULONG                   bit;
+    ULONG                   remaining;
+    ULONG                   data;
+
+    if (Index >= Field->Count)
+        return;
+
+    if (Value < Field->LogicalMin)
+        Value = Field->LogicalMin;
+    else if (Value > Field->LogicalMax)
+        Value = Field->LogicalMax;
+
+    bit = Field->BitOffset + Index * Field->BitSize;
+    data = (ULONG)Value;
+
+    switch (Field->Shape) {
+    case FIELD_SHAPE_BIT:
+        if (data & 1)
+            Report[bit / 8] |= (UCHAR)(1 << (bit % 8));
+        else
+            Report[bit / 8] &= (UCHAR)~(1 << (bit % 8));
+        break;
+
+    case FIELD_SHAPE_BYTES:
+        for (remaining = Field->BitSize; remaining != 0; remaining -= 8) {
+            Report[bit / 8] = (UCHAR)data;
+            data >>= 8;
+            bit += 8;
+        }
+        break;
+
+    default:
+        for (remaining = Field->BitSize; remaining != 0; ) {
+            ULONG shift = bit % 8;
+            ULONG count = min(8 - shift, remaining);
+            UCHAR mask = (UCHAR)(((1u << count) - 1) << shift);
+
+            Report[bit / 8] = (UCHAR)((Report[bit / 8] & ~mask) | ((data << shift) & mask));
+            data >>= count;
+            bit += count;
+            remaining -= count;
+        }
+        break;
+    }
+}
+
+LONG
+FieldUnpack(
+    _In_  const UCHAR*      Report,
+    _In_  const LAYOUT_FIELD* Field,
+    _In_  ULONG             Index
+    )
+/*++
+
+Routine Description:
+
+    Reads element Index of a field, sign extended if its logical range
+    goes below zero. Elements past Count read as 0.
+
+--*/
+{
+    ULONG                   bit;
+    ULONG                   done;
+    ULONG                   data = 0;
+
+    if (Index >= Field->Count)
+        return 0;
+
+    bit = Field->BitOffset + Index * Field->BitSize;
+
+    switch (Field->Shape) {
+    case FIELD_SHAPE_BIT:
+        data = (Report[bit / 8] >> (bit % 8)) & 1;
+        break;
+
+    case FIELD_SHAPE_BYTES:
+        for (done = 0; done < Field->BitSize; done += 8)
+            data |= (ULONG)Report[(bit + done) / 8] << done;
+        break;
+
+    default:
+        for (done = 0; done < Field->BitSize; ) {
+            ULONG shift = bit % 8;
+            ULONG count = min(8 - shift, Field->BitSize - done);
+
+            data |= ((ULONG)(Report[bit / 8] >> shift) & ((1u << count) - 1)) << done;
+            bit += count;
+            done += count;
+        }
+        break;
+    }
+
+    if ((Field->Flags & FIELD_SIGNED) != 0 && Field->BitSize < 32 &&
+        (data & (1u << (Field->BitSize - 1))) != 0)
+        data |= ~0u << Field->BitSize;
+
+    return (LONG)data;
+}
@@ -0,0 +1,105 @@
+#ifndef __LAYOUT_H_
+#define __LAYOUT_H_
+
+//
+// Report descriptor parser. LayoutParse validates a descriptor and lays out
+// each report it declares, per report id and type, as a list of fields with
+// their bit position, size, usages and logical range; FieldPack and
+// FieldUnpack then read and write a field of a report buffer. Constant
+// fields (padding) take room in their report but are not listed.
+//
+// Only what reports are made of is kept: physical ranges, units and
+// designators are parsed and ignored. Long items are rejected, and so are
+// descriptors mixing reports with and without an id.
+//
+#define LAYOUT_MAX_FIELDS       64
+#define LAYOUT_MAX_REPORTS      16
+#define LAYOUT_MAX_REPORT_BYTES 64      // report id included
+#define LAYOUT_MAX_DEPTH        8       // nested collections
+#define LAYOUT_MAX_PUSH         4       // Push without Pop
+#define LAYOUT_MAX_USAGES       16      // Usage items before a main item
+
+#define LAYOUT_INPUT            0x08    // main item tags
+#define LAYOUT_OUTPUT           0x09
+#define LAYOUT_FEATURE          0x0B
+
+#define FIELD_VARIABLE          0x02    // main item data bits
+#define FIELD_RELATIVE          0x04
+#define FIELD_SIGNED            0x80    // logical minimum below zero
+
+//
+// How FieldPack and FieldUnpack get at a field's elements, chosen once by
+// LayoutParse from its position and size.
+//
+#define FIELD_SHAPE_BYTES       0       // whole aligned bytes: 8, 16 or 32 bits
+#define FIELD_SHAPE_BIT         1       // single bits
+#define FIELD_SHAPE_GENERIC     2       // anything else, across byte boundaries
+
+typedef struct _LAYOUT_FIELD {
+    USHORT                  BitOffset;      // of the first element, report id included
+    UCHAR                   BitSize;        // per element, 1..32
+    UCHAR                   Count;          // elements
+    UCHAR                   Flags;          // FIELD_xxx
+    UCHAR                   Shape;          // FIELD_SHAPE_xxx
+    USHORT                  UsagePage;
+    USHORT                  UsageMin;       // variable field: usage of element i is
+    USHORT                  UsageMax;       // UsageMin + i, up to UsageMax
+    LONG                    LogicalMin;
+    LONG                    LogicalMax;
+} LAYOUT_FIELD, *PLAYOUT_FIELD;
+
+typedef struct _LAYOUT_REPORT {
+    UCHAR                   ReportId;       // 0 if the descriptor uses none
+    UCHAR                   Type;           // LAYOUT_INPUT, LAYOUT_OUTPUT or LAYOUT_FEATURE
+    USHORT                  BitLength;      // report id included
+    UCHAR                   FirstField;
+    UCHAR                   FieldCount;
+} LAYOUT_REPORT, *PLAYOUT_REPORT;
+
+typedef struct _DESCRIPTOR_LAYOUT {
+    ULONG                   ReportCount;
+    ULONG                   FieldCount;
+    LAYOUT_REPORT           Reports[LAYOUT_MAX_REPORTS];
+    LAYOUT_FIELD            Fields[LAYOUT_MAX_FIELDS];      // grouped by report
+} DESCRIPTOR_LAYOUT, *PDESCRIPTOR_LAYOUT;
+
+BOOLEAN
+LayoutParse(
+    _In_reads_bytes_(Length) const UCHAR* Descriptor,
+    _In_  ULONG             Length,
+    _Out_ PDESCRIPTOR_LAYOUT Layout,
+    _Out_ PULONG            ErrorOffset
+    );
+
+const LAYOUT_REPORT*
+LayoutFindReport(
+    _In_  const DESCRIPTOR_LAYOUT* Layout,
+    _In_  UCHAR             ReportId,
+    _In_  UCHAR             Type
+    );
+
+const LAYOUT_FIELD*
+LayoutFindField(
+    _In_  const DESCRIPTOR_LAYOUT* Layout,
+    _In_  const LAYOUT_REPORT* Report,
+    _In_  USHORT            UsagePage,
+    _In_  USHORT            Usage,
+    _Out_ PULONG            Index
+    );
+
+VOID
+FieldPack(
+    _Inout_ PUCHAR          Report,
+    _In_  const LAYOUT_FIELD* Field,
+    _In_  ULONG             Index,
+    _In_  LONG              Value
+    );
+
+LONG
+FieldUnpack(
+    _In_  const UCHAR*      Report,
+    _In_  const LAYOUT_FIELD* Field,
+    _In_  ULONG             Index
+    );
+
+#endif // __LAYOUT_H_
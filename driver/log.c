@@ -0,0 +1,138 @@
+#include "vhidmini.h"
+
+#define LOG_DRAIN_DELAY_MS  10
+
+ULONG G_LogMask = LOG_DEFAULT_MASK;
+
+static LOG_RING G_LogRing;
+static WDFTIMER G_LogTimer;
+static volatile LONG G_LogDrainPending;
+static volatile LONG G_LogDraining;         // the timer may fire again while running
+
+EVT_WDF_TIMER EvtLogTimer;
+
+VOID
+LogWrite(
+    _In_  ULONG             Level,
+    _In_z_ _Printf_format_string_ PCSTR Format,
+    ...
+    )
+/*++
+
+Routine Description:
+
+    Stores a message for EvtLogTimer to print. Callable at any IRQL up to
+    DISPATCH_LEVEL.
+
+--*/
+{
+    va_list                 args;
+
+    NT_ASSERT(LogFormatValid(Format));
+
+    va_start(args, Format);
+    LogRingWrite(&G_LogRing, Level, Format, args);
+    va_end(args);
+
+    if (G_LogTimer != NULL && InterlockedExchange(&G_LogDrainPending, TRUE) == FALSE)
+        WdfTimerStart(G_LogTimer, WDF_REL_TIMEOUT_IN_MS(LOG_DRAIN_DELAY_MS));
+}
+
+VOID
+EvtLogTimer(
+    _In_  WDFTIMER          Timer
+    )
+/*++
+
+Routine Description:
+
+    Prints the messages queued since the last run, in order. Messages
+    overwritten before they could be printed are reported as a count.
+
+--*/
+{
+    PLOG_RECORD             record;
+    ULONG                   last;
+    ULONG                   sequence;
+
+    if (InterlockedExchange(&G_LogDraining, TRUE) == TRUE) {
+        WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_MS(LOG_DRAIN_DELAY_MS));
+        return;
+    }
+
+    InterlockedExchange(&G_LogDrainPending, FALSE);
+
+    last = (ULONG)G_LogRing.Next;
+    KeMemoryBarrier();
+
+    if (last - G_LogRing.Drained > LOG_RING_SIZE) {
+        DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_WARNING_LEVEL,
+            "vhidmini: %u log messages lost\n", last - G_LogRing.Drained - LOG_RING_SIZE);
+        G_LogRing.Drained = last - LOG_RING_SIZE;
+    }
+
+    for (sequence = G_LogRing.Drained + 1; sequence - 1 != last; sequence++) {
+        record = &G_LogRing.Records[sequence & (LOG_RING_SIZE - 1)];
+        if (record->Sequence != sequence) {
+            //
+            // Still being written; pick it up on the next run.
+            //
+            if (InterlockedExchange(&G_LogDrainPending, TRUE) == FALSE)
+                WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_MS(LOG_DRAIN_DELAY_MS));
+            break;
+        }
+        KeMemoryBarrier();
+
+        DbgPrintEx(DPFLTR_IHVDRIVER_ID,
+            record->Level == LOG_LEVEL_ERROR ? DPFLTR_ERROR_LEVEL :
+            record->Level == LOG_LEVEL_WARNING ? DPFLTR_WARNING_LEVEL : DPFLTR_INFO_LEVEL,
+            record->Format,
+            record->Args[0], record->Args[1], record->Args[2], record->Args[3]);
+
+        G_LogRing.Drained = sequence;
+    }
+
+    InterlockedExchange(&G_LogDraining, FALSE);
+}
+
+NTSTATUS
+LogInitialize(
+    _In_  WDFDRIVER         Driver
+    )
+/*++
+
+Routine Description:
+
+    Reads the runtime mask from the registry and creates the drain timer.
+    Messages logged before this point are printed on the first drain.
+
+--*/
+{
+    NTSTATUS                status;
+    WDFKEY                  key;
+    ULONG                   mask;
+    WDF_TIMER_CONFIG        timerConfig;
+    WDF_OBJECT_ATTRIBUTES   timerAttributes;
+    DECLARE_CONST_UNICODE_STRING(valueName, L"LogMask");
+
+    status = WdfDriverOpenParametersRegistryKey(Driver, KEY_READ, WDF_NO_OBJECT_ATTRIBUTES, &key);
+    if (NT_SUCCESS(status)) {
+        if (NT_SUCCESS(WdfRegistryQueryULong(key, &valueName, &mask)))
+            G_LogMask = mask;
+        WdfRegistryClose(key);
+    }
+
+    WDF_TIMER_CONFIG_INIT(&timerConfig, EvtLogTimer);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+    timerAttributes.ParentObject = Driver;
+
+    status = WdfTimerCreate(&timerConfig, &timerAttributes, &G_LogTimer);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    if (InterlockedExchange(&G_LogDrainPending, TRUE) == FALSE)
+        WdfTimerStart(G_LogTimer, WDF_REL_TIMEOUT_IN_MS(LOG_DRAIN_DELAY_MS));
+
+    return STATUS_SUCCESS;
+}
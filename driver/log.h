@@ -0,0 +1,59 @@
+#ifndef __LOG_H_
+#define __LOG_H_
+
+//
+// Debug output. Messages are filtered twice: at compile time against
+// VHID_LOG_MAX_LEVEL, so that disabled levels generate no code at all, and
+// at run time against G_LogMask, a single load. Enabled messages are not
+// formatted on the calling path; the format pointer and up to
+// LOG_MAX_ARGS integer arguments are stored in a lock-free ring (logring.h),
+// and a timer prints them later with DbgPrintEx. Formats must therefore be
+// string literals whose conversions take int or pointer sized arguments:
+// no %s, %ll or %I64. Checked builds assert this on every message.
+//
+// The runtime mask can be set with the LogMask REG_DWORD value under the
+// service's Parameters key. Each subsystem owns four bits, one per level.
+//
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_WARNING   2
+#define LOG_LEVEL_INFO      3
+#define LOG_LEVEL_VERBOSE   4
+
+#define LOG_PNP             0       // device setup and teardown
+#define LOG_HID             1       // hidclass requests, including reads
+#define LOG_USER            2       // injection IOCTLs
+#define LOG_CONFIG          3       // configuration changes
+
+#ifndef VHID_LOG_MAX_LEVEL
+#if DBG
+#define VHID_LOG_MAX_LEVEL  LOG_LEVEL_VERBOSE
+#else
+#define VHID_LOG_MAX_LEVEL  LOG_LEVEL_WARNING
+#endif
+#endif
+
+#define LOG_BIT(Subsystem, Level)   (1UL << ((Subsystem) * 4 + (Level) - 1))
+#define LOG_DEFAULT_MASK            0x3333  // errors and warnings
+
+extern ULONG G_LogMask;
+
+#define VhidLog(Subsystem, Level, ...)                                  \
+    do {                                                                \
+        if ((Level) <= VHID_LOG_MAX_LEVEL &&                            \
+            (G_LogMask & LOG_BIT(Subsystem, Level)))                    \
+            LogWrite(Level, __VA_ARGS__);                               \
+    } while (0)
+
+VOID
+LogWrite(
+    _In_  ULONG             Level,
+    _In_z_ _Printf_format_string_ PCSTR Format,
+    ...
+    );
+
+NTSTATUS
+LogInitialize(
+    _In_  WDFDRIVER         Driver
+    );
+
+#endif // __LOG_H_
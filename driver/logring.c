@@ -0,0 +1,99 @@
+#include "vhidport.h"
+#include <stdarg.h>
+#include "logring.h"
+
+C_ASSERT((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0);
+
+VOID
+LogRingWrite(
+    _Inout_ PLOG_RING       Ring,
+    _In_  ULONG             Level,
+    _In_z_ PCSTR            Format,
+    _In_  va_list           Args
+    )
+/*++
+
+Routine Description:
+
+    Stores a message. Only the arguments the format consumes are read; the
+    conversions are counted, not parsed. Lock-free, callable at any IRQL up
+    to DISPATCH_LEVEL.
+
+--*/
+{
+    ULONG                   sequence = (ULONG)InterlockedIncrement(&Ring->Next);
+    PLOG_RECORD             record = &Ring->Records[sequence & (LOG_RING_SIZE - 1)];
+    PCSTR                   p;
+    ULONG                   count = 0;
+
+    record->Sequence = 0;
+    MemoryBarrier();
+
+    record->Level = Level;
+    record->Format = Format;
+
+    for (p = Format; *p != '\0' && count < LOG_MAX_ARGS; p++) {
+        if (p[0] == '%') {
+            if (p[1] == '%')
+                p++;
+            else
+                record->Args[count++] = va_arg(Args, ULONG_PTR);
+        }
+    }
+
+    MemoryBarrier();
+    record->Sequence = sequence;
+}
+
+BOOLEAN
+LogFormatValid(
+    _In_z_ PCSTR            Format
+    )
+/*++
+
+Routine Description:
+
+    Checks that a format can be deferred: at most LOG_MAX_ARGS conversions,
+    each taking an int or pointer sized argument, and no '*' width or
+    precision, which would consume an argument LogRingWrite doesn't count.
+
+--*/
+{
+    PCSTR                   p = Format;
+    ULONG                   count = 0;
+
+    while (*p != '\0') {
+        if (*p++ != '%')
+            continue;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+
+        while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+            p++;
+        while ((*p >= '0' && *p <= '9') || *p == '.')
+            p++;
+
+        if (p[0] == 'l' && p[1] == 'l')
+            return FALSE;
+        if (p[0] == 'I' && p[1] == '6' && p[2] == '4')
+            return FALSE;
+        if (p[0] == 'I' && p[1] == '3' && p[2] == '2')
+            p += 3;
+        else if (*p == 'h' || *p == 'l' || *p == 'I')
+            p++;
+
+        switch (*p) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c': case 'p':
+            break;
+        default:
+            return FALSE;
+        }
+        p++;
+
+        if (++count > LOG_MAX_ARGS)
+            return FALSE;
+    }
+    return TRUE;
+}
@@ -0,0 +1,41 @@
+#ifndef __LOGRING_H_
+#define __LOGRING_H_
+
+//
+// Ring of the deferred debug messages behind VhidLog (log.c). A record
+// holds the format pointer and up to LOG_MAX_ARGS arguments, each read as
+// a ULONG_PTR: that is the size of a variadic slot on x64 and of an int on
+// x86, so it only holds for int or pointer sized conversions. Formats
+// using anything else (%s, %ll, %I64, %f, %*) would desynchronize the
+// arguments; LogFormatValid tells them apart.
+//
+#define LOG_RING_SIZE       256     // power of two
+#define LOG_MAX_ARGS        4
+
+typedef struct _LOG_RECORD {
+    volatile ULONG          Sequence;       // published last, 0 while written
+    ULONG                   Level;
+    PCSTR                   Format;
+    ULONG_PTR               Args[LOG_MAX_ARGS];
+} LOG_RECORD, *PLOG_RECORD;
+
+typedef struct _LOG_RING {
+    volatile LONG           Next;           // last sequence number claimed
+    ULONG                   Drained;        // last sequence number printed
+    LOG_RECORD              Records[LOG_RING_SIZE];
+} LOG_RING, *PLOG_RING;
+
+VOID
+LogRingWrite(
+    _Inout_ PLOG_RING       Ring,
+    _In_  ULONG             Level,
+    _In_z_ PCSTR            Format,
+    _In_  va_list           Args
+    );
+
+BOOLEAN
+LogFormatValid(
+    _In_z_ PCSTR            Format
+    );
+
+#endif // __LOGRING_H_
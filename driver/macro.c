@@ -0,0 +1,379 @@
+#include "vhidmini.h"
+
+//
+// Macros started by IOCTL_VHIDMINI_RUN_MACRO, and chords, which are
+// compiled into macros. Each one lives in a node of DEVICE_CONTEXT.Nodes,
+// linked on DEVICE_CONTEXT.Macros, and runs from the pipeline timer with
+// StateLock held. A macro holds keys as its own KEY_OWNER, merged with
+// those of the open handles.
+//
+typedef struct _MACRO {
+    LIST_ENTRY              Link;           // DEVICE_CONTEXT.Macros
+    PDEVICE_CONTEXT         DeviceContext;
+    WDFFILEOBJECT           FileObject;     // handle that started it, may be NULL
+    ULONG                   Sequence;       // request, also the macro id
+    BOOLEAN                 Ordered;        // a chord
+    KEY_OWNER               Keys;
+    MACRO_VM                Vm;
+} MACRO, *PMACRO;
+
+C_ASSERT(sizeof(MACRO) <= NODE_SIZE);
+
+MACRO_EMIT_ROUTINE MacroEmit;
+MACRO_QUERY_ROUTINE MacroQuery;
+
+VOID
+MacroEmit(
+    _In_opt_ PVOID          Context,
+    _In_  const VHID_BATCH_EVENT* Event
+    )
+{
+    PMACRO                  macro = (PMACRO)Context;
+
+    InjectEvent(macro->DeviceContext, &macro->Keys, Event);
+}
+
+ULONG
+MacroQuery(
+    _In_opt_ PVOID          Context,
+    _In_  ULONG             Query,
+    _In_  UCHAR             Arg
+    )
+{
+    PDEVICE_CONTEXT         deviceContext = ((PMACRO)Context)->DeviceContext;
+
+    switch (Query) {
+    case MACRO_QUERY_LEDS:
+        return deviceContext->KeyboardOutput.Leds;
+    case MACRO_QUERY_KEY:
+        return deviceContext->KeyMerge.KeyRefs[Arg] != 0;
+    case MACRO_QUERY_DRAINED:
+        return deviceContext->Reports.Count == 0;
+    }
+
+    return 0;
+}
+
+VOID
+MacroEnd(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  PMACRO            Macro
+    )
+/*++
+Routine Description:
+
+    Unlinks a macro, releases what it still holds, closes its receipt and
+    frees its node. Called with StateLock held.
+
+--*/
+{
+    RemoveEntryList(&Macro->Link);
+    InjectRetract(DeviceContext, &Macro->Keys);
+    ReceiptClose(&DeviceContext->Receipts, Macro->Sequence, VhidQueryTime());
+    SlabFree(&DeviceContext->Nodes, Macro);
+}
+
+static
+ULONGLONG
+MacroRunSlice(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  PMACRO            Macro,
+    _In_  ULONGLONG         Now
+    )
+/*++
+Routine Description:
+
+    Runs a slice of one macro, its reports tagged with its sequence, and
+    ends it if it is done. Called with StateLock held.
+
+Return Value:
+
+    When the macro is next due, or -1 if it has ended.
+
+--*/
+{
+    MACRO_HOST              host;
+    BOOLEAN                 done;
+
+    host.Emit = MacroEmit;
+    host.Query = MacroQuery;
+    host.Context = Macro;
+
+    DeviceContext->ActiveSequence = Macro->Sequence;
+    DeviceContext->ActiveOrdered = Macro->Ordered;
+    done = MacroVmRun(&Macro->Vm, &host, Now);
+    DeviceContext->ActiveSequence = 0;
+    DeviceContext->ActiveOrdered = FALSE;
+
+    if (done) {
+        VhidLog(LOG_USER, LOG_LEVEL_VERBOSE, "Macro %u done, %u instruction(s)\n", Macro->Sequence, Macro->Vm.Steps);
+        MacroEnd(DeviceContext, Macro);
+        return (ULONGLONG)-1;
+    }
+
+    return MacroVmNextDeadline(&Macro->Vm, Now);
+}
+
+VOID
+MacroTick(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  ULONGLONG         Now
+    )
+/*++
+Routine Description:
+
+    Runs a slice of every macro that is due, ends those that are done, and
+    records when the next one is due in MacroDeadline. Called with
+    StateLock held.
+
+--*/
+{
+    PLIST_ENTRY             entry;
+    PMACRO                  macro;
+    ULONGLONG               deadline = (ULONGLONG)-1;
+    ULONGLONG               next;
+
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    entry = DeviceContext->Macros.Flink;
+    while (entry != &DeviceContext->Macros) {
+        macro = CONTAINING_RECORD(entry, MACRO, Link);
+        entry = entry->Flink;
+
+        next = MacroRunSlice(DeviceContext, macro, Now);
+        if (next < deadline)
+            deadline = next;
+    }
+
+    DeviceContext->MacroDeadline = deadline;
+}
+
+PMACRO
+MacroCreate(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_opt_ WDFFILEOBJECT  FileObject,
+    _In_reads_bytes_(Length) const UCHAR* Code,
+    _In_  size_t            Length,
+    _Out_ NTSTATUS*         Status
+    )
+/*++
+Routine Description:
+
+    Verifies a program and loads it into a new node.
+
+Return Value:
+
+    NULL, with STATUS_INVALID_PARAMETER if the verifier rejects the program
+    or STATUS_INSUFFICIENT_RESOURCES if no node is free.
+
+--*/
+{
+    PMACRO                  macro;
+    ULONG                   offset;
+
+    if (!MacroVerify(Code, Length, &offset)) {
+        VhidLog(LOG_USER, LOG_LEVEL_WARNING, "Macro rejected at offset %u\n", offset);
+        *Status = STATUS_INVALID_PARAMETER;
+        return NULL;
+    }
+
+    macro = (PMACRO)SlabAlloc(&DeviceContext->Nodes);
+    if (macro == NULL) {
+        *Status = STATUS_INSUFFICIENT_RESOURCES;
+        return NULL;
+    }
+
+    macro->DeviceContext = DeviceContext;
+    macro->FileObject = FileObject;
+    macro->Sequence = 0;
+    macro->Ordered = FALSE;
+    KeyOwnerInit(&macro->Keys);
+    MacroVmInit(&macro->Vm, Code, (USHORT)Length);
+
+    *Status = STATUS_SUCCESS;
+    return macro;
+}
+
+ULONG
+MacroLaunch(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  PMACRO            Macro
+    )
+/*++
+Routine Description:
+
+    Gives a macro its sequence number, which is also its id, and runs its
+    first slice right away. Only its own: other macros that are due run
+    from the timer, so that nothing queues between a chord's room check
+    and its presses. Called with StateLock held.
+
+Return Value:
+
+    The sequence number. The macro may have ended, and its node been freed,
+    by the time this returns.
+
+--*/
+{
+    ULONGLONG               now = VhidQueryTime();
+    ULONGLONG               next;
+    ULONG                   sequence;
+
+    Macro->Sequence = ReceiptOpen(&DeviceContext->Receipts, now);
+    if (Macro->Ordered)
+        TraceWrite(&DeviceContext->Trace, VHID_TRACE_CHORD, &Macro->Sequence, sizeof(ULONG), now);
+    InsertTailList(&DeviceContext->Macros, &Macro->Link);
+    sequence = Macro->Sequence;
+
+    next = MacroRunSlice(DeviceContext, Macro, now);
+    if (next < DeviceContext->MacroDeadline)
+        DeviceContext->MacroDeadline = next;
+    PipelineArmTimer(DeviceContext, now);
+
+    return sequence;
+}
+
+NTSTATUS
+MacroStart(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_opt_ WDFFILEOBJECT  FileObject,
+    _In_reads_bytes_(Length) const UCHAR* Code,
+    _In_  size_t            Length,
+    _Out_ PULONG            Id
+    )
+/*++
+Routine Description:
+
+    Verifies a program and starts running it right away.
+
+--*/
+{
+    NTSTATUS                status;
+    PMACRO                  macro;
+
+    *Id = 0;
+
+    macro = MacroCreate(DeviceContext, FileObject, Code, Length, &status);
+    if (macro == NULL)
+        return status;
+
+    StateLockAcquire(DeviceContext);
+    *Id = MacroLaunch(DeviceContext, macro);
+    StateLockRelease(DeviceContext);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+ChordStart(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_opt_ WDFFILEOBJECT  FileObject,
+    _In_  const VHID_CHORD* Chord,
+    _Out_ PULONG            Sequence
+    )
+/*++
+Routine Description:
+
+    Starts a chord. Its presses are queued before this returns, and its
+    releases right away too unless it has a hold time. The room check and
+    the first slice happen under the same StateLock hold, so the presses
+    can't be evicted from the queue as they are being queued.
+
+Return Value:
+
+    STATUS_INVALID_PARAMETER if the chord is invalid.
+    STATUS_DEVICE_BUSY if the report queue can't take the whole chord.
+
+--*/
+{
+    NTSTATUS                status;
+    PMACRO                  macro;
+    UCHAR                   code[VHID_MACRO_MAX_CODE];
+    USHORT                  length;
+    ULONG                   reports;
+
+    *Sequence = 0;
+
+    if (!ChordCompile(Chord, code, &length, &reports))
+        return STATUS_INVALID_PARAMETER;
+
+    macro = MacroCreate(DeviceContext, FileObject, code, length, &status);
+    if (macro == NULL)
+        return status;
+
+    StateLockAcquire(DeviceContext);
+    if (ReportQueueRoom(&DeviceContext->Reports) < reports) {
+        StateLockRelease(DeviceContext);
+        SlabFree(&DeviceContext->Nodes, macro);
+        return STATUS_DEVICE_BUSY;
+    }
+
+    macro->Ordered = TRUE;
+    *Sequence = MacroLaunch(DeviceContext, macro);
+    StateLockRelease(DeviceContext);
+
+    return STATUS_SUCCESS;
+}
+
+ULONG
+MacroCancel(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_opt_ WDFFILEOBJECT  FileObject,
+    _In_  ULONG             Id
+    )
+/*++
+Routine Description:
+
+    Stops the macro Id, or every macro when Id is 0, among those started
+    on FileObject. Called with StateLock held.
+
+Return Value:
+
+    The number of macros stopped.
+
+--*/
+{
+    PLIST_ENTRY             entry;
+    PMACRO                  macro;
+    ULONG                   count = 0;
+
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    entry = DeviceContext->Macros.Flink;
+    while (entry != &DeviceContext->Macros) {
+        macro = CONTAINING_RECORD(entry, MACRO, Link);
+        entry = entry->Flink;
+
+        if (macro->FileObject != FileObject || (Id != 0 && macro->Sequence != Id))
+            continue;
+        MacroEnd(DeviceContext, macro);
+        count++;
+    }
+
+    return count;
+}
+
+VOID
+MacroWithdraw(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_reads_(KEY_MERGE_USAGES / 32) const ULONG* Keys,
+    _In_  UCHAR             Buttons
+    )
+/*++
+Routine Description:
+
+    Takes keys and buttons away from every running macro, which keeps
+    running; a later release of them by the macro changes nothing. Called
+    with StateLock held.
+
+--*/
+{
+    PLIST_ENTRY             entry;
+    PMACRO                  macro;
+
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    for (entry = DeviceContext->Macros.Flink; entry != &DeviceContext->Macros; entry = entry->Flink) {
+        macro = CONTAINING_RECORD(entry, MACRO, Link);
+        KeyMergeWithdraw(&DeviceContext->KeyMerge, &macro->Keys, Keys, Buttons);
+    }
+}
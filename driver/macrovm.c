@@ -0,0 +1,255 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "macrovm.h"
+
+//
+// Operand bytes following each opcode. The branch offset is always the
+// last operand, relative to the next instruction.
+//
+static const UCHAR MacroOperands[] = {
+    0,      // VHID_OP_END
+    2,      // VHID_OP_KEY
+    2,      // VHID_OP_MOVE
+    1,      // VHID_OP_BUTTON
+    2,      // VHID_OP_WAIT
+    2,      // VHID_OP_WAIT_DRAIN
+    1,      // VHID_OP_LOOP
+    0,      // VHID_OP_END_LOOP
+    3,      // VHID_OP_IF_LED
+    3,      // VHID_OP_IF_KEY
+    1,      // VHID_OP_SKIP
+};
+
+#define MACRO_NOT_INSTRUCTION   0xFFFF
+
+#define MacroUshort(Operand)    ((USHORT)((Operand)[0] | (Operand)[1] << 8))
+
+BOOLEAN
+MacroVerify(
+    _In_reads_bytes_(Length) const UCHAR* Code,
+    _In_  size_t            Length,
+    _Out_ PULONG            ErrorOffset
+    )
+/*++
+
+Routine Description:
+
+    Checks that a program is well formed and bounded. The worst case is
+    found in a single pass: an instruction executes as many times as the
+    product of the counts of the loops around it, whatever the branches
+    skip. Branches may only go forward and stay in their loop body, which
+    also keeps the loop stack balanced.
+
+Return Value:
+
+    FALSE, with the offset of the first offending instruction in
+    ErrorOffset, if the program is rejected.
+
+--*/
+{
+    USHORT                  block[VHID_MACRO_MAX_CODE + 1]; // innermost LOOP + 1, 0 at top level
+    USHORT                  open[VHID_MACRO_MAX_DEPTH];
+    ULONGLONG               times[VHID_MACRO_MAX_DEPTH + 1];
+    ULONGLONG               steps = 0;
+    ULONGLONG               waited = 0;
+    ULONG                   depth = 0;
+    ULONG                   pc;
+    ULONG                   next;
+    UCHAR                   op;
+
+    *ErrorOffset = 0;
+    if (Length == 0 || Length > VHID_MACRO_MAX_CODE)
+        return FALSE;
+
+    for (pc = 0; pc <= Length; pc++)
+        block[pc] = MACRO_NOT_INSTRUCTION;
+    times[0] = 1;
+
+    for (pc = 0; pc < Length; pc = next) {
+        *ErrorOffset = pc;
+        op = Code[pc];
+        if (op >= ARRAYSIZE(MacroOperands))
+            return FALSE;
+        next = pc + 1 + MacroOperands[op];
+        if (next > Length)
+            return FALSE;
+
+        block[pc] = depth == 0 ? 0 : open[depth - 1] + 1;
+        steps += times[depth];
+
+        switch (op) {
+        case VHID_OP_WAIT:
+        case VHID_OP_WAIT_DRAIN:
+            waited += MacroUshort(&Code[pc + 1]) * times[depth];
+            break;
+        case VHID_OP_LOOP:
+            if (depth == VHID_MACRO_MAX_DEPTH || Code[pc + 1] == 0)
+                return FALSE;
+            open[depth] = (USHORT)pc;
+            times[depth + 1] = times[depth] * Code[pc + 1];
+            depth++;
+            break;
+        case VHID_OP_END_LOOP:
+            if (depth == 0)
+                return FALSE;
+            depth--;
+            break;
+        }
+
+        if (steps > VHID_MACRO_MAX_STEPS || waited > VHID_MACRO_MAX_WAIT_MS)
+            return FALSE;
+    }
+
+    *ErrorOffset = (ULONG)Length;
+    if (depth != 0)
+        return FALSE;
+    block[Length] = 0;
+
+    for (pc = 0; pc < Length; pc = next) {
+        op = Code[pc];
+        next = pc + 1 + MacroOperands[op];
+        if (op != VHID_OP_IF_LED && op != VHID_OP_IF_KEY && op != VHID_OP_SKIP)
+            continue;
+        *ErrorOffset = pc;
+        if (next + Code[next - 1] > Length || block[next + Code[next - 1]] != block[pc])
+            return FALSE;
+    }
+
+    *ErrorOffset = 0;
+    return TRUE;
+}
+
+VOID
+MacroVmInit(
+    _Out_ PMACRO_VM         Vm,
+    _In_reads_bytes_(Length) const UCHAR* Code,
+    _In_  USHORT            Length
+    )
+/*++
+
+Routine Description:
+
+    Loads a program MacroVerify accepted.
+
+--*/
+{
+    RtlZeroMemory(Vm, FIELD_OFFSET(MACRO_VM, Code));
+    RtlCopyMemory(Vm->Code, Code, Length);
+    Vm->Length = Length;
+}
+
+BOOLEAN
+MacroVmRun(
+    _Inout_ PMACRO_VM       Vm,
+    _In_  const MACRO_HOST* Host,
+    _In_  ULONGLONG         Now
+    )
+/*++
+
+Routine Description:
+
+    Runs the program until it waits, ends, or has used up its slice. Does
+    nothing if it is still waiting.
+
+Return Value:
+
+    TRUE once the program has ended.
+
+--*/
+{
+    VHID_BATCH_EVENT        event;
+    const UCHAR*            operand;
+    ULONG                   budget = MACRO_STEPS_PER_RUN;
+    BOOLEAN                 held;
+
+    if (Now < Vm->WakeTime &&
+        !(Vm->WaitDrain && Host->Query(Host->Context, MACRO_QUERY_DRAINED, 0)))
+        return FALSE;
+    Vm->WaitDrain = FALSE;
+
+    RtlZeroMemory(&event, sizeof(event));
+
+    while (Vm->Pc < Vm->Length) {
+        if (budget-- == 0) {
+            Vm->WakeTime = Now + MACRO_YIELD;
+            return FALSE;
+        }
+
+        Vm->Steps++;
+        operand = &Vm->Code[Vm->Pc + 1];
+        Vm->Pc += 1 + MacroOperands[Vm->Code[Vm->Pc]];
+
+        switch (operand[-1]) {
+        case VHID_OP_END:
+            Vm->Pc = Vm->Length;
+            break;
+        case VHID_OP_KEY:
+        case VHID_OP_MOVE:
+            event.Type = operand[-1] == VHID_OP_KEY ? VHID_BATCH_KEY : VHID_BATCH_MOVE;
+            event.Data[0] = operand[0];
+            event.Data[1] = operand[1];
+            Host->Emit(Host->Context, &event);
+            break;
+        case VHID_OP_BUTTON:
+            event.Type = VHID_BATCH_BUTTON;
+            event.Data[0] = operand[0];
+            event.Data[1] = 0;
+            Host->Emit(Host->Context, &event);
+            break;
+        case VHID_OP_WAIT:
+            Vm->WakeTime = Now + MacroUshort(operand) * 10000ULL;
+            return FALSE;
+        case VHID_OP_WAIT_DRAIN:
+            if (Host->Query(Host->Context, MACRO_QUERY_DRAINED, 0))
+                break;
+            Vm->WakeTime = Now + MacroUshort(operand) * 10000ULL;
+            Vm->WaitDrain = TRUE;
+            return FALSE;
+        case VHID_OP_LOOP:
+            Vm->Loops[Vm->Depth].Body = Vm->Pc;
+            Vm->Loops[Vm->Depth].Remaining = operand[0];
+            Vm->Depth++;
+            break;
+        case VHID_OP_END_LOOP:
+            if (--Vm->Loops[Vm->Depth - 1].Remaining != 0)
+                Vm->Pc = Vm->Loops[Vm->Depth - 1].Body;
+            else
+                Vm->Depth--;
+            break;
+        case VHID_OP_IF_LED:
+            if ((Host->Query(Host->Context, MACRO_QUERY_LEDS, 0) & operand[0]) != operand[1])
+                Vm->Pc += operand[2];
+            break;
+        case VHID_OP_IF_KEY:
+            held = Host->Query(Host->Context, MACRO_QUERY_KEY, operand[0]) != 0;
+            if (held != (operand[1] != 0))
+                Vm->Pc += operand[2];
+            break;
+        case VHID_OP_SKIP:
+            Vm->Pc += operand[0];
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+ULONGLONG
+MacroVmNextDeadline(
+    _In_  const MACRO_VM*   Vm,
+    _In_  ULONGLONG         Now
+    )
+/*++
+
+Routine Description:
+
+    When the program should run next. A program waiting for the backlog to
+    drain is polled until its timeout.
+
+--*/
+{
+    if (Vm->WaitDrain && Now + MACRO_DRAIN_POLL < Vm->WakeTime)
+        return Now + MACRO_DRAIN_POLL;
+
+    return Vm->WakeTime;
+}
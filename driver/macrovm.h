@@ -0,0 +1,83 @@
+#ifndef __MACROVM_H_
+#define __MACROVM_H_
+
+//
+// Interpreter for the macro programs of IOCTL_VHIDMINI_RUN_MACRO. A program
+// is checked once by MacroVerify, which bounds everything it can do, then
+// run in slices by MacroVmRun: a slice stops at a wait or after
+// MACRO_STEPS_PER_RUN instructions, so one call never holds the caller for
+// long. The VM doesn't know the device; it emits events and reads device
+// state through the caller's routines. Times are in 100ns units from any
+// monotonic clock.
+//
+#define MACRO_STEPS_PER_RUN     64
+#define MACRO_YIELD             10000       // before resuming a slice cut short
+#define MACRO_DRAIN_POLL        10000       // while waiting for the backlog to drain
+
+#define MACRO_QUERY_LEDS        1           // keyboard output report
+#define MACRO_QUERY_KEY         2           // Arg = key code, nonzero while held
+#define MACRO_QUERY_DRAINED     3           // nonzero if no report is pending
+
+typedef
+VOID
+MACRO_EMIT_ROUTINE(
+    _In_opt_ PVOID          Context,
+    _In_  const VHID_BATCH_EVENT* Event
+    );
+
+typedef
+ULONG
+MACRO_QUERY_ROUTINE(
+    _In_opt_ PVOID          Context,
+    _In_  ULONG             Query,
+    _In_  UCHAR             Arg
+    );
+
+typedef struct _MACRO_HOST {
+    MACRO_EMIT_ROUTINE*     Emit;
+    MACRO_QUERY_ROUTINE*    Query;
+    PVOID                   Context;
+} MACRO_HOST, *PMACRO_HOST;
+
+typedef struct _MACRO_VM {
+    ULONGLONG               WakeTime;       // not run before, unless drained
+    ULONG                   Steps;          // instructions executed
+    USHORT                  Length;
+    USHORT                  Pc;
+    UCHAR                   Depth;
+    BOOLEAN                 WaitDrain;
+    struct {
+        USHORT              Body;           // first instruction of the loop body
+        USHORT              Remaining;
+    } Loops[VHID_MACRO_MAX_DEPTH];
+    UCHAR                   Code[VHID_MACRO_MAX_CODE];
+} MACRO_VM, *PMACRO_VM;
+
+BOOLEAN
+MacroVerify(
+    _In_reads_bytes_(Length) const UCHAR* Code,
+    _In_  size_t            Length,
+    _Out_ PULONG            ErrorOffset
+    );
+
+VOID
+MacroVmInit(
+    _Out_ PMACRO_VM         Vm,
+    _In_reads_bytes_(Length) const UCHAR* Code,
+    _In_  USHORT            Length
+    );
+
+BOOLEAN
+MacroVmRun(
+    _Inout_ PMACRO_VM       Vm,
+    _In_  const MACRO_HOST* Host,
+    _In_  ULONGLONG         Now
+    );
+
+ULONGLONG
+MacroVmNextDeadline(
+    _In_  const MACRO_VM*   Vm,
+    _In_  ULONGLONG         Now
+    );
+
+#endif // __MACROVM_H_
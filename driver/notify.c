@@ -0,0 +1,231 @@
+#include "vhidmini.h"
+
+//
+// Inverted-call notification channel. Clients pend IOCTL_VHIDMINI_WAIT_EVENT
+// requests; they are parked in NotifyQueue and completed with the records
+// queued for their file object. NotifyLock is a spin lock because events are
+// raised from the hidclass read path, which may run at DISPATCH_LEVEL.
+//
+
+NTSTATUS
+NotifyQueueCreate(
+    _In_  WDFDEVICE         Device,
+    _Out_ WDFQUEUE*         Queue
+    )
+/*++
+Routine Description:
+
+    This function creates the manual queue holding pended
+    IOCTL_VHIDMINI_WAIT_EVENT requests, and the lock protecting the per-file
+    event queues.
+
+Arguments:
+
+    Device - Handle to a framework device object.
+
+    Queue - Output pointer to a framework I/O queue handle, on success.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    NTSTATUS                status;
+    WDF_IO_QUEUE_CONFIG     queueConfig;
+    WDF_OBJECT_ATTRIBUTES   queueAttributes;
+    WDFQUEUE                queue;
+    PQUEUE_CONTEXT          queueContext;
+    PDEVICE_CONTEXT         deviceContext = GetDeviceContext(Device);
+
+    InitializeListHead(&deviceContext->FileList);
+
+    status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &deviceContext->NotifyLock);
+    if (!NT_SUCCESS(status)) {
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "WdfSpinLockCreate failed 0x%x\n", status);
+        return status;
+    }
+
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&queueAttributes, QUEUE_CONTEXT);
+
+    status = WdfIoQueueCreate(Device, &queueConfig, &queueAttributes, &queue);
+    if (!NT_SUCCESS(status)) {
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "WdfIoQueueCreate failed 0x%x\n", status);
+        return status;
+    }
+
+    queueContext = GetQueueContext(queue);
+    queueContext->Queue = queue;
+    queueContext->DeviceContext = deviceContext;
+
+    *Queue = queue;
+    return status;
+}
+
+VOID
+NotifyCompleteRequest(
+    _In_  PFILE_CONTEXT     FileContext,
+    _In_  WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Completes a wait request with as many queued events as fit in its buffer.
+    The buffer size has been validated when the request was received.
+
+--*/
+{
+    NTSTATUS                status;
+    PVHID_NOTIFY_EVENT      events;
+    size_t                  length;
+    ULONG                   count = 0;
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VHID_NOTIFY_EVENT), (PVOID*)&events, &length);
+    if (NT_SUCCESS(status)) {
+        count = EventQueuePop(&FileContext->Events, events, (ULONG)(length / sizeof(VHID_NOTIFY_EVENT)));
+    }
+
+    WdfRequestCompleteWithInformation(Request, status, count * sizeof(VHID_NOTIFY_EVENT));
+}
+
+VOID
+NotifyDeliver(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  PFILE_CONTEXT     FileContext
+    )
+/*++
+Routine Description:
+
+    Drains a file object's event queue into its pended wait requests.
+    Called with NotifyLock held.
+
+--*/
+{
+    NTSTATUS                status;
+    WDFREQUEST              request;
+
+    while (FileContext->Events.Count != 0) {
+        status = WdfIoQueueRetrieveRequestByFileObject(DeviceContext->NotifyQueue,
+            FileContext->FileObject,
+            &request);
+        if (!NT_SUCCESS(status))
+            break;
+
+        NotifyCompleteRequest(FileContext, request);
+    }
+}
+
+VOID
+NotifyFileCreate(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFFILEOBJECT     FileObject
+    )
+{
+    PFILE_CONTEXT           fileContext = GetFileContext(FileObject);
+
+    fileContext->FileObject = FileObject;
+    EventQueueInit(&fileContext->Events);
+
+    WdfSpinLockAcquire(DeviceContext->NotifyLock);
+    InsertTailList(&DeviceContext->FileList, &fileContext->Link);
+    WdfSpinLockRelease(DeviceContext->NotifyLock);
+}
+
+VOID
+NotifyFileClose(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFFILEOBJECT     FileObject
+    )
+/*++
+Routine Description:
+
+    Unlinks the file object's event queue. Wait requests still pended for
+    this file object have already been cancelled by the framework on cleanup.
+
+--*/
+{
+    PFILE_CONTEXT           fileContext = GetFileContext(FileObject);
+
+    WdfSpinLockAcquire(DeviceContext->NotifyLock);
+    RemoveEntryList(&fileContext->Link);
+    InitializeListHead(&fileContext->Link);
+    WdfSpinLockRelease(DeviceContext->NotifyLock);
+}
+
+NTSTATUS
+NotifyWaitEvent(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFREQUEST        Request,
+    _In_  size_t            OutputBufferLength,
+    _Always_(_Out_)
+    BOOLEAN*                CompleteRequest
+    )
+/*++
+Routine Description:
+
+    Handles IOCTL_VHIDMINI_WAIT_EVENT. Completes the request right away if
+    events are already queued for the caller, otherwise pends it. Events
+    are queued per handle, so a request without a file object is refused.
+
+--*/
+{
+    NTSTATUS                status;
+    WDFFILEOBJECT           fileObject;
+    PFILE_CONTEXT           fileContext;
+
+    *CompleteRequest = TRUE;
+
+    if (OutputBufferLength < sizeof(VHID_NOTIFY_EVENT))
+        return STATUS_INVALID_BUFFER_SIZE;
+
+    fileObject = WdfRequestGetFileObject(Request);
+    if (fileObject == NULL)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    fileContext = GetFileContext(fileObject);
+
+    WdfSpinLockAcquire(DeviceContext->NotifyLock);
+    if (fileContext->Events.Count != 0) {
+        NotifyCompleteRequest(fileContext, Request);
+        *CompleteRequest = FALSE;
+        status = STATUS_SUCCESS;
+    }
+    else {
+        status = WdfRequestForwardToIoQueue(Request, DeviceContext->NotifyQueue);
+        if (NT_SUCCESS(status))
+            *CompleteRequest = FALSE;
+        else
+            VhidLog(LOG_USER, LOG_LEVEL_ERROR, "WdfRequestForwardToIoQueue failed with 0x%x\n", status);
+    }
+    WdfSpinLockRelease(DeviceContext->NotifyLock);
+
+    return status;
+}
+
+VOID
+NotifyEvent(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  ULONG             Type,
+    _In_  ULONG             Data
+    )
+/*++
+Routine Description:
+
+    Queues an event for every open handle and completes pended waits.
+
+--*/
+{
+    PLIST_ENTRY             entry;
+    PFILE_CONTEXT           fileContext;
+    ULONGLONG               now = VhidQueryTime();
+
+    WdfSpinLockAcquire(DeviceContext->NotifyLock);
+    for (entry = DeviceContext->FileList.Flink; entry != &DeviceContext->FileList; entry = entry->Flink) {
+        fileContext = CONTAINING_RECORD(entry, FILE_CONTEXT, Link);
+        EventQueuePush(&fileContext->Events, Type, Data, now);
+        NotifyDeliver(DeviceContext, fileContext);
+    }
+    WdfSpinLockRelease(DeviceContext->NotifyLock);
+}
@@ -0,0 +1,108 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "reportq.h"
+#include "pacer.h"
+
+VOID
+PacerInit(
+    _Out_ PPACER            Pacer,
+    _In_  ULONG             IntervalUs
+    )
+{
+    RtlZeroMemory(Pacer, sizeof(PACER));
+    PacerSetInterval(Pacer, IntervalUs);
+}
+
+VOID
+PacerSetInterval(
+    _Inout_ PPACER          Pacer,
+    _In_  ULONG             IntervalUs
+    )
+{
+    Pacer->Interval = (ULONGLONG)IntervalUs * 10;
+}
+
+ULONG
+PacerReadyMask(
+    _In_  PPACER            Pacer,
+    _In_  ULONGLONG         Now
+    )
+/*++
+
+Routine Description:
+
+    Returns the REPORT_ID_MASK of the report ids allowed to release a report
+    at time Now. Ids past PACER_MAX_REPORT_ID are never paced.
+
+--*/
+{
+    ULONG                   mask = REPORT_ID_ANY;
+    UCHAR                   id;
+
+    if (Pacer->Interval == 0)
+        return mask;
+
+    for (id = 0; id < PACER_MAX_REPORT_ID; id++) {
+        if (Now < Pacer->NextRelease[id])
+            mask &= ~REPORT_ID_MASK(id);
+    }
+    return mask;
+}
+
+VOID
+PacerRelease(
+    _Inout_ PPACER          Pacer,
+    _In_  UCHAR             ReportId,
+    _In_  ULONGLONG         Now
+    )
+/*++
+
+Routine Description:
+
+    Records that a report was released at time Now. Releases stay on the
+    interval grid as long as the collection is busy, so a late tick does not
+    push every later report back (no drift); after an idle period the grid
+    restarts from Now.
+
+--*/
+{
+    ULONGLONG               next;
+
+    if (Pacer->Interval == 0 || ReportId >= PACER_MAX_REPORT_ID)
+        return;
+
+    next = Pacer->NextRelease[ReportId];
+    if (Now >= next + Pacer->Interval)
+        next = Now;
+    Pacer->NextRelease[ReportId] = next + Pacer->Interval;
+}
+
+ULONGLONG
+PacerNextDeadline(
+    _In_  PPACER            Pacer,
+    _In_  ULONG             ReportIdMask
+    )
+/*++
+
+Routine Description:
+
+    Returns the earliest time at which one of the report ids in ReportIdMask
+    may release a report, or 0 if one of them may release right away.
+
+--*/
+{
+    ULONGLONG               deadline = (ULONGLONG)-1;
+    UCHAR                   id;
+
+    if (Pacer->Interval == 0)
+        return 0;
+
+    for (id = 0; id < PACER_MAX_REPORT_ID; id++) {
+        if ((ReportIdMask & REPORT_ID_MASK(id)) && Pacer->NextRelease[id] < deadline)
+            deadline = Pacer->NextRelease[id];
+    }
+    if (ReportIdMask & ~((1UL << PACER_MAX_REPORT_ID) - 1))
+        deadline = 0;
+
+    return deadline;
+}
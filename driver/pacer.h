@@ -0,0 +1,50 @@
+#ifndef __PACER_H_
+#define __PACER_H_
+
+//
+// Emulates a USB polling interval: each report id gets at most one report
+// released per interval. Times are in 100ns units, as returned by
+// VhidQueryTime, but any monotonic clock works.
+//
+#define PACER_MAX_REPORT_ID     8
+
+#define PACER_MIN_INTERVAL_US   125
+#define PACER_MAX_INTERVAL_US   8000
+
+typedef struct _PACER {
+    ULONGLONG               Interval;       // 0 = pacing disabled
+    ULONGLONG               NextRelease[PACER_MAX_REPORT_ID];
+} PACER, *PPACER;
+
+VOID
+PacerInit(
+    _Out_ PPACER            Pacer,
+    _In_  ULONG             IntervalUs
+    );
+
+VOID
+PacerSetInterval(
+    _Inout_ PPACER          Pacer,
+    _In_  ULONG             IntervalUs
+    );
+
+ULONG
+PacerReadyMask(
+    _In_  PPACER            Pacer,
+    _In_  ULONGLONG         Now
+    );
+
+VOID
+PacerRelease(
+    _Inout_ PPACER          Pacer,
+    _In_  UCHAR             ReportId,
+    _In_  ULONGLONG         Now
+    );
+
+ULONGLONG
+PacerNextDeadline(
+    _In_  PPACER            Pacer,
+    _In_  ULONG             ReportIdMask
+    );
+
+#endif // __PACER_H_
@@ -0,0 +1,196 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "receipt.h"
+
+C_ASSERT((RECEIPT_RING_SIZE & (RECEIPT_RING_SIZE - 1)) == 0);
+
+#define SLOT(Ring, Sequence) (&(Ring)->Slots[(Sequence) & (RECEIPT_RING_SIZE - 1)])
+
+static
+PRECEIPT
+ReceiptFind(
+    _In_  PRECEIPT_RING     Ring,
+    _In_  ULONG             Sequence
+    )
+{
+    PRECEIPT                receipt = SLOT(Ring, Sequence);
+
+    if (Sequence == 0 || receipt->Sequence != Sequence)
+        return NULL;
+
+    return receipt;
+}
+
+VOID
+ReceiptRingInit(
+    _Out_ PRECEIPT_RING     Ring
+    )
+{
+    RtlZeroMemory(Ring, sizeof(RECEIPT_RING));
+}
+
+ULONG
+ReceiptOpen(
+    _Inout_ PRECEIPT_RING   Ring,
+    _In_  ULONGLONG         Now
+    )
+/*++
+
+Routine Description:
+
+    Numbers a new request, overwriting the oldest receipt.
+
+Return Value:
+
+    The sequence number of the request, never 0.
+
+--*/
+{
+    PRECEIPT                receipt;
+
+    if (++Ring->Last == 0)
+        Ring->Last = 1;
+
+    receipt = SLOT(Ring, Ring->Last);
+    receipt->Sequence = Ring->Last;
+    receipt->Pending = 0;
+    receipt->Flags = RECEIPT_OPEN;
+    receipt->Submitted = Now;
+    receipt->Completed = 0;
+
+    return Ring->Last;
+}
+
+VOID
+ReceiptClose(
+    _Inout_ PRECEIPT_RING   Ring,
+    _In_  ULONG             Sequence,
+    _In_  ULONGLONG         Now
+    )
+/*++
+
+Routine Description:
+
+    Records that the request will queue no more reports. A request that
+    queued none is complete right away.
+
+--*/
+{
+    PRECEIPT                receipt = ReceiptFind(Ring, Sequence);
+
+    if (receipt == NULL)
+        return;
+
+    receipt->Flags &= ~RECEIPT_OPEN;
+    if (receipt->Pending == 0 && receipt->Completed == 0)
+        receipt->Completed = Now;
+}
+
+VOID
+ReceiptQueued(
+    _Inout_ PRECEIPT_RING   Ring,
+    _In_  ULONG             Sequence
+    )
+{
+    PRECEIPT                receipt = ReceiptFind(Ring, Sequence);
+
+    if (receipt != NULL)
+        receipt->Pending++;
+}
+
+VOID
+ReceiptResolve(
+    _Inout_ PRECEIPT_RING   Ring,
+    _In_  ULONG             Sequence,
+    _In_  UCHAR             Fate,
+    _In_  ULONGLONG         Now
+    )
+/*++
+
+Routine Description:
+
+    Records what became of one of the request's queued reports: read by
+    hidclass (RECEIPT_DELIVERED), folded into a newer report
+    (RECEIPT_MERGED) or evicted (RECEIPT_DROPPED). Completed is the time
+    of the last delivery, or of the last fate if nothing was delivered.
+
+--*/
+{
+    PRECEIPT                receipt = ReceiptFind(Ring, Sequence);
+
+    if (receipt == NULL || receipt->Pending == 0)
+        return;
+
+    receipt->Pending--;
+    receipt->Flags |= Fate;
+    if (Fate == RECEIPT_DELIVERED || !(receipt->Flags & RECEIPT_DELIVERED))
+        receipt->Completed = Now;
+}
+
+ULONG
+ReceiptRingRead(
+    _In_  const RECEIPT_RING* Ring,
+    _In_  ULONG             FirstSequence,
+    _Out_writes_to_(MaxReceipts, return) PVHID_RECEIPT Receipts,
+    _In_  ULONG             MaxReceipts
+    )
+/*++
+
+Routine Description:
+
+    Copies the receipts still in the ring starting at FirstSequence (0 for
+    the oldest available), in sequence order. Sequence numbers are compared
+    by their distance to the last one given, so that reads carry on across
+    the wrap; a FirstSequence past the last one has nothing to read yet.
+
+Return Value:
+
+    Number of receipts copied.
+
+--*/
+{
+    ULONG                   last = Ring->Last;
+    ULONG                   sequence;
+    ULONG                   distance;
+    ULONG                   n;
+    ULONG                   count = 0;
+    const RECEIPT*          receipt;
+    PVHID_RECEIPT           out;
+
+    if (last == 0)
+        return 0;
+
+    if (FirstSequence != 0 && (LONG)(last - FirstSequence) < 0)
+        return 0;
+    if (FirstSequence == 0 || (ULONG)(last - FirstSequence) >= RECEIPT_RING_SIZE)
+        FirstSequence = last - (RECEIPT_RING_SIZE - 1);
+    distance = last - FirstSequence;
+
+    for (n = 0; n <= distance && count < MaxReceipts; n++) {
+        sequence = FirstSequence + n;
+        if (sequence == 0)
+            continue;
+        receipt = SLOT(Ring, sequence);
+        if (receipt->Sequence != sequence)
+            continue;
+
+        out = &Receipts[count++];
+        out->Sequence = sequence;
+        out->Submitted = receipt->Submitted;
+        out->Completed = receipt->Completed;
+
+        if ((receipt->Flags & RECEIPT_OPEN) || receipt->Pending != 0) {
+            out->Status = VHID_RECEIPT_PENDING;
+            out->Completed = 0;
+        } else if (receipt->Flags & RECEIPT_DROPPED)
+            out->Status = VHID_RECEIPT_DROPPED;
+        else if (receipt->Flags & RECEIPT_MERGED)
+            out->Status = VHID_RECEIPT_MERGED;
+        else if (receipt->Flags & RECEIPT_DELIVERED)
+            out->Status = VHID_RECEIPT_DELIVERED;
+        else
+            out->Status = VHID_RECEIPT_NONE;
+    }
+
+    return count;
+}
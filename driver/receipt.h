@@ -0,0 +1,71 @@
+#ifndef __RECEIPT_H_
+#define __RECEIPT_H_
+
+//
+// Fate of the reports queued by each injection request, for
+// IOCTL_VHIDMINI_GET_RECEIPTS. Requests are numbered by ReceiptOpen; the
+// ring keeps the last RECEIPT_RING_SIZE of them, and a receipt overwritten
+// by a newer request is forgotten, along with anything that still happens
+// to its reports. Called with StateLock held.
+//
+#define RECEIPT_RING_SIZE   256     // power of two
+
+#define RECEIPT_OPEN        0x01    // the request may still queue reports
+#define RECEIPT_DELIVERED   0x02
+#define RECEIPT_MERGED      0x04
+#define RECEIPT_DROPPED     0x08
+
+typedef struct _RECEIPT {
+    ULONG                   Sequence;       // 0 = slot unused
+    USHORT                  Pending;        // reports queued and not read yet
+    UCHAR                   Flags;          // RECEIPT_xxx
+    ULONGLONG               Submitted;
+    ULONGLONG               Completed;
+} RECEIPT, *PRECEIPT;
+
+typedef struct _RECEIPT_RING {
+    ULONG                   Last;           // last sequence number given
+    RECEIPT                 Slots[RECEIPT_RING_SIZE];
+} RECEIPT_RING, *PRECEIPT_RING;
+
+VOID
+ReceiptRingInit(
+    _Out_ PRECEIPT_RING     Ring
+    );
+
+ULONG
+ReceiptOpen(
+    _Inout_ PRECEIPT_RING   Ring,
+    _In_  ULONGLONG         Now
+    );
+
+VOID
+ReceiptClose(
+    _Inout_ PRECEIPT_RING   Ring,
+    _In_  ULONG             Sequence,
+    _In_  ULONGLONG         Now
+    );
+
+VOID
+ReceiptQueued(
+    _Inout_ PRECEIPT_RING   Ring,
+    _In_  ULONG             Sequence
+    );
+
+VOID
+ReceiptResolve(
+    _Inout_ PRECEIPT_RING   Ring,
+    _In_  ULONG             Sequence,
+    _In_  UCHAR             Fate,
+    _In_  ULONGLONG         Now
+    );
+
+ULONG
+ReceiptRingRead(
+    _In_  const RECEIPT_RING* Ring,
+    _In_  ULONG             FirstSequence,
+    _Out_writes_to_(MaxReceipts, return) PVHID_RECEIPT Receipts,
+    _In_  ULONG             MaxReceipts
+    );
+
+#endif // __RECEIPT_H_
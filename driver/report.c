@@ -0,0 +1,835 @@
+#include "vhidmini.h"
+
+//
+// Report pipeline: reports are queued in DEVICE_CONTEXT.Reports and handed to
+// the reads hidclass parks in ManualQueue, at most one per collection per
+// pacing interval when pacing is enabled. Reports identical to the last one
+// of their id are dropped before being queued. A single one-shot timer
+// serves the pacer, typematic and idle repeats, and macros, armed for
+// whichever is due first. Everything here runs with StateLock held, which
+// is a spin lock since the timer fires at DISPATCH_LEVEL.
+//
+
+EVT_WDF_TIMER EvtPipelineTimer;
+
+C_ASSERT(sizeof(HID_NKRO_REPORT) <= REPORT_MAX_SIZE);
+C_ASSERT(sizeof(HID_GAMEPAD_REPORT) <= REPORT_MAX_SIZE);
+
+NTSTATUS
+PipelineTimerCreate(
+    _In_  WDFDEVICE         Device,
+    _Out_ WDFTIMER*         Timer
+    )
+/*++
+Routine Description:
+
+    This function creates the one-shot, high resolution timer releasing
+    reports held back by the pacer and generating typematic repeats.
+
+Arguments:
+
+    Device - Handle to a framework device object.
+
+    Timer - Output pointer to a framework timer handle, on success.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    NTSTATUS                status;
+    WDF_TIMER_CONFIG        timerConfig;
+    WDF_OBJECT_ATTRIBUTES   timerAttributes;
+
+    WDF_TIMER_CONFIG_INIT(&timerConfig, EvtPipelineTimer);
+    timerConfig.UseHighResolutionTimer = WdfTrue;
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+    timerAttributes.ParentObject = Device;
+
+    status = WdfTimerCreate(&timerConfig, &timerAttributes, Timer);
+    if (!NT_SUCCESS(status)) {
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "WdfTimerCreate failed 0x%x\n", status);
+        return status;
+    }
+
+    return status;
+}
+
+VOID
+PipelineArmTimer(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  ULONGLONG         Now
+    )
+/*++
+Routine Description:
+
+    Arms the pipeline timer for the earliest of the pacer, typematic and
+    idle deadlines that lies in the future, or for a macro. A macro that is
+    already due runs on the next tick. Called with StateLock held.
+
+--*/
+{
+    ULONGLONG               deadline = (ULONGLONG)-1;
+    ULONGLONG               next;
+
+    if (DeviceContext->Reports.Count != 0) {
+        next = PacerNextDeadline(&DeviceContext->Pacer, ReportQueueEligibleMask(&DeviceContext->Reports));
+        if (next > Now)
+            deadline = next;
+    }
+
+    next = TypematicNextDeadline(&DeviceContext->Typematic);
+    if (next > Now && next < deadline)
+        deadline = next;
+
+    next = IdleFilterNextDeadline(&DeviceContext->Idle);
+    if (next > Now && next < deadline)
+        deadline = next;
+
+    next = DeviceContext->MacroDeadline;
+    if (next != (ULONGLONG)-1 && next < deadline)
+        deadline = next > Now ? next : Now + 1;
+
+    if (deadline != (ULONGLONG)-1)
+        WdfTimerStart(DeviceContext->PipelineTimer, -(LONGLONG)(deadline - Now));
+}
+
+BOOLEAN
+ReportDispatch(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    )
+/*++
+Routine Description:
+
+    Completes parked hidclass reads with the queued reports the pacer lets
+    through, and arms the pipeline timer for the ones it holds back.
+    Called with StateLock held.
+
+Return Value:
+
+    TRUE if the report queue is empty.
+
+--*/
+{
+    NTSTATUS                status;
+    WDFREQUEST              request;
+    REPORT_ENTRY            report;
+    ULONGLONG               now = VhidQueryTime();
+    ULONG                   ready;
+
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    while (DeviceContext->Reports.Count != 0) {
+        ready = PacerReadyMask(&DeviceContext->Pacer, now);
+        if (!(ReportQueueEligibleMask(&DeviceContext->Reports) & ready))
+            break;
+
+        //
+        // If no read is parked, ReadReport will pick the reports up.
+        //
+        status = WdfIoQueueRetrieveNextRequest(DeviceContext->ManualQueue, &request);
+        if (!NT_SUCCESS(status))
+            break;
+
+        ReportQueuePop(&DeviceContext->Reports, ready, &report);
+        PacerRelease(&DeviceContext->Pacer, report.Data[0], now);
+        ReceiptResolve(&DeviceContext->Receipts, report.Sequence, RECEIPT_DELIVERED, now);
+
+        TraceWrite(&DeviceContext->Trace, VHID_TRACE_REPORT_COMPLETED, report.Data, report.Length, now);
+        status = RequestCopyFromBuffer(request, report.Data, report.Length);
+        WdfRequestComplete(request, status);
+    }
+
+    PipelineArmTimer(DeviceContext, now);
+
+    return DeviceContext->Reports.Count == 0;
+}
+
+VOID
+ReportSetQueueDepth(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  ULONG             Depth
+    )
+/*++
+Routine Description:
+
+    Changes the report queue depth. When it shrinks below the reports
+    pending, the oldest are evicted and accounted for as reports dropped
+    on overflow. Called with StateLock held.
+
+--*/
+{
+    ULONG                   displaced;
+    ULONGLONG               now = VhidQueryTime();
+
+    ReportQueueSetLimit(&DeviceContext->Reports, Depth);
+    while (ReportQueueTrim(&DeviceContext->Reports, &displaced)) {
+        ReceiptResolve(&DeviceContext->Receipts, displaced, RECEIPT_DROPPED, now);
+        TraceWrite(&DeviceContext->Trace, VHID_TRACE_REPORT_EVICTED, NULL, 0, now);
+    }
+}
+
+VOID
+ReportEnqueue(
+    _In_  PDEVICE_CONTEXT   Ctx,
+    _In_reads_bytes_(Size) const VOID* Report,
+    _In_  size_t            Size
+    )
+/*++
+Routine Description:
+
+    Queues a report and dispatches whatever can be delivered. The report
+    is tagged with ActiveSequence, the request being served, and is a chord
+    report if ActiveOrdered is set. A backlog drained by the dispatch is
+    notified when StateLock is released. Called with StateLock held.
+
+--*/
+{
+    UCHAR reportId = *(const UCHAR*)Report;
+    BOOLEAN backlog;
+    ULONG outcome;
+    ULONG displaced;
+    ULONGLONG now;
+
+    backlog = Ctx->Reports.Count != 0;
+
+    //
+    // A gamepad report is the whole state, only the latest one matters.
+    //
+    outcome = ReportQueuePush(&Ctx->Reports, Report, (UCHAR)Size,
+        reportId == MOUSE_REPORT_ID ? Ctx->Config.MouseCoalesce :
+        reportId == GAMEPAD_REPORT_ID ? VHID_COALESCE_LATEST : Ctx->Config.KeyboardCoalesce,
+        reportId == MOUSE_REPORT_ID ? MouseReportMerge : NULL,
+        Ctx->ActiveSequence, Ctx->ActiveOrdered ? REPORT_ORDERED : 0, &displaced);
+
+    now = VhidQueryTime();
+    ReceiptQueued(&Ctx->Receipts, Ctx->ActiveSequence);
+    if (outcome == REPORT_PUSH_EVICTED) {
+        ReceiptResolve(&Ctx->Receipts, displaced, RECEIPT_DROPPED, now);
+        TraceWrite(&Ctx->Trace, VHID_TRACE_REPORT_EVICTED, NULL, 0, now);
+    }
+    else if (outcome == REPORT_PUSH_MERGED) {
+        ReceiptResolve(&Ctx->Receipts, displaced, RECEIPT_MERGED, now);
+    }
+    TraceWrite(&Ctx->Trace,
+        outcome == REPORT_PUSH_MERGED ? VHID_TRACE_REPORT_MERGED : VHID_TRACE_REPORT_QUEUED,
+        Report, (ULONG)Size, now);
+
+    if (ReportDispatch(Ctx) && backlog)
+        Ctx->DrainedPending = TRUE;
+}
+
+NTSTATUS
+SendReport(
+    _In_  PDEVICE_CONTEXT   Ctx,
+    _In_reads_bytes_(Size) VOID* Report,
+    _In_  size_t            Size
+    )
+/*++
+Routine Description:
+
+    Queues a report built from the injected state. Reports of disabled
+    collections, or of collections the profile doesn't have, are dropped,
+    and so are reports that repeat the last state of their id: mouse motion
+    is always sent, only the buttons are compared.
+    Called with StateLock held.
+
+--*/
+{
+    UCHAR reportId = *(PUCHAR)Report;
+    HID_MOUSE_REPORT mouseState;
+    BOOLEAN accepted;
+
+    STATE_LOCK_ASSERT_HELD(Ctx);
+
+    if (!(Ctx->Config.EnabledCollections & Ctx->Collections & ReportCollection(reportId)))
+        return STATUS_SUCCESS;
+
+    if (reportId == MOUSE_REPORT_ID) {
+        mouseState = *(PHID_MOUSE_REPORT)Report;
+        mouseState.X = 0;
+        mouseState.Y = 0;
+        accepted = IdleFilterAccept(&Ctx->Idle, &mouseState, sizeof(mouseState),
+            ((PHID_MOUSE_REPORT)Report)->X != 0 || ((PHID_MOUSE_REPORT)Report)->Y != 0, VhidQueryTime());
+    }
+    else {
+        accepted = IdleFilterAccept(&Ctx->Idle, Report, (UCHAR)Size, FALSE, VhidQueryTime());
+    }
+
+    if (accepted)
+        ReportEnqueue(Ctx, Report, Size);
+
+    return STATUS_SUCCESS;
+}
+
+ULONG
+InjectOpen(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    )
+/*++
+Routine Description:
+
+    Gives an injection request its sequence number and makes it the one
+    the reports queued from now on are charged to. Called with StateLock
+    held.
+
+--*/
+{
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    DeviceContext->ActiveSequence = ReceiptOpen(&DeviceContext->Receipts, VhidQueryTime());
+
+    return DeviceContext->ActiveSequence;
+}
+
+VOID
+InjectClose(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  ULONG             Sequence
+    )
+/*++
+Routine Description:
+
+    Ends the request opened by InjectOpen: its receipt resolves once its
+    queued reports are read. Called with StateLock held.
+
+--*/
+{
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    ReceiptClose(&DeviceContext->Receipts, Sequence, VhidQueryTime());
+    DeviceContext->ActiveSequence = 0;
+}
+
+VOID
+KeyboardApplyKey(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  UCHAR             KeyCode,
+    _In_  BOOLEAN           Pressed
+    )
+{
+    KeyboardReportApplyKey(&DeviceContext->KeyboardState, KeyCode, Pressed);
+    NkroReportApplyKey(&DeviceContext->NkroState, KeyCode, Pressed);
+}
+
+VOID
+KeyboardSend(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  UCHAR             ReleasedKey
+    )
+/*++
+Routine Description:
+
+    Sends the keyboard state in the report layout of the profile, with
+    ReleasedKey, if not 0, shown released. Called with StateLock held.
+
+--*/
+{
+    HID_KEYBOARD_REPORT     boot;
+    HID_NKRO_REPORT         nkro;
+
+    if (DeviceContext->Config.Profile == VHID_PROFILE_NKRO) {
+        nkro = DeviceContext->NkroState;
+        NkroReportApplyKey(&nkro, ReleasedKey, FALSE);
+        SendReport(DeviceContext, &nkro, sizeof(HID_NKRO_REPORT));
+    }
+    else {
+        boot = DeviceContext->KeyboardState;
+        KeyboardReportApplyKey(&boot, ReleasedKey, FALSE);
+        SendReport(DeviceContext, &boot, sizeof(HID_KEYBOARD_REPORT));
+    }
+}
+
+VOID
+InjectKeyEvent(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  UCHAR             KeyCode,
+    _In_  BOOLEAN           Pressed
+    )
+/*++
+Routine Description:
+
+    Records a key transition for the client owning Owner. If it changes the
+    merged state, applies it to the keyboard state and sends the resulting
+    report. Called with StateLock held.
+
+--*/
+{
+    UCHAR                   key[2] = { KeyCode, Pressed };
+    ULONGLONG               now = VhidQueryTime();
+
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    TraceWrite(&DeviceContext->Trace, VHID_TRACE_KEY, key, sizeof(key), now);
+
+    if (!KeyMergeApplyKey(&DeviceContext->KeyMerge, Owner, KeyCode, Pressed))
+        return;
+
+    KeyboardApplyKey(DeviceContext, KeyCode, Pressed);
+
+    TypematicKeyEvent(&DeviceContext->Typematic, KeyCode, Pressed, now);
+
+    KeyboardSend(DeviceContext, 0);
+}
+
+VOID
+InjectMouseMove(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  CHAR              DeltaX,
+    _In_  CHAR              DeltaY
+    )
+/*++
+Routine Description:
+
+    Sends a relative motion report. Called with StateLock held.
+
+--*/
+{
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    DeviceContext->MouseState.X = DeltaX;
+    DeviceContext->MouseState.Y = DeltaY;
+    SendReport(DeviceContext, &DeviceContext->MouseState, sizeof(HID_MOUSE_REPORT));
+    DeviceContext->MouseState.X = 0;
+    DeviceContext->MouseState.Y = 0;
+}
+
+VOID
+InjectMouseButtons(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  UCHAR             ButtonMask
+    )
+/*++
+Routine Description:
+
+    Sets the buttons held by the client owning Owner, and sends the merged
+    button state if it changed. Called with StateLock held.
+
+--*/
+{
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    if (!KeyMergeApplyButtons(&DeviceContext->KeyMerge, Owner, ButtonMask & 0x07))
+        return;
+
+    DeviceContext->MouseState.Buttons = DeviceContext->KeyMerge.Buttons;
+    SendReport(DeviceContext, &DeviceContext->MouseState, sizeof(HID_MOUSE_REPORT));
+}
+
+VOID
+InjectGamepad(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  const VHID_GAMEPAD_STATE* State
+    )
+/*++
+Routine Description:
+
+    Replaces the gamepad state and sends it, packed where the descriptor
+    puts each field. Called with StateLock held.
+
+--*/
+{
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    GamepadPack(&DeviceContext->GamepadLayout, State, (PUCHAR)&DeviceContext->GamepadState);
+    SendReport(DeviceContext, &DeviceContext->GamepadState, sizeof(HID_GAMEPAD_REPORT));
+}
+
+VOID
+InjectRetract(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner
+    )
+/*++
+Routine Description:
+
+    Releases whatever a closing client still holds and no other client
+    does, with one report per collection. Called with StateLock held.
+
+--*/
+{
+    UCHAR                   released[KEY_MERGE_USAGES];
+    BOOLEAN                 buttonsChanged;
+    ULONGLONG               now = VhidQueryTime();
+    ULONG                   count;
+    ULONG                   i;
+
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    count = KeyMergeRetract(&DeviceContext->KeyMerge, Owner, released, &buttonsChanged);
+
+    for (i = 0; i < count; i++) {
+        KeyboardApplyKey(DeviceContext, released[i], FALSE);
+        TypematicKeyEvent(&DeviceContext->Typematic, released[i], FALSE, now);
+    }
+    if (count != 0) {
+        VhidLog(LOG_USER, LOG_LEVEL_INFO, "Released %u key(s) left held by a closed client\n", count);
+        KeyboardSend(DeviceContext, 0);
+    }
+
+    if (buttonsChanged) {
+        DeviceContext->MouseState.Buttons = DeviceContext->KeyMerge.Buttons;
+        SendReport(DeviceContext, &DeviceContext->MouseState, sizeof(HID_MOUSE_REPORT));
+    }
+}
+
+VOID
+InjectSnapshot(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  const KEY_OWNER*  Owner,
+    _Out_ PVHID_SNAPSHOT    Snapshot
+    )
+/*++
+Routine Description:
+
+    Reads the state of every collection, and the part of it Owner holds.
+    Called with StateLock held.
+
+--*/
+{
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+
+    C_ASSERT(VHID_SNAPSHOT_KEY_WORDS == KEY_MERGE_USAGES / 32);
+
+    RtlZeroMemory(Snapshot, sizeof(*Snapshot));
+    KeyMergeHeld(&DeviceContext->KeyMerge, Snapshot->Keys);
+    RtlCopyMemory(Snapshot->OwnKeys, Owner->Keys, sizeof(Snapshot->OwnKeys));
+    Snapshot->Buttons = DeviceContext->KeyMerge.Buttons;
+    Snapshot->OwnButtons = Owner->Buttons;
+    Snapshot->Collections = DeviceContext->Collections;
+    GamepadUnpack(&DeviceContext->GamepadLayout, (const UCHAR*)&DeviceContext->GamepadState, &Snapshot->Gamepad);
+}
+
+ULONG
+InjectRestore(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  const VHID_SNAPSHOT* Snapshot
+    )
+/*++
+Routine Description:
+
+    Brings the collections in Snapshot->Collections back to the state of
+    Snapshot. What has to be released is withdrawn from every handle and
+    macro holding it, what has to be pressed is pressed by Owner, and each
+    collection that changed is then sent once, in its final state, instead
+    of one report per transition.
+
+Return Value:
+
+    The sequence number of the request.
+
+--*/
+{
+    VHID_SNAPSHOT           current;
+    SNAPSHOT_DIFF           diff;
+    ULONG                   released[VHID_SNAPSHOT_KEY_WORDS];
+    ULONG                   pressed[VHID_SNAPSHOT_KEY_WORDS];
+    PLIST_ENTRY             entry;
+    ULONGLONG               now = VhidQueryTime();
+    ULONG                   sequence;
+    UCHAR                   key;
+
+    StateLockAcquire(DeviceContext);
+    sequence = InjectOpen(DeviceContext);
+
+    InjectSnapshot(DeviceContext, Owner, &current);
+    SnapshotDiff(&current, Snapshot, Snapshot->Collections, &diff);
+
+    if (diff.Transitions != 0) {
+        //
+        // StateLock keeps every owner's bitmap stable; NotifyLock keeps the
+        // file list stable.
+        //
+        KeyMergeWithdraw(&DeviceContext->KeyMerge, &DeviceContext->DeviceKeys, diff.Released, diff.ButtonsReleased);
+        MacroWithdraw(DeviceContext, diff.Released, diff.ButtonsReleased);
+        WdfSpinLockAcquire(DeviceContext->NotifyLock);
+        for (entry = DeviceContext->FileList.Flink; entry != &DeviceContext->FileList; entry = entry->Flink) {
+            KeyMergeWithdraw(&DeviceContext->KeyMerge, &CONTAINING_RECORD(entry, FILE_CONTEXT, Link)->Keys,
+                diff.Released, diff.ButtonsReleased);
+        }
+        WdfSpinLockRelease(DeviceContext->NotifyLock);
+
+        //
+        // Releases first, so the keys being pressed find free slots in a
+        // boot keyboard report.
+        //
+        RtlCopyMemory(released, diff.Released, sizeof(released));
+        while (SnapshotNextKey(released, &key)) {
+            KeyboardApplyKey(DeviceContext, key, FALSE);
+            TypematicKeyEvent(&DeviceContext->Typematic, key, FALSE, now);
+        }
+        RtlCopyMemory(pressed, diff.Pressed, sizeof(pressed));
+        while (SnapshotNextKey(pressed, &key)) {
+            KeyMergeApplyKey(&DeviceContext->KeyMerge, Owner, key, TRUE);
+            KeyboardApplyKey(DeviceContext, key, TRUE);
+            TypematicKeyEvent(&DeviceContext->Typematic, key, TRUE, now);
+        }
+        KeyMergeApplyButtons(&DeviceContext->KeyMerge, Owner, Owner->Buttons | diff.ButtonsPressed);
+    }
+
+    if (diff.Collections & VHID_COLLECTION_KEYBOARD)
+        KeyboardSend(DeviceContext, 0);
+
+    if (diff.Collections & VHID_COLLECTION_MOUSE) {
+        DeviceContext->MouseState.Buttons = DeviceContext->KeyMerge.Buttons;
+        SendReport(DeviceContext, &DeviceContext->MouseState, sizeof(HID_MOUSE_REPORT));
+    }
+
+    if (diff.GamepadChanged)
+        InjectGamepad(DeviceContext, &Snapshot->Gamepad);
+
+    InjectClose(DeviceContext, sequence);
+    StateLockRelease(DeviceContext);
+
+    VhidLog(LOG_USER, LOG_LEVEL_INFO, "Restored a snapshot with %u transition(s)\n", diff.Transitions);
+    return sequence;
+}
+
+VOID
+InjectEvent(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  const VHID_BATCH_EVENT* Event
+    )
+/*++
+Routine Description:
+
+    Applies one batch record. Records of an unknown type are ignored.
+    Called with StateLock held.
+
+--*/
+{
+    switch (Event->Type) {
+    case VHID_BATCH_KEY:
+        InjectKeyEvent(DeviceContext, Owner, Event->Data[0], Event->Data[1] != 0);
+        break;
+    case VHID_BATCH_MOVE:
+        InjectMouseMove(DeviceContext, (CHAR)Event->Data[0], (CHAR)Event->Data[1]);
+        break;
+    case VHID_BATCH_BUTTON:
+        InjectMouseButtons(DeviceContext, Owner, Event->Data[0]);
+        break;
+    }
+}
+
+NTSTATUS
+InjectBatch(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_reads_(Count) const VHID_BATCH_EVENT* Events,
+    _In_  ULONG             Count,
+    _Out_ PULONG            Sequence
+    )
+/*++
+Routine Description:
+
+    Applies a batch of events under a single StateLock acquisition, as one
+    request with one sequence number. Nothing is applied if any event is
+    malformed.
+
+--*/
+{
+    ULONG                   i;
+
+    *Sequence = 0;
+
+    for (i = 0; i < Count; i++) {
+        if (Events[i].Type < VHID_BATCH_KEY || Events[i].Type > VHID_BATCH_BUTTON)
+            return STATUS_INVALID_PARAMETER;
+    }
+
+    StateLockAcquire(DeviceContext);
+    *Sequence = InjectOpen(DeviceContext);
+    for (i = 0; i < Count; i++)
+        InjectEvent(DeviceContext, Owner, &Events[i]);
+    InjectClose(DeviceContext, *Sequence);
+    StateLockRelease(DeviceContext);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+InjectStream(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_reads_bytes_(Length) const UCHAR* Data,
+    _In_  size_t            Length,
+    _Out_ size_t*           Consumed
+    )
+/*++
+Routine Description:
+
+    Applies the records of a bulk payload in place, as many as the report
+    queue has room for, as one request. A request is one slice: StateLock
+    is held once, around at most a queue's worth of records, and the caller
+    resubmits the rest once hidclass has read some of the queue.
+
+Return Value:
+
+    STATUS_DEVICE_BUSY if the queue had no room for a single record.
+    STATUS_INVALID_PARAMETER if the first record has an unknown type, or
+    is cut by the end of the payload.
+
+--*/
+{
+    STREAM_PARSER           parser;
+    VHID_BATCH_EVENT        events[VHID_MAX_QUEUE_DEPTH];
+    size_t                  used;
+    ULONG                   room;
+    ULONG                   count;
+    ULONG                   sequence;
+    ULONG                   i;
+
+    StreamParserInit(&parser);
+
+    StateLockAcquire(DeviceContext);
+    sequence = InjectOpen(DeviceContext);
+
+    //
+    // Each event queues at most one report, and events bounds the slice.
+    //
+    room = min(ReportQueueRoom(&DeviceContext->Reports), (ULONG)RTL_NUMBER_OF(events));
+    count = StreamParserFeed(&parser, Data, Length, &used, events, room);
+    for (i = 0; i < count; i++)
+        InjectEvent(DeviceContext, Owner, &events[i]);
+
+    InjectClose(DeviceContext, sequence);
+    StateLockRelease(DeviceContext);
+
+    *Consumed = parser.Consumed;
+
+    //
+    // The payload is whole, so a record the parser holds a part of can
+    // never be completed.
+    //
+    if (parser.Consumed == 0 && Length != 0) {
+        if (parser.Invalid || parser.PartialLength != 0)
+            return STATUS_INVALID_PARAMETER;
+        return STATUS_DEVICE_BUSY;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+TypeText(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  ULONG             Layout,
+    _In_reads_bytes_(Length) const UCHAR* Text,
+    _In_  size_t            Length,
+    _Out_ PVHID_TYPE_TEXT_RESULT Result
+    )
+/*++
+Routine Description:
+
+    Types as much of Text as the report queue has room for, so that no key
+    transition is coalesced away. Modifiers are released at the end of each
+    call; a character is never split across calls.
+
+Return Value:
+
+    STATUS_DEVICE_BUSY if the queue is too full to type a single character.
+
+--*/
+{
+    NTSTATUS                status;
+    TEXT_COMPILER           compiler;
+    VHID_KEY_EVENT          events[VHID_MAX_QUEUE_DEPTH];
+    size_t                  consumed = 0;
+    ULONG                   room;
+    ULONG                   count;
+    ULONG                   i;
+
+    status = TextCompilerInit(&compiler, Layout);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    StateLockAcquire(DeviceContext);
+
+    if (DeviceContext->Config.KeyboardCoalesce != VHID_COALESCE_QUEUE) {
+        StateLockRelease(DeviceContext);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    Result->Sequence = InjectOpen(DeviceContext);
+
+    //
+    // Each event queues one report, and events bounds what one call types.
+    //
+    room = min(ReportQueueRoom(&DeviceContext->Reports), (ULONG)RTL_NUMBER_OF(events));
+    if (room > TEXT_MAX_FINISH_EVENTS) {
+        count = TextCompilerFeed(&compiler, Text, Length, &consumed, events, room - TEXT_MAX_FINISH_EVENTS);
+        count += TextCompilerFinish(&compiler, events + count, room - count);
+
+        for (i = 0; i < count; i++)
+            InjectKeyEvent(DeviceContext, Owner, events[i].KeyCode, events[i].Pressed != 0);
+    }
+
+    InjectClose(DeviceContext, Result->Sequence);
+    StateLockRelease(DeviceContext);
+
+    Result->Consumed = (ULONG)consumed;
+    Result->Unmapped = compiler.Unmapped;
+
+    if (consumed == 0 && Length != 0)
+        return STATUS_DEVICE_BUSY;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+TypematicRepeat(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  UCHAR             KeyCode
+    )
+/*++
+Routine Description:
+
+    Sends a release/press pair for a held key. hidclass only reports state
+    changes, so a repeat has to look like a new key press. This relies on
+    the keyboard coalescing policy being VHID_COALESCE_QUEUE; with
+    VHID_COALESCE_LATEST the pair folds back into the unchanged state.
+
+--*/
+{
+    KeyboardSend(DeviceContext, KeyCode);
+    KeyboardSend(DeviceContext, 0);
+}
+
+VOID
+EvtPipelineTimer(
+    _In_  WDFTIMER          Timer
+    )
+{
+    PDEVICE_CONTEXT         deviceContext = GetDeviceContext(WdfTimerGetParentObject(Timer));
+    REPORT_ENTRY            report;
+    UCHAR                   keyCode;
+
+    StateLockAcquire(deviceContext);
+    if (TypematicTick(&deviceContext->Typematic, VhidQueryTime(), &keyCode))
+        TypematicRepeat(deviceContext, keyCode);
+
+    //
+    // Idle repeats bypass the duplicate filter, repeating is their point.
+    //
+    while (IdleFilterTick(&deviceContext->Idle, VhidQueryTime(),
+        ReportQueuePendingMask(&deviceContext->Reports), &report))
+        ReportEnqueue(deviceContext, report.Data, report.Length);
+
+    if (!IsListEmpty(&deviceContext->Macros))
+        MacroTick(deviceContext, VhidQueryTime());
+
+    if (deviceContext->Reports.Count != 0) {
+        if (ReportDispatch(deviceContext))
+            deviceContext->DrainedPending = TRUE;
+    }
+    else
+        PipelineArmTimer(deviceContext, VhidQueryTime());
+    StateLockRelease(deviceContext);
+}
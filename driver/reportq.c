@@ -0,0 +1,260 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "reportq.h"
+
+#define ENTRY(Queue, Index) (&(Queue)->Entries[((Queue)->Head + (Index)) % VHID_MAX_QUEUE_DEPTH])
+
+VOID
+ReportQueueInit(
+    _Out_ PREPORT_QUEUE     Queue,
+    _In_  ULONG             Limit
+    )
+{
+    RtlZeroMemory(Queue, sizeof(REPORT_QUEUE));
+    Queue->Limit = Limit;
+}
+
+VOID
+ReportQueueSetLimit(
+    _Inout_ PREPORT_QUEUE   Queue,
+    _In_  ULONG             Limit
+    )
+/*++
+
+Routine Description:
+
+    Changes the queue depth. Reports already pending beyond a smaller limit
+    stay queued until the caller evicts them with ReportQueueTrim.
+
+--*/
+{
+    Queue->Limit = Limit;
+}
+
+BOOLEAN
+ReportQueueTrim(
+    _Inout_ PREPORT_QUEUE   Queue,
+    _Out_ PULONG            Displaced
+    )
+/*++
+
+Routine Description:
+
+    Evicts the oldest report if more are pending than the limit allows,
+    as ReportQueuePush does on overflow.
+
+Return Value:
+
+    TRUE and the sequence number of the evicted report in Displaced, or
+    FALSE if the queue is within its limit.
+
+--*/
+{
+    *Displaced = 0;
+
+    if (Queue->Count <= Queue->Limit)
+        return FALSE;
+
+    *Displaced = ENTRY(Queue, 0)->Sequence;
+    Queue->Head = (Queue->Head + 1) % VHID_MAX_QUEUE_DEPTH;
+    Queue->Count--;
+    Queue->Dropped++;
+    return TRUE;
+}
+
+ULONG
+ReportQueueRoom(
+    _In_  PREPORT_QUEUE     Queue
+    )
+/*++
+
+Return Value:
+
+    Number of reports that can be queued without merging or evicting, 0
+    when the queue is at or over its limit.
+
+--*/
+{
+    return Queue->Count >= Queue->Limit ? 0 : Queue->Limit - Queue->Count;
+}
+
+PREPORT_ENTRY
+ReportQueueFindNewest(
+    _In_  PREPORT_QUEUE     Queue,
+    _In_  UCHAR             ReportId
+    )
+/*++
+
+Routine Description:
+
+    Finds the pending report a new one of ReportId can be merged into.
+    Merging into a report queued before a chord would move the new state
+    ahead of the chord, so the search stops at the newest chord report.
+
+--*/
+{
+    ULONG                   i;
+    PREPORT_ENTRY           entry;
+
+    for (i = Queue->Count; i-- > 0; ) {
+        entry = ENTRY(Queue, i);
+        if (entry->Flags & REPORT_ORDERED)
+            return NULL;
+        if (entry->Data[0] == ReportId)
+            return entry;
+    }
+    return NULL;
+}
+
+ULONG
+ReportQueuePush(
+    _Inout_ PREPORT_QUEUE   Queue,
+    _In_reads_bytes_(Length) const VOID* Report,
+    _In_  UCHAR             Length,
+    _In_  UCHAR             Coalesce,
+    _In_opt_ REPORT_MERGE_ROUTINE* Merge,
+    _In_  ULONG             Sequence,
+    _In_  UCHAR             Flags,
+    _Out_ PULONG            Displaced
+    )
+/*++
+
+Routine Description:
+
+    Queues a report for request Sequence, merging it into a pending one
+    when the collection's policy or a full queue calls for it.
+
+Return Value:
+
+    REPORT_PUSH_xxx. For REPORT_PUSH_MERGED and REPORT_PUSH_EVICTED,
+    Displaced receives the sequence number of the report merged into or
+    evicted.
+
+--*/
+{
+    PREPORT_ENTRY           entry;
+    ULONG                   outcome = REPORT_PUSH_QUEUED;
+
+    *Displaced = 0;
+
+    if (Length == 0 || Length > REPORT_MAX_SIZE)
+        return REPORT_PUSH_QUEUED;
+
+    if (!(Flags & REPORT_ORDERED) && (Coalesce == VHID_COALESCE_LATEST || Queue->Count >= Queue->Limit)) {
+        entry = ReportQueueFindNewest(Queue, ((const UCHAR*)Report)[0]);
+        if (entry != NULL && entry->Length == Length) {
+            if (Merge == NULL)
+                RtlCopyMemory(entry->Data, Report, Length);
+            if (Merge == NULL || Merge(entry->Data, Report, Length)) {
+                Queue->Merged++;
+                *Displaced = entry->Sequence;
+                entry->Sequence = Sequence;
+                return REPORT_PUSH_MERGED;
+            }
+        }
+    }
+
+    if (Queue->Count >= Queue->Limit || Queue->Count == VHID_MAX_QUEUE_DEPTH) {
+        //
+        // Full, and nothing of this collection to merge into: evict
+        // the oldest report.
+        //
+        *Displaced = ENTRY(Queue, 0)->Sequence;
+        Queue->Head = (Queue->Head + 1) % VHID_MAX_QUEUE_DEPTH;
+        Queue->Count--;
+        Queue->Dropped++;
+        outcome = REPORT_PUSH_EVICTED;
+    }
+
+    entry = ENTRY(Queue, Queue->Count);
+    entry->Sequence = Sequence;
+    entry->Flags = Flags;
+    entry->Length = Length;
+    RtlCopyMemory(entry->Data, Report, Length);
+    Queue->Count++;
+
+    return outcome;
+}
+
+BOOLEAN
+ReportQueuePop(
+    _Inout_ PREPORT_QUEUE   Queue,
+    _In_  ULONG             ReportIdMask,
+    _Out_ PREPORT_ENTRY     Entry
+    )
+/*++
+
+Routine Description:
+
+    Removes the oldest report whose id is in ReportIdMask. Reports of other
+    collections keep their place, so each collection stays in order. The
+    search stops at a chord report, which nothing behind it may overtake.
+
+--*/
+{
+    ULONG                   i, j;
+    PREPORT_ENTRY           entry;
+
+    for (i = 0; i < Queue->Count; i++) {
+        entry = ENTRY(Queue, i);
+        if (ReportIdMask & REPORT_ID_MASK(entry->Data[0]))
+            break;
+        if (entry->Flags & REPORT_ORDERED)
+            return FALSE;
+    }
+    if (i == Queue->Count)
+        return FALSE;
+
+    *Entry = *ENTRY(Queue, i);
+
+    if (i == 0) {
+        Queue->Head = (Queue->Head + 1) % VHID_MAX_QUEUE_DEPTH;
+    }
+    else {
+        for (j = i; j + 1 < Queue->Count; j++)
+            *ENTRY(Queue, j) = *ENTRY(Queue, j + 1);
+    }
+    Queue->Count--;
+    return TRUE;
+}
+
+ULONG
+ReportQueuePendingMask(
+    _In_  PREPORT_QUEUE     Queue
+    )
+{
+    ULONG                   i;
+    ULONG                   mask = 0;
+
+    for (i = 0; i < Queue->Count; i++)
+        mask |= REPORT_ID_MASK(ENTRY(Queue, i)->Data[0]);
+
+    return mask;
+}
+
+ULONG
+ReportQueueEligibleMask(
+    _In_  PREPORT_QUEUE     Queue
+    )
+/*++
+
+Routine Description:
+
+    Returns the REPORT_ID_MASK of the report ids ReportQueuePop can return
+    now, which excludes those only queued behind a chord report.
+
+--*/
+{
+    ULONG                   i;
+    ULONG                   mask = 0;
+    PREPORT_ENTRY           entry;
+
+    for (i = 0; i < Queue->Count; i++) {
+        entry = ENTRY(Queue, i);
+        mask |= REPORT_ID_MASK(entry->Data[0]);
+        if (entry->Flags & REPORT_ORDERED)
+            break;
+    }
+
+    return mask;
+}
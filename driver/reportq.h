@@ -0,0 +1,107 @@
+#ifndef __REPORTQ_H_
+#define __REPORTQ_H_
+
+//
+// Input reports waiting for a hidclass read. Entries are whole reports
+// (report id first) kept in arrival order. Depending on the collection's
+// coalescing policy a new state is either merged into the newest pending
+// report of the same id or appended; when the queue is full it is merged
+// if at all possible, so the final state is not lost.
+//
+// A collection's merge routine decides how two states combine. Without one
+// the newer report simply replaces the pending one.
+//
+// Each report carries the sequence number of the request that queued it,
+// or last merged into it, so its fate can be reported back. Reports pushed
+// with REPORT_ORDERED belong to a chord: they are never merged, and no
+// report queued after one of them is popped before it, so a chord reaches
+// hidclass as a contiguous sequence across collections.
+//
+#define REPORT_MAX_SIZE     16
+
+#define REPORT_ORDERED      0x01
+
+#define REPORT_PUSH_QUEUED  0
+#define REPORT_PUSH_MERGED  1           // into a pending report
+#define REPORT_PUSH_EVICTED 2           // queued, the oldest report was evicted
+
+#define REPORT_ID_MASK(Id)  (1UL << ((Id) & 31))
+#define REPORT_ID_ANY       0xFFFFFFFF
+
+typedef
+BOOLEAN
+REPORT_MERGE_ROUTINE(
+    _Inout_updates_bytes_(Length) PVOID Pending,
+    _In_reads_bytes_(Length) const VOID* Report,
+    _In_  UCHAR             Length
+    );
+
+typedef struct _REPORT_ENTRY {
+    ULONG                   Sequence;       // request, 0 = none
+    UCHAR                   Flags;          // REPORT_xxx
+    UCHAR                   Length;
+    UCHAR                   Data[REPORT_MAX_SIZE];
+} REPORT_ENTRY, *PREPORT_ENTRY;
+
+typedef struct _REPORT_QUEUE {
+    ULONG                   Head;
+    ULONG                   Count;
+    ULONG                   Limit;
+    ULONG                   Merged;         // states overwritten before being read
+    ULONG                   Dropped;        // reports evicted on overflow
+    REPORT_ENTRY            Entries[VHID_MAX_QUEUE_DEPTH];
+} REPORT_QUEUE, *PREPORT_QUEUE;
+
+VOID
+ReportQueueInit(
+    _Out_ PREPORT_QUEUE     Queue,
+    _In_  ULONG             Limit
+    );
+
+VOID
+ReportQueueSetLimit(
+    _Inout_ PREPORT_QUEUE   Queue,
+    _In_  ULONG             Limit
+    );
+
+BOOLEAN
+ReportQueueTrim(
+    _Inout_ PREPORT_QUEUE   Queue,
+    _Out_ PULONG            Displaced
+    );
+
+ULONG
+ReportQueueRoom(
+    _In_  PREPORT_QUEUE     Queue
+    );
+
+ULONG
+ReportQueuePush(
+    _Inout_ PREPORT_QUEUE   Queue,
+    _In_reads_bytes_(Length) const VOID* Report,
+    _In_  UCHAR             Length,
+    _In_  UCHAR             Coalesce,
+    _In_opt_ REPORT_MERGE_ROUTINE* Merge,
+    _In_  ULONG             Sequence,
+    _In_  UCHAR             Flags,
+    _Out_ PULONG            Displaced
+    );
+
+BOOLEAN
+ReportQueuePop(
+    _Inout_ PREPORT_QUEUE   Queue,
+    _In_  ULONG             ReportIdMask,
+    _Out_ PREPORT_ENTRY     Entry
+    );
+
+ULONG
+ReportQueuePendingMask(
+    _In_  PREPORT_QUEUE     Queue
+    );
+
+ULONG
+ReportQueueEligibleMask(
+    _In_  PREPORT_QUEUE     Queue
+    );
+
+#endif // __REPORTQ_H_
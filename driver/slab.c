@@ -0,0 +1,83 @@
+#include "vhidport.h"
+#include "slab.h"
+
+VOID
+SlabInit(
+    _Out_ PSLAB             Slab,
+    _In_  PVOID             Memory,
+    _In_  size_t            Length,
+    _In_  ULONG             ObjectSize
+    )
+/*++
+
+Routine Description:
+
+    Carves Memory into as many objects of ObjectSize as fit and spreads
+    them over the shards. Memory must be aligned on
+    MEMORY_ALLOCATION_ALIGNMENT and outlive the slab.
+
+--*/
+{
+    ULONG                   i;
+
+    RtlZeroMemory(Slab, sizeof(SLAB));
+    for (i = 0; i < SLAB_SHARDS; i++)
+        InitializeSListHead(&Slab->Free[i]);
+
+    Slab->Base = (PUCHAR)Memory;
+    Slab->Stride = (ULONG)SLAB_STRIDE(ObjectSize);
+    Slab->Count = (ULONG)(Length / Slab->Stride);
+
+    for (i = 0; i < Slab->Count; i++)
+        InterlockedPushEntrySList(&Slab->Free[i % SLAB_SHARDS], (PSLIST_ENTRY)(Slab->Base + (size_t)i * Slab->Stride));
+}
+
+PVOID
+SlabAlloc(
+    _Inout_ PSLAB           Slab
+    )
+/*++
+
+Routine Description:
+
+    Takes a free object, from the current processor's shard if it has one.
+    The object's contents are undefined.
+
+Return Value:
+
+    The object, or NULL if the slab is exhausted.
+
+--*/
+{
+    ULONG                   shard = VhidCurrentProcessor();
+    PSLIST_ENTRY            entry = NULL;
+    LONG                    inUse;
+    LONG                    peak;
+    ULONG                   i;
+
+    for (i = 0; i < SLAB_SHARDS && entry == NULL; i++)
+        entry = InterlockedPopEntrySList(&Slab->Free[(shard + i) % SLAB_SHARDS]);
+
+    if (entry == NULL) {
+        InterlockedIncrement(&Slab->Failures);
+        return NULL;
+    }
+
+    inUse = InterlockedIncrement(&Slab->InUse);
+    for (peak = Slab->Peak; inUse > peak; peak = Slab->Peak) {
+        if (InterlockedCompareExchange(&Slab->Peak, inUse, peak) == peak)
+            break;
+    }
+
+    return entry;
+}
+
+VOID
+SlabFree(
+    _Inout_ PSLAB           Slab,
+    _In_  PVOID             Object
+    )
+{
+    InterlockedDecrement(&Slab->InUse);
+    InterlockedPushEntrySList(&Slab->Free[VhidCurrentProcessor() % SLAB_SHARDS], (PSLIST_ENTRY)Object);
+}
@@ -0,0 +1,49 @@
+#ifndef __SLAB_H_
+#define __SLAB_H_
+
+//
+// Fixed-size object allocator over a block of memory provided up front, so
+// allocating never touches the pool. Free objects sit on interlocked
+// singly-linked lists, one per processor shard: an allocation pops from the
+// caller's shard and only looks at the others when it is empty, and a free
+// pushes to the caller's shard, so processors mostly stay off each other's
+// list heads. Both are lock-free and callable at any IRQL up to
+// DISPATCH_LEVEL. An allocation that finds every shard empty fails and is
+// counted.
+//
+#define SLAB_SHARDS             8
+
+#define SLAB_STRIDE(Size)       \
+    ((((Size) < sizeof(SLIST_ENTRY) ? sizeof(SLIST_ENTRY) : (Size)) + MEMORY_ALLOCATION_ALIGNMENT - 1) & \
+        ~(size_t)(MEMORY_ALLOCATION_ALIGNMENT - 1))
+
+typedef struct _SLAB {
+    SLIST_HEADER            Free[SLAB_SHARDS];
+    PUCHAR                  Base;
+    ULONG                   Stride;
+    ULONG                   Count;
+    volatile LONG           InUse;
+    volatile LONG           Peak;
+    volatile LONG           Failures;
+} SLAB, *PSLAB;
+
+VOID
+SlabInit(
+    _Out_ PSLAB             Slab,
+    _In_  PVOID             Memory,
+    _In_  size_t            Length,
+    _In_  ULONG             ObjectSize
+    );
+
+PVOID
+SlabAlloc(
+    _Inout_ PSLAB           Slab
+    );
+
+VOID
+SlabFree(
+    _Inout_ PSLAB           Slab,
+    _In_  PVOID             Object
+    );
+
+#endif // __SLAB_H_
@@ -0,0 +1,103 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "snapshot.h"
+
+static
+ULONG
+BitCount(
+    _In_  ULONG             Bits
+    )
+{
+    ULONG                   count = 0;
+
+    while (Bits != 0) {
+        Bits &= Bits - 1;
+        count++;
+    }
+    return count;
+}
+
+VOID
+SnapshotDiff(
+    _In_  const VHID_SNAPSHOT* From,
+    _In_  const VHID_SNAPSHOT* To,
+    _In_  UCHAR             Collections,
+    _Out_ PSNAPSHOT_DIFF    Diff
+    )
+/*++
+
+Routine Description:
+
+    Computes the transitions taking the state of From to that of To, for
+    the collections in Collections only. The keys of both snapshots are
+    compared a word at a time; OwnKeys and OwnButtons play no part.
+
+--*/
+{
+    ULONG                   i;
+
+    RtlZeroMemory(Diff, sizeof(*Diff));
+
+    if (Collections & VHID_COLLECTION_KEYBOARD) {
+        for (i = 0; i < VHID_SNAPSHOT_KEY_WORDS; i++) {
+            Diff->Released[i] = From->Keys[i] & ~To->Keys[i];
+            Diff->Pressed[i] = To->Keys[i] & ~From->Keys[i];
+            Diff->Transitions += BitCount(Diff->Released[i] | Diff->Pressed[i]);
+        }
+        if (Diff->Transitions != 0)
+            Diff->Collections |= VHID_COLLECTION_KEYBOARD;
+    }
+
+    if (Collections & VHID_COLLECTION_MOUSE) {
+        Diff->ButtonsReleased = From->Buttons & ~To->Buttons & 0x07;
+        Diff->ButtonsPressed = To->Buttons & ~From->Buttons & 0x07;
+        if ((Diff->ButtonsReleased | Diff->ButtonsPressed) != 0) {
+            Diff->Transitions += BitCount(Diff->ButtonsReleased | Diff->ButtonsPressed);
+            Diff->Collections |= VHID_COLLECTION_MOUSE;
+        }
+    }
+
+    //
+    // The gamepad report is absolute: one report with the new state,
+    // whatever changed in it.
+    //
+    if ((Collections & VHID_COLLECTION_GAMEPAD) &&
+        (From->Gamepad.Buttons != To->Gamepad.Buttons ||
+         From->Gamepad.X != To->Gamepad.X || From->Gamepad.Y != To->Gamepad.Y ||
+         From->Gamepad.Z != To->Gamepad.Z || From->Gamepad.Rz != To->Gamepad.Rz)) {
+        Diff->GamepadChanged = TRUE;
+        Diff->Collections |= VHID_COLLECTION_GAMEPAD;
+    }
+}
+
+BOOLEAN
+SnapshotNextKey(
+    _Inout_updates_(VHID_SNAPSHOT_KEY_WORDS) PULONG Keys,
+    _Out_ PUCHAR            KeyCode
+    )
+/*++
+
+Routine Description:
+
+    Takes the lowest usage out of a key bitmap, such as the Released or
+    Pressed of a SNAPSHOT_DIFF.
+
+Return Value:
+
+    FALSE once the bitmap is empty.
+
+--*/
+{
+    ULONG                   i;
+    ULONG                   bit;
+
+    for (i = 0; i < VHID_SNAPSHOT_KEY_WORDS; i++) {
+        if (Keys[i] != 0) {
+            BitScanForward(&bit, Keys[i]);
+            Keys[i] &= Keys[i] - 1;
+            *KeyCode = (UCHAR)(i * 32 + bit);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
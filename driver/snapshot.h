@@ -0,0 +1,33 @@
+#ifndef __SNAPSHOT_H_
+#define __SNAPSHOT_H_
+
+//
+// Difference between two VHID_SNAPSHOTs, as the transitions taking the
+// first to the second and the collections whose report they change. A
+// restore applies them and sends one report per collection in Collections.
+//
+typedef struct _SNAPSHOT_DIFF {
+    ULONG                   Released[VHID_SNAPSHOT_KEY_WORDS];
+    ULONG                   Pressed[VHID_SNAPSHOT_KEY_WORDS];
+    UCHAR                   ButtonsReleased;
+    UCHAR                   ButtonsPressed;
+    UCHAR                   Collections;    // VHID_COLLECTION_xxx with a change
+    BOOLEAN                 GamepadChanged;
+    ULONG                   Transitions;    // keys and buttons changing
+} SNAPSHOT_DIFF, *PSNAPSHOT_DIFF;
+
+VOID
+SnapshotDiff(
+    _In_  const VHID_SNAPSHOT* From,
+    _In_  const VHID_SNAPSHOT* To,
+    _In_  UCHAR             Collections,
+    _Out_ PSNAPSHOT_DIFF    Diff
+    );
+
+BOOLEAN
+SnapshotNextKey(
+    _Inout_updates_(VHID_SNAPSHOT_KEY_WORDS) PULONG Keys,
+    _Out_ PUCHAR            KeyCode
+    );
+
+#endif // __SNAPSHOT_H_
@@ -0,0 +1,118 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "stream.h"
+
+static
+UCHAR
+StreamRecordSize(
+    _In_  UCHAR             Type
+    )
+{
+    switch (Type) {
+    case VHID_BATCH_KEY:
+    case VHID_BATCH_MOVE:
+        return 3;
+    case VHID_BATCH_BUTTON:
+        return 2;
+    }
+
+    return 0;
+}
+
+static
+VOID
+StreamDecode(
+    _In_reads_bytes_(VHID_STREAM_MAX_RECORD) const UCHAR* Record,
+    _Out_ PVHID_BATCH_EVENT Event
+    )
+{
+    Event->Type = Record[0];
+    Event->Data[0] = Record[1];
+    Event->Data[1] = Record[0] == VHID_BATCH_BUTTON ? 0 : Record[2];
+    Event->Data[2] = 0;
+}
+
+VOID
+StreamParserInit(
+    _Out_ PSTREAM_PARSER    Parser
+    )
+{
+    RtlZeroMemory(Parser, sizeof(STREAM_PARSER));
+}
+
+ULONG
+StreamParserFeed(
+    _Inout_ PSTREAM_PARSER  Parser,
+    _In_reads_bytes_(Length) const UCHAR* Data,
+    _In_  size_t            Length,
+    _Out_ size_t*           Used,
+    _Out_writes_to_(MaxEvents, return) PVHID_BATCH_EVENT Events,
+    _In_  ULONG             MaxEvents
+    )
+/*++
+
+Routine Description:
+
+    Parses records from the next chunk of the payload, until the chunk is
+    used up, MaxEvents events have been produced, or a record has an
+    unknown type. Records are decoded straight from Data; only the tail of
+    a record cut by the end of a chunk is copied.
+
+Return Value:
+
+    The number of events stored in Events. Used receives the bytes of Data
+    taken, including a partial record now held by the parser.
+
+--*/
+{
+    ULONG                   count = 0;
+    size_t                  used = 0;
+    size_t                  take;
+    UCHAR                   size;
+
+    *Used = 0;
+    if (Parser->Invalid)
+        return 0;
+
+    //
+    // Complete the record the previous chunk cut.
+    //
+    if (Parser->PartialLength != 0) {
+        size = StreamRecordSize(Parser->Partial[0]);
+        take = min(Length, (size_t)(size - Parser->PartialLength));
+        if (Parser->PartialLength + take == size && MaxEvents == 0)
+            return 0;
+        RtlCopyMemory(Parser->Partial + Parser->PartialLength, Data, take);
+        Parser->PartialLength += (UCHAR)take;
+        used = take;
+        if (Parser->PartialLength < size) {
+            *Used = used;
+            return 0;
+        }
+        StreamDecode(Parser->Partial, &Events[count++]);
+        Parser->Consumed += size;
+        Parser->PartialLength = 0;
+    }
+
+    while (used < Length) {
+        size = StreamRecordSize(Data[used]);
+        if (size == 0) {
+            Parser->Invalid = TRUE;
+            break;
+        }
+        if (Length - used < size) {
+            RtlCopyMemory(Parser->Partial, Data + used, Length - used);
+            Parser->PartialLength = (UCHAR)(Length - used);
+            used = Length;
+            break;
+        }
+        if (count == MaxEvents)
+            break;
+        StreamDecode(Data + used, &Events[count++]);
+        Parser->Consumed += size;
+        used += size;
+    }
+
+    *Used = used;
+    return count;
+}
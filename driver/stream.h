@@ -0,0 +1,33 @@
+#ifndef __STREAM_H_
+#define __STREAM_H_
+
+//
+// Parser for the packed records of IOCTL_VHIDMINI_SEND_STREAM. The payload
+// can be fed in chunks split anywhere, even inside a record: the bytes of
+// a record cut by the end of a chunk are kept until the next one completes
+// it. Consumed only counts whole records turned into events, which is
+// where a caller that stops early resumes.
+//
+typedef struct _STREAM_PARSER {
+    size_t                  Consumed;       // bytes of whole records parsed
+    BOOLEAN                 Invalid;        // stopped at an unknown record type
+    UCHAR                   PartialLength;
+    UCHAR                   Partial[VHID_STREAM_MAX_RECORD];
+} STREAM_PARSER, *PSTREAM_PARSER;
+
+VOID
+StreamParserInit(
+    _Out_ PSTREAM_PARSER    Parser
+    );
+
+ULONG
+StreamParserFeed(
+    _Inout_ PSTREAM_PARSER  Parser,
+    _In_reads_bytes_(Length) const UCHAR* Data,
+    _In_  size_t            Length,
+    _Out_ size_t*           Used,
+    _Out_writes_to_(MaxEvents, return) PVHID_BATCH_EVENT Events,
+    _In_  ULONG             MaxEvents
+    );
+
+#endif // __STREAM_H_
@@ -0,0 +1,615 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "textcomp.h"
+
+#define TEXT_SHIFT          0x01
+#define TEXT_ALTGR          0x02
+#define TEXT_DEAD           0x04    // dead key, followed by a space
+
+#define USAGE_LEFT_SHIFT    0xE1
+#define USAGE_RIGHT_ALT     0xE6    // AltGr
+#define USAGE_ENTER         0x28
+#define USAGE_TAB           0x2B
+#define USAGE_SPACE         0x2C
+
+typedef struct _TEXT_KEY {
+    UCHAR                   Usage;
+    UCHAR                   Flags;          // TEXT_xxx
+} TEXT_KEY;
+
+typedef struct _TEXT_EXTRA_KEY {
+    ULONG                   CodePoint;
+    TEXT_KEY                Key;
+} TEXT_EXTRA_KEY;
+
+struct _TEXT_LAYOUT {
+    const TEXT_KEY*         Ascii;          // U+0020..U+007E
+    const TEXT_EXTRA_KEY*   Extra;          // sorted by code point
+    ULONG                   ExtraCount;
+};
+
+#define K(u)    { u, 0 }
+#define S(u)    { u, TEXT_SHIFT }
+#define G(u)    { u, TEXT_ALTGR }
+#define D(u)    { u, TEXT_DEAD }
+#define SD(u)   { u, TEXT_SHIFT | TEXT_DEAD }
+#define GD(u)   { u, TEXT_ALTGR | TEXT_DEAD }
+
+//
+// Layout tables, by HID usage of the key position. Generated from the
+// Windows layouts; the printable ASCII range is indexed directly.
+//
+static const TEXT_KEY G_LayoutUsAscii[] = {
+    K(0x2C),   // space
+    S(0x1E),   // !
+    S(0x34),   // "
+    S(0x20),   // #
+    S(0x21),   // $
+    S(0x22),   // %
+    S(0x24),   // &
+    K(0x34),   // '
+    S(0x26),   // (
+    S(0x27),   // )
+    S(0x25),   // *
+    S(0x2E),   // +
+    K(0x36),   // ,
+    K(0x2D),   // -
+    K(0x37),   // .
+    K(0x38),   // /
+    K(0x27),   // 0
+    K(0x1E),   // 1
+    K(0x1F),   // 2
+    K(0x20),   // 3
+    K(0x21),   // 4
+    K(0x22),   // 5
+    K(0x23),   // 6
+    K(0x24),   // 7
+    K(0x25),   // 8
+    K(0x26),   // 9
+    S(0x33),   // :
+    K(0x33),   // ;
+    S(0x36),   // <
+    K(0x2E),   // =
+    S(0x37),   // >
+    S(0x38),   // ?
+    S(0x1F),   // @
+    S(0x04),   // A
+    S(0x05),   // B
+    S(0x06),   // C
+    S(0x07),   // D
+    S(0x08),   // E
+    S(0x09),   // F
+    S(0x0A),   // G
+    S(0x0B),   // H
+    S(0x0C),   // I
+    S(0x0D),   // J
+    S(0x0E),   // K
+    S(0x0F),   // L
+    S(0x10),   // M
+    S(0x11),   // N
+    S(0x12),   // O
+    S(0x13),   // P
+    S(0x14),   // Q
+    S(0x15),   // R
+    S(0x16),   // S
+    S(0x17),   // T
+    S(0x18),   // U
+    S(0x19),   // V
+    S(0x1A),   // W
+    S(0x1B),   // X
+    S(0x1C),   // Y
+    S(0x1D),   // Z
+    K(0x2F),   // [
+    K(0x31),   // backslash
+    K(0x30),   // ]
+    S(0x23),   // ^
+    S(0x2D),   // _
+    K(0x35),   // `
+    K(0x04),   // a
+    K(0x05),   // b
+    K(0x06),   // c
+    K(0x07),   // d
+    K(0x08),   // e
+    K(0x09),   // f
+    K(0x0A),   // g
+    K(0x0B),   // h
+    K(0x0C),   // i
+    K(0x0D),   // j
+    K(0x0E),   // k
+    K(0x0F),   // l
+    K(0x10),   // m
+    K(0x11),   // n
+    K(0x12),   // o
+    K(0x13),   // p
+    K(0x14),   // q
+    K(0x15),   // r
+    K(0x16),   // s
+    K(0x17),   // t
+    K(0x18),   // u
+    K(0x19),   // v
+    K(0x1A),   // w
+    K(0x1B),   // x
+    K(0x1C),   // y
+    K(0x1D),   // z
+    S(0x2F),   // {
+    S(0x31),   // |
+    S(0x30),   // }
+    S(0x35),   // ~
+};
+
+static const TEXT_KEY G_LayoutFrAscii[] = {
+    K(0x2C),   // space
+    K(0x38),   // !
+    K(0x20),   // "
+    G(0x20),   // #
+    K(0x30),   // $
+    S(0x34),   // %
+    K(0x1E),   // &
+    K(0x21),   // '
+    K(0x22),   // (
+    K(0x2D),   // )
+    K(0x32),   // *
+    S(0x2E),   // +
+    K(0x10),   // ,
+    K(0x23),   // -
+    S(0x36),   // .
+    S(0x37),   // /
+    S(0x27),   // 0
+    S(0x1E),   // 1
+    S(0x1F),   // 2
+    S(0x20),   // 3
+    S(0x21),   // 4
+    S(0x22),   // 5
+    S(0x23),   // 6
+    S(0x24),   // 7
+    S(0x25),   // 8
+    S(0x26),   // 9
+    K(0x37),   // :
+    K(0x36),   // ;
+    K(0x64),   // <
+    K(0x2E),   // =
+    S(0x64),   // >
+    S(0x10),   // ?
+    G(0x27),   // @
+    S(0x14),   // A
+    S(0x05),   // B
+    S(0x06),   // C
+    S(0x07),   // D
+    S(0x08),   // E
+    S(0x09),   // F
+    S(0x0A),   // G
+    S(0x0B),   // H
+    S(0x0C),   // I
+    S(0x0D),   // J
+    S(0x0E),   // K
+    S(0x0F),   // L
+    S(0x33),   // M
+    S(0x11),   // N
+    S(0x12),   // O
+    S(0x13),   // P
+    S(0x04),   // Q
+    S(0x15),   // R
+    S(0x16),   // S
+    S(0x17),   // T
+    S(0x18),   // U
+    S(0x19),   // V
+    S(0x1D),   // W
+    S(0x1B),   // X
+    S(0x1C),   // Y
+    S(0x1A),   // Z
+    G(0x22),   // [
+    G(0x25),   // backslash
+    G(0x2D),   // ]
+    G(0x26),   // ^
+    K(0x25),   // _
+    GD(0x24),  // `
+    K(0x14),   // a
+    K(0x05),   // b
+    K(0x06),   // c
+    K(0x07),   // d
+    K(0x08),   // e
+    K(0x09),   // f
+    K(0x0A),   // g
+    K(0x0B),   // h
+    K(0x0C),   // i
+    K(0x0D),   // j
+    K(0x0E),   // k
+    K(0x0F),   // l
+    K(0x33),   // m
+    K(0x11),   // n
+    K(0x12),   // o
+    K(0x13),   // p
+    K(0x04),   // q
+    K(0x15),   // r
+    K(0x16),   // s
+    K(0x17),   // t
+    K(0x18),   // u
+    K(0x19),   // v
+    K(0x1D),   // w
+    K(0x1B),   // x
+    K(0x1C),   // y
+    K(0x1A),   // z
+    G(0x21),   // {
+    G(0x23),   // |
+    G(0x2E),   // }
+    GD(0x1F),  // ~
+};
+
+static const TEXT_EXTRA_KEY G_LayoutFrExtra[] = {
+    { 0x00A3, S(0x30) },   // U+00A3
+    { 0x00A4, G(0x30) },   // U+00A4
+    { 0x00A7, S(0x38) },   // U+00A7
+    { 0x00B0, S(0x2D) },   // U+00B0
+    { 0x00B2, K(0x35) },   // U+00B2
+    { 0x00B5, S(0x32) },   // U+00B5
+    { 0x00E0, K(0x27) },   // U+00E0
+    { 0x00E7, K(0x26) },   // U+00E7
+    { 0x00E8, K(0x24) },   // U+00E8
+    { 0x00E9, K(0x1F) },   // U+00E9
+    { 0x00F9, K(0x34) },   // U+00F9
+    { 0x20AC, G(0x08) },   // U+20AC
+};
+
+static const TEXT_KEY G_LayoutDeAscii[] = {
+    K(0x2C),   // space
+    S(0x1E),   // !
+    S(0x1F),   // "
+    K(0x32),   // #
+    S(0x21),   // $
+    S(0x22),   // %
+    S(0x23),   // &
+    S(0x32),   // '
+    S(0x25),   // (
+    S(0x26),   // )
+    S(0x30),   // *
+    K(0x30),   // +
+    K(0x36),   // ,
+    K(0x38),   // -
+    K(0x37),   // .
+    S(0x24),   // /
+    K(0x27),   // 0
+    K(0x1E),   // 1
+    K(0x1F),   // 2
+    K(0x20),   // 3
+    K(0x21),   // 4
+    K(0x22),   // 5
+    K(0x23),   // 6
+    K(0x24),   // 7
+    K(0x25),   // 8
+    K(0x26),   // 9
+    S(0x37),   // :
+    S(0x36),   // ;
+    K(0x64),   // <
+    S(0x27),   // =
+    S(0x64),   // >
+    S(0x2D),   // ?
+    G(0x14),   // @
+    S(0x04),   // A
+    S(0x05),   // B
+    S(0x06),   // C
+    S(0x07),   // D
+    S(0x08),   // E
+    S(0x09),   // F
+    S(0x0A),   // G
+    S(0x0B),   // H
+    S(0x0C),   // I
+    S(0x0D),   // J
+    S(0x0E),   // K
+    S(0x0F),   // L
+    S(0x10),   // M
+    S(0x11),   // N
+    S(0x12),   // O
+    S(0x13),   // P
+    S(0x14),   // Q
+    S(0x15),   // R
+    S(0x16),   // S
+    S(0x17),   // T
+    S(0x18),   // U
+    S(0x19),   // V
+    S(0x1A),   // W
+    S(0x1B),   // X
+    S(0x1D),   // Y
+    S(0x1C),   // Z
+    G(0x25),   // [
+    G(0x2D),   // backslash
+    G(0x26),   // ]
+    D(0x35),   // ^
+    S(0x38),   // _
+    SD(0x2E),  // `
+    K(0x04),   // a
+    K(0x05),   // b
+    K(0x06),   // c
+    K(0x07),   // d
+    K(0x08),   // e
+    K(0x09),   // f
+    K(0x0A),   // g
+    K(0x0B),   // h
+    K(0x0C),   // i
+    K(0x0D),   // j
+    K(0x0E),   // k
+    K(0x0F),   // l
+    K(0x10),   // m
+    K(0x11),   // n
+    K(0x12),   // o
+    K(0x13),   // p
+    K(0x14),   // q
+    K(0x15),   // r
+    K(0x16),   // s
+    K(0x17),   // t
+    K(0x18),   // u
+    K(0x19),   // v
+    K(0x1A),   // w
+    K(0x1B),   // x
+    K(0x1D),   // y
+    K(0x1C),   // z
+    G(0x24),   // {
+    G(0x64),   // |
+    G(0x27),   // }
+    G(0x30),   // ~
+};
+
+static const TEXT_EXTRA_KEY G_LayoutDeExtra[] = {
+    { 0x00A7, S(0x20) },   // U+00A7
+    { 0x00B0, S(0x35) },   // U+00B0
+    { 0x00B2, G(0x1F) },   // U+00B2
+    { 0x00B3, G(0x20) },   // U+00B3
+    { 0x00B5, G(0x10) },   // U+00B5
+    { 0x00C4, S(0x34) },   // U+00C4
+    { 0x00D6, S(0x33) },   // U+00D6
+    { 0x00DC, S(0x2F) },   // U+00DC
+    { 0x00DF, K(0x2D) },   // U+00DF
+    { 0x00E4, K(0x34) },   // U+00E4
+    { 0x00F6, K(0x33) },   // U+00F6
+    { 0x00FC, K(0x2F) },   // U+00FC
+    { 0x20AC, G(0x08) },   // U+20AC
+};
+
+#undef K
+#undef S
+#undef G
+#undef D
+#undef SD
+#undef GD
+
+C_ASSERT(sizeof(G_LayoutUsAscii) / sizeof(TEXT_KEY) == 0x7F - 0x20);
+C_ASSERT(sizeof(G_LayoutFrAscii) / sizeof(TEXT_KEY) == 0x7F - 0x20);
+C_ASSERT(sizeof(G_LayoutDeAscii) / sizeof(TEXT_KEY) == 0x7F - 0x20);
+
+static const TEXT_LAYOUT G_Layouts[] = {
+    { G_LayoutUsAscii, NULL, 0 },
+    { G_LayoutFrAscii, G_LayoutFrExtra, ARRAYSIZE(G_LayoutFrExtra) },
+    { G_LayoutDeAscii, G_LayoutDeExtra, ARRAYSIZE(G_LayoutDeExtra) },
+};
+
+NTSTATUS
+TextCompilerInit(
+    _Out_ PTEXT_COMPILER    Compiler,
+    _In_  ULONG             Layout
+    )
+{
+    RtlZeroMemory(Compiler, sizeof(TEXT_COMPILER));
+
+    if (Layout >= ARRAYSIZE(G_Layouts))
+        return STATUS_INVALID_PARAMETER;
+
+    Compiler->Layout = &G_Layouts[Layout];
+    return STATUS_SUCCESS;
+}
+
+ULONG
+TextDecodeUtf8(
+    _In_reads_bytes_(Length) const UCHAR* Text,
+    _In_  size_t            Length,
+    _Out_ ULONG*            CodePoint
+    )
+/*++
+
+Routine Description:
+
+    Decodes one UTF-8 sequence. Malformed bytes decode as U+FFFD, one byte
+    at a time.
+
+Return Value:
+
+    Number of bytes used, or 0 if the sequence is cut by the end of the
+    buffer.
+
+--*/
+{
+    ULONG                   length, i;
+    ULONG                   cp = Text[0];
+
+    if (cp < 0x80) {
+        *CodePoint = cp;
+        return 1;
+    }
+    if (cp >= 0xC2 && cp <= 0xDF) {
+        length = 2;
+        cp &= 0x1F;
+    }
+    else if (cp >= 0xE0 && cp <= 0xEF) {
+        length = 3;
+        cp &= 0x0F;
+    }
+    else if (cp >= 0xF0 && cp <= 0xF4) {
+        length = 4;
+        cp &= 0x07;
+    }
+    else {
+        *CodePoint = 0xFFFD;
+        return 1;
+    }
+
+    for (i = 1; i < length; i++) {
+        if (i == Length)
+            return 0;
+        if ((Text[i] & 0xC0) != 0x80) {
+            *CodePoint = 0xFFFD;
+            return 1;
+        }
+        cp = (cp << 6) | (Text[i] & 0x3F);
+    }
+
+    *CodePoint = cp;
+    return length;
+}
+
+BOOLEAN
+TextLookup(
+    _In_  const TEXT_LAYOUT* Layout,
+    _In_  ULONG             CodePoint,
+    _Out_ TEXT_KEY*         Key
+    )
+{
+    ULONG                   low, high, mid;
+
+    switch (CodePoint) {
+    case '\n':
+        Key->Usage = USAGE_ENTER;
+        Key->Flags = 0;
+        return TRUE;
+    case '\t':
+        Key->Usage = USAGE_TAB;
+        Key->Flags = 0;
+        return TRUE;
+    }
+
+    if (CodePoint >= 0x20 && CodePoint < 0x7F) {
+        *Key = Layout->Ascii[CodePoint - 0x20];
+        return TRUE;
+    }
+
+    low = 0;
+    high = Layout->ExtraCount;
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (Layout->Extra[mid].CodePoint == CodePoint) {
+            *Key = Layout->Extra[mid].Key;
+            return TRUE;
+        }
+        if (Layout->Extra[mid].CodePoint < CodePoint)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return FALSE;
+}
+
+ULONG
+TextSetModifiers(
+    _Inout_ PTEXT_COMPILER  Compiler,
+    _In_  UCHAR             Modifiers,
+    _Out_writes_(TEXT_MAX_FINISH_EVENTS * 2) PVHID_KEY_EVENT Events
+    )
+{
+    ULONG                   count = 0;
+    UCHAR                   release = Compiler->Modifiers & ~Modifiers;
+    UCHAR                   press = Modifiers & ~Compiler->Modifiers;
+
+    if (release & TEXT_SHIFT) {
+        Events[count].KeyCode = USAGE_LEFT_SHIFT;
+        Events[count++].Pressed = 0;
+    }
+    if (release & TEXT_ALTGR) {
+        Events[count].KeyCode = USAGE_RIGHT_ALT;
+        Events[count++].Pressed = 0;
+    }
+    if (press & TEXT_SHIFT) {
+        Events[count].KeyCode = USAGE_LEFT_SHIFT;
+        Events[count++].Pressed = 1;
+    }
+    if (press & TEXT_ALTGR) {
+        Events[count].KeyCode = USAGE_RIGHT_ALT;
+        Events[count++].Pressed = 1;
+    }
+
+    Compiler->Modifiers = Modifiers;
+    return count;
+}
+
+ULONG
+TextCompilerFeed(
+    _Inout_ PTEXT_COMPILER  Compiler,
+    _In_reads_bytes_(Length) const UCHAR* Text,
+    _In_  size_t            Length,
+    _Out_ size_t*           Consumed,
+    _Out_writes_to_(MaxEvents, return) PVHID_KEY_EVENT Events,
+    _In_  ULONG             MaxEvents
+    )
+/*++
+
+Routine Description:
+
+    Compiles as many whole characters as fit in Events. '\r' is ignored so
+    that CRLF types a single Enter; characters absent from the layout are
+    skipped and counted in Compiler->Unmapped. Modifiers may be left held
+    at the end; TextCompilerFinish releases them.
+
+Return Value:
+
+    Number of events written. *Consumed is the number of bytes compiled;
+    it stops short of Length when Events is full or the text ends in the
+    middle of a UTF-8 sequence.
+
+--*/
+{
+    size_t                  offset = 0;
+    ULONG                   count = 0;
+    ULONG                   length;
+    ULONG                   codePoint;
+    TEXT_KEY                key;
+
+    while (offset < Length && MaxEvents - count >= TEXT_MAX_EVENTS_PER_CHAR) {
+        length = TextDecodeUtf8(Text + offset, Length - offset, &codePoint);
+        if (length == 0)
+            break;
+        offset += length;
+
+        if (codePoint == '\r')
+            continue;
+
+        if (!TextLookup(Compiler->Layout, codePoint, &key) || key.Usage == 0) {
+            Compiler->Unmapped++;
+            continue;
+        }
+
+        count += TextSetModifiers(Compiler, key.Flags & (TEXT_SHIFT | TEXT_ALTGR), Events + count);
+
+        Events[count].KeyCode = key.Usage;
+        Events[count++].Pressed = 1;
+        Events[count].KeyCode = key.Usage;
+        Events[count++].Pressed = 0;
+
+        if (key.Flags & TEXT_DEAD) {
+            Events[count].KeyCode = USAGE_SPACE;
+            Events[count++].Pressed = 1;
+            Events[count].KeyCode = USAGE_SPACE;
+            Events[count++].Pressed = 0;
+        }
+    }
+
+    *Consumed = offset;
+    return count;
+}
+
+ULONG
+TextCompilerFinish(
+    _Inout_ PTEXT_COMPILER  Compiler,
+    _Out_writes_to_(MaxEvents, return) PVHID_KEY_EVENT Events,
+    _In_  ULONG             MaxEvents
+    )
+/*++
+
+Routine Description:
+
+    Releases the modifiers still held. Needs up to TEXT_MAX_FINISH_EVENTS
+    events; returns 0 and keeps them held if MaxEvents is smaller.
+
+--*/
+{
+    if (MaxEvents < TEXT_MAX_FINISH_EVENTS)
+        return 0;
+
+    return TextSetModifiers(Compiler, 0, Events);
+}
@@ -0,0 +1,50 @@
+#ifndef __TEXTCOMP_H_
+#define __TEXTCOMP_H_
+
+//
+// Text-to-HID compiler: turns UTF-8 text into the VHID_KEY_EVENT sequence
+// typing it on a given keyboard layout. Modifiers are only toggled when the
+// next character needs a different set, so a run of capitals is typed with
+// Shift held once. The compiler is shared by the driver
+// (IOCTL_VHIDMINI_TYPE_TEXT) and by clients typing through key events.
+//
+
+//
+// Worst case for one character: release two modifiers, press two, press
+// and release the key, and a space to resolve a dead key.
+//
+#define TEXT_MAX_EVENTS_PER_CHAR    8
+#define TEXT_MAX_FINISH_EVENTS      2
+
+typedef struct _TEXT_LAYOUT TEXT_LAYOUT;
+
+typedef struct _TEXT_COMPILER {
+    const TEXT_LAYOUT*      Layout;
+    UCHAR                   Modifiers;      // TEXT_xxx modifiers currently held
+    ULONG                   Unmapped;       // characters skipped
+} TEXT_COMPILER, *PTEXT_COMPILER;
+
+NTSTATUS
+TextCompilerInit(
+    _Out_ PTEXT_COMPILER    Compiler,
+    _In_  ULONG             Layout
+    );
+
+ULONG
+TextCompilerFeed(
+    _Inout_ PTEXT_COMPILER  Compiler,
+    _In_reads_bytes_(Length) const UCHAR* Text,
+    _In_  size_t            Length,
+    _Out_ size_t*           Consumed,
+    _Out_writes_to_(MaxEvents, return) PVHID_KEY_EVENT Events,
+    _In_  ULONG             MaxEvents
+    );
+
+ULONG
+TextCompilerFinish(
+    _Inout_ PTEXT_COMPILER  Compiler,
+    _Out_writes_to_(MaxEvents, return) PVHID_KEY_EVENT Events,
+    _In_  ULONG             MaxEvents
+    );
+
+#endif // __TEXTCOMP_H_
@@ -0,0 +1,98 @@
+#include "vhidport.h"
+#include "vhidmini_ioctl.h"
+#include "trace.h"
+
+C_ASSERT((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0);
+
+#define SLOT(Ring, Sequence) (&(Ring)->Records[(Sequence) & (TRACE_RING_SIZE - 1)])
+
+VOID
+TraceRingInit(
+    _Out_ PTRACE_RING       Ring
+    )
+{
+    RtlZeroMemory(Ring, sizeof(TRACE_RING));
+}
+
+VOID
+TraceWrite(
+    _Inout_ PTRACE_RING     Ring,
+    _In_  UCHAR             Type,
+    _In_reads_bytes_opt_(Length) const VOID* Data,
+    _In_  ULONG             Length,
+    _In_  ULONGLONG         Timestamp
+    )
+/*++
+
+Routine Description:
+
+    Appends a record, overwriting the oldest one. Data longer than
+    VHID_TRACE_DATA_SIZE is truncated.
+
+--*/
+{
+    ULONG                   sequence = (ULONG)InterlockedIncrement(&Ring->Next);
+    PVHID_TRACE_RECORD      record = SLOT(Ring, sequence);
+
+    if (Length > VHID_TRACE_DATA_SIZE)
+        Length = VHID_TRACE_DATA_SIZE;
+
+    record->Sequence = 0;
+    MemoryBarrier();
+
+    record->Timestamp = Timestamp;
+    record->Type = Type;
+    record->Length = (UCHAR)Length;
+    if (Length != 0)
+        RtlCopyMemory(record->Data, Data, Length);
+
+    MemoryBarrier();
+    record->Sequence = sequence;
+}
+
+ULONG
+TraceRingRead(
+    _In_  PTRACE_RING       Ring,
+    _In_  ULONG             FirstSequence,
+    _Out_writes_to_(MaxRecords, return) PVHID_TRACE_RECORD Records,
+    _In_  ULONG             MaxRecords
+    )
+/*++
+
+Routine Description:
+
+    Copies the records still in the ring starting at FirstSequence (0 for
+    the oldest available). Records being written concurrently are left out.
+
+Return Value:
+
+    Number of records copied.
+
+--*/
+{
+    ULONG                   last = (ULONG)Ring->Next;
+    ULONG                   sequence;
+    ULONG                   count = 0;
+    PVHID_TRACE_RECORD      record;
+
+    MemoryBarrier();
+
+    if (last >= TRACE_RING_SIZE && FirstSequence <= last - TRACE_RING_SIZE)
+        FirstSequence = last - TRACE_RING_SIZE + 1;
+    if (FirstSequence == 0)
+        FirstSequence = 1;
+
+    for (sequence = FirstSequence; sequence <= last && count < MaxRecords; sequence++) {
+        record = SLOT(Ring, sequence);
+        if (record->Sequence != sequence)
+            continue;
+        MemoryBarrier();
+        Records[count] = *record;
+        MemoryBarrier();
+        if (record->Sequence != sequence)
+            continue;
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,39 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+//
+// Always-on ring of VHID_TRACE_RECORD. Writers claim a slot with an
+// interlocked increment and publish it by storing its sequence number last,
+// so records can be written from any path without a lock. A reader copying
+// a slot that is being rewritten sees the sequence change and skips it.
+//
+#define TRACE_RING_SIZE     1024    // power of two
+
+typedef struct _TRACE_RING {
+    volatile LONG           Next;           // last sequence number claimed
+    VHID_TRACE_RECORD       Records[TRACE_RING_SIZE];
+} TRACE_RING, *PTRACE_RING;
+
+VOID
+TraceRingInit(
+    _Out_ PTRACE_RING       Ring
+    );
+
+VOID
+TraceWrite(
+    _Inout_ PTRACE_RING     Ring,
+    _In_  UCHAR             Type,
+    _In_reads_bytes_opt_(Length) const VOID* Data,
+    _In_  ULONG             Length,
+    _In_  ULONGLONG         Timestamp
+    );
+
+ULONG
+TraceRingRead(
+    _In_  PTRACE_RING       Ring,
+    _In_  ULONG             FirstSequence,
+    _Out_writes_to_(MaxRecords, return) PVHID_TRACE_RECORD Records,
+    _In_  ULONG             MaxRecords
+    );
+
+#endif // __TRACE_H_
@@ -0,0 +1,113 @@
+#include "vhidport.h"
+#include "typematic.h"
+
+VOID
+TypematicInit(
+    _Out_ PTYPEMATIC        Typematic,
+    _In_  ULONG             DelayMs,
+    _In_  ULONG             Rate
+    )
+{
+    RtlZeroMemory(Typematic, sizeof(TYPEMATIC));
+    TypematicSetRate(Typematic, DelayMs, Rate);
+}
+
+VOID
+TypematicSetRate(
+    _Inout_ PTYPEMATIC      Typematic,
+    _In_  ULONG             DelayMs,
+    _In_  ULONG             Rate
+    )
+/*++
+
+Routine Description:
+
+    Changes the delay and rate. A zero delay or rate disables auto-repeat
+    and forgets the held key.
+
+--*/
+{
+    if (DelayMs == 0 || Rate == 0) {
+        Typematic->Delay = 0;
+        Typematic->Period = 0;
+        Typematic->Key = 0;
+        return;
+    }
+
+    Typematic->Delay = (ULONGLONG)DelayMs * 10000;
+    Typematic->Period = 10000000 / Rate;
+}
+
+VOID
+TypematicKeyEvent(
+    _Inout_ PTYPEMATIC      Typematic,
+    _In_  UCHAR             KeyCode,
+    _In_  BOOLEAN           Pressed,
+    _In_  ULONGLONG         Now
+    )
+{
+    if (Typematic->Delay == 0)
+        return;
+
+    //
+    // Modifiers are never repeated and don't interrupt a repeating key.
+    //
+    if (KeyCode >= 0xE0 && KeyCode <= 0xE7)
+        return;
+
+    if (Pressed) {
+        Typematic->Key = KeyCode;
+        Typematic->NextRepeat = Now + Typematic->Delay;
+    }
+    else if (Typematic->Key == KeyCode) {
+        Typematic->Key = 0;
+    }
+}
+
+BOOLEAN
+TypematicTick(
+    _Inout_ PTYPEMATIC      Typematic,
+    _In_  ULONGLONG         Now,
+    _Out_ PUCHAR            KeyCode
+    )
+/*++
+
+Routine Description:
+
+    Checks whether the held key is due for a repeat at time Now. Repeats
+    stay on the Period grid; if the caller fell more than a period behind,
+    the missed repeats are skipped rather than sent in a burst.
+
+Return Value:
+
+    TRUE and the key to repeat in KeyCode, or FALSE if nothing is due.
+
+--*/
+{
+    *KeyCode = 0;
+
+    if (Typematic->Key == 0 || Now < Typematic->NextRepeat)
+        return FALSE;
+
+    Typematic->NextRepeat += Typematic->Period;
+    if (Typematic->NextRepeat <= Now)
+        Typematic->NextRepeat = Now + Typematic->Period;
+
+    *KeyCode = Typematic->Key;
+    return TRUE;
+}
+
+ULONGLONG
+TypematicNextDeadline(
+    _In_  PTYPEMATIC        Typematic
+    )
+/*++
+
+Return Value:
+
+    Time of the next repeat, or 0 if no key is repeating.
+
+--*/
+{
+    return Typematic->Key != 0 ? Typematic->NextRepeat : 0;
+}
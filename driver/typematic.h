@@ -0,0 +1,54 @@
+#ifndef __TYPEMATIC_H_
+#define __TYPEMATIC_H_
+
+//
+// Driver-side typematic (auto-repeat). The last non-modifier key pressed is
+// repeated after Delay, then every Period, until it is released or another
+// key is pressed. Times are in 100ns units from any monotonic clock.
+//
+#define TYPEMATIC_MIN_DELAY_MS  100
+#define TYPEMATIC_MAX_DELAY_MS  2000
+#define TYPEMATIC_MAX_RATE      50      // repeats per second
+
+typedef struct _TYPEMATIC {
+    ULONGLONG               Delay;          // 0 = disabled
+    ULONGLONG               Period;
+    ULONGLONG               NextRepeat;
+    UCHAR                   Key;            // 0 = no key held
+} TYPEMATIC, *PTYPEMATIC;
+
+VOID
+TypematicInit(
+    _Out_ PTYPEMATIC        Typematic,
+    _In_  ULONG             DelayMs,
+    _In_  ULONG             Rate
+    );
+
+VOID
+TypematicSetRate(
+    _Inout_ PTYPEMATIC      Typematic,
+    _In_  ULONG             DelayMs,
+    _In_  ULONG             Rate
+    );
+
+VOID
+TypematicKeyEvent(
+    _Inout_ PTYPEMATIC      Typematic,
+    _In_  UCHAR             KeyCode,
+    _In_  BOOLEAN           Pressed,
+    _In_  ULONGLONG         Now
+    );
+
+BOOLEAN
+TypematicTick(
+    _Inout_ PTYPEMATIC      Typematic,
+    _In_  ULONGLONG         Now,
+    _Out_ PUCHAR            KeyCode
+    );
+
+ULONGLONG
+TypematicNextDeadline(
+    _In_  PTYPEMATIC        Typematic
+    );
+
+#endif // __TYPEMATIC_H_
@@ -34,14 +34,14 @@ Return Value:
 
     status = WdfRequestRetrieveOutputMemory(Request, &memory);
     if (!NT_SUCCESS(status)) {
-        KdPrint(("WdfRequestRetrieveOutputMemory failed 0x%x\n", status));
+        VhidLog(LOG_HID, LOG_LEVEL_ERROR, "WdfRequestRetrieveOutputMemory failed 0x%x\n", status);
         return status;
     }
 
     WdfMemoryGetBuffer(memory, &outputBufferLength);
     if (outputBufferLength < NumBytesToCopyFrom) {
-        KdPrint(("RequestCopyFromBuffer: buffer too small. Size %d, expect %d\n",
-            (int)outputBufferLength, (int)NumBytesToCopyFrom));
+        VhidLog(LOG_HID, LOG_LEVEL_ERROR, "RequestCopyFromBuffer: buffer too small. Size %d, expect %d\n",
+            (int)outputBufferLength, (int)NumBytesToCopyFrom);
         return STATUS_INVALID_BUFFER_SIZE;
     }
 
@@ -50,7 +50,7 @@ Return Value:
         SourceBuffer,
         NumBytesToCopyFrom);
     if (!NT_SUCCESS(status)) {
-        KdPrint(("WdfMemoryCopyFromBuffer failed 0x%x\n", status));
+        VhidLog(LOG_HID, LOG_LEVEL_ERROR, "WdfMemoryCopyFromBuffer failed 0x%x\n", status);
         return status;
     }
 
@@ -58,6 +58,77 @@ Return Value:
     return status;
 }
 
+ULONGLONG
+VhidQueryTime(
+    VOID
+)
+/*++
+
+Routine Description:
+
+    Returns the precise interrupt time, in 100ns units. Used to timestamp
+    events handed back to clients.
+
+--*/
+{
+    ULONG64                 qpc;
+
+    return KeQueryInterruptTimePrecise(&qpc);
+}
+
+VOID
+StateLockAcquire(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Acquires StateLock and records the owner and acquisition time, so the
+    hold time can be accounted for on release and reported through
+    IOCTL_VHIDMINI_GET_STATS.
+
+--*/
+{
+    WdfSpinLockAcquire(DeviceContext->StateLock);
+
+    NT_ASSERT(DeviceContext->StateLockOwner == NULL);
+    DeviceContext->StateLockOwner = KeGetCurrentThread();
+    DeviceContext->StateLockAcquired = VhidQueryTime();
+}
+
+VOID
+StateLockRelease(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    )
+/*++
+
+Routine Description:
+
+    Releases StateLock, then raises VHID_EVENT_BACKLOG_DRAINED if the
+    report queue drained during the hold, so that pended waits are not
+    completed with StateLock held.
+
+--*/
+{
+    ULONGLONG               hold = VhidQueryTime() - DeviceContext->StateLockAcquired;
+    BOOLEAN                 drained = DeviceContext->DrainedPending;
+
+    STATE_LOCK_ASSERT_HELD(DeviceContext);
+    DeviceContext->StateLockOwner = NULL;
+    DeviceContext->DrainedPending = FALSE;
+
+    DeviceContext->StateLockCount++;
+    DeviceContext->StateLockHoldTotal += hold;
+    if (hold > DeviceContext->StateLockHoldMax)
+        DeviceContext->StateLockHoldMax = hold > MAXULONG ? MAXULONG : (ULONG)hold;
+
+    WdfSpinLockRelease(DeviceContext->StateLock);
+
+    if (drained)
+        NotifyEvent(DeviceContext, VHID_EVENT_BACKLOG_DRAINED, 0);
+}
+
 //
 // First let's review Buffer Descriptions for I/O Control Codes
 //
@@ -91,18 +162,18 @@ RequestGetHidXferPacket_ToReadFromDevice(
     WdfRequestGetParameters(Request, &params);
 
     if (params.Parameters.DeviceIoControl.OutputBufferLength < sizeof(HID_XFER_PACKET)) {
-        KdPrint(("RequestGetHidXferPacket: invalid HID_XFER_PACKET\n"));
+        VhidLog(LOG_HID, LOG_LEVEL_ERROR, "RequestGetHidXferPacket: invalid HID_XFER_PACKET\n");
         return STATUS_BUFFER_TOO_SMALL;
     }
 
     PIRP irp = WdfRequestWdmGetIrp(Request);
     if (irp == NULL) {
-        KdPrint(("RequestGetHidXferPacket: WdfRequestWdmGetIrp returned NULL\n"));
+        VhidLog(LOG_HID, LOG_LEVEL_ERROR, "RequestGetHidXferPacket: WdfRequestWdmGetIrp returned NULL\n");
         return STATUS_INVALID_DEVICE_REQUEST;
     }
     
     if (irp->UserBuffer == NULL) {
-        KdPrint(("RequestGetHidXferPacket: Irp->UserBuffer is NULL\n"));
+        VhidLog(LOG_HID, LOG_LEVEL_ERROR, "RequestGetHidXferPacket: Irp->UserBuffer is NULL\n");
         return STATUS_INVALID_PARAMETER;
     }
 
@@ -122,18 +193,18 @@ RequestGetHidXferPacket_ToWriteToDevice(
     WdfRequestGetParameters(Request, &params);
 
     if (params.Parameters.DeviceIoControl.InputBufferLength < sizeof(HID_XFER_PACKET)) {
-        KdPrint(("RequestGetHidXferPacket: invalid HID_XFER_PACKET\n"));
+        VhidLog(LOG_HID, LOG_LEVEL_ERROR, "RequestGetHidXferPacket: invalid HID_XFER_PACKET\n");
         return STATUS_BUFFER_TOO_SMALL;
     }
 
     PIRP irp = WdfRequestWdmGetIrp(Request);
     if (irp == NULL) {
-        KdPrint(("RequestGetHidXferPacket: WdfRequestWdmGetIrp returned NULL\n"));
+        VhidLog(LOG_HID, LOG_LEVEL_ERROR, "RequestGetHidXferPacket: WdfRequestWdmGetIrp returned NULL\n");
         return STATUS_INVALID_DEVICE_REQUEST;
     }
 
     if (irp->UserBuffer == NULL) {
-        KdPrint(("RequestGetHidXferPacket: Irp->UserBuffer is NULL\n"));
+        VhidLog(LOG_HID, LOG_LEVEL_ERROR, "RequestGetHidXferPacket: Irp->UserBuffer is NULL\n");
         return STATUS_INVALID_PARAMETER;
     }
 
@@ -3,6 +3,94 @@
 EVT_WDF_DEVICE_FILE_CREATE EvtDeviceFileCreate;
 EVT_WDF_FILE_CLOSE EvtFileClose;
 
+ULONG
+DeviceQueryProfile(
+    _In_  WDFDEVICE         Device
+    )
+/*++
+Routine Description:
+
+    Reads the VHID_PROFILE_xxx chosen at install time from the Profile
+    value of the device's hardware key.
+
+--*/
+{
+    WDFKEY                  key;
+    ULONG                   profile = VHID_PROFILE_KEYBOARD_MOUSE;
+    DECLARE_CONST_UNICODE_STRING(valueName, L"Profile");
+
+    if (NT_SUCCESS(WdfDeviceOpenRegistryKey(Device, PLUGPLAY_REGKEY_DEVICE, KEY_READ, WDF_NO_OBJECT_ATTRIBUTES, &key))) {
+        if (!NT_SUCCESS(WdfRegistryQueryULong(key, &valueName, &profile)))
+            profile = VHID_PROFILE_KEYBOARD_MOUSE;
+        WdfRegistryClose(key);
+    }
+
+    return profile;
+}
+
+BOOLEAN
+DeviceCheckLayout(
+    _Inout_ PDEVICE_CONTEXT DeviceContext,
+    _In_  ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Parses the report descriptor assembled for the profile and checks that
+    every report it declares is the size of the structure the driver fills
+    in for it, so that a descriptor edit that does not match its report
+    fails the device instead of handing HIDClass short reports. Finds the
+    fields the gamepad report is built from.
+
+--*/
+{
+    static const struct {
+        UCHAR               ReportId;
+        UCHAR               Type;
+        UCHAR               Collection;
+        USHORT              Size;
+    } expected[] = {
+        { KEYBOARD_REPORT_ID,    LAYOUT_INPUT,   VHID_COLLECTION_KEYBOARD, sizeof(HID_KEYBOARD_REPORT) },
+        { KEYBOARD_REPORT_ID,    LAYOUT_OUTPUT,  VHID_COLLECTION_KEYBOARD, sizeof(HID_KEYBOARD_OUTPUT_REPORT) },
+        { MOUSE_REPORT_ID,       LAYOUT_INPUT,   VHID_COLLECTION_MOUSE,    sizeof(HID_MOUSE_REPORT) },
+        { GAMEPAD_REPORT_ID,     LAYOUT_INPUT,   VHID_COLLECTION_GAMEPAD,  sizeof(HID_GAMEPAD_REPORT) },
+        { VHID_CONFIG_REPORT_ID, LAYOUT_FEATURE, 0,                        sizeof(VHID_CONFIG_REPORT) },
+    };
+    const LAYOUT_REPORT*    report;
+    ULONG                   errorOffset;
+    ULONG                   i;
+
+    if (!LayoutParse(DeviceContext->ReportDescriptor, Length, &DeviceContext->Layout, &errorOffset)) {
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "Report descriptor rejected at offset %u\n", errorOffset);
+        return FALSE;
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF(expected); i++) {
+        ULONG size = expected[i].Size;
+
+        if (expected[i].Collection != 0 && (DeviceContext->Collections & expected[i].Collection) == 0)
+            continue;
+        if (expected[i].ReportId == KEYBOARD_REPORT_ID && expected[i].Type == LAYOUT_INPUT &&
+            DeviceContext->Config.Profile == VHID_PROFILE_NKRO)
+            size = sizeof(HID_NKRO_REPORT);
+
+        report = LayoutFindReport(&DeviceContext->Layout, expected[i].ReportId, expected[i].Type);
+        if (report == NULL || report->BitLength != size * 8) {
+            VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "Report %u type %u is %u bits, expected %u\n",
+                expected[i].ReportId, expected[i].Type, report != NULL ? report->BitLength : 0, size * 8);
+            return FALSE;
+        }
+    }
+
+    if ((DeviceContext->Collections & VHID_COLLECTION_GAMEPAD) != 0 &&
+        !GamepadLayoutInit(&DeviceContext->GamepadLayout, &DeviceContext->Layout, GAMEPAD_REPORT_ID)) {
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "Gamepad report %u lacks a button or axis\n", GAMEPAD_REPORT_ID);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 NTSTATUS
 DriverEntry(
     _In_  PDRIVER_OBJECT    DriverObject,
@@ -39,8 +127,9 @@ Return Value:
 {
     WDF_DRIVER_CONFIG       config;
     NTSTATUS                status;
+    WDFDRIVER               driver;
 
-    KdPrint(("DriverEntry for VHidMini\n"));
+    VhidLog(LOG_PNP, LOG_LEVEL_INFO, "DriverEntry for VHidMini\n");
 
     //
     // Opt-in to using non-executable pool memory on Windows 8 and later.
@@ -54,12 +143,16 @@ Return Value:
                             RegistryPath,
                             WDF_NO_OBJECT_ATTRIBUTES,
                             &config,
-                            WDF_NO_HANDLE);
+                            &driver);
     if (!NT_SUCCESS(status)) {
-        KdPrint(("Error: WdfDriverCreate failed 0x%x\n", status));
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "Error: WdfDriverCreate failed 0x%x\n", status);
         return status;
     }
 
+    status = LogInitialize(driver);
+    if (!NT_SUCCESS(status))
+        return status;
+
     return status;
 }
 
@@ -93,9 +186,14 @@ Return Value:
     PDEVICE_CONTEXT         deviceContext;
     PHID_DEVICE_ATTRIBUTES  hidAttributes;
     WDF_FILEOBJECT_CONFIG   fileConfig;
+    WDF_OBJECT_ATTRIBUTES   fileAttributes;
+    WDF_OBJECT_ATTRIBUTES   memoryAttributes;
+    PVOID                   nodes;
+    ULONG                   profile;
+    ULONG                   length;
     UNREFERENCED_PARAMETER  (Driver);
 
-    KdPrint(("Enter EvtDeviceAdd\n"));
+    VhidLog(LOG_PNP, LOG_LEVEL_INFO, "Enter EvtDeviceAdd\n");
 
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&deviceAttributes, DEVICE_CONTEXT);
 
@@ -103,11 +201,13 @@ Return Value:
 
     WDF_FILEOBJECT_CONFIG_INIT(&fileConfig, EvtDeviceFileCreate, EvtFileClose, WDF_NO_EVENT_CALLBACK);
 
-    WdfDeviceInitSetFileObjectConfig(DeviceInit, &fileConfig, WDF_NO_OBJECT_ATTRIBUTES);
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fileAttributes, FILE_CONTEXT);
+
+    WdfDeviceInitSetFileObjectConfig(DeviceInit, &fileConfig, &fileAttributes);
 
     status = WdfDeviceCreate(&DeviceInit, &deviceAttributes, &device);
     if (!NT_SUCCESS(status)) {
-        KdPrint(("Error: WdfDeviceCreate failed 0x%x\n", status));
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "Error: WdfDeviceCreate failed 0x%x\n", status);
         return status;
     }
 
@@ -124,9 +224,53 @@ Return Value:
     hidAttributes->VersionNumber = HIDMINI_VERSION;
 
 	deviceContext->KeyboardState.ReportId = KEYBOARD_REPORT_ID;
+    deviceContext->NkroState.ReportId = KEYBOARD_REPORT_ID;
 	deviceContext->MouseState.ReportId = MOUSE_REPORT_ID;
+    deviceContext->GamepadState.ReportId = GAMEPAD_REPORT_ID;
+    deviceContext->KeyboardOutput.ReportId = KEYBOARD_REPORT_ID;
+
+    profile = DeviceQueryProfile(device);
+    if (!DescriptorBuild(profile, deviceContext->ReportDescriptor, sizeof(deviceContext->ReportDescriptor),
+            &length, &deviceContext->Collections)) {
+        VhidLog(LOG_PNP, LOG_LEVEL_WARNING, "Unknown profile %u, using keyboard and mouse\n", profile);
+        profile = VHID_PROFILE_KEYBOARD_MOUSE;
+        DescriptorBuild(profile, deviceContext->ReportDescriptor, sizeof(deviceContext->ReportDescriptor),
+            &length, &deviceContext->Collections);
+    }
+    deviceContext->HidDescriptor = G_DefaultHidDescriptor;
+    deviceContext->HidDescriptor.DescriptorList[0].wReportLength = (USHORT)length;
+
+    ConfigInitDefault(&deviceContext->Config);
+    deviceContext->Config.Profile = (UCHAR)profile;
+    if (!DeviceCheckLayout(deviceContext, length))
+        return STATUS_DEVICE_CONFIGURATION_ERROR;
+    ReportQueueInit(&deviceContext->Reports, deviceContext->Config.QueueDepth);
+    PacerInit(&deviceContext->Pacer, deviceContext->Config.PacingInterval);
+    TypematicInit(&deviceContext->Typematic, deviceContext->Config.TypematicDelay, deviceContext->Config.TypematicRate);
+    TraceRingInit(&deviceContext->Trace);
+    ReceiptRingInit(&deviceContext->Receipts);
+    IdleFilterInit(&deviceContext->Idle);
+    IdleFilterSetRate(&deviceContext->Idle, KEYBOARD_REPORT_ID, deviceContext->Config.IdleRate, VhidQueryTime());
+    KeyMergeInit(&deviceContext->KeyMerge);
+    KeyOwnerInit(&deviceContext->DeviceKeys);
+    InitializeListHead(&deviceContext->Macros);
+    deviceContext->MacroDeadline = (ULONGLONG)-1;
+
+    status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &deviceContext->StateLock);
+    if (!NT_SUCCESS(status))
+        return status;
 
-    status = WdfWaitLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &deviceContext->StateLock);
+    WDF_OBJECT_ATTRIBUTES_INIT(&memoryAttributes);
+    memoryAttributes.ParentObject = device;
+    status = WdfMemoryCreate(&memoryAttributes, NonPagedPoolNx, VHIDMINI_POOL_TAG,
+        NODE_COUNT * SLAB_STRIDE(NODE_SIZE), &deviceContext->NodeMemory, &nodes);
+    if (!NT_SUCCESS(status)) {
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "WdfMemoryCreate failed 0x%x\n", status);
+        return status;
+    }
+    SlabInit(&deviceContext->Nodes, nodes, NODE_COUNT * SLAB_STRIDE(NODE_SIZE), NODE_SIZE);
+
+    status = PipelineTimerCreate(device, &deviceContext->PipelineTimer);
     if (!NT_SUCCESS(status))
         return status;
 
@@ -143,6 +287,10 @@ Return Value:
     if (!NT_SUCCESS(status))
         return status;
 
+    status = NotifyQueueCreate(device, &deviceContext->NotifyQueue);
+    if (!NT_SUCCESS(status))
+        return status;
+
     return status;
 }
 
@@ -173,7 +321,7 @@ ManualQueueCreate(
                             &queue);
 
     if( !NT_SUCCESS(status) ) {
-        KdPrint(("WdfIoQueueCreate failed 0x%x\n",status));
+        VhidLog(LOG_PNP, LOG_LEVEL_ERROR, "WdfIoQueueCreate failed 0x%x\n",status);
         return status;
     }
 
@@ -192,8 +340,8 @@ VOID EvtDeviceFileCreate(
     WDFFILEOBJECT FileObject
 )
 {
-    UNREFERENCED_PARAMETER(Device);
-    UNREFERENCED_PARAMETER(FileObject);
+    KeyOwnerInit(&GetFileContext(FileObject)->Keys);
+    NotifyFileCreate(GetDeviceContext(Device), FileObject);
 
     WdfRequestComplete(Request, STATUS_SUCCESS);
 }
@@ -202,5 +350,16 @@ VOID EvtFileClose(
     WDFFILEOBJECT FileObject
 )
 {
-    UNREFERENCED_PARAMETER(FileObject);
+    PDEVICE_CONTEXT deviceContext = GetDeviceContext(WdfFileObjectGetDevice(FileObject));
+
+    //
+    // A client that exits or crashes with keys down must not leave them
+    // stuck for everybody else.
+    //
+    StateLockAcquire(deviceContext);
+    MacroCancel(deviceContext, FileObject, 0);
+    InjectRetract(deviceContext, &GetFileContext(FileObject)->Keys);
+    StateLockRelease(deviceContext);
+
+    NotifyFileClose(deviceContext, FileObject);
 }
@@ -7,6 +7,29 @@
 
 #include <hidport.h>
 
+#include "vhidmini_ioctl.h"
+#include "logring.h"
+#include "log.h"
+#include "hidreport.h"
+#include "descriptor.h"
+#include "layout.h"
+#include "gamepad.h"
+#include "evtqueue.h"
+#include "config.h"
+#include "reportq.h"
+#include "pacer.h"
+#include "typematic.h"
+#include "idle.h"
+#include "keymerge.h"
+#include "slab.h"
+#include "macrovm.h"
+#include "chord.h"
+#include "stream.h"
+#include "textcomp.h"
+#include "trace.h"
+#include "receipt.h"
+#include "snapshot.h"
+
 typedef UCHAR HID_REPORT_DESCRIPTOR, *PHID_REPORT_DESCRIPTOR;
 
 #define MAXIMUM_STRING_LENGTH           (126 * sizeof(WCHAR))
@@ -16,27 +39,18 @@ typedef UCHAR HID_REPORT_DESCRIPTOR, *PHID_REPORT_DESCRIPTOR;
 #define VHIDMINI_DEVICE_STRING          L"UMDF Virtual hidmini device"  
 #define VHIDMINI_DEVICE_STRING_INDEX    5
 
-#include <pshpack1.h>
-
-typedef struct _HID_KEYBOARD_REPORT {
-    UCHAR ReportId;      // Report ID = 1
-    UCHAR Modifiers;     // Ctrl, Shift, Alt, GUI
-    UCHAR Reserved;      // Toujours 0
-    UCHAR Keys[6];       // Codes des touches
-} HID_KEYBOARD_REPORT, * PHID_KEYBOARD_REPORT;
-
-typedef struct _HID_MOUSE_REPORT {
-    UCHAR ReportId;      // Report ID = 2
-    UCHAR Buttons;       // bits 0-2 = bouton1-3, bits 3-7 padding
-    CHAR X;              // mouvement X relatif
-    CHAR Y;              // mouvement Y relatif
-} HID_MOUSE_REPORT, * PHID_MOUSE_REPORT;
+#define VHIDMINI_POOL_TAG               'dihV'
 
 //
-// Misc definitions
+// Each device preallocates NODE_COUNT nodes of NODE_SIZE bytes in
+// EvtDeviceAdd, for state that has to outlive the request creating it.
+// They come from DEVICE_CONTEXT.Nodes, so nothing on the injection path
+// allocates from the pool.
 //
-#define KEYBOARD_REPORT_ID   0x01
-#define MOUSE_REPORT_ID   0x02
+#define NODE_SIZE                       256
+#define NODE_COUNT                      64
+
+#include <pshpack1.h>
 
 //
 // These are the device attributes returned by the mini driver in response
@@ -48,21 +62,61 @@ typedef struct _HID_MOUSE_REPORT {
 
 #include <poppack.h>
 
+extern HID_DESCRIPTOR G_DefaultHidDescriptor;
+
 DRIVER_INITIALIZE                   DriverEntry;
 EVT_WDF_DRIVER_DEVICE_ADD           EvtDeviceAdd;
 
+//
+// One per devnode. Several root\vhidmini devices can be installed side by
+// side; each gets its own context, locks, queues and timers, and its own
+// interface instance, so they never contend with each other. The only
+// driver-wide mutable state is the log ring in log.c.
+//
 typedef struct _DEVICE_CONTEXT
 {
     WDFDEVICE               Device;
     WDFQUEUE                QueueKernel;
     WDFQUEUE                ManualQueue;
     WDFQUEUE                QueueUser;
+    WDFQUEUE                NotifyQueue;
     HID_DEVICE_ATTRIBUTES   HidDeviceAttributes;
-    WDFWAITLOCK             StateLock;
+    HID_DESCRIPTOR          HidDescriptor;
+    UCHAR                   ReportDescriptor[DESCRIPTOR_MAX_SIZE];
+    UCHAR                   Collections;    // VHID_COLLECTION_xxx of the profile
+    DESCRIPTOR_LAYOUT       Layout;         // of ReportDescriptor
+    GAMEPAD_LAYOUT          GamepadLayout;  // GamepadState fields in Layout
+    WDFSPINLOCK             StateLock;
+    PKTHREAD                StateLockOwner;
+    ULONGLONG               StateLockAcquired;
+    ULONGLONG               StateLockCount;
+    ULONGLONG               StateLockHoldTotal;
+    ULONG                   StateLockHoldMax;
 	HID_KEYBOARD_REPORT     KeyboardState;
-    int                     KeyboardChanged;
+    HID_NKRO_REPORT         NkroState;      // sent instead of KeyboardState for VHID_PROFILE_NKRO
 	HID_MOUSE_REPORT        MouseState;
-    int                     MouseChanged;
+    HID_GAMEPAD_REPORT      GamepadState;
+    KEY_MERGE               KeyMerge;       // what each client holds, merged
+    KEY_OWNER               DeviceKeys;     // requests without a file object
+    REPORT_QUEUE            Reports;        // waiting for a hidclass read
+    PACER                   Pacer;
+    TYPEMATIC               Typematic;
+    IDLE_FILTER             Idle;           // last report per id, idle repeats
+    WDFTIMER                PipelineTimer;
+    VHID_CONFIG_REPORT      Config;
+    HID_KEYBOARD_OUTPUT_REPORT KeyboardOutput;
+    LONG                    ReaderStarted;
+    WDFSPINLOCK             NotifyLock;     // protects FileList and the event queues
+    LIST_ENTRY              FileList;
+    WDFMEMORY               NodeMemory;
+    SLAB                    Nodes;
+    LIST_ENTRY              Macros;         // protected by StateLock
+    ULONGLONG               MacroDeadline;  // next macro to run, -1 = none
+    RECEIPT_RING            Receipts;       // protected by StateLock
+    ULONG                   ActiveSequence; // request whose reports are being queued, 0 = none
+    BOOLEAN                 ActiveOrdered;  // ... and it is a chord
+    BOOLEAN                 DrainedPending; // VHID_EVENT_BACKLOG_DRAINED to raise once StateLock is released
+    TRACE_RING              Trace;
 } DEVICE_CONTEXT, *PDEVICE_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_CONTEXT, GetDeviceContext);
@@ -75,6 +129,16 @@ typedef struct _QUEUE_CONTEXT
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(QUEUE_CONTEXT, GetQueueContext);
 
+typedef struct _FILE_CONTEXT
+{
+    LIST_ENTRY              Link;           // DEVICE_CONTEXT.FileList
+    WDFFILEOBJECT           FileObject;
+    EVENT_QUEUE             Events;
+    KEY_OWNER               Keys;           // protected by StateLock
+} FILE_CONTEXT, *PFILE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FILE_CONTEXT, GetFileContext);
+
 NTSTATUS
 KernelQueueCreate(
     _In_  WDFDEVICE         Device,
@@ -93,6 +157,227 @@ UserQueueCreate(
     _Out_ WDFQUEUE* Queue
 );
 
+NTSTATUS
+NotifyQueueCreate(
+    _In_  WDFDEVICE         Device,
+    _Out_ WDFQUEUE*         Queue
+    );
+
+VOID
+NotifyFileCreate(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFFILEOBJECT     FileObject
+    );
+
+VOID
+NotifyFileClose(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFFILEOBJECT     FileObject
+    );
+
+NTSTATUS
+NotifyWaitEvent(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  WDFREQUEST        Request,
+    _In_  size_t            OutputBufferLength,
+    _Always_(_Out_)
+    BOOLEAN*                CompleteRequest
+    );
+
+VOID
+NotifyEvent(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  ULONG             Type,
+    _In_  ULONG             Data
+    );
+
+NTSTATUS
+PipelineTimerCreate(
+    _In_  WDFDEVICE         Device,
+    _Out_ WDFTIMER*         Timer
+    );
+
+VOID
+PipelineArmTimer(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  ULONGLONG         Now
+    );
+
+BOOLEAN
+ReportDispatch(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    );
+
+VOID
+ReportSetQueueDepth(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  ULONG             Depth
+    );
+
+ULONG
+InjectOpen(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    );
+
+VOID
+InjectClose(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  ULONG             Sequence
+    );
+
+VOID
+InjectKeyEvent(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  UCHAR             KeyCode,
+    _In_  BOOLEAN           Pressed
+    );
+
+VOID
+InjectMouseMove(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  CHAR              DeltaX,
+    _In_  CHAR              DeltaY
+    );
+
+VOID
+InjectMouseButtons(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  UCHAR             ButtonMask
+    );
+
+VOID
+InjectGamepad(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  const VHID_GAMEPAD_STATE* State
+    );
+
+VOID
+InjectRetract(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner
+    );
+
+VOID
+InjectEvent(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  const VHID_BATCH_EVENT* Event
+    );
+
+NTSTATUS
+InjectBatch(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_reads_(Count) const VHID_BATCH_EVENT* Events,
+    _In_  ULONG             Count,
+    _Out_ PULONG            Sequence
+    );
+
+NTSTATUS
+InjectStream(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_reads_bytes_(Length) const UCHAR* Data,
+    _In_  size_t            Length,
+    _Out_ size_t*           Consumed
+    );
+
+VOID
+InjectSnapshot(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  const KEY_OWNER*  Owner,
+    _Out_ PVHID_SNAPSHOT    Snapshot
+    );
+
+ULONG
+InjectRestore(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  const VHID_SNAPSHOT* Snapshot
+    );
+
+NTSTATUS
+TypeText(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _Inout_ PKEY_OWNER      Owner,
+    _In_  ULONG             Layout,
+    _In_reads_bytes_(Length) const UCHAR* Text,
+    _In_  size_t            Length,
+    _Out_ PVHID_TYPE_TEXT_RESULT Result
+    );
+
+NTSTATUS
+MacroStart(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_opt_ WDFFILEOBJECT  FileObject,
+    _In_reads_bytes_(Length) const UCHAR* Code,
+    _In_  size_t            Length,
+    _Out_ PULONG            Id
+    );
+
+NTSTATUS
+ChordStart(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_opt_ WDFFILEOBJECT  FileObject,
+    _In_  const VHID_CHORD* Chord,
+    _Out_ PULONG            Sequence
+    );
+
+ULONG
+MacroCancel(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_opt_ WDFFILEOBJECT  FileObject,
+    _In_  ULONG             Id
+    );
+
+VOID
+MacroWithdraw(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_reads_(KEY_MERGE_USAGES / 32) const ULONG* Keys,
+    _In_  UCHAR             Buttons
+    );
+
+VOID
+MacroTick(
+    _In_  PDEVICE_CONTEXT   DeviceContext,
+    _In_  ULONGLONG         Now
+    );
+
+NTSTATUS
+SendReport(
+    _In_  PDEVICE_CONTEXT   Ctx,
+    _In_reads_bytes_(Size) VOID* Report,
+    _In_  size_t            Size
+    );
+
+ULONGLONG
+VhidQueryTime(
+    VOID
+    );
+
+VOID
+StateLockAcquire(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    );
+
+VOID
+StateLockRelease(
+    _In_  PDEVICE_CONTEXT   DeviceContext
+    );
+
+//
+// Routines documented as "called with StateLock held" check it on checked
+// builds.
+//
+#if DBG
+#define STATE_LOCK_ASSERT_HELD(Ctx) \
+    NT_ASSERT((Ctx)->StateLockOwner == KeGetCurrentThread())
+#else
+#define STATE_LOCK_ASSERT_HELD(Ctx)
+#endif
+
 NTSTATUS
 RequestCopyFromBuffer(
     _In_  WDFREQUEST        Request,
@@ -0,0 +1,26 @@
+#ifndef __VHIDPORT_H_
+#define __VHIDPORT_H_
+
+//
+// Base types for the modules that don't depend on WDF (evtqueue.c, ...).
+// They only use what both the kernel and user mode headers provide, so the
+// same sources can be built into the driver and into user mode tools.
+//
+#if defined(_KERNEL_MODE)
+#include <ntddk.h>
+#else
+#include <windows.h>
+#include <winioctl.h>
+#endif
+
+//
+// The processor the caller runs on. Only a hint for spreading work, the
+// caller may migrate right after.
+//
+#if defined(_KERNEL_MODE)
+#define VhidCurrentProcessor()  KeGetCurrentProcessorNumberEx(NULL)
+#else
+#define VhidCurrentProcessor()  GetCurrentProcessorNumber()
+#endif
+
+#endif // __VHIDPORT_H_
@@ -12,7 +12,49 @@ DEFINE_GUID(GUID_DEVINTERFACE_VHIDMINI, 0xea8ff883, 0x45f3, 0x4463, 0xb2, 0xa8,
 #define IOCTL_VHIDMINI_MOVE_EVENT CTL_CODE(FILE_DEVICE_VHIDMINI, 0x801, METHOD_BUFFERED, FILE_WRITE_ACCESS)
 #define IOCTL_VHIDMINI_BUTTON_EVENT CTL_CODE(FILE_DEVICE_VHIDMINI, 0x802, METHOD_BUFFERED, FILE_WRITE_ACCESS)
 #define IOCTL_VHIDMINI_WHEEL_EVENT CTL_CODE(FILE_DEVICE_VHIDMINI, 0x803, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_VHIDMINI_WAIT_EVENT CTL_CODE(FILE_DEVICE_VHIDMINI, 0x804, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_VHIDMINI_TYPE_TEXT CTL_CODE(FILE_DEVICE_VHIDMINI, 0x805, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_VHIDMINI_GET_STATS CTL_CODE(FILE_DEVICE_VHIDMINI, 0x806, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_VHIDMINI_GET_TRACE CTL_CODE(FILE_DEVICE_VHIDMINI, 0x807, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_VHIDMINI_SEND_BATCH CTL_CODE(FILE_DEVICE_VHIDMINI, 0x808, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_VHIDMINI_RUN_MACRO CTL_CODE(FILE_DEVICE_VHIDMINI, 0x809, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_VHIDMINI_CANCEL_MACRO CTL_CODE(FILE_DEVICE_VHIDMINI, 0x80A, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_VHIDMINI_SEND_STREAM CTL_CODE(FILE_DEVICE_VHIDMINI, 0x80B, METHOD_IN_DIRECT, FILE_WRITE_ACCESS)
+#define IOCTL_VHIDMINI_TYPE_TEXT_DIRECT CTL_CODE(FILE_DEVICE_VHIDMINI, 0x80C, METHOD_IN_DIRECT, FILE_WRITE_ACCESS)
+#define IOCTL_VHIDMINI_SEND_CHORD CTL_CODE(FILE_DEVICE_VHIDMINI, 0x80D, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_VHIDMINI_GET_RECEIPTS CTL_CODE(FILE_DEVICE_VHIDMINI, 0x80E, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_VHIDMINI_GAMEPAD_EVENT CTL_CODE(FILE_DEVICE_VHIDMINI, 0x80F, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_VHIDMINI_GET_SNAPSHOT CTL_CODE(FILE_DEVICE_VHIDMINI, 0x810, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_VHIDMINI_RESTORE_SNAPSHOT CTL_CODE(FILE_DEVICE_VHIDMINI, 0x811, METHOD_BUFFERED, FILE_WRITE_ACCESS)
 
+//
+// Collections a device presents, chosen at install time by the REG_DWORD
+// value Profile of its hardware key. hidclass only sees the collections of
+// the profile; events for the others are accepted and dropped, like those
+// of a disabled collection. The configuration collection is always there.
+// A missing or unknown value selects VHID_PROFILE_KEYBOARD_MOUSE.
+//
+#define VHID_PROFILE_KEYBOARD_MOUSE 0   // boot keyboard and mouse
+#define VHID_PROFILE_KEYBOARD       1   // boot keyboard
+#define VHID_PROFILE_MOUSE          2   // mouse
+#define VHID_PROFILE_NKRO           3   // keyboard without the six key limit, and mouse
+#define VHID_PROFILE_GAMEPAD        4   // gamepad
+#define VHID_PROFILE_COUNT          5
+
+//
+// Every injection request is given a sequence number, from one counter per
+// device that only goes up. KEY_EVENT, MOVE_EVENT, BUTTON_EVENT,
+// GAMEPAD_EVENT, SEND_BATCH and RESTORE_SNAPSHOT return it as their
+// optional ULONG output; TYPE_TEXT, RUN_MACRO and SEND_CHORD return it as
+// described with their structures. The METHOD_IN_DIRECT requests have no
+// output buffer left to return it in; their receipts can still be found
+// with IOCTL_VHIDMINI_GET_RECEIPTS.
+//
+
+//
+// Keys and buttons are held per handle: the device reports a key down while
+// any open handle holds it, and closing a handle releases what it held.
+//
 typedef struct _VHID_KEY_EVENT {
     UCHAR KeyCode;   // code HID (ex: 0x04 = A)
     UCHAR Pressed;   // 1 = down, 0 = up
@@ -27,4 +69,291 @@ typedef struct _VHID_MOUSE_BUTTON {
     UCHAR ButtonMask;   // bit0=left, bit1=right, bit2=middle
 } VHID_MOUSE_BUTTON, *PVHID_MOUSE_BUTTON;
 
+//
+// IOCTL_VHIDMINI_GAMEPAD_EVENT input: the whole state of the gamepad, which
+// is shared by every handle; the last state sent wins.
+//
+typedef struct _VHID_GAMEPAD_STATE {
+    USHORT Buttons;     // bit n = button n + 1
+    CHAR X;
+    CHAR Y;
+    CHAR Z;
+    CHAR Rz;
+} VHID_GAMEPAD_STATE, *PVHID_GAMEPAD_STATE;
+
+//
+// IOCTL_VHIDMINI_SEND_BATCH input: a VHID_BATCH_HEADER followed by Count
+// VHID_BATCH_EVENT records. The whole batch is validated, then applied in
+// order in one pass, exactly as if each event had been sent on its own.
+//
+#define VHID_BATCH_KEY              1   // Data = key code, pressed
+#define VHID_BATCH_MOVE             2   // Data = delta x, delta y
+#define VHID_BATCH_BUTTON           3   // Data = button mask
+
+#define VHID_BATCH_MAX_EVENTS       256
+
+typedef struct _VHID_BATCH_EVENT {
+    UCHAR Type;         // VHID_BATCH_xxx
+    UCHAR Data[3];
+} VHID_BATCH_EVENT, *PVHID_BATCH_EVENT;
+
+typedef struct _VHID_BATCH_HEADER {
+    ULONG Count;
+    ULONG Reserved;
+} VHID_BATCH_HEADER, *PVHID_BATCH_HEADER;
+
+//
+// IOCTL_VHIDMINI_SEND_CHORD input: a shortcut such as Ctrl+Shift+Esc or
+// Ctrl+click. The keys are pressed in the order given, then the buttons;
+// after HoldMs the buttons are released, then the keys in reverse order.
+// Each phase is queued in one go, so no other client's report comes in
+// between, and hidclass reads the chord's reports in that order across the
+// keyboard and mouse collections, ahead of anything queued after them.
+// The output, if any, is the ULONG sequence number the device gave the
+// chord, also found in the VHID_TRACE_CHORD trace record. The request
+// fails with STATUS_DEVICE_BUSY if the report queue can't take the whole
+// chord. It runs like a macro: closing the handle, or cancelling all of
+// its macros, releases a chord still held.
+//
+#define VHID_CHORD_MAX_KEYS         8
+
+typedef struct _VHID_CHORD {
+    UCHAR KeyCount;
+    UCHAR Buttons;      // bit0=left, bit1=right, bit2=middle
+    USHORT HoldMs;
+    UCHAR Keys[VHID_CHORD_MAX_KEYS];
+} VHID_CHORD, *PVHID_CHORD;
+
+//
+// IOCTL_VHIDMINI_SEND_STREAM takes bulk payloads, such as recorded sessions,
+// without the copy through the system buffer: it is METHOD_IN_DIRECT, the
+// payload is passed as the output buffer and the driver reads it in place
+// from the locked pages. The payload is a sequence of packed records, a
+// VHID_BATCH_xxx type byte followed by the data of that type (key code and
+// pressed, delta x and delta y, or button mask). Records are applied in
+// order, as many as the report queue has room for, and the request
+// completes with the bytes of whole records applied; the caller resubmits
+// the rest. A request applies at most VHID_MAX_QUEUE_DEPTH records, so
+// there is no point passing more than VHID_STREAM_MAX_SLICE bytes: every
+// page passed is locked, whether read or not. It fails with
+// STATUS_DEVICE_BUSY when the queue had no room at all, and with
+// STATUS_INVALID_PARAMETER when the first record has an unknown type or
+// is cut by the end of the payload.
+//
+// IOCTL_VHIDMINI_TYPE_TEXT_DIRECT is IOCTL_VHIDMINI_TYPE_TEXT with the text
+// passed the same way: VHID_TYPE_TEXT is the input buffer, the UTF-8 text
+// the output buffer, and the request completes with the bytes of text
+// typed. Characters missing from the layout are skipped without being
+// counted.
+//
+#define VHID_STREAM_MAX_RECORD      3
+#define VHID_STREAM_MAX_SLICE       (VHID_MAX_QUEUE_DEPTH * VHID_STREAM_MAX_RECORD)
+
+//
+// IOCTL_VHIDMINI_RUN_MACRO input: a macro program, run by the driver on its
+// own so that waits and decisions on device state cost no round trip. The
+// output, if any, is the ULONG macro id, which is also the sequence number
+// of the request, for IOCTL_VHIDMINI_CANCEL_MACRO
+// (input: a ULONG id, 0 for every macro started on the handle).
+//
+// A program is a sequence of instructions, an opcode byte followed by its
+// operands; USHORT operands are little endian. Running past the last
+// instruction ends the program like VHID_OP_END. Programs are verified when
+// loaded and rejected with STATUS_INVALID_PARAMETER unless:
+//  - loops have a constant count and nest at most VHID_MACRO_MAX_DEPTH deep;
+//  - branches only skip forward, to an instruction of the same loop body;
+//  - at most VHID_MACRO_MAX_STEPS instructions execute in total, and the
+//    waits add up to at most VHID_MACRO_MAX_WAIT_MS.
+// Keys and buttons a macro holds are merged like another handle's, and
+// released when it ends, is cancelled, or the handle that started it is
+// closed.
+//
+#define VHID_OP_END                 0x00
+#define VHID_OP_KEY                 0x01    // key code, pressed
+#define VHID_OP_MOVE                0x02    // delta x, delta y
+#define VHID_OP_BUTTON              0x03    // button mask
+#define VHID_OP_WAIT                0x04    // USHORT ms
+#define VHID_OP_WAIT_DRAIN          0x05    // USHORT timeout ms: until every pending report has been read
+#define VHID_OP_LOOP                0x06    // count, 1..255: the body up to VHID_OP_END_LOOP
+#define VHID_OP_END_LOOP            0x07
+#define VHID_OP_IF_LED              0x08    // mask, value, skip: skip bytes unless (LEDs & mask) == value
+#define VHID_OP_IF_KEY              0x09    // key code, pressed, skip: skip bytes unless the key is in that state
+#define VHID_OP_SKIP                0x0A    // skip: always skip bytes
+
+#define VHID_MACRO_MAX_CODE         128
+#define VHID_MACRO_MAX_DEPTH        4
+#define VHID_MACRO_MAX_STEPS        100000
+#define VHID_MACRO_MAX_WAIT_MS      600000
+
+//
+// IOCTL_VHIDMINI_TYPE_TEXT input: a VHID_TYPE_TEXT header followed by UTF-8
+// text, up to the end of the input buffer. The driver types as much as the
+// report queue can take and returns a VHID_TYPE_TEXT_RESULT; when nothing
+// could be consumed it fails with STATUS_DEVICE_BUSY, and the caller should
+// retry once VHID_EVENT_BACKLOG_DRAINED is signaled.
+//
+#define VHID_LAYOUT_US              0
+#define VHID_LAYOUT_FR              1   // AZERTY
+#define VHID_LAYOUT_DE              2   // QWERTZ
+
+typedef struct _VHID_TYPE_TEXT {
+    ULONG Layout;       // VHID_LAYOUT_xxx
+    ULONG Reserved;
+} VHID_TYPE_TEXT, *PVHID_TYPE_TEXT;
+
+typedef struct _VHID_TYPE_TEXT_RESULT {
+    ULONG Consumed;     // bytes of text typed, always whole characters
+    ULONG Unmapped;     // characters skipped, not present on the layout
+    ULONG Sequence;     // of the request; left out if the output buffer is shorter
+} VHID_TYPE_TEXT_RESULT, *PVHID_TYPE_TEXT_RESULT;
+
+//
+// IOCTL_VHIDMINI_GET_STATS output. Counters run from device start; times
+// are in 100ns units.
+//
+typedef struct _VHID_STATS {
+    ULONGLONG StateLockCount;       // StateLock acquisitions
+    ULONGLONG StateLockHoldTotal;   // sum of hold times
+    ULONG StateLockHoldMax;         // longest hold
+    ULONG ReportsMerged;            // reports folded into a pending one
+    ULONG ReportsDropped;           // reports evicted from a full queue
+    ULONG ReportsPending;
+    ULONG NodesInUse;               // per-device node slab
+    ULONG NodesPeak;
+    ULONG NodeFailures;             // allocations that found the slab empty
+    ULONG ReportsSuppressed;        // reports identical to the previous one
+} VHID_STATS, *PVHID_STATS;
+
+//
+// Records returned by IOCTL_VHIDMINI_GET_TRACE. The driver keeps the most
+// recent records in a fixed-size ring; the optional ULONG input is the
+// first sequence number wanted, so a client can poll incrementally. Records
+// come back in sequence order. A gap in Sequence means records were
+// overwritten before they were read.
+//
+#define VHID_TRACE_KEY              1   // Data = key code, pressed
+#define VHID_TRACE_REPORT_QUEUED    2   // Data = report, appended to the queue
+#define VHID_TRACE_REPORT_MERGED    3   // Data = report, folded into a pending one
+#define VHID_TRACE_REPORT_EVICTED   4   // oldest pending report discarded
+#define VHID_TRACE_REPORT_COMPLETED 5   // Data = report, handed to hidclass
+#define VHID_TRACE_READ_PARKED      6   // hidclass read waiting for a report
+#define VHID_TRACE_CONFIG           7   // Data = configuration report, truncated
+#define VHID_TRACE_CHORD            8   // Data = ULONG chord sequence number
+
+#define VHID_TRACE_DATA_SIZE        10
+
+typedef struct _VHID_TRACE_RECORD {
+    ULONGLONG Timestamp;    // interrupt time, 100ns units
+    ULONG     Sequence;     // starts at 1, per device
+    UCHAR     Type;         // VHID_TRACE_xxx
+    UCHAR     Length;       // bytes of Data used
+    UCHAR     Data[VHID_TRACE_DATA_SIZE];
+} VHID_TRACE_RECORD, *PVHID_TRACE_RECORD;
+
+//
+// Receipts returned by IOCTL_VHIDMINI_GET_RECEIPTS, one per injection
+// request, for the most recent requests only. Like IOCTL_VHIDMINI_GET_TRACE
+// the optional ULONG input is the first sequence number wanted, and
+// receipts come back in sequence order. Sequence numbers skip 0 when they
+// wrap, and 0 asks for the oldest receipt kept. A request is pending until
+// it can queue no more reports and every report it queued has met its
+// fate; its status is then the worst of those fates. Completed is when the
+// last of its reports was read by hidclass, or met its fate if none was
+// read.
+//
+#define VHID_RECEIPT_PENDING        0
+#define VHID_RECEIPT_DELIVERED      1   // every report was read by hidclass
+#define VHID_RECEIPT_MERGED         2   // a report was folded into a newer one before being read
+#define VHID_RECEIPT_DROPPED        3   // a report was evicted from a full queue
+#define VHID_RECEIPT_NONE           4   // no report was queued: no change, suppressed or disabled
+
+typedef struct _VHID_RECEIPT {
+    ULONG     Sequence;
+    ULONG     Status;       // VHID_RECEIPT_xxx
+    ULONGLONG Submitted;    // interrupt time, 100ns units
+    ULONGLONG Completed;    // interrupt time, 0 while pending
+} VHID_RECEIPT, *PVHID_RECEIPT;
+
+//
+// IOCTL_VHIDMINI_GET_SNAPSHOT output and IOCTL_VHIDMINI_RESTORE_SNAPSHOT
+// input: the injected state of every collection, read or replaced under
+// one acquisition of the device state lock. Keys and Buttons are what the
+// device reports, whichever handles hold them; OwnKeys and OwnButtons are
+// the part held by the calling handle, and are ignored by a restore.
+//
+// A restore only touches the collections in Collections. Keys and buttons
+// down but not in the snapshot are released from every handle and macro
+// holding them; those in the snapshot but not down are pressed by the
+// calling handle. Each collection that changes gets a single report with
+// its final state, and unchanged collections get none.
+//
+#define VHID_SNAPSHOT_KEY_WORDS     8   // 256 usages
+
+typedef struct _VHID_SNAPSHOT {
+    ULONG Keys[VHID_SNAPSHOT_KEY_WORDS];    // usage n is down if bit n % 32 of Keys[n / 32] is set
+    ULONG OwnKeys[VHID_SNAPSHOT_KEY_WORDS];
+    UCHAR Buttons;              // mouse, bit0=left, bit1=right, bit2=middle
+    UCHAR OwnButtons;
+    UCHAR Collections;          // VHID_COLLECTION_xxx: of the profile when read, to restore
+    UCHAR Reserved;             // must be zero
+    VHID_GAMEPAD_STATE Gamepad;
+} VHID_SNAPSHOT, *PVHID_SNAPSHOT;
+
+//
+// Notifications returned by IOCTL_VHIDMINI_WAIT_EVENT. Each handle has its own
+// bounded event queue; a pended request is completed with as many records as
+// fit in its output buffer. Several requests may be pended at once.
+//
+#define VHID_EVENT_READER_STARTED   1   // hidclass parked its first read
+#define VHID_EVENT_BACKLOG_DRAINED  2   // every pending report has been read
+#define VHID_EVENT_OUTPUT_CHANGED   3   // Data = report id << 8 | output byte
+#define VHID_EVENT_FEATURE_CHANGED  4   // Data = feature report id
+
+typedef struct _VHID_NOTIFY_EVENT {
+    ULONG     Type;
+    ULONG     Sequence;     // per handle, increments for every queued event
+    ULONG     Dropped;      // events lost to overflow just before this one
+    ULONG     Data;
+    ULONGLONG Timestamp;    // interrupt time, 100ns units
+} VHID_NOTIFY_EVENT, *PVHID_NOTIFY_EVENT;
+
+//
+// Vendor-defined feature report holding the live pipeline configuration. It
+// belongs to its own top-level collection, so any HID-aware process can read
+// or change it with HidD_GetFeature/HidD_SetFeature. The report size never
+// changes: fields added by later versions are carved out of Reserved, and
+// older versions are accepted with the newer fields at their defaults.
+//
+#define VHID_CONFIG_REPORT_ID       0x03
+#define VHID_CONFIG_VERSION         5
+
+#define VHID_COLLECTION_KEYBOARD    0x01
+#define VHID_COLLECTION_MOUSE       0x02
+#define VHID_COLLECTION_GAMEPAD     0x04    // v5, enabled for older versions
+#define VHID_COLLECTION_ALL         (VHID_COLLECTION_KEYBOARD | VHID_COLLECTION_MOUSE | VHID_COLLECTION_GAMEPAD)
+
+#define VHID_COALESCE_LATEST        0   // a pending report is replaced by the newer state
+#define VHID_COALESCE_QUEUE         1   // every state is queued, up to QueueDepth
+
+#define VHID_MAX_QUEUE_DEPTH        64
+
+#include <pshpack1.h>
+
+typedef struct _VHID_CONFIG_REPORT {
+    UCHAR ReportId;             // VHID_CONFIG_REPORT_ID
+    UCHAR Version;              // VHID_CONFIG_VERSION
+    UCHAR EnabledCollections;   // VHID_COLLECTION_xxx, reports of others are dropped
+    UCHAR KeyboardCoalesce;     // VHID_COALESCE_xxx
+    UCHAR MouseCoalesce;        // VHID_COALESCE_xxx
+    UCHAR QueueDepth;           // pending reports, 1..VHID_MAX_QUEUE_DEPTH
+    USHORT PacingInterval;      // v2: us between two reports of a collection, 0 = off
+    USHORT TypematicDelay;      // v3: ms before a held key repeats, 0 = off
+    UCHAR TypematicRate;        // v3: repeats per second
+    UCHAR IdleRate;             // v4: 4ms units between repeats of an unchanged keyboard report, 0 = off
+    UCHAR Profile;              // v5: VHID_PROFILE_xxx, read-only, ignored when written
+    UCHAR Reserved[3];          // must be zero
+} VHID_CONFIG_REPORT, *PVHID_CONFIG_REPORT;
+
+#include <poppack.h>
+
 #endif //__VHIDMINI_IOCTL_H__
@@ -0,0 +1,216 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "hidreport.h"
+#include "reportq.h"
+#include "macrovm.h"
+#include "chord.h"
+#include "vhidtest.h"
+
+//
+// Host queueing each event of a macro as one report, ordered for a chord,
+// the way the driver's macros do: key code and pressed in a keyboard
+// report, buttons in a mouse report.
+//
+typedef struct _CHORD_HOST {
+    PREPORT_QUEUE           Queue;
+    ULONG                   Sequence;
+    ULONG                   Evicted;
+    BOOLEAN                 Unordered;      // a plain macro
+} CHORD_HOST;
+
+static VOID chordEmit(PVOID context, const VHID_BATCH_EVENT* event) {
+    CHORD_HOST* host = (CHORD_HOST*)context;
+    HID_KEYBOARD_REPORT keyboard = { KEYBOARD_REPORT_ID };
+    HID_MOUSE_REPORT mouse = { MOUSE_REPORT_ID };
+    UCHAR flags = host->Unordered ? 0 : REPORT_ORDERED;
+    ULONG displaced;
+    ULONG outcome;
+
+    if (event->Type == VHID_BATCH_KEY) {
+        keyboard.Keys[0] = event->Data[0];
+        keyboard.Keys[1] = event->Data[1];
+        outcome = ReportQueuePush(host->Queue, &keyboard, sizeof(keyboard), VHID_COALESCE_QUEUE, NULL,
+            host->Sequence, flags, &displaced);
+    }
+    else {
+        mouse.Buttons = event->Data[0];
+        outcome = ReportQueuePush(host->Queue, &mouse, sizeof(mouse), VHID_COALESCE_LATEST, MouseReportMerge,
+            host->Sequence, flags, &displaced);
+    }
+    if (outcome == REPORT_PUSH_EVICTED)
+        host->Evicted++;
+}
+
+static ULONG chordQuery(PVOID context, ULONG query, UCHAR arg) {
+    UNREFERENCED_PARAMETER(context);
+    UNREFERENCED_PARAMETER(query);
+    UNREFERENCED_PARAMETER(arg);
+    return 0;
+}
+
+//
+// What ChordStart does under StateLock: refuse the chord unless the queue
+// has room for all of its reports, then run its first slice.
+//
+static BOOLEAN chordStart(CHORD_HOST* host, const VHID_CHORD* chord) {
+    MACRO_HOST macroHost = { chordEmit, chordQuery, host };
+    UCHAR code[VHID_MACRO_MAX_CODE];
+    USHORT length;
+    ULONG reports;
+    MACRO_VM vm;
+
+    CHECK(ChordCompile(chord, code, &length, &reports));
+    if (ReportQueueRoom(host->Queue) < reports)
+        return FALSE;
+
+    MacroVmInit(&vm, code, length);
+    CHECK(MacroVmRun(&vm, &macroHost, 0));
+    return TRUE;
+}
+
+static void testCompile(void) {
+    VHID_CHORD chord = { 0 };
+    UCHAR code[VHID_MACRO_MAX_CODE];
+    USHORT length;
+    ULONG reports, error, i;
+
+    CHECK(!ChordCompile(&chord, code, &length, &reports));
+    chord.Buttons = 0x08;
+    CHECK(!ChordCompile(&chord, code, &length, &reports));
+    chord.Buttons = 0;
+    chord.KeyCount = 2;
+    chord.Keys[0] = 0xE0;
+    CHECK(!ChordCompile(&chord, code, &length, &reports));
+    chord.Keys[1] = 0xE0;
+    CHECK(!ChordCompile(&chord, code, &length, &reports));
+    chord.KeyCount = VHID_CHORD_MAX_KEYS + 1;
+    CHECK(!ChordCompile(&chord, code, &length, &reports));
+
+    //
+    // The largest chord, held, fits a program and the verifier takes it.
+    //
+    chord.KeyCount = VHID_CHORD_MAX_KEYS;
+    for (i = 0; i < VHID_CHORD_MAX_KEYS; i++)
+        chord.Keys[i] = (UCHAR)(0x04 + i);
+    chord.Buttons = 0x07;
+    chord.HoldMs = 500;
+    CHECK(ChordCompile(&chord, code, &length, &reports));
+    CHECK_EQ(reports, 2 * (VHID_CHORD_MAX_KEYS + 1));
+    CHECK_EQ(length, 2 * (3 * VHID_CHORD_MAX_KEYS + 2) + 3);
+    CHECK(MacroVerify(code, length, &error));
+}
+
+static void testOrder(void) {
+    static const VHID_CHORD chord = { 2, 0x01, 0, { 0xE0, 0x06 } };
+    static const UCHAR keys[] = { 0xE0, 0x06, 0, 0x06, 0xE0 };
+    REPORT_QUEUE queue;
+    REPORT_ENTRY entry;
+    CHORD_HOST host = { &queue, 7, 0 };
+    HID_MOUSE_REPORT move = { MOUSE_REPORT_ID, 0, 5, 0 };
+    ULONG displaced, i;
+
+    //
+    // Presses in order, then the buttons, then the releases in reverse. A
+    // mouse report queued after the chord waits for all of it, even while
+    // only the mouse collection reads.
+    //
+    ReportQueueInit(&queue, 8);
+    CHECK(chordStart(&host, &chord));
+    CHECK_EQ(queue.Count, 6);
+    ReportQueuePush(&queue, &move, sizeof(move), VHID_COALESCE_LATEST, MouseReportMerge, 8, 0, &displaced);
+    CHECK_EQ(queue.Count, 7);
+    CHECK(!ReportQueuePop(&queue, REPORT_ID_MASK(MOUSE_REPORT_ID), &entry));
+
+    for (i = 0; i < 6; i++) {
+        CHECK(ReportQueuePop(&queue, REPORT_ID_ANY, &entry));
+        CHECK_EQ(entry.Sequence, 7);
+        CHECK_EQ(entry.Data[0], i == 2 || i == 3 ? MOUSE_REPORT_ID : KEYBOARD_REPORT_ID);
+        if (i == 2)
+            CHECK_EQ(((PHID_MOUSE_REPORT)entry.Data)->Buttons, 0x01);
+        else if (i == 3)
+            CHECK_EQ(((PHID_MOUSE_REPORT)entry.Data)->Buttons, 0);
+        else
+            CHECK_EQ(((PHID_KEYBOARD_REPORT)entry.Data)->Keys[0], keys[i < 2 ? i : i - 1]);
+    }
+    CHECK(ReportQueuePop(&queue, REPORT_ID_MASK(MOUSE_REPORT_ID), &entry));
+    CHECK_EQ(entry.Sequence, 8);
+}
+
+static void testEviction(void) {
+    static const VHID_CHORD chord = { 3, 0, 0, { 0xE0, 0xE2, 0x4C } };
+    REPORT_QUEUE queue;
+    CHORD_HOST host = { &queue, 1, 0 };
+    HID_KEYBOARD_REPORT key = { KEYBOARD_REPORT_ID };
+    ULONG displaced;
+
+    //
+    // A chord is all or nothing: it is refused rather than evicting its own
+    // presses, or anything queued before it.
+    //
+    ReportQueueInit(&queue, 8);
+    ReportQueuePush(&queue, &key, sizeof(key), VHID_COALESCE_QUEUE, NULL, 0, 0, &displaced);
+    ReportQueuePush(&queue, &key, sizeof(key), VHID_COALESCE_QUEUE, NULL, 0, 0, &displaced);
+    CHECK(chordStart(&host, &chord));
+    CHECK_EQ(queue.Count, 8);
+    host.Sequence++;
+    CHECK(!chordStart(&host, &chord));
+    CHECK_EQ(queue.Count, 8);
+    CHECK_EQ(host.Evicted, 0);
+    CHECK_EQ(queue.Dropped, 0);
+
+    //
+    // A queue left over its limit by a shrink has no room at all, rather
+    // than a wrapped-around lot of it.
+    //
+    ReportQueueSetLimit(&queue, 4);
+    CHECK_EQ(ReportQueueRoom(&queue), 0);
+    CHECK(!chordStart(&host, &chord));
+    CHECK_EQ(queue.Count, 8);
+}
+
+static void testDueMacro(void) {
+    static const VHID_CHORD first = { 2, 0, 0, { 0xE0, 0x06 } };
+    static const VHID_CHORD second = { 1, 0x02, 0, { 0x19 } };
+    static const UCHAR other[] = { VHID_OP_KEY, 0x04, 1, VHID_OP_KEY, 0x04, 0 };
+    REPORT_QUEUE queue;
+    REPORT_ENTRY entry;
+    CHORD_HOST host = { &queue, 1, 0 };
+    CHORD_HOST otherHost = { &queue, 3, 0, TRUE };
+    MACRO_HOST macroHost = { chordEmit, chordQuery, &otherHost };
+    MACRO_VM vm;
+    ULONG i;
+
+    //
+    // A macro is due as a chord starts into a queue with just enough room
+    // for it. Starting the chord runs its own slice only, as MacroLaunch
+    // does, so the due macro can't take the room and have the chord evict
+    // the reports of the one before it; the macro runs from the timer,
+    // once hidclass has read.
+    //
+    ReportQueueInit(&queue, 8);
+    CHECK(chordStart(&host, &first));
+    MacroVmInit(&vm, other, sizeof(other));
+    host.Sequence = 2;
+    CHECK(chordStart(&host, &second));
+    CHECK_EQ(queue.Count, 8);
+    CHECK_EQ(queue.Dropped, 0);
+    CHECK_EQ(host.Evicted, 0);
+
+    for (i = 0; i < 8; i++) {
+        CHECK(ReportQueuePop(&queue, REPORT_ID_ANY, &entry));
+        CHECK_EQ(entry.Sequence, i < 4 ? 1 : 2);
+        CHECK(entry.Flags & REPORT_ORDERED);
+    }
+
+    CHECK(MacroVmRun(&vm, &macroHost, 0));
+    CHECK_EQ(queue.Count, 2);
+    CHECK_EQ(otherHost.Evicted, 0);
+}
+
+void testChord(void) {
+    testCompile();
+    testOrder();
+    testEviction();
+    testDueMacro();
+}
@@ -0,0 +1,80 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "config.h"
+#include "vhidtest.h"
+
+static void testRoundTrip(void) {
+    VHID_CONFIG_REPORT config, report, decoded;
+
+    ConfigInitDefault(&config);
+    config.QueueDepth = 8;
+    config.PacingInterval = 1000;
+    config.TypematicDelay = 250;
+    config.TypematicRate = 30;
+    ConfigEncode(&config, &report);
+
+    CHECK_EQ(ConfigDecode(&report, sizeof(report), &decoded), STATUS_SUCCESS);
+    CHECK(RtlEqualMemory(&config, &decoded, sizeof(config)));
+}
+
+static void testOldVersion(void) {
+    VHID_CONFIG_REPORT report, decoded;
+
+    //
+    // A version 1 client knows nothing past QueueDepth: the rest is
+    // ignored and the gamepad stays enabled.
+    //
+    RtlFillMemory(&report, sizeof(report), 0xFF);
+    report.ReportId = VHID_CONFIG_REPORT_ID;
+    report.Version = 1;
+    report.EnabledCollections = VHID_COLLECTION_KEYBOARD;
+    report.KeyboardCoalesce = VHID_COALESCE_QUEUE;
+    report.MouseCoalesce = VHID_COALESCE_LATEST;
+    report.QueueDepth = 4;
+
+    CHECK_EQ(ConfigDecode(&report, sizeof(report), &decoded), STATUS_SUCCESS);
+    CHECK_EQ(decoded.EnabledCollections, VHID_COLLECTION_KEYBOARD | VHID_COLLECTION_GAMEPAD);
+    CHECK_EQ(decoded.QueueDepth, 4);
+    CHECK_EQ(decoded.PacingInterval, 0);
+    CHECK_EQ(decoded.TypematicDelay, 0);
+}
+
+static void testInvalid(void) {
+    VHID_CONFIG_REPORT config, report, decoded;
+
+    ConfigInitDefault(&config);
+    ConfigEncode(&config, &report);
+
+    CHECK_EQ(ConfigDecode(&report, sizeof(report) - 1, &decoded), STATUS_INVALID_BUFFER_SIZE);
+
+    report.Version = VHID_CONFIG_VERSION + 1;
+    CHECK_EQ(ConfigDecode(&report, sizeof(report), &decoded), STATUS_REVISION_MISMATCH);
+
+    ConfigEncode(&config, &report);
+    report.QueueDepth = 0;
+    CHECK_EQ(ConfigDecode(&report, sizeof(report), &decoded), STATUS_INVALID_PARAMETER);
+
+    ConfigEncode(&config, &report);
+    report.QueueDepth = VHID_MAX_QUEUE_DEPTH + 1;
+    CHECK_EQ(ConfigDecode(&report, sizeof(report), &decoded), STATUS_INVALID_PARAMETER);
+
+    ConfigEncode(&config, &report);
+    report.PacingInterval = 50;
+    CHECK_EQ(ConfigDecode(&report, sizeof(report), &decoded), STATUS_INVALID_PARAMETER);
+
+    ConfigEncode(&config, &report);
+    report.TypematicDelay = 500;
+    report.TypematicRate = 0;
+    CHECK_EQ(ConfigDecode(&report, sizeof(report), &decoded), STATUS_INVALID_PARAMETER);
+
+    ConfigEncode(&config, &report);
+    report.Reserved[2] = 1;
+    CHECK_EQ(ConfigDecode(&report, sizeof(report), &decoded), STATUS_INVALID_PARAMETER);
+}
+
+void testConfig(void) {
+    testRoundTrip();
+    testOldVersion();
+    testInvalid();
+}
@@ -0,0 +1,89 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "hidreport.h"
+#include "descriptor.h"
+#include "layout.h"
+#include "vhidtest.h"
+
+typedef struct _EXPECTED_REPORT {
+    UCHAR ReportId;
+    UCHAR Type;
+    ULONG Size;
+} EXPECTED_REPORT;
+
+#define KEYBOARD_REPORTS \
+    { KEYBOARD_REPORT_ID, LAYOUT_INPUT, sizeof(HID_KEYBOARD_REPORT) }, \
+    { KEYBOARD_REPORT_ID, LAYOUT_OUTPUT, sizeof(HID_KEYBOARD_OUTPUT_REPORT) }
+#define NKRO_REPORTS \
+    { KEYBOARD_REPORT_ID, LAYOUT_INPUT, sizeof(HID_NKRO_REPORT) }, \
+    { KEYBOARD_REPORT_ID, LAYOUT_OUTPUT, sizeof(HID_KEYBOARD_OUTPUT_REPORT) }
+#define MOUSE_REPORTS \
+    { MOUSE_REPORT_ID, LAYOUT_INPUT, sizeof(HID_MOUSE_REPORT) }
+#define GAMEPAD_REPORTS \
+    { GAMEPAD_REPORT_ID, LAYOUT_INPUT, sizeof(HID_GAMEPAD_REPORT) }
+#define CONFIG_REPORTS \
+    { VHID_CONFIG_REPORT_ID, LAYOUT_FEATURE, sizeof(VHID_CONFIG_REPORT) }
+
+typedef struct _EXPECTED_PROFILE {
+    UCHAR Collections;
+    ULONG ReportCount;
+    EXPECTED_REPORT Reports[4];
+} EXPECTED_PROFILE;
+
+//
+// The reports each profile's descriptor must declare, sized as the
+// structures the driver fills in.
+//
+static const EXPECTED_PROFILE profiles[VHID_PROFILE_COUNT] = {
+    { VHID_COLLECTION_KEYBOARD | VHID_COLLECTION_MOUSE, 4, { KEYBOARD_REPORTS, MOUSE_REPORTS, CONFIG_REPORTS } },
+    { VHID_COLLECTION_KEYBOARD, 3, { KEYBOARD_REPORTS, CONFIG_REPORTS } },
+    { VHID_COLLECTION_MOUSE, 2, { MOUSE_REPORTS, CONFIG_REPORTS } },
+    { VHID_COLLECTION_KEYBOARD | VHID_COLLECTION_MOUSE, 4, { NKRO_REPORTS, MOUSE_REPORTS, CONFIG_REPORTS } },
+    { VHID_COLLECTION_GAMEPAD, 2, { CONFIG_REPORTS, GAMEPAD_REPORTS } },
+};
+
+static void testProfiles(void) {
+    UCHAR descriptor[DESCRIPTOR_MAX_SIZE];
+    static DESCRIPTOR_LAYOUT layout;
+    const LAYOUT_REPORT* report;
+    const EXPECTED_REPORT* expected;
+    ULONG profile, length, error, i;
+    UCHAR collections;
+
+    for (profile = 0; profile < VHID_PROFILE_COUNT; profile++) {
+        CHECK(DescriptorBuild(profile, descriptor, sizeof(descriptor), &length, &collections));
+        CHECK_EQ(collections, profiles[profile].Collections);
+
+        CHECK(LayoutParse(descriptor, length, &layout, &error));
+        CHECK_EQ(layout.ReportCount, profiles[profile].ReportCount);
+        for (i = 0; i < profiles[profile].ReportCount; i++) {
+            expected = &profiles[profile].Reports[i];
+            report = LayoutFindReport(&layout, expected->ReportId, expected->Type);
+            CHECK(report != NULL);
+            if (report != NULL)
+                CHECK_EQ(report->BitLength, 8 * expected->Size);
+        }
+    }
+}
+
+static void testFailures(void) {
+    UCHAR descriptor[DESCRIPTOR_MAX_SIZE];
+    ULONG length, needed;
+    UCHAR collections;
+
+    CHECK(!DescriptorBuild(VHID_PROFILE_COUNT, descriptor, sizeof(descriptor), &length, &collections));
+    CHECK_EQ(length, 0);
+
+    CHECK(DescriptorBuild(VHID_PROFILE_NKRO, descriptor, sizeof(descriptor), &needed, &collections));
+    CHECK(DescriptorBuild(VHID_PROFILE_NKRO, descriptor, needed, &length, &collections));
+    CHECK_EQ(length, needed);
+    CHECK(!DescriptorBuild(VHID_PROFILE_NKRO, descriptor, needed - 1, &length, &collections));
+    CHECK_EQ(length, 0);
+    CHECK_EQ(collections, 0);
+}
+
+void testDescriptor(void) {
+    testProfiles();
+    testFailures();
+}
@@ -0,0 +1,47 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "evtqueue.h"
+#include "vhidtest.h"
+
+static void testOrder(void) {
+    EVENT_QUEUE queue;
+    VHID_NOTIFY_EVENT events[4];
+    ULONG i;
+
+    EventQueueInit(&queue);
+    for (i = 0; i < 3; i++)
+        EventQueuePush(&queue, 1, i, 100 + i);
+
+    CHECK_EQ(EventQueuePop(&queue, events, 2), 2);
+    CHECK_EQ(events[0].Sequence, 1);
+    CHECK_EQ(events[0].Data, 0);
+    CHECK_EQ(events[1].Timestamp, 101);
+    CHECK_EQ(EventQueuePop(&queue, events, 4), 1);
+    CHECK_EQ(events[0].Sequence, 3);
+    CHECK_EQ(EventQueuePop(&queue, events, 4), 0);
+}
+
+static void testOverflow(void) {
+    EVENT_QUEUE queue;
+    VHID_NOTIFY_EVENT events[EVENT_QUEUE_DEPTH];
+    ULONG i;
+
+    //
+    // The two oldest events are lost and charged to the oldest survivor.
+    //
+    EventQueueInit(&queue);
+    for (i = 0; i < EVENT_QUEUE_DEPTH + 2; i++)
+        EventQueuePush(&queue, 1, i, 0);
+
+    CHECK_EQ(EventQueuePop(&queue, events, EVENT_QUEUE_DEPTH), EVENT_QUEUE_DEPTH);
+    CHECK_EQ(events[0].Sequence, 3);
+    CHECK_EQ(events[0].Dropped, 2);
+    CHECK_EQ(events[1].Dropped, 0);
+    CHECK_EQ(events[EVENT_QUEUE_DEPTH - 1].Sequence, EVENT_QUEUE_DEPTH + 2);
+}
+
+void testEventQueue(void) {
+    testOrder();
+    testOverflow();
+}
@@ -0,0 +1,77 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "hidreport.h"
+#include "vhidtest.h"
+
+static void testKeyboard(void) {
+    HID_KEYBOARD_REPORT report = { KEYBOARD_REPORT_ID };
+    UCHAR key;
+
+    KeyboardReportApplyKey(&report, 0xE1, TRUE);
+    CHECK_EQ(report.Modifiers, 0x02);
+    KeyboardReportApplyKey(&report, 4, TRUE);
+    KeyboardReportApplyKey(&report, 4, TRUE);
+    KeyboardReportApplyKey(&report, 5, TRUE);
+    CHECK_EQ(report.Keys[0], 4);
+    CHECK_EQ(report.Keys[1], 5);
+    CHECK_EQ(report.Keys[2], 0);
+
+    KeyboardReportApplyKey(&report, 4, FALSE);
+    CHECK_EQ(report.Keys[0], 0);
+    CHECK_EQ(report.Keys[1], 5);
+
+    //
+    // A seventh key is ignored.
+    //
+    for (key = 6; key < 12; key++)
+        KeyboardReportApplyKey(&report, key, TRUE);
+    for (key = 0; key < 6; key++)
+        CHECK(report.Keys[key] != 11);
+
+    KeyboardReportApplyKey(&report, 0xE1, FALSE);
+    CHECK_EQ(report.Modifiers, 0);
+}
+
+static void testNkro(void) {
+    HID_NKRO_REPORT report = { KEYBOARD_REPORT_ID };
+
+    NkroReportApplyKey(&report, 0x04, TRUE);
+    NkroReportApplyKey(&report, 0x0F, TRUE);
+    NkroReportApplyKey(&report, 0xE7, TRUE);
+    NkroReportApplyKey(&report, NKRO_KEY_COUNT, TRUE);
+    CHECK_EQ(report.Keys[0], 0x10);
+    CHECK_EQ(report.Keys[1], 0x80);
+    CHECK_EQ(report.Modifiers, 0x80);
+
+    NkroReportApplyKey(&report, 0x0F, FALSE);
+    CHECK_EQ(report.Keys[1], 0);
+}
+
+static void testMouseMerge(void) {
+    HID_MOUSE_REPORT pending = { MOUSE_REPORT_ID, 0, 100, -100 };
+    HID_MOUSE_REPORT report = { MOUSE_REPORT_ID, 0, 20, -20 };
+
+    //
+    // Deltas add up as long as they fit; a button change or an overflow
+    // has to be queued on its own.
+    //
+    CHECK(MouseReportMerge(&pending, &report, sizeof(report)));
+    CHECK_EQ(pending.X, 120);
+    CHECK_EQ(pending.Y, -120);
+    CHECK(!MouseReportMerge(&pending, &report, sizeof(report)));
+    CHECK_EQ(pending.X, 120);
+
+    report.X = report.Y = 0;
+    report.Buttons = 1;
+    CHECK(!MouseReportMerge(&pending, &report, sizeof(report)));
+}
+
+void testHidReport(void) {
+    CHECK_EQ(ReportCollection(KEYBOARD_REPORT_ID), VHID_COLLECTION_KEYBOARD);
+    CHECK_EQ(ReportCollection(GAMEPAD_REPORT_ID), VHID_COLLECTION_GAMEPAD);
+    CHECK_EQ(ReportCollection(VHID_CONFIG_REPORT_ID), 0);
+    testKeyboard();
+    testNkro();
+    testMouseMerge();
+}
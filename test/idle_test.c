@@ -0,0 +1,85 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "reportq.h"
+#include "idle.h"
+#include "vhidtest.h"
+
+#define MS                  10000ULL    // 100ns units
+
+static void testDuplicates(void) {
+    IDLE_FILTER filter;
+    UCHAR keyboard[] = { 1, 0, 0, 0x04, 0, 0, 0, 0, 0 };
+    UCHAR other[] = { 2, 1, 0, 0 };
+
+    IdleFilterInit(&filter);
+    CHECK(IdleFilterAccept(&filter, keyboard, sizeof(keyboard), FALSE, 0));
+    CHECK(!IdleFilterAccept(&filter, keyboard, sizeof(keyboard), FALSE, 0));
+    CHECK(IdleFilterAccept(&filter, keyboard, sizeof(keyboard), TRUE, 0));
+    CHECK_EQ(filter.Suppressed, 1);
+
+    //
+    // Each report id keeps its own last report.
+    //
+    CHECK(IdleFilterAccept(&filter, other, sizeof(other), FALSE, 0));
+    CHECK(!IdleFilterAccept(&filter, keyboard, sizeof(keyboard), FALSE, 0));
+    keyboard[3] = 0;
+    CHECK(IdleFilterAccept(&filter, keyboard, sizeof(keyboard), FALSE, 0));
+    CHECK(!IdleFilterAccept(&filter, other, sizeof(other), FALSE, 0));
+    CHECK_EQ(filter.Suppressed, 3);
+
+    //
+    // Ids past the table are never filtered.
+    //
+    other[0] = IDLE_MAX_REPORT_ID;
+    CHECK(IdleFilterAccept(&filter, other, sizeof(other), FALSE, 0));
+    CHECK(IdleFilterAccept(&filter, other, sizeof(other), FALSE, 0));
+}
+
+static void testRepeat(void) {
+    IDLE_FILTER filter;
+    REPORT_ENTRY report;
+    UCHAR keyboard[] = { 1, 0, 0, 0x04, 0, 0, 0, 0, 0 };
+
+    //
+    // A rate of 25 is 100ms between repeats; nothing repeats before the
+    // first report.
+    //
+    IdleFilterInit(&filter);
+    IdleFilterSetRate(&filter, 1, 25, 0);
+    CHECK_EQ(IdleFilterNextDeadline(&filter), 0);
+    CHECK(!IdleFilterTick(&filter, 200 * MS, 0, &report));
+
+    CHECK(IdleFilterAccept(&filter, keyboard, sizeof(keyboard), FALSE, 200 * MS));
+    CHECK_EQ(IdleFilterNextDeadline(&filter), 300 * MS);
+    CHECK(!IdleFilterTick(&filter, 300 * MS - 1, 0, &report));
+    CHECK(IdleFilterTick(&filter, 300 * MS, 0, &report));
+    CHECK_EQ(report.Length, sizeof(keyboard));
+    CHECK(RtlEqualMemory(report.Data, keyboard, sizeof(keyboard)));
+    CHECK(!IdleFilterTick(&filter, 300 * MS, 0, &report));
+    CHECK_EQ(IdleFilterNextDeadline(&filter), 400 * MS);
+
+    //
+    // A new report restarts the period, and so does a pending one, without
+    // a repeat.
+    //
+    keyboard[3] = 0x05;
+    CHECK(IdleFilterAccept(&filter, keyboard, sizeof(keyboard), FALSE, 350 * MS));
+    CHECK(!IdleFilterTick(&filter, 400 * MS, 0, &report));
+    CHECK(!IdleFilterTick(&filter, 450 * MS, REPORT_ID_MASK(1), &report));
+    CHECK_EQ(IdleFilterNextDeadline(&filter), 550 * MS);
+    CHECK(IdleFilterTick(&filter, 550 * MS, REPORT_ID_MASK(2), &report));
+    CHECK_EQ(report.Data[3], 0x05);
+
+    //
+    // A rate of 0 turns repeats off.
+    //
+    IdleFilterSetRate(&filter, 1, 0, 600 * MS);
+    CHECK_EQ(IdleFilterNextDeadline(&filter), 0);
+    CHECK(!IdleFilterTick(&filter, 10000 * MS, 0, &report));
+}
+
+void testIdle(void) {
+    testDuplicates();
+    testRepeat();
+}
@@ -0,0 +1,124 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "keymerge.h"
+#include "vhidtest.h"
+
+static void testSharedKey(void) {
+    KEY_MERGE merge;
+    KEY_OWNER a, b;
+
+    //
+    // A key is down while any client holds it; repeated transitions from
+    // the same client change nothing.
+    //
+    KeyMergeInit(&merge);
+    KeyOwnerInit(&a);
+    KeyOwnerInit(&b);
+
+    CHECK(KeyMergeApplyKey(&merge, &a, 0x04, TRUE));
+    CHECK(!KeyMergeApplyKey(&merge, &a, 0x04, TRUE));
+    CHECK(!KeyMergeApplyKey(&merge, &b, 0x04, TRUE));
+    CHECK_EQ(merge.KeyRefs[0x04], 2);
+
+    CHECK(!KeyMergeApplyKey(&merge, &a, 0x04, FALSE));
+    CHECK(!KeyMergeApplyKey(&merge, &a, 0x04, FALSE));
+    CHECK(KeyMergeApplyKey(&merge, &b, 0x04, FALSE));
+    CHECK_EQ(merge.KeyRefs[0x04], 0);
+
+    CHECK(!KeyMergeApplyKey(&merge, &b, 0x05, FALSE));
+    CHECK_EQ(merge.KeyRefs[0x05], 0);
+}
+
+static void testButtons(void) {
+    KEY_MERGE merge;
+    KEY_OWNER a, b;
+
+    KeyMergeInit(&merge);
+    KeyOwnerInit(&a);
+    KeyOwnerInit(&b);
+
+    CHECK(KeyMergeApplyButtons(&merge, &a, 0x01));
+    CHECK(KeyMergeApplyButtons(&merge, &b, 0x03));
+    CHECK_EQ(merge.Buttons, 0x03);
+    CHECK(!KeyMergeApplyButtons(&merge, &a, 0x00));
+    CHECK(KeyMergeApplyButtons(&merge, &b, 0x00));
+    CHECK_EQ(merge.Buttons, 0);
+
+    //
+    // Bits past KEY_MERGE_BUTTONS are ignored.
+    //
+    CHECK(!KeyMergeApplyButtons(&merge, &a, 0xF8));
+    CHECK_EQ(a.Buttons, 0);
+}
+
+static void testRetract(void) {
+    KEY_MERGE merge;
+    KEY_OWNER a, b;
+    UCHAR released[KEY_MERGE_USAGES];
+    BOOLEAN buttonsChanged;
+
+    //
+    // Only the keys no other client holds are reported released.
+    //
+    KeyMergeInit(&merge);
+    KeyOwnerInit(&a);
+    KeyOwnerInit(&b);
+    KeyMergeApplyKey(&merge, &a, 0x04, TRUE);
+    KeyMergeApplyKey(&merge, &a, 0x3F, TRUE);
+    KeyMergeApplyKey(&merge, &a, 0xE1, TRUE);
+    KeyMergeApplyKey(&merge, &b, 0x3F, TRUE);
+    KeyMergeApplyButtons(&merge, &a, 0x04);
+
+    CHECK_EQ(KeyMergeRetract(&merge, &a, released, &buttonsChanged), 2);
+    CHECK_EQ(released[0], 0x04);
+    CHECK_EQ(released[1], 0xE1);
+    CHECK(buttonsChanged);
+    CHECK_EQ(merge.KeyRefs[0x3F], 1);
+    CHECK_EQ(a.Keys[0] | a.Keys[1] | a.Keys[7], 0);
+
+    CHECK_EQ(KeyMergeRetract(&merge, &a, released, &buttonsChanged), 0);
+    CHECK(!buttonsChanged);
+}
+
+static void testHeldAndWithdraw(void) {
+    KEY_MERGE merge;
+    KEY_OWNER a, b;
+    ULONG held[KEY_MERGE_USAGES / 32];
+    ULONG withdraw[KEY_MERGE_USAGES / 32] = { 0 };
+
+    KeyMergeInit(&merge);
+    KeyOwnerInit(&a);
+    KeyOwnerInit(&b);
+    KeyMergeApplyKey(&merge, &a, 0x04, TRUE);
+    KeyMergeApplyKey(&merge, &b, 0x04, TRUE);
+    KeyMergeApplyKey(&merge, &b, 0xE0, TRUE);
+    KeyMergeApplyButtons(&merge, &a, 0x03);
+
+    KeyMergeHeld(&merge, held);
+    CHECK_EQ(held[0], 1u << 4);
+    CHECK_EQ(held[7], 1u << 0);
+
+    //
+    // Withdrawing a key from every client that holds it releases it;
+    // a key the client doesn't hold is left alone.
+    //
+    withdraw[0] = 1u << 4;
+    withdraw[7] = 1u << 0;
+    KeyMergeWithdraw(&merge, &a, withdraw, 0x01);
+    CHECK_EQ(merge.KeyRefs[0x04], 1);
+    CHECK_EQ(merge.KeyRefs[0xE0], 1);
+    CHECK_EQ(merge.Buttons, 0x02);
+    KeyMergeWithdraw(&merge, &b, withdraw, 0x01);
+
+    KeyMergeHeld(&merge, held);
+    CHECK_EQ(held[0], 0);
+    CHECK_EQ(held[7], 0);
+    CHECK(!KeyMergeApplyKey(&merge, &b, 0x04, FALSE));
+}
+
+void testKeyMerge(void) {
+    testSharedKey();
+    testButtons();
+    testRetract();
+    testHeldAndWithdraw();
+}
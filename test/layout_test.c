@@ -0,0 +1,162 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "hidreport.h"
+#include "descriptor.h"
+#include "layout.h"
+#include "gamepad.h"
+#include "vhidtest.h"
+
+//
+// A report whose fields straddle bytes: a 3 bit signed value, 5 bits of
+// padding, two 12 bit values and a 4 bit array.
+//
+static const UCHAR oddDescriptor[] = {
+    0x05, 0x01,         // Usage Page (Generic Desktop)
+    0x09, 0x00,         // Usage (Undefined)
+    0xA1, 0x01,         // Collection (Application)
+    0x85, 0x07,         //   Report ID (7)
+    0x09, 0x30,         //   Usage (X)
+    0x15, 0xFC,         //   Logical Min (-4)
+    0x25, 0x03,         //   Logical Max (3)
+    0x75, 0x03,         //   Report Size (3)
+    0x95, 0x01,         //   Report Count (1)
+    0x81, 0x02,         //   Input (Data, Variable, Absolute)
+    0x75, 0x05,         //   Report Size (5)
+    0x81, 0x01,         //   Input (Constant)
+    0x19, 0x31,         //   Usage Min (Y)
+    0x29, 0x32,         //   Usage Max (Z)
+    0x15, 0x00,         //   Logical Min (0)
+    0x26, 0xFF, 0x0F,   //   Logical Max (4095)
+    0x75, 0x0C,         //   Report Size (12)
+    0x95, 0x02,         //   Report Count (2)
+    0x81, 0x02,         //   Input (Data, Variable, Absolute)
+    0x05, 0x09,         //   Usage Page (Button)
+    0x19, 0x01,         //   Usage Min (1)
+    0x29, 0x0F,         //   Usage Max (15)
+    0x25, 0x0F,         //   Logical Max (15)
+    0x75, 0x04,         //   Report Size (4)
+    0x95, 0x01,         //   Report Count (1)
+    0x81, 0x00,         //   Input (Data, Array)
+    0xC0,               // End Collection
+};
+
+static void testFields(void) {
+    static DESCRIPTOR_LAYOUT layout;
+    const LAYOUT_REPORT* report;
+    const LAYOUT_FIELD* x;
+    const LAYOUT_FIELD* z;
+    const LAYOUT_FIELD* buttons;
+    UCHAR data[6] = { 7 };
+    ULONG error, index;
+
+    CHECK(LayoutParse(oddDescriptor, sizeof(oddDescriptor), &layout, &error));
+    report = LayoutFindReport(&layout, 7, LAYOUT_INPUT);
+    CHECK(report != NULL);
+    if (report == NULL)
+        return;
+    CHECK_EQ(report->BitLength, 8 + 3 + 5 + 24 + 4);
+    CHECK_EQ(report->FieldCount, 3);
+    CHECK(LayoutFindReport(&layout, 7, LAYOUT_OUTPUT) == NULL);
+
+    x = LayoutFindField(&layout, report, 0x01, 0x30, &index);
+    CHECK(x != NULL && index == 0 && (x->Flags & FIELD_SIGNED));
+    z = LayoutFindField(&layout, report, 0x01, 0x32, &index);
+    CHECK(z != NULL && index == 1 && z->BitOffset == 16);
+    buttons = LayoutFindField(&layout, report, 0x09, 0x05, &index);
+    CHECK(buttons != NULL && index == 0 && !(buttons->Flags & FIELD_VARIABLE));
+    CHECK(LayoutFindField(&layout, report, 0x01, 0x35, &index) == NULL);
+    if (x == NULL || z == NULL || buttons == NULL)
+        return;
+
+    //
+    // Values are clamped to the logical range and read back sign extended;
+    // neighbouring bits are left alone.
+    //
+    FieldPack(data, x, 0, -9);
+    FieldPack(data, z, 0, 0xABC);
+    FieldPack(data, z, 1, 0x123);
+    FieldPack(data, buttons, 0, 9);
+    CHECK_EQ(data[0], 7);
+    CHECK_EQ(FieldUnpack(data, x, 0), -4);
+    CHECK_EQ(FieldUnpack(data, z, 0), 0xABC);
+    CHECK_EQ(FieldUnpack(data, z, 1), 0x123);
+    CHECK_EQ(FieldUnpack(data, buttons, 0), 9);
+    CHECK_EQ(data[2], 0xBC);
+    CHECK_EQ(data[3], 0x3A);
+    CHECK_EQ(data[4], 0x12);
+    CHECK_EQ(data[5], 0x09);
+
+    FieldPack(data, x, 0, 3);
+    FieldPack(data, x, 1, 1);
+    CHECK_EQ(FieldUnpack(data, x, 0), 3);
+    CHECK_EQ(FieldUnpack(data, z, 0), 0xABC);
+}
+
+static void testRejected(void) {
+    static DESCRIPTOR_LAYOUT layout;
+    UCHAR descriptor[sizeof(oddDescriptor)];
+    ULONG error;
+
+    //
+    // Cut inside an item, an unclosed collection, and an extra End
+    // Collection.
+    //
+    CHECK(!LayoutParse(oddDescriptor, 25, &layout, &error));
+    CHECK(!LayoutParse(oddDescriptor, sizeof(oddDescriptor) - 1, &layout, &error));
+    RtlCopyMemory(descriptor, oddDescriptor, sizeof(descriptor));
+    descriptor[4] = 0xC0;
+    CHECK(!LayoutParse(descriptor, sizeof(descriptor), &layout, &error));
+}
+
+static void testGamepad(void) {
+    static DESCRIPTOR_LAYOUT layout;
+    UCHAR descriptor[DESCRIPTOR_MAX_SIZE];
+    GAMEPAD_LAYOUT gamepad;
+    HID_GAMEPAD_REPORT report = { GAMEPAD_REPORT_ID };
+    VHID_GAMEPAD_STATE state = { 0x8005, -128, 127, 0, -1 };
+    VHID_GAMEPAD_STATE back;
+    ULONG length, error;
+    UCHAR collections;
+
+    //
+    // Packed through the descriptor, the report matches HID_GAMEPAD_REPORT,
+    // with X clamped to the logical minimum of -127.
+    //
+    CHECK(DescriptorBuild(VHID_PROFILE_GAMEPAD, descriptor, sizeof(descriptor), &length, &collections));
+    CHECK(LayoutParse(descriptor, length, &layout, &error));
+    CHECK(GamepadLayoutInit(&gamepad, &layout, GAMEPAD_REPORT_ID));
+
+    GamepadPack(&gamepad, &state, (PUCHAR)&report);
+    CHECK_EQ(report.ReportId, GAMEPAD_REPORT_ID);
+    CHECK_EQ(report.Buttons, 0x8005);
+    CHECK_EQ(report.X, -127);
+    CHECK_EQ(report.Y, 127);
+    CHECK_EQ(report.Z, 0);
+    CHECK_EQ(report.Rz, -1);
+
+    GamepadUnpack(&gamepad, (const UCHAR*)&report, &back);
+    CHECK_EQ(back.Buttons, 0x8005);
+    CHECK_EQ(back.X, -127);
+    CHECK_EQ(back.Rz, -1);
+
+    state.Buttons = 0x0002;
+    GamepadPack(&gamepad, &state, (PUCHAR)&report);
+    CHECK_EQ(report.Buttons, 0x0002);
+
+    //
+    // A descriptor without the gamepad binds nothing, and packs nothing.
+    //
+    CHECK(DescriptorBuild(VHID_PROFILE_KEYBOARD_MOUSE, descriptor, sizeof(descriptor), &length, &collections));
+    CHECK(LayoutParse(descriptor, length, &layout, &error));
+    CHECK(!GamepadLayoutInit(&gamepad, &layout, GAMEPAD_REPORT_ID));
+    GamepadPack(&gamepad, &state, (PUCHAR)&report);
+    CHECK_EQ(report.Buttons, 0x0002);
+    CHECK_EQ(report.X, -127);
+}
+
+void testLayout(void) {
+    testFields();
+    testRejected();
+    testGamepad();
+}
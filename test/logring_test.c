@@ -0,0 +1,60 @@
+#include <windows.h>
+#include <stdarg.h>
+#include "logring.h"
+#include "vhidtest.h"
+
+static LOG_RING ring;
+
+static void writeLog(ULONG level, PCSTR format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    LogRingWrite(&ring, level, format, args);
+    va_end(args);
+}
+
+static void testWrite(void) {
+    static const char format[] = "Report %u type %u is %u bits, expected %u (%p)\n";
+    PLOG_RECORD record;
+    int marker;
+
+    //
+    // Only the first LOG_MAX_ARGS arguments are kept, and "%%" consumes
+    // none.
+    //
+    writeLog(2, "100%% of 0x%x\n", 0xC0000001);
+    writeLog(3, format, 1, 8, 72, 64, &marker);
+
+    record = &ring.Records[1];
+    CHECK_EQ(record->Sequence, 1);
+    CHECK_EQ(record->Level, 2);
+    CHECK_EQ((ULONG)record->Args[0], 0xC0000001);
+
+    record = &ring.Records[2];
+    CHECK_EQ(record->Sequence, 2);
+    CHECK(record->Format == format);
+    CHECK_EQ((ULONG)record->Args[0], 1);
+    CHECK_EQ((ULONG)record->Args[3], 64);
+}
+
+static void testFormatValid(void) {
+    CHECK(LogFormatValid("ReadReport\n"));
+    CHECK(LogFormatValid("100%% done\n"));
+    CHECK(LogFormatValid("WdfIoQueueCreate failed 0x%x\n"));
+    CHECK(LogFormatValid("%u %d %-8lu %08X\n"));
+    CHECK(LogFormatValid("%p %Iu %I32x\n"));
+    CHECK(LogFormatValid("%hu %c\n"));
+
+    CHECK(!LogFormatValid("name %s\n"));
+    CHECK(!LogFormatValid("name %wZ\n"));
+    CHECK(!LogFormatValid("time %llu\n"));
+    CHECK(!LogFormatValid("time %I64x\n"));
+    CHECK(!LogFormatValid("width %*u\n"));
+    CHECK(!LogFormatValid("%u %u %u %u %u\n"));
+    CHECK(!LogFormatValid("trailing %"));
+}
+
+void testLogRing(void) {
+    testWrite();
+    testFormatValid();
+}
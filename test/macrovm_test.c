@@ -0,0 +1,203 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "macrovm.h"
+#include "vhidtest.h"
+
+#define MS                  10000ULL    // 100ns units
+
+//
+// Host recording what a program emits, with device state set by the test.
+//
+typedef struct _RECORDER {
+    ULONG               Count;
+    VHID_BATCH_EVENT    Events[512];
+    ULONG               Leds;
+    UCHAR               HeldKey;
+    BOOLEAN             Drained;
+} RECORDER;
+
+static VOID recordEmit(PVOID context, const VHID_BATCH_EVENT* event) {
+    RECORDER* r = (RECORDER*)context;
+
+    if (r->Count < ARRAYSIZE(r->Events))
+        r->Events[r->Count] = *event;
+    r->Count++;
+}
+
+static ULONG recordQuery(PVOID context, ULONG query, UCHAR arg) {
+    RECORDER* r = (RECORDER*)context;
+
+    switch (query) {
+    case MACRO_QUERY_LEDS:
+        return r->Leds;
+    case MACRO_QUERY_KEY:
+        return arg == r->HeldKey;
+    case MACRO_QUERY_DRAINED:
+        return r->Drained;
+    }
+    return 0;
+}
+
+static BOOLEAN verify(const UCHAR* code, size_t length, ULONG expectedError) {
+    ULONG error;
+    BOOLEAN ok = MacroVerify(code, length, &error);
+
+    CHECK_EQ(error, expectedError);
+    return ok;
+}
+
+static void testVerify(void) {
+    static const UCHAR good[] = { VHID_OP_LOOP, 2, VHID_OP_IF_KEY, 4, 1, 3, VHID_OP_KEY, 5, 1, VHID_OP_END_LOOP };
+    static const UCHAR opcode[] = { VHID_OP_KEY, 4, 1, 0x0B };
+    static const UCHAR truncated[] = { VHID_OP_KEY, 4, 1, VHID_OP_WAIT, 1 };
+    static const UCHAR zeroLoop[] = { VHID_OP_LOOP, 0, VHID_OP_END_LOOP };
+    static const UCHAR unopened[] = { VHID_OP_KEY, 4, 1, VHID_OP_END_LOOP };
+    static const UCHAR unclosed[] = { VHID_OP_LOOP, 2, VHID_OP_KEY, 4, 1 };
+    static const UCHAR deep[] = { VHID_OP_LOOP, 1, VHID_OP_LOOP, 1, VHID_OP_LOOP, 1, VHID_OP_LOOP, 1, VHID_OP_LOOP, 1 };
+    static const UCHAR outOfLoop[] = { VHID_OP_LOOP, 2, VHID_OP_SKIP, 1, VHID_OP_END_LOOP, VHID_OP_END };
+    static const UCHAR midInstruction[] = { VHID_OP_SKIP, 1, VHID_OP_KEY, 4, 1 };
+    static const UCHAR steps[] = { VHID_OP_LOOP, 255, VHID_OP_LOOP, 255, VHID_OP_KEY, 4, 1, VHID_OP_END_LOOP, VHID_OP_END_LOOP };
+    static const UCHAR waits[] = { VHID_OP_LOOP, 20, VHID_OP_WAIT, 0x60, 0xEA, VHID_OP_END_LOOP };
+    UCHAR large[VHID_MACRO_MAX_CODE + 1] = { 0 };
+    ULONG error;
+
+    CHECK(verify(good, sizeof(good), 0));
+    CHECK(!MacroVerify(good, 0, &error));
+    CHECK(!MacroVerify(large, sizeof(large), &error));
+    CHECK(MacroVerify(large, VHID_MACRO_MAX_CODE, &error));
+
+    CHECK(!verify(opcode, sizeof(opcode), 3));
+    CHECK(!verify(truncated, sizeof(truncated), 3));
+    CHECK(!verify(zeroLoop, sizeof(zeroLoop), 0));
+    CHECK(!verify(unopened, sizeof(unopened), 3));
+    CHECK(!verify(unclosed, sizeof(unclosed), sizeof(unclosed)));
+    CHECK(!verify(deep, sizeof(deep), 8));
+    CHECK(!verify(outOfLoop, sizeof(outOfLoop), 2));
+    CHECK(!verify(midInstruction, sizeof(midInstruction), 0));
+
+    //
+    // 255 * 255 key presses exceed VHID_MACRO_MAX_STEPS; 20 waits of 60 s
+    // exceed VHID_MACRO_MAX_WAIT_MS.
+    //
+    CHECK(!verify(steps, sizeof(steps), 7));
+    CHECK(!verify(waits, sizeof(waits), 2));
+}
+
+static void testWait(void) {
+    static const UCHAR code[] = { VHID_OP_KEY, 4, 1, VHID_OP_WAIT, 10, 0, VHID_OP_KEY, 4, 0 };
+    RECORDER r = { 0 };
+    MACRO_HOST host = { recordEmit, recordQuery, &r };
+    MACRO_VM vm;
+
+    MacroVmInit(&vm, code, sizeof(code));
+    CHECK(!MacroVmRun(&vm, &host, 0));
+    CHECK_EQ(r.Count, 1);
+    CHECK_EQ(r.Events[0].Type, VHID_BATCH_KEY);
+    CHECK_EQ(r.Events[0].Data[0], 4);
+    CHECK_EQ(r.Events[0].Data[1], 1);
+    CHECK_EQ(MacroVmNextDeadline(&vm, 0), 10 * MS);
+
+    CHECK(!MacroVmRun(&vm, &host, 10 * MS - 1));
+    CHECK_EQ(r.Count, 1);
+    CHECK(MacroVmRun(&vm, &host, 10 * MS));
+    CHECK_EQ(r.Count, 2);
+    CHECK_EQ(r.Events[1].Data[1], 0);
+    CHECK_EQ(vm.Steps, 3);
+}
+
+static void testLoopAndSlices(void) {
+    static const UCHAR code[] = { VHID_OP_LOOP, 100, VHID_OP_MOVE, 1, 0xFF, VHID_OP_BUTTON, 1, VHID_OP_END_LOOP };
+    RECORDER r = { 0 };
+    MACRO_HOST host = { recordEmit, recordQuery, &r };
+    MACRO_VM vm;
+    ULONG runs = 0;
+    ULONGLONG now = 0;
+
+    //
+    // 301 steps run in slices of MACRO_STEPS_PER_RUN, each resuming after
+    // MACRO_YIELD.
+    //
+    MacroVmInit(&vm, code, sizeof(code));
+    while (!MacroVmRun(&vm, &host, now)) {
+        CHECK_EQ(MacroVmNextDeadline(&vm, now), now + MACRO_YIELD);
+        now = MacroVmNextDeadline(&vm, now);
+        runs++;
+    }
+    CHECK_EQ(runs, 301 / MACRO_STEPS_PER_RUN);
+    CHECK_EQ(vm.Steps, 301);
+    CHECK_EQ(r.Count, 200);
+    CHECK_EQ(r.Events[198].Type, VHID_BATCH_MOVE);
+    CHECK_EQ((CHAR)r.Events[198].Data[1], -1);
+    CHECK_EQ(r.Events[199].Type, VHID_BATCH_BUTTON);
+}
+
+static void testBranches(void) {
+    //
+    // Toggle Caps Lock unless it is on, then press A unless B is held.
+    //
+    static const UCHAR code[] = {
+        VHID_OP_IF_LED, 0x02, 0x00, 6, VHID_OP_KEY, 0x39, 1, VHID_OP_KEY, 0x39, 0,
+        VHID_OP_IF_KEY, 0x05, 1, 2, VHID_OP_SKIP, 3, VHID_OP_KEY, 0x04, 1,
+    };
+    RECORDER r = { 0 };
+    MACRO_HOST host = { recordEmit, recordQuery, &r };
+    MACRO_VM vm;
+    ULONG error;
+
+    CHECK(MacroVerify(code, sizeof(code), &error));
+
+    MacroVmInit(&vm, code, sizeof(code));
+    CHECK(MacroVmRun(&vm, &host, 0));
+    CHECK_EQ(r.Count, 3);
+    CHECK_EQ(r.Events[0].Data[0], 0x39);
+    CHECK_EQ(r.Events[2].Data[0], 0x04);
+
+    r.Count = 0;
+    r.Leds = 0x02;
+    MacroVmInit(&vm, code, sizeof(code));
+    CHECK(MacroVmRun(&vm, &host, 0));
+    CHECK_EQ(r.Count, 1);
+    CHECK_EQ(r.Events[0].Data[0], 0x04);
+
+    r.Count = 0;
+    r.HeldKey = 0x05;
+    MacroVmInit(&vm, code, sizeof(code));
+    CHECK(MacroVmRun(&vm, &host, 0));
+    CHECK_EQ(r.Count, 0);
+}
+
+static void testWaitDrain(void) {
+    static const UCHAR code[] = { VHID_OP_WAIT_DRAIN, 100, 0, VHID_OP_KEY, 4, 1 };
+    RECORDER r = { 0 };
+    MACRO_HOST host = { recordEmit, recordQuery, &r };
+    MACRO_VM vm;
+
+    //
+    // Polled every MACRO_DRAIN_POLL until drained or timed out.
+    //
+    MacroVmInit(&vm, code, sizeof(code));
+    CHECK(!MacroVmRun(&vm, &host, 0));
+    CHECK_EQ(MacroVmNextDeadline(&vm, 0), MACRO_DRAIN_POLL);
+    CHECK(!MacroVmRun(&vm, &host, MACRO_DRAIN_POLL));
+    CHECK_EQ(r.Count, 0);
+
+    r.Drained = TRUE;
+    CHECK(MacroVmRun(&vm, &host, 2 * MACRO_DRAIN_POLL));
+    CHECK_EQ(r.Count, 1);
+
+    r.Count = 0;
+    r.Drained = FALSE;
+    MacroVmInit(&vm, code, sizeof(code));
+    CHECK(!MacroVmRun(&vm, &host, 0));
+    CHECK(MacroVmRun(&vm, &host, 100 * MS));
+    CHECK_EQ(r.Count, 1);
+}
+
+void testMacroVm(void) {
+    testVerify();
+    testWait();
+    testLoopAndSlices();
+    testBranches();
+    testWaitDrain();
+}
@@ -0,0 +1,84 @@
+#include <windows.h>
+#include <winioctl.h>
+#include <stdio.h>
+#include <string.h>
+#include "vhidtest.h"
+
+//
+// Runs the tests named on the command line, or all of them.
+//
+
+typedef struct _TEST {
+    const char* Name;
+    void        (*Run)(void);
+} TEST;
+
+static const TEST tests[] = {
+    { "evtqueue",   testEventQueue },
+    { "config",     testConfig },
+    { "reportq",    testReportQueue },
+    { "pacer",      testPacer },
+    { "hidreport",  testHidReport },
+    { "typematic",  testTypematic },
+    { "textcomp",   testTextCompiler },
+    { "trace",      testTrace },
+    { "logring",    testLogRing },
+    { "keymerge",   testKeyMerge },
+    { "slab",       testSlab },
+    { "macrovm",    testMacroVm },
+    { "stream",     testStream },
+    { "idle",       testIdle },
+    { "chord",      testChord },
+    { "receipt",    testReceipt },
+    { "descriptor", testDescriptor },
+    { "layout",     testLayout },
+    { "snapshot",   testSnapshot },
+};
+
+static ULONG failures;
+
+void testFail(const char* file, int line, const char* expr) {
+    printf("%s(%d): CHECK(%s) failed\n", file, line, expr);
+    failures++;
+}
+
+void testCheckEq(const char* file, int line, const char* expr, LONGLONG a, LONGLONG b) {
+    if (a == b)
+        return;
+    printf("%s(%d): CHECK(%s) failed: %lld != %lld\n", file, line, expr, a, b);
+    failures++;
+}
+
+static BOOLEAN selected(const char* name, int argc, char* argv[]) {
+    int i;
+
+    if (argc < 2)
+        return TRUE;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+int main(int argc, char* argv[]) {
+    ULONG i, before, run = 0, failed = 0;
+
+    for (i = 0; i < ARRAYSIZE(tests); i++) {
+        if (!selected(tests[i].Name, argc, argv))
+            continue;
+        before = failures;
+        tests[i].Run();
+        run++;
+        if (failures != before)
+            failed++;
+        printf("%-12s %s\n", tests[i].Name, failures != before ? "FAILED" : "ok");
+    }
+
+    if (run == 0) {
+        printf("usage: vhidtest [module ...]\n");
+        return 2;
+    }
+    printf("%u of %u modules passed\n", run - failed, run);
+    return failed != 0;
+}
@@ -0,0 +1,53 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "reportq.h"
+#include "pacer.h"
+#include "vhidtest.h"
+
+#define MS                  10000ULL    // 100ns units
+
+static void testDisabled(void) {
+    PACER pacer;
+
+    PacerInit(&pacer, 0);
+    PacerRelease(&pacer, 1, 0);
+    CHECK_EQ(PacerReadyMask(&pacer, 0), REPORT_ID_ANY);
+    CHECK_EQ(PacerNextDeadline(&pacer, REPORT_ID_MASK(1)), 0);
+}
+
+static void testInterval(void) {
+    PACER pacer;
+
+    PacerInit(&pacer, 1000);
+    PacerRelease(&pacer, 1, 0);
+    CHECK(!(PacerReadyMask(&pacer, MS / 2) & REPORT_ID_MASK(1)));
+    CHECK(PacerReadyMask(&pacer, MS / 2) & REPORT_ID_MASK(2));
+    CHECK_EQ(PacerNextDeadline(&pacer, REPORT_ID_MASK(1)), MS);
+    CHECK(PacerReadyMask(&pacer, MS) & REPORT_ID_MASK(1));
+
+    //
+    // Ids past PACER_MAX_REPORT_ID are never held back.
+    //
+    CHECK_EQ(PacerNextDeadline(&pacer, REPORT_ID_MASK(1) | REPORT_ID_MASK(PACER_MAX_REPORT_ID)), 0);
+}
+
+static void testGrid(void) {
+    PACER pacer;
+
+    //
+    // A late release keeps the grid; after an idle interval it restarts.
+    //
+    PacerInit(&pacer, 1000);
+    PacerRelease(&pacer, 1, 0);
+    PacerRelease(&pacer, 1, MS + MS / 2);
+    CHECK_EQ(PacerNextDeadline(&pacer, REPORT_ID_MASK(1)), 2 * MS);
+    PacerRelease(&pacer, 1, 5 * MS + 3);
+    CHECK_EQ(PacerNextDeadline(&pacer, REPORT_ID_MASK(1)), 6 * MS + 3);
+}
+
+void testPacer(void) {
+    testDisabled();
+    testInterval();
+    testGrid();
+}
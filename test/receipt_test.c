@@ -0,0 +1,168 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "receipt.h"
+#include "vhidtest.h"
+
+static BOOLEAN readOne(PRECEIPT_RING ring, ULONG sequence, PVHID_RECEIPT receipt) {
+    return ReceiptRingRead(ring, sequence, receipt, 1) == 1 && receipt->Sequence == sequence;
+}
+
+static void testFates(void) {
+    static RECEIPT_RING ring;
+    VHID_RECEIPT receipt;
+    ULONG none, delivered, merged, dropped;
+
+    ReceiptRingInit(&ring);
+
+    //
+    // A request that queued nothing completes when it closes.
+    //
+    none = ReceiptOpen(&ring, 10);
+    CHECK_EQ(none, 1);
+    CHECK(readOne(&ring, none, &receipt));
+    CHECK_EQ(receipt.Status, VHID_RECEIPT_PENDING);
+    ReceiptClose(&ring, none, 11);
+    CHECK(readOne(&ring, none, &receipt));
+    CHECK_EQ(receipt.Status, VHID_RECEIPT_NONE);
+    CHECK_EQ(receipt.Submitted, 10);
+    CHECK_EQ(receipt.Completed, 11);
+
+    //
+    // Pending until closed and every report has met its fate; Completed is
+    // the last delivery.
+    //
+    delivered = ReceiptOpen(&ring, 20);
+    ReceiptQueued(&ring, delivered);
+    ReceiptQueued(&ring, delivered);
+    ReceiptResolve(&ring, delivered, RECEIPT_DELIVERED, 21);
+    ReceiptClose(&ring, delivered, 22);
+    CHECK(readOne(&ring, delivered, &receipt));
+    CHECK_EQ(receipt.Status, VHID_RECEIPT_PENDING);
+    CHECK_EQ(receipt.Completed, 0);
+    ReceiptResolve(&ring, delivered, RECEIPT_DELIVERED, 23);
+    CHECK(readOne(&ring, delivered, &receipt));
+    CHECK_EQ(receipt.Status, VHID_RECEIPT_DELIVERED);
+    CHECK_EQ(receipt.Completed, 23);
+
+    //
+    // The worst fate wins, and a later merge doesn't move Completed past
+    // the last delivery.
+    //
+    merged = ReceiptOpen(&ring, 30);
+    ReceiptQueued(&ring, merged);
+    ReceiptQueued(&ring, merged);
+    ReceiptClose(&ring, merged, 30);
+    ReceiptResolve(&ring, merged, RECEIPT_DELIVERED, 31);
+    ReceiptResolve(&ring, merged, RECEIPT_MERGED, 32);
+    CHECK(readOne(&ring, merged, &receipt));
+    CHECK_EQ(receipt.Status, VHID_RECEIPT_MERGED);
+    CHECK_EQ(receipt.Completed, 31);
+
+    dropped = ReceiptOpen(&ring, 40);
+    ReceiptQueued(&ring, dropped);
+    ReceiptQueued(&ring, dropped);
+    ReceiptClose(&ring, dropped, 40);
+    ReceiptResolve(&ring, dropped, RECEIPT_MERGED, 41);
+    ReceiptResolve(&ring, dropped, RECEIPT_DROPPED, 42);
+    CHECK(readOne(&ring, dropped, &receipt));
+    CHECK_EQ(receipt.Status, VHID_RECEIPT_DROPPED);
+    CHECK_EQ(receipt.Completed, 42);
+
+    //
+    // Extra fates and unknown sequences are ignored.
+    //
+    ReceiptResolve(&ring, dropped, RECEIPT_DELIVERED, 50);
+    ReceiptResolve(&ring, 0, RECEIPT_DELIVERED, 50);
+    ReceiptQueued(&ring, 99);
+    CHECK(readOne(&ring, dropped, &receipt));
+    CHECK_EQ(receipt.Completed, 42);
+    CHECK_EQ(ReceiptRingRead(&ring, 0, &receipt, 1), 1);
+    CHECK_EQ(receipt.Sequence, none);
+}
+
+static void testOverwrite(void) {
+    static RECEIPT_RING ring;
+    static VHID_RECEIPT receipts[RECEIPT_RING_SIZE + 1];
+    ULONG first, sequence, i;
+
+    //
+    // Only the last RECEIPT_RING_SIZE requests are kept; a read from a
+    // forgotten sequence starts at the oldest kept one, and what still
+    // happens to a forgotten request doesn't touch its slot's new owner.
+    //
+    ReceiptRingInit(&ring);
+    first = ReceiptOpen(&ring, 0);
+    ReceiptQueued(&ring, first);
+    for (i = 1; i <= RECEIPT_RING_SIZE; i++) {
+        sequence = ReceiptOpen(&ring, i);
+        ReceiptClose(&ring, sequence, i);
+    }
+    ReceiptResolve(&ring, first, RECEIPT_DROPPED, 1000);
+
+    CHECK_EQ(ReceiptRingRead(&ring, first, receipts, ARRAYSIZE(receipts)), RECEIPT_RING_SIZE);
+    CHECK_EQ(receipts[0].Sequence, first + 1);
+    CHECK_EQ(receipts[RECEIPT_RING_SIZE - 1].Sequence, sequence);
+    CHECK_EQ(receipts[RECEIPT_RING_SIZE - 1].Status, VHID_RECEIPT_NONE);
+    CHECK_EQ(receipts[RECEIPT_RING_SIZE - 1].Completed, RECEIPT_RING_SIZE);
+
+    CHECK_EQ(ReceiptRingRead(&ring, sequence - 1, receipts, 8), 2);
+    CHECK_EQ(ReceiptRingRead(&ring, sequence + 1, receipts, 8), 0);
+
+    //
+    // Sequence numbers skip 0 when they wrap.
+    //
+    ring.Last = 0xFFFFFFFF;
+    CHECK_EQ(ReceiptOpen(&ring, 0), 1);
+}
+
+static void testWrap(void) {
+    static RECEIPT_RING ring;
+    static VHID_RECEIPT receipts[RECEIPT_RING_SIZE];
+    ULONG sequence, count, i;
+
+    //
+    // 200 requests from 0xFFFFFF81 on, across the wrap: a reader carries on
+    // from a cursor before the wrap, and the oldest receipts are still
+    // there for a read from 0.
+    //
+    ReceiptRingInit(&ring);
+    ring.Last = 0xFFFFFF80;
+    for (i = 0; i < 200; i++) {
+        sequence = ReceiptOpen(&ring, i);
+        ReceiptClose(&ring, sequence, i);
+    }
+    CHECK_EQ(sequence, 200 - 127);
+
+    count = ReceiptRingRead(&ring, 0xFFFFFFF0, receipts, ARRAYSIZE(receipts));
+    CHECK_EQ(count, 16 + sequence);
+    CHECK_EQ(receipts[15].Sequence, 0xFFFFFFFF);
+    CHECK_EQ(receipts[16].Sequence, 1);
+    CHECK_EQ(receipts[count - 1].Sequence, sequence);
+
+    count = ReceiptRingRead(&ring, 0, receipts, ARRAYSIZE(receipts));
+    CHECK_EQ(count, 200);
+    CHECK_EQ(receipts[0].Sequence, 0xFFFFFF81);
+    CHECK_EQ(receipts[0].Submitted, 0);
+
+    CHECK_EQ(ReceiptRingRead(&ring, 1, receipts, 4), 4);
+    CHECK_EQ(receipts[0].Sequence, 1);
+    CHECK_EQ(ReceiptRingRead(&ring, sequence + 1, receipts, 4), 0);
+
+    //
+    // Past a ring's worth more, a stale cursor starts at the oldest kept.
+    //
+    for (i = 0; i < RECEIPT_RING_SIZE; i++) {
+        sequence = ReceiptOpen(&ring, i);
+        ReceiptClose(&ring, sequence, i);
+    }
+    count = ReceiptRingRead(&ring, 0xFFFFFFF0, receipts, ARRAYSIZE(receipts));
+    CHECK_EQ(count, RECEIPT_RING_SIZE);
+    CHECK_EQ(receipts[0].Sequence, sequence - RECEIPT_RING_SIZE + 1);
+}
+
+void testReceipt(void) {
+    testFates();
+    testOverwrite();
+    testWrap();
+}
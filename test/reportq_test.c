@@ -0,0 +1,162 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "hidreport.h"
+#include "reportq.h"
+#include "vhidtest.h"
+
+static ULONG pushKey(PREPORT_QUEUE queue, UCHAR key, UCHAR coalesce, ULONG sequence, UCHAR flags, PULONG displaced) {
+    HID_KEYBOARD_REPORT report = { KEYBOARD_REPORT_ID };
+
+    report.Keys[0] = key;
+    return ReportQueuePush(queue, &report, sizeof(report), coalesce, NULL, sequence, flags, displaced);
+}
+
+static ULONG pushMove(PREPORT_QUEUE queue, CHAR x, UCHAR coalesce, ULONG sequence, UCHAR flags, PULONG displaced) {
+    HID_MOUSE_REPORT report = { MOUSE_REPORT_ID };
+
+    report.X = x;
+    return ReportQueuePush(queue, &report, sizeof(report), coalesce, MouseReportMerge, sequence, flags, displaced);
+}
+
+static void testQueuePolicy(void) {
+    REPORT_QUEUE queue;
+    REPORT_ENTRY entry;
+    ULONG displaced;
+
+    ReportQueueInit(&queue, 8);
+    CHECK_EQ(pushKey(&queue, 4, VHID_COALESCE_QUEUE, 1, 0, &displaced), REPORT_PUSH_QUEUED);
+    CHECK_EQ(pushKey(&queue, 5, VHID_COALESCE_QUEUE, 2, 0, &displaced), REPORT_PUSH_QUEUED);
+    CHECK_EQ(queue.Count, 2);
+
+    CHECK(ReportQueuePop(&queue, REPORT_ID_ANY, &entry));
+    CHECK_EQ(entry.Sequence, 1);
+    CHECK_EQ(((PHID_KEYBOARD_REPORT)entry.Data)->Keys[0], 4);
+    CHECK(ReportQueuePop(&queue, REPORT_ID_ANY, &entry));
+    CHECK_EQ(entry.Sequence, 2);
+    CHECK(!ReportQueuePop(&queue, REPORT_ID_ANY, &entry));
+}
+
+static void testLatestPolicy(void) {
+    REPORT_QUEUE queue;
+    REPORT_ENTRY entry;
+    ULONG displaced;
+
+    //
+    // Relative motion is summed, and the merged report answers for the
+    // newer request.
+    //
+    ReportQueueInit(&queue, 8);
+    CHECK_EQ(pushMove(&queue, 3, VHID_COALESCE_LATEST, 1, 0, &displaced), REPORT_PUSH_QUEUED);
+    CHECK_EQ(pushMove(&queue, 4, VHID_COALESCE_LATEST, 2, 0, &displaced), REPORT_PUSH_MERGED);
+    CHECK_EQ(displaced, 1);
+    CHECK_EQ(queue.Merged, 1);
+
+    CHECK(ReportQueuePop(&queue, REPORT_ID_ANY, &entry));
+    CHECK_EQ(entry.Sequence, 2);
+    CHECK_EQ(((PHID_MOUSE_REPORT)entry.Data)->X, 7);
+}
+
+static void testFull(void) {
+    REPORT_QUEUE queue;
+    REPORT_ENTRY entry;
+    ULONG displaced;
+
+    //
+    // A full queue merges into a pending report of the same id, and only
+    // evicts the oldest report when there is none.
+    //
+    ReportQueueInit(&queue, 2);
+    pushKey(&queue, 4, VHID_COALESCE_QUEUE, 1, 0, &displaced);
+    pushKey(&queue, 5, VHID_COALESCE_QUEUE, 2, 0, &displaced);
+    CHECK_EQ(pushKey(&queue, 6, VHID_COALESCE_QUEUE, 3, 0, &displaced), REPORT_PUSH_MERGED);
+    CHECK_EQ(displaced, 2);
+    CHECK_EQ(queue.Count, 2);
+
+    CHECK_EQ(pushMove(&queue, 1, VHID_COALESCE_QUEUE, 4, 0, &displaced), REPORT_PUSH_EVICTED);
+    CHECK_EQ(displaced, 1);
+    CHECK_EQ(queue.Dropped, 1);
+    CHECK_EQ(queue.Count, 2);
+
+    CHECK(ReportQueuePop(&queue, REPORT_ID_ANY, &entry));
+    CHECK_EQ(entry.Sequence, 3);
+    CHECK_EQ(((PHID_KEYBOARD_REPORT)entry.Data)->Keys[0], 6);
+}
+
+static void testPerCollectionPop(void) {
+    REPORT_QUEUE queue;
+    REPORT_ENTRY entry;
+    ULONG displaced;
+
+    ReportQueueInit(&queue, 8);
+    pushKey(&queue, 4, VHID_COALESCE_QUEUE, 1, 0, &displaced);
+    pushMove(&queue, 1, VHID_COALESCE_QUEUE, 2, 0, &displaced);
+    pushKey(&queue, 5, VHID_COALESCE_QUEUE, 3, 0, &displaced);
+
+    CHECK_EQ(ReportQueuePendingMask(&queue), REPORT_ID_MASK(KEYBOARD_REPORT_ID) | REPORT_ID_MASK(MOUSE_REPORT_ID));
+    CHECK(ReportQueuePop(&queue, REPORT_ID_MASK(MOUSE_REPORT_ID), &entry));
+    CHECK_EQ(entry.Sequence, 2);
+    CHECK(!ReportQueuePop(&queue, REPORT_ID_MASK(MOUSE_REPORT_ID), &entry));
+    CHECK(ReportQueuePop(&queue, REPORT_ID_MASK(KEYBOARD_REPORT_ID), &entry));
+    CHECK_EQ(entry.Sequence, 1);
+}
+
+static void testOrdered(void) {
+    REPORT_QUEUE queue;
+    REPORT_ENTRY entry;
+    ULONG displaced;
+
+    //
+    // Nothing queued behind a chord report overtakes it, and chord reports
+    // are never merged.
+    //
+    ReportQueueInit(&queue, 8);
+    pushKey(&queue, 4, VHID_COALESCE_QUEUE, 1, REPORT_ORDERED, &displaced);
+    CHECK_EQ(pushMove(&queue, 1, VHID_COALESCE_LATEST, 2, REPORT_ORDERED, &displaced), REPORT_PUSH_QUEUED);
+    CHECK_EQ(pushMove(&queue, 2, VHID_COALESCE_LATEST, 3, 0, &displaced), REPORT_PUSH_QUEUED);
+
+    CHECK_EQ(ReportQueueEligibleMask(&queue), REPORT_ID_MASK(KEYBOARD_REPORT_ID));
+    CHECK(!ReportQueuePop(&queue, REPORT_ID_MASK(MOUSE_REPORT_ID), &entry));
+    CHECK(ReportQueuePop(&queue, REPORT_ID_MASK(KEYBOARD_REPORT_ID), &entry));
+    CHECK(ReportQueuePop(&queue, REPORT_ID_MASK(MOUSE_REPORT_ID), &entry));
+    CHECK_EQ(entry.Sequence, 2);
+    CHECK(ReportQueuePop(&queue, REPORT_ID_MASK(MOUSE_REPORT_ID), &entry));
+    CHECK_EQ(entry.Sequence, 3);
+}
+
+static void testShrink(void) {
+    REPORT_QUEUE queue;
+    REPORT_ENTRY entry;
+    ULONG displaced, i;
+
+    //
+    // Shrinking below the pending reports leaves them for ReportQueueTrim,
+    // which evicts the oldest; there is no room until then.
+    //
+    ReportQueueInit(&queue, 8);
+    for (i = 1; i <= 5; i++)
+        pushKey(&queue, (UCHAR)(3 + i), VHID_COALESCE_QUEUE, i, 0, &displaced);
+    CHECK_EQ(ReportQueueRoom(&queue), 3);
+    CHECK(!ReportQueueTrim(&queue, &displaced));
+
+    ReportQueueSetLimit(&queue, 2);
+    CHECK_EQ(ReportQueueRoom(&queue), 0);
+    for (i = 1; ReportQueueTrim(&queue, &displaced); i++)
+        CHECK_EQ(displaced, i);
+    CHECK_EQ(i, 4);
+    CHECK_EQ(queue.Count, 2);
+    CHECK_EQ(queue.Dropped, 3);
+
+    CHECK(ReportQueuePop(&queue, REPORT_ID_ANY, &entry));
+    CHECK_EQ(entry.Sequence, 4);
+    CHECK_EQ(ReportQueueRoom(&queue), 1);
+}
+
+void testReportQueue(void) {
+    testQueuePolicy();
+    testLatestPolicy();
+    testFull();
+    testPerCollectionPop();
+    testOrdered();
+    testShrink();
+}
@@ -0,0 +1,7 @@
+#ifndef __SHIM_INITGUID_H_
+#define __SHIM_INITGUID_H_
+
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    static const GUID name = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+#endif // __SHIM_INITGUID_H_
@@ -0,0 +1,215 @@
+#ifndef __SHIM_WINDOWS_H_
+#define __SHIM_WINDOWS_H_
+
+//
+// The part of <windows.h> the portable driver modules use, so they can be
+// built and tested on a host without the Windows SDK. Only on the include
+// path when the host is not Windows; see ../Makefile.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef void                VOID, *PVOID;
+typedef char                CHAR, *PCHAR;
+typedef unsigned char       UCHAR, *PUCHAR, BYTE, *PBYTE, BOOLEAN, *PBOOLEAN;
+typedef short               SHORT, *PSHORT;
+typedef unsigned short      USHORT, *PUSHORT, WORD;
+typedef int                 INT, BOOL;
+typedef int32_t             LONG, *PLONG;
+typedef uint32_t            ULONG, *PULONG, DWORD;
+typedef long long           LONGLONG, *PLONGLONG, LONG64;
+typedef unsigned long long  ULONGLONG, *PULONGLONG, ULONG64;
+typedef intptr_t            LONG_PTR;
+typedef uintptr_t           ULONG_PTR, SIZE_T;
+typedef LONG                NTSTATUS;
+typedef const char*         PCSTR;
+typedef void*               HANDLE;
+
+typedef struct _GUID {
+    ULONG                   Data1;
+    USHORT                  Data2;
+    USHORT                  Data3;
+    UCHAR                   Data4[8];
+} GUID;
+
+#define TRUE                1
+#define FALSE               0
+
+//
+// Annotations
+//
+#define _In_
+#define _In_opt_
+#define _In_z_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _In_reads_(n)
+#define _In_reads_bytes_(n)
+#define _In_reads_bytes_opt_(n)
+#define _Out_writes_(n)
+#define _Out_writes_bytes_(n)
+#define _Out_writes_to_(n, c)
+#define _Out_writes_bytes_to_(n, c)
+#define _Inout_updates_(n)
+#define _Inout_updates_bytes_(n)
+#define _Success_(e)
+#define _Must_inspect_result_
+
+#define FORCEINLINE         static inline
+#define UNREFERENCED_PARAMETER(p)   ((void)(p))
+#define C_ASSERT(e)         typedef char __C_ASSERT__[(e) ? 1 : -1]
+
+#define RtlZeroMemory(d, n)         memset((d), 0, (n))
+#define RtlFillMemory(d, n, v)      memset((d), (v), (n))
+#define RtlCopyMemory(d, s, n)      memcpy((d), (s), (n))
+#define RtlMoveMemory(d, s, n)      memmove((d), (s), (n))
+#define RtlEqualMemory(a, b, n)     (memcmp((a), (b), (n)) == 0)
+
+#define ARRAYSIZE(a)        (sizeof(a) / sizeof((a)[0]))
+#define RTL_NUMBER_OF(a)    ARRAYSIZE(a)
+#define FIELD_OFFSET(t, f)  ((LONG)offsetof(t, f))
+#define CONTAINING_RECORD(a, t, f)  ((t*)((PCHAR)(a) - offsetof(t, f)))
+
+#ifndef min
+#define min(a, b)           (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)           (((a) > (b)) ? (a) : (b))
+#endif
+
+//
+// Interlocked operations, on the GCC/Clang builtins
+//
+#define InterlockedIncrement(p)     __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p)     __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define MemoryBarrier()             __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+FORCEINLINE
+LONG
+InterlockedCompareExchange(
+    _Inout_ volatile LONG*  Destination,
+    _In_  LONG              Exchange,
+    _In_  LONG              Comparand
+    )
+{
+    __atomic_compare_exchange_n(Destination, &Comparand, Exchange, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comparand;
+}
+
+//
+// Interlocked singly-linked lists. A spinlock per list head stands in for
+// the double-width compare-exchange of the real ones: same semantics,
+// different contention profile.
+//
+#define MEMORY_ALLOCATION_ALIGNMENT 16
+
+typedef struct _SLIST_ENTRY {
+    struct _SLIST_ENTRY*    Next;
+} SLIST_ENTRY, *PSLIST_ENTRY;
+
+typedef struct _SLIST_HEADER {
+    PSLIST_ENTRY            First;
+    volatile LONG           Lock;
+} __attribute__((aligned(16))) SLIST_HEADER, *PSLIST_HEADER;
+
+FORCEINLINE
+VOID
+InitializeSListHead(
+    _Out_ PSLIST_HEADER     Head
+    )
+{
+    Head->First = NULL;
+    Head->Lock = 0;
+}
+
+FORCEINLINE
+PSLIST_ENTRY
+InterlockedPushEntrySList(
+    _Inout_ PSLIST_HEADER   Head,
+    _Inout_ PSLIST_ENTRY    Entry
+    )
+{
+    PSLIST_ENTRY            first;
+
+    while (__atomic_exchange_n(&Head->Lock, 1, __ATOMIC_ACQUIRE) != 0)
+        ;
+    first = Head->First;
+    Entry->Next = first;
+    Head->First = Entry;
+    __atomic_store_n(&Head->Lock, 0, __ATOMIC_RELEASE);
+    return first;
+}
+
+FORCEINLINE
+PSLIST_ENTRY
+InterlockedPopEntrySList(
+    _Inout_ PSLIST_HEADER   Head
+    )
+{
+    PSLIST_ENTRY            first;
+
+    while (__atomic_exchange_n(&Head->Lock, 1, __ATOMIC_ACQUIRE) != 0)
+        ;
+    first = Head->First;
+    if (first != NULL)
+        Head->First = first->Next;
+    __atomic_store_n(&Head->Lock, 0, __ATOMIC_RELEASE);
+    return first;
+}
+
+int sched_getcpu(void);
+
+FORCEINLINE
+DWORD
+GetCurrentProcessorNumber(
+    VOID
+    )
+{
+    int                     cpu = sched_getcpu();
+
+    return cpu < 0 ? 0 : (DWORD)cpu;
+}
+
+FORCEINLINE
+BOOLEAN
+BitScanForward(
+    _Out_ PULONG            Index,
+    _In_  ULONG             Mask
+    )
+{
+    if (Mask == 0)
+        return FALSE;
+    *Index = (ULONG)__builtin_ctz(Mask);
+    return TRUE;
+}
+
+//
+// Status codes, as <ntstatus.h> defines them
+//
+#define NT_SUCCESS(s)                   ((NTSTATUS)(s) >= 0)
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                  ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING                  ((NTSTATUS)0x00000103L)
+#define STATUS_DEVICE_BUSY              ((NTSTATUS)0x80000011L)
+#define STATUS_NO_MORE_ENTRIES          ((NTSTATUS)0x8000001AL)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INVALID_DEVICE_REQUEST   ((NTSTATUS)0xC0000010L)
+#define STATUS_MORE_PROCESSING_REQUIRED ((NTSTATUS)0xC0000016L)
+#define STATUS_ILLEGAL_INSTRUCTION      ((NTSTATUS)0xC000001DL)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define STATUS_DATA_ERROR               ((NTSTATUS)0xC000003EL)
+#define STATUS_QUOTA_EXCEEDED           ((NTSTATUS)0xC0000044L)
+#define STATUS_REVISION_MISMATCH        ((NTSTATUS)0xC0000059L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_DEVICE_NOT_READY         ((NTSTATUS)0xC00000A3L)
+#define STATUS_NOT_SUPPORTED            ((NTSTATUS)0xC00000BBL)
+#define STATUS_CANCELLED                ((NTSTATUS)0xC0000120L)
+#define STATUS_INVALID_DEVICE_STATE     ((NTSTATUS)0xC0000184L)
+#define STATUS_INVALID_BUFFER_SIZE      ((NTSTATUS)0xC0000206L)
+#define STATUS_NO_MATCH                 ((NTSTATUS)0xC0000272L)
+
+#endif // __SHIM_WINDOWS_H_
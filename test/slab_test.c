@@ -0,0 +1,114 @@
+#include <windows.h>
+#include <pthread.h>
+#include "slab.h"
+#include "vhidtest.h"
+
+#define OBJECT_SIZE         40
+#define OBJECT_COUNT        64
+
+static SLIST_ENTRY memory[OBJECT_COUNT * SLAB_STRIDE(OBJECT_SIZE) / sizeof(SLIST_ENTRY)]
+    __attribute__((aligned(MEMORY_ALLOCATION_ALIGNMENT)));
+
+static void testExhaust(void) {
+    SLAB slab;
+    PVOID objects[OBJECT_COUNT];
+    ULONG i;
+
+    //
+    // Every object is handed out once, aligned and inside the block, and
+    // the slab fails cleanly when empty.
+    //
+    SlabInit(&slab, memory, sizeof(memory), OBJECT_SIZE);
+    CHECK_EQ(slab.Stride, 48);
+    CHECK_EQ(slab.Count, OBJECT_COUNT);
+
+    for (i = 0; i < OBJECT_COUNT; i++) {
+        objects[i] = SlabAlloc(&slab);
+        CHECK(objects[i] != NULL);
+        CHECK_EQ(((PUCHAR)objects[i] - (PUCHAR)memory) % slab.Stride, 0);
+        CHECK((PUCHAR)objects[i] < (PUCHAR)memory + sizeof(memory));
+        memset(objects[i], 0xA5, OBJECT_SIZE);
+    }
+    CHECK(SlabAlloc(&slab) == NULL);
+    CHECK_EQ(slab.Failures, 1);
+    CHECK_EQ(slab.InUse, OBJECT_COUNT);
+    CHECK_EQ(slab.Peak, OBJECT_COUNT);
+
+    for (i = 0; i < OBJECT_COUNT; i++)
+        SlabFree(&slab, objects[i]);
+    CHECK_EQ(slab.InUse, 0);
+    CHECK_EQ(slab.Peak, OBJECT_COUNT);
+    CHECK(SlabAlloc(&slab) != NULL);
+}
+
+//
+// Threads churn through the slab, each holding a few objects at a time and
+// stamping them with its id; an object handed out twice shows up as a
+// stamp changed under its owner.
+//
+#define CHURN_THREADS       4
+#define CHURN_WINDOW        8
+#define CHURN_ROUNDS        200000
+
+C_ASSERT(CHURN_THREADS * CHURN_WINDOW <= OBJECT_COUNT);
+
+typedef struct _CHURN {
+    PSLAB   Slab;
+    ULONG   Id;
+    ULONG   Corrupted;
+    ULONG   Failures;
+} CHURN;
+
+static void* churnThread(void* parameter) {
+    CHURN* c = (CHURN*)parameter;
+    PULONG live[CHURN_WINDOW] = { NULL };
+    ULONG seed = c->Id, slot, i;
+
+    for (i = 0; i < CHURN_ROUNDS; i++) {
+        seed = seed * 1103515245 + 12345;
+        slot = (seed >> 16) % CHURN_WINDOW;
+        if (live[slot] != NULL) {
+            if (live[slot][1] != c->Id)
+                c->Corrupted++;
+            SlabFree(c->Slab, live[slot]);
+        }
+        live[slot] = (PULONG)SlabAlloc(c->Slab);
+        if (live[slot] == NULL)
+            c->Failures++;
+        else
+            live[slot][1] = c->Id;
+    }
+    for (slot = 0; slot < CHURN_WINDOW; slot++) {
+        if (live[slot] != NULL)
+            SlabFree(c->Slab, live[slot]);
+    }
+    return NULL;
+}
+
+static void testChurn(void) {
+    SLAB slab;
+    CHURN churn[CHURN_THREADS];
+    pthread_t threads[CHURN_THREADS];
+    ULONG i;
+
+    SlabInit(&slab, memory, sizeof(memory), OBJECT_SIZE);
+    for (i = 0; i < CHURN_THREADS; i++) {
+        churn[i].Slab = &slab;
+        churn[i].Id = i + 1;
+        churn[i].Corrupted = 0;
+        churn[i].Failures = 0;
+        pthread_create(&threads[i], NULL, churnThread, &churn[i]);
+    }
+    for (i = 0; i < CHURN_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK_EQ(churn[i].Corrupted, 0);
+        CHECK_EQ(churn[i].Failures, 0);
+    }
+    CHECK_EQ(slab.InUse, 0);
+    CHECK(slab.Peak <= CHURN_THREADS * CHURN_WINDOW);
+}
+
+void testSlab(void) {
+    testExhaust();
+    testChurn();
+}
@@ -0,0 +1,102 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "snapshot.h"
+#include "vhidtest.h"
+
+static void setKey(PVHID_SNAPSHOT snapshot, UCHAR usage) {
+    snapshot->Keys[usage / 32] |= 1UL << (usage % 32);
+}
+
+static void testDiff(void) {
+    VHID_SNAPSHOT from = { { 0 } };
+    VHID_SNAPSHOT to = { { 0 } };
+    SNAPSHOT_DIFF diff;
+    UCHAR key;
+
+    //
+    // Shift and A held, restored to A and Z held with the left button: one
+    // release and one press of a key, and one button press.
+    //
+    setKey(&from, 0xE1);
+    setKey(&from, 0x04);
+    setKey(&to, 0x04);
+    setKey(&to, 0x1D);
+    to.Buttons = 0x01;
+    from.OwnButtons = 0x04;
+
+    SnapshotDiff(&from, &to, VHID_COLLECTION_ALL, &diff);
+    CHECK_EQ(diff.Transitions, 3);
+    CHECK_EQ(diff.Collections, VHID_COLLECTION_KEYBOARD | VHID_COLLECTION_MOUSE);
+    CHECK_EQ(diff.ButtonsPressed, 0x01);
+    CHECK_EQ(diff.ButtonsReleased, 0);
+    CHECK(!diff.GamepadChanged);
+
+    CHECK(SnapshotNextKey(diff.Released, &key));
+    CHECK_EQ(key, 0xE1);
+    CHECK(!SnapshotNextKey(diff.Released, &key));
+    CHECK(SnapshotNextKey(diff.Pressed, &key));
+    CHECK_EQ(key, 0x1D);
+    CHECK(!SnapshotNextKey(diff.Pressed, &key));
+
+    //
+    // Collections left out are not compared, and neither are buttons past
+    // the third.
+    //
+    SnapshotDiff(&from, &to, VHID_COLLECTION_MOUSE, &diff);
+    CHECK_EQ(diff.Transitions, 1);
+    CHECK_EQ(diff.Collections, VHID_COLLECTION_MOUSE);
+    CHECK_EQ(diff.Pressed[0], 0);
+
+    from.Buttons = 0xF8;
+    to.Buttons = 0;
+    SnapshotDiff(&from, &to, VHID_COLLECTION_MOUSE, &diff);
+    CHECK_EQ(diff.Collections, 0);
+    CHECK_EQ(diff.Transitions, 0);
+}
+
+static void testGamepad(void) {
+    VHID_SNAPSHOT from = { { 0 } };
+    VHID_SNAPSHOT to = { { 0 } };
+    SNAPSHOT_DIFF diff;
+
+    //
+    // Any change of the absolute gamepad state takes one report, and is not
+    // counted as a transition.
+    //
+    to.Gamepad.Rz = -1;
+    SnapshotDiff(&from, &to, VHID_COLLECTION_ALL, &diff);
+    CHECK(diff.GamepadChanged);
+    CHECK_EQ(diff.Collections, VHID_COLLECTION_GAMEPAD);
+    CHECK_EQ(diff.Transitions, 0);
+
+    SnapshotDiff(&from, &to, VHID_COLLECTION_KEYBOARD | VHID_COLLECTION_MOUSE, &diff);
+    CHECK(!diff.GamepadChanged);
+    CHECK_EQ(diff.Collections, 0);
+
+    SnapshotDiff(&to, &to, VHID_COLLECTION_ALL, &diff);
+    CHECK(!diff.GamepadChanged);
+}
+
+static void testNextKey(void) {
+    ULONG keys[VHID_SNAPSHOT_KEY_WORDS] = { 0 };
+    UCHAR key;
+    ULONG usage, count = 0;
+
+    //
+    // Every usage comes out once, lowest first.
+    //
+    for (usage = 0; usage < 256; usage++)
+        keys[usage / 32] |= 1UL << (usage % 32);
+    while (SnapshotNextKey(keys, &key)) {
+        CHECK_EQ(key, count);
+        count++;
+    }
+    CHECK_EQ(count, 256);
+}
+
+void testSnapshot(void) {
+    testDiff();
+    testGamepad();
+    testNextKey();
+}
@@ -0,0 +1,126 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "stream.h"
+#include "vhidtest.h"
+
+static const UCHAR payload[] = {
+    VHID_BATCH_KEY, 0x04, 1,
+    VHID_BATCH_MOVE, 0x05, 0xFB,
+    VHID_BATCH_BUTTON, 0x01,
+    VHID_BATCH_KEY, 0x04, 0,
+    VHID_BATCH_BUTTON, 0x00,
+    VHID_BATCH_MOVE, 0x80, 0x7F,
+};
+
+#define PAYLOAD_EVENTS      6
+
+static void checkEvents(const VHID_BATCH_EVENT* events) {
+    CHECK_EQ(events[0].Type, VHID_BATCH_KEY);
+    CHECK_EQ(events[0].Data[0], 0x04);
+    CHECK_EQ(events[0].Data[1], 1);
+    CHECK_EQ(events[1].Type, VHID_BATCH_MOVE);
+    CHECK_EQ(events[1].Data[1], 0xFB);
+    CHECK_EQ(events[2].Type, VHID_BATCH_BUTTON);
+    CHECK_EQ(events[2].Data[0], 0x01);
+    CHECK_EQ(events[2].Data[1], 0);
+    CHECK_EQ(events[3].Data[1], 0);
+    CHECK_EQ(events[4].Type, VHID_BATCH_BUTTON);
+    CHECK_EQ(events[5].Data[0], 0x80);
+    CHECK_EQ(events[5].Data[1], 0x7F);
+}
+
+//
+// Every chunk size, so that records are cut at every offset, including
+// chunks smaller than a record.
+//
+static void testChunks(void) {
+    VHID_BATCH_EVENT events[PAYLOAD_EVENTS];
+    STREAM_PARSER parser;
+    size_t chunk, offset, length, used;
+    ULONG count;
+
+    for (chunk = 1; chunk <= sizeof(payload); chunk++) {
+        StreamParserInit(&parser);
+        count = 0;
+        for (offset = 0; offset < sizeof(payload); offset += used) {
+            length = min(chunk, sizeof(payload) - offset);
+            count += StreamParserFeed(&parser, payload + offset, length, &used,
+                events + count, PAYLOAD_EVENTS - count);
+            CHECK_EQ(used, length);
+        }
+        CHECK_EQ(count, PAYLOAD_EVENTS);
+        CHECK_EQ(parser.Consumed, sizeof(payload));
+        CHECK_EQ(parser.PartialLength, 0);
+        CHECK(!parser.Invalid);
+        checkEvents(events);
+    }
+}
+
+//
+// A full Events stops parsing at a record boundary, and the caller resumes
+// where it stopped, with the same parser.
+//
+static void testMaxEvents(void) {
+    VHID_BATCH_EVENT events[PAYLOAD_EVENTS];
+    STREAM_PARSER parser;
+    size_t offset = 0, used;
+    ULONG count = 0, produced;
+
+    StreamParserInit(&parser);
+    CHECK_EQ(StreamParserFeed(&parser, payload, sizeof(payload), &used, events, 0), 0);
+    CHECK_EQ(used, 0);
+
+    while (offset < sizeof(payload)) {
+        produced = StreamParserFeed(&parser, payload + offset, sizeof(payload) - offset, &used, events + count, 1);
+        CHECK_EQ(produced, 1);
+        count += produced;
+        offset += used;
+        CHECK_EQ(parser.Consumed, offset);
+    }
+    CHECK_EQ(count, PAYLOAD_EVENTS);
+    checkEvents(events);
+
+    //
+    // The record completing a partial one isn't taken without room for it.
+    //
+    StreamParserInit(&parser);
+    CHECK_EQ(StreamParserFeed(&parser, payload, 2, &used, events, 1), 0);
+    CHECK_EQ(parser.PartialLength, 2);
+    CHECK_EQ(StreamParserFeed(&parser, payload + 2, 1, &used, events, 0), 0);
+    CHECK_EQ(used, 0);
+    CHECK_EQ(StreamParserFeed(&parser, payload + 2, 1, &used, events, 1), 1);
+    CHECK_EQ(used, 1);
+    CHECK_EQ(parser.Consumed, 3);
+}
+
+static void testInvalid(void) {
+    static const UCHAR bad[] = { VHID_BATCH_KEY, 0x04, 1, 0x7F, 0x00, VHID_BATCH_BUTTON, 1 };
+    VHID_BATCH_EVENT events[4];
+    STREAM_PARSER parser;
+    size_t used;
+
+    StreamParserInit(&parser);
+    CHECK_EQ(StreamParserFeed(&parser, bad, sizeof(bad), &used, events, 4), 1);
+    CHECK(parser.Invalid);
+    CHECK_EQ(parser.Consumed, 3);
+    CHECK_EQ(used, 3);
+    CHECK_EQ(StreamParserFeed(&parser, bad + used, sizeof(bad) - used, &used, events, 4), 0);
+
+    //
+    // A payload ending inside a record leaves it held, which is how a whole
+    // payload is known to be truncated.
+    //
+    StreamParserInit(&parser);
+    CHECK_EQ(StreamParserFeed(&parser, payload, 5, &used, events, 4), 1);
+    CHECK_EQ(used, 5);
+    CHECK_EQ(parser.Consumed, 3);
+    CHECK_EQ(parser.PartialLength, 2);
+    CHECK(!parser.Invalid);
+}
+
+void testStream(void) {
+    testChunks();
+    testMaxEvents();
+    testInvalid();
+}
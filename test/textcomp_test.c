@@ -0,0 +1,101 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "textcomp.h"
+#include "vhidtest.h"
+
+#define MAX_EVENTS          64
+
+typedef struct _EXPECT {
+    UCHAR KeyCode;
+    UCHAR Pressed;
+} EXPECT;
+
+//
+// Compiles text in one go and checks the events, including the release of
+// the modifiers left held.
+//
+static void checkText(ULONG layout, const char* text, const EXPECT* expect, ULONG count) {
+    TEXT_COMPILER compiler;
+    VHID_KEY_EVENT events[MAX_EVENTS];
+    size_t length = strlen(text), consumed;
+    ULONG n, i;
+
+    CHECK_EQ(TextCompilerInit(&compiler, layout), STATUS_SUCCESS);
+    n = TextCompilerFeed(&compiler, (const UCHAR*)text, length, &consumed, events, MAX_EVENTS);
+    CHECK_EQ(consumed, length);
+    n += TextCompilerFinish(&compiler, events + n, MAX_EVENTS - n);
+
+    CHECK_EQ(n, count);
+    for (i = 0; i < n && i < count; i++) {
+        CHECK_EQ(events[i].KeyCode, expect[i].KeyCode);
+        CHECK_EQ(events[i].Pressed, expect[i].Pressed);
+    }
+}
+
+static void testModifiers(void) {
+    static const EXPECT mixed[] = {
+        { 0xE1, 1 }, { 0x04, 1 }, { 0x04, 0 }, { 0xE1, 0 }, { 0x05, 1 }, { 0x05, 0 },
+        { 0x28, 1 }, { 0x28, 0 },
+    };
+    static const EXPECT capitals[] = {
+        { 0xE1, 1 }, { 0x04, 1 }, { 0x04, 0 }, { 0x05, 1 }, { 0x05, 0 }, { 0xE1, 0 },
+    };
+
+    //
+    // CRLF types a single Enter; a run of capitals holds Shift once.
+    //
+    checkText(VHID_LAYOUT_US, "Ab\r\n", mixed, ARRAYSIZE(mixed));
+    checkText(VHID_LAYOUT_US, "AB", capitals, ARRAYSIZE(capitals));
+}
+
+static void testLayouts(void) {
+    static const EXPECT eAcute[] = { { 0x1F, 1 }, { 0x1F, 0 } };
+    static const EXPECT grave[] = {
+        { 0xE6, 1 }, { 0x24, 1 }, { 0x24, 0 }, { 0x2C, 1 }, { 0x2C, 0 }, { 0xE6, 0 },
+    };
+    static const EXPECT a[] = { { 0x14, 1 }, { 0x14, 0 } };
+
+    checkText(VHID_LAYOUT_FR, "\xC3\xA9", eAcute, ARRAYSIZE(eAcute));
+    checkText(VHID_LAYOUT_FR, "`", grave, ARRAYSIZE(grave));
+    checkText(VHID_LAYOUT_FR, "a", a, ARRAYSIZE(a));
+}
+
+static void testUnmapped(void) {
+    TEXT_COMPILER compiler;
+    VHID_KEY_EVENT events[MAX_EVENTS];
+    size_t consumed;
+
+    CHECK_EQ(TextCompilerInit(&compiler, VHID_LAYOUT_US), STATUS_SUCCESS);
+    CHECK_EQ(TextCompilerFeed(&compiler, (const UCHAR*)"\xC3\xA9", 2, &consumed, events, MAX_EVENTS), 0);
+    CHECK_EQ(consumed, 2);
+    CHECK_EQ(compiler.Unmapped, 1);
+
+    CHECK(!NT_SUCCESS(TextCompilerInit(&compiler, VHID_LAYOUT_DE + 1)));
+}
+
+static void testPartial(void) {
+    TEXT_COMPILER compiler;
+    VHID_KEY_EVENT events[MAX_EVENTS];
+    size_t consumed;
+
+    //
+    // Only whole characters are consumed: not a cut UTF-8 sequence, and not
+    // a character whose worst case doesn't fit in the events left.
+    //
+    TextCompilerInit(&compiler, VHID_LAYOUT_FR);
+    CHECK_EQ(TextCompilerFeed(&compiler, (const UCHAR*)"a\xC3\xA9", 2, &consumed, events, MAX_EVENTS), 2);
+    CHECK_EQ(consumed, 1);
+
+    CHECK_EQ(TextCompilerFeed(&compiler, (const UCHAR*)"ab", 2, &consumed, events, TEXT_MAX_EVENTS_PER_CHAR + 1), 2);
+    CHECK_EQ(consumed, 1);
+    CHECK_EQ(TextCompilerFeed(&compiler, (const UCHAR*)"ab", 2, &consumed, events, TEXT_MAX_EVENTS_PER_CHAR - 1), 0);
+    CHECK_EQ(consumed, 0);
+}
+
+void testTextCompiler(void) {
+    testModifiers();
+    testLayouts();
+    testUnmapped();
+    testPartial();
+}
@@ -0,0 +1,52 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "vhidmini_ioctl.h"
+#include "trace.h"
+#include "vhidtest.h"
+
+static TRACE_RING ring;
+static VHID_TRACE_RECORD records[TRACE_RING_SIZE];
+
+static void testRead(void) {
+    UCHAR data[VHID_TRACE_DATA_SIZE + 4] = { 1, 2, 3 };
+
+    TraceRingInit(&ring);
+    TraceWrite(&ring, VHID_TRACE_REPORT_QUEUED, data, 3, 10);
+    TraceWrite(&ring, VHID_TRACE_REPORT_EVICTED, NULL, 0, 20);
+    TraceWrite(&ring, VHID_TRACE_CONFIG, data, sizeof(data), 30);
+
+    CHECK_EQ(TraceRingRead(&ring, 0, records, TRACE_RING_SIZE), 3);
+    CHECK_EQ(records[0].Sequence, 1);
+    CHECK_EQ(records[0].Length, 3);
+    CHECK_EQ(records[0].Data[2], 3);
+    CHECK_EQ(records[1].Type, VHID_TRACE_REPORT_EVICTED);
+    CHECK_EQ(records[1].Timestamp, 20);
+    CHECK_EQ(records[2].Length, VHID_TRACE_DATA_SIZE);
+
+    CHECK_EQ(TraceRingRead(&ring, 3, records, TRACE_RING_SIZE), 1);
+    CHECK_EQ(records[0].Sequence, 3);
+    CHECK_EQ(TraceRingRead(&ring, 4, records, TRACE_RING_SIZE), 0);
+}
+
+static void testWrap(void) {
+    ULONG i;
+
+    //
+    // Once the ring wraps only the newest TRACE_RING_SIZE records are left,
+    // whatever first sequence number is asked for.
+    //
+    TraceRingInit(&ring);
+    for (i = 0; i < TRACE_RING_SIZE + 5; i++)
+        TraceWrite(&ring, VHID_TRACE_REPORT_QUEUED, NULL, 0, i);
+
+    CHECK_EQ(TraceRingRead(&ring, 2, records, TRACE_RING_SIZE), TRACE_RING_SIZE);
+    CHECK_EQ(records[0].Sequence, 6);
+    CHECK_EQ(records[TRACE_RING_SIZE - 1].Sequence, TRACE_RING_SIZE + 5);
+    CHECK_EQ(TraceRingRead(&ring, 0, records, 2), 2);
+    CHECK_EQ(records[1].Sequence, 7);
+}
+
+void testTrace(void) {
+    testRead();
+    testWrap();
+}
@@ -0,0 +1,80 @@
+#include <windows.h>
+#include <winioctl.h>
+#include "typematic.h"
+#include "vhidtest.h"
+
+#define MS                  10000ULL    // 100ns units
+
+static void testRepeat(void) {
+    TYPEMATIC typematic;
+    UCHAR key;
+
+    TypematicInit(&typematic, 500, 10);
+    TypematicKeyEvent(&typematic, 0x04, TRUE, 0);
+    CHECK_EQ(TypematicNextDeadline(&typematic), 500 * MS);
+    CHECK(!TypematicTick(&typematic, 500 * MS - 1, &key));
+
+    CHECK(TypematicTick(&typematic, 500 * MS, &key));
+    CHECK_EQ(key, 0x04);
+    CHECK_EQ(TypematicNextDeadline(&typematic), 600 * MS);
+
+    //
+    // A modifier neither repeats nor interrupts the repeating key.
+    //
+    TypematicKeyEvent(&typematic, 0xE1, TRUE, 550 * MS);
+    CHECK(TypematicTick(&typematic, 600 * MS, &key));
+    CHECK_EQ(key, 0x04);
+
+    TypematicKeyEvent(&typematic, 0x04, FALSE, 650 * MS);
+    CHECK(!TypematicTick(&typematic, 700 * MS, &key));
+    CHECK_EQ(TypematicNextDeadline(&typematic), 0);
+}
+
+static void testLastKey(void) {
+    TYPEMATIC typematic;
+    UCHAR key;
+
+    //
+    // The newest key repeats; releasing the older one doesn't stop it.
+    //
+    TypematicInit(&typematic, 500, 10);
+    TypematicKeyEvent(&typematic, 0x04, TRUE, 0);
+    TypematicKeyEvent(&typematic, 0x05, TRUE, 100 * MS);
+    TypematicKeyEvent(&typematic, 0x04, FALSE, 200 * MS);
+    CHECK(!TypematicTick(&typematic, 500 * MS, &key));
+    CHECK(TypematicTick(&typematic, 600 * MS, &key));
+    CHECK_EQ(key, 0x05);
+}
+
+static void testLate(void) {
+    TYPEMATIC typematic;
+    UCHAR key;
+
+    //
+    // Missed repeats are skipped, not sent in a burst.
+    //
+    TypematicInit(&typematic, 500, 10);
+    TypematicKeyEvent(&typematic, 0x04, TRUE, 0);
+    CHECK(TypematicTick(&typematic, 950 * MS, &key));
+    CHECK_EQ(TypematicNextDeadline(&typematic), 1050 * MS);
+    CHECK(!TypematicTick(&typematic, 1000 * MS, &key));
+}
+
+static void testDisabled(void) {
+    TYPEMATIC typematic;
+    UCHAR key;
+
+    TypematicInit(&typematic, 500, 10);
+    TypematicKeyEvent(&typematic, 0x04, TRUE, 0);
+    TypematicSetRate(&typematic, 0, 0);
+    CHECK(!TypematicTick(&typematic, 1000 * MS, &key));
+    TypematicKeyEvent(&typematic, 0x04, TRUE, 0);
+    CHECK_EQ(TypematicNextDeadline(&typematic), 0);
+}
+
+void testTypematic(void) {
+    testRepeat();
+    testLastKey();
+    testLate();
+    testDisabled();
+}
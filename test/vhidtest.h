@@ -0,0 +1,39 @@
+#ifndef __VHIDTEST_H_
+#define __VHIDTEST_H_
+
+//
+// Host tests of the portable driver modules. A failed CHECK reports the
+// expression and its location and the test goes on, so one run lists every
+// failure; main() exits non-zero if there was any.
+//
+#define CHECK(e)            ((e) ? (void)0 : testFail(__FILE__, __LINE__, #e))
+
+#define CHECK_EQ(a, b)      testCheckEq(__FILE__, __LINE__, #a " == " #b, (LONGLONG)(a), (LONGLONG)(b))
+
+void testFail(const char* file, int line, const char* expr);
+void testCheckEq(const char* file, int line, const char* expr, LONGLONG a, LONGLONG b);
+
+//
+// One entry point per module, listed in main.c
+//
+void testEventQueue(void);
+void testConfig(void);
+void testReportQueue(void);
+void testPacer(void);
+void testHidReport(void);
+void testTypematic(void);
+void testTextCompiler(void);
+void testTrace(void);
+void testLogRing(void);
+void testKeyMerge(void);
+void testSlab(void);
+void testMacroVm(void);
+void testStream(void);
+void testIdle(void);
+void testChord(void);
+void testReceipt(void);
+void testDescriptor(void);
+void testLayout(void);
+void testSnapshot(void);
+
+#endif // __VHIDTEST_H_